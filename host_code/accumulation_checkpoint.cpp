@@ -0,0 +1,259 @@
+#include "accumulation_checkpoint.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+
+namespace {
+	constexpr char MAGIC[8] = "PTACCUM";
+
+	struct file_header {
+		char mMagic[8];
+		uint32_t mVersion;
+		uint32_t mWidth;
+		uint32_t mHeight;
+		uint32_t mMomentWidth;
+		uint32_t mMomentHeight;
+		uint32_t mGuideWidth;
+		uint32_t mGuideHeight;
+		uint32_t mSamplesPerPixel;
+		uint64_t mSceneHash;
+		double mSeconds;
+		glm::mat4 mCameraTransform;
+	};
+
+	uint64_t image_bytes(glm::uvec2 resolution, uint64_t texelBytes)
+	{
+		return uint64_t(resolution.x) * resolution.y * texelBytes;
+	}
+
+	vk::BufferImageCopy whole_image(uint64_t bufferOffset, glm::uvec2 resolution)
+	{
+		return vk::BufferImageCopy{ bufferOffset, 0, 0, vk::ImageSubresourceLayers{ vk::ImageAspectFlagBits::eColor, 0, 0, 1 }, vk::Offset3D{}, vk::Extent3D{ resolution.x, resolution.y, 1 } };
+	}
+
+	// rgba16f, see denoiser
+	constexpr uint64_t GUIDE_TEXEL_BYTES = 4 * sizeof(uint16_t);
+}
+
+
+accumulation_checkpoint::accumulation_checkpoint(avk::queue &aQueue, const std::string &aPath, double aIntervalSeconds)
+	: mQueue{&aQueue}
+	, mPath{aPath}
+	, mIntervalSeconds{aIntervalSeconds}
+	, mWriter(2) // one writer thread besides the render thread
+{
+}
+
+accumulation_checkpoint::~accumulation_checkpoint()
+{
+	flush();
+}
+
+
+void accumulation_checkpoint::create_resources(glm::uvec2 aResolution, glm::uvec2 aMomentResolution, glm::uvec2 aGuideResolution)
+{
+	mResolution = aResolution;
+	mMomentResolution = aMomentResolution;
+	mGuideResolution = aGuideResolution;
+	mLastSave = std::chrono::steady_clock::now();
+	if (!enabled()) {
+		return;
+	}
+
+	mStagingBuffer = avk::context().create_buffer(
+		avk::memory_usage::host_visible,
+		vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eTransferSrc,
+		avk::generic_buffer_meta::create_from_size(staging_size())
+	);
+}
+
+
+std::array<vk::BufferImageCopy, 5> accumulation_checkpoint::regions() const
+{
+	// The r32f moments come last, every other offset stays a multiple of its texel size
+	uint64_t colorBytes = image_bytes(mResolution, sizeof(glm::vec4));
+	uint64_t guideBytes = image_bytes(mGuideResolution, GUIDE_TEXEL_BYTES);
+	return {
+		whole_image(0, mResolution),
+		whole_image(colorBytes, mResolution),
+		whole_image(2 * colorBytes, mGuideResolution),
+		whole_image(2 * colorBytes + guideBytes, mGuideResolution),
+		whole_image(2 * colorBytes + 2 * guideBytes, mMomentResolution)
+	};
+}
+
+uint64_t accumulation_checkpoint::staging_size() const
+{
+	return 2 * image_bytes(mResolution, sizeof(glm::vec4)) + 2 * image_bytes(mGuideResolution, GUIDE_TEXEL_BYTES) + image_bytes(mMomentResolution, sizeof(float));
+}
+
+
+std::optional<accumulation_checkpoint::state> accumulation_checkpoint::resume(const avk::image_view &aCameraImageView, const avk::image_view &aLightImageView,
+	const avk::image_view &aMomentImageView, const avk::image_view &aAlbedoImageView, const avk::image_view &aNormalDepthImageView, uint64_t aSceneHash)
+{
+	if (!enabled()) {
+		return {};
+	}
+	std::ifstream file(mPath, std::ios::binary);
+	if (!file) {
+		return {};
+	}
+
+	file_header header = {};
+	if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)) || std::memcmp(header.mMagic, MAGIC, sizeof(MAGIC)) != 0 || header.mVersion != VERSION) {
+		printf("Ignoring the checkpoint %s, it was written by another version\n", mPath.c_str());
+		return {};
+	}
+	if (header.mWidth != mResolution.x || header.mHeight != mResolution.y || header.mMomentWidth != mMomentResolution.x || header.mMomentHeight != mMomentResolution.y
+		|| header.mGuideWidth != mGuideResolution.x || header.mGuideHeight != mGuideResolution.y) {
+		// The guides only exist in windowed runs and with --denoise
+		printf("Ignoring the checkpoint %s, it has another resolution, adaptive sampling or denoiser setting\n", mPath.c_str());
+		return {};
+	}
+	if (header.mSceneHash != aSceneHash) {
+		printf("Ignoring the checkpoint %s, it belongs to another scene\n", mPath.c_str());
+		return {};
+	}
+
+	{
+		auto mapping = (*mStagingBuffer)->map_memory(avk::mapping_access::write);
+		if (!file.read(static_cast<char *>(mapping.get()), staging_size())) {
+			printf("Ignoring the checkpoint %s, it is truncated\n", mPath.c_str());
+			return {};
+		}
+	}
+
+	vk::Buffer staging = (*mStagingBuffer)->handle();
+	std::array<vk::Image, 5> images = {
+		aCameraImageView->get_image().handle(), aLightImageView->get_image().handle(), aAlbedoImageView->get_image().handle(),
+		aNormalDepthImageView->get_image().handle(), aMomentImageView->get_image().handle()
+	};
+	std::array<vk::BufferImageCopy, 5> copyRegions = regions();
+	avk::context().record_and_submit_with_fence({
+		avk::command::custom_commands([=](avk::command_buffer_t &cb) {
+			// The images stay in the general layout, nothing has been traced yet
+			for (size_t i = 0; i < images.size(); i++) {
+				cb.handle().copyBufferToImage(staging, images[i], vk::ImageLayout::eGeneral, copyRegions[i], cb.root_ptr()->dispatch_loader_core());
+			}
+		}),
+		avk::sync::global_memory_barrier(
+			avk::stage::copy >> (avk::stage::ray_tracing_shader | avk::stage::compute_shader),
+			avk::access::transfer_write >> (avk::access::shader_read | avk::access::shader_write)
+		)
+	}, *mQueue)->wait_until_signalled();
+
+	printf("Resumed %u spp (%.1lf s of accumulation) from %s\n", header.mSamplesPerPixel, header.mSeconds, mPath.c_str());
+	mLastSave = std::chrono::steady_clock::now();
+	return state{ header.mCameraTransform, header.mSceneHash, header.mSamplesPerPixel, header.mSeconds };
+}
+
+
+bool accumulation_checkpoint::due() const
+{
+	return enabled() && std::chrono::duration<double>(std::chrono::steady_clock::now() - mLastSave).count() >= mIntervalSeconds;
+}
+
+bool accumulation_checkpoint::save(const avk::image_view &aCameraImageView, const avk::image_view &aLightImageView, const avk::image_view &aMomentImageView,
+	const avk::image_view &aAlbedoImageView, const avk::image_view &aNormalDepthImageView, const state &aState)
+{
+	poll();
+	if (mState != save_state::idle) {
+		printf("Checkpoint skipped, the previous one is still being written\n");
+		return false;
+	}
+	mLastSave = std::chrono::steady_clock::now();
+	mSavedState = aState;
+
+	vk::Buffer staging = (*mStagingBuffer)->handle();
+	std::array<vk::Image, 5> images = {
+		aCameraImageView->get_image().handle(), aLightImageView->get_image().handle(), aAlbedoImageView->get_image().handle(),
+		aNormalDepthImageView->get_image().handle(), aMomentImageView->get_image().handle()
+	};
+	std::array<vk::BufferImageCopy, 5> copyRegions = regions();
+
+	mFence = avk::context().record_and_submit_with_fence({
+		avk::command::custom_commands([=](avk::command_buffer_t &cb) {
+			// The launches and the reprojection of earlier frames wrote the images, which stay in the general layout
+			cb.handle().pipelineBarrier(
+				vk::PipelineStageFlagBits::eRayTracingShaderKHR | vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer, {},
+				vk::MemoryBarrier{ vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eTransferRead },
+				nullptr, nullptr, cb.root_ptr()->dispatch_loader_core());
+			for (size_t i = 0; i < images.size(); i++) {
+				cb.handle().copyImageToBuffer(images[i], vk::ImageLayout::eGeneral, staging, copyRegions[i], cb.root_ptr()->dispatch_loader_core());
+			}
+			// The next frames clear or accumulate into them again
+			cb.handle().pipelineBarrier(
+				vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eRayTracingShaderKHR | vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eTransfer, {},
+				vk::MemoryBarrier{ vk::AccessFlagBits::eTransferRead, vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eTransferWrite },
+				nullptr, nullptr, cb.root_ptr()->dispatch_loader_core());
+		})
+	}, *mQueue);
+	mState = save_state::copying;
+	return true;
+}
+
+
+void accumulation_checkpoint::poll()
+{
+	if (mState == save_state::copying && avk::context().device().getFenceStatus((*mFence)->handle(), avk::context().dynamic_dispatch()) == vk::Result::eSuccess) {
+		mFence.reset();
+		mState = save_state::writing;
+		mWriter.run(mWriting, [this, savedState = mSavedState]() { write(savedState); });
+	}
+	if (mState == save_state::writing && mWriting.mPending == 0) {
+		mState = save_state::idle;
+	}
+}
+
+void accumulation_checkpoint::flush()
+{
+	if (mState == save_state::copying) {
+		(*mFence)->wait_until_signalled();
+	}
+	poll();
+	mWriter.wait(mWriting);
+	poll();
+}
+
+
+void accumulation_checkpoint::write(const state &aState)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	file_header header = {};
+	std::memcpy(header.mMagic, MAGIC, sizeof(MAGIC));
+	header.mVersion = VERSION;
+	header.mWidth = mResolution.x;
+	header.mHeight = mResolution.y;
+	header.mMomentWidth = mMomentResolution.x;
+	header.mMomentHeight = mMomentResolution.y;
+	header.mGuideWidth = mGuideResolution.x;
+	header.mGuideHeight = mGuideResolution.y;
+	header.mSamplesPerPixel = aState.mSamplesPerPixel;
+	header.mSceneHash = aState.mSceneHash;
+	header.mSeconds = aState.mSeconds;
+	header.mCameraTransform = aState.mCameraTransform;
+
+	// Replaces the previous checkpoint only once the new one is complete
+	std::string temporaryPath = mPath + ".tmp";
+	{
+		auto mapping = (*mStagingBuffer)->map_memory(avk::mapping_access::read);
+		std::ofstream file(temporaryPath, std::ios::binary);
+		file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+		file.write(static_cast<const char *>(mapping.get()), staging_size());
+		if (!file) {
+			std::cerr << "could not write the checkpoint " << temporaryPath << std::endl;
+			return;
+		}
+	}
+	std::error_code error;
+	std::filesystem::rename(temporaryPath, mPath, error);
+	if (error) {
+		std::cerr << "could not replace the checkpoint " << mPath << ": " << error.message() << std::endl;
+		return;
+	}
+	printf("Checkpoint of %u spp written to %s in %.2lf s\n", aState.mSamplesPerPixel, mPath.c_str(),
+		std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+}
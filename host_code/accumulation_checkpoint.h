@@ -0,0 +1,93 @@
+#pragma once
+
+#include "task_system.h"
+
+#include <auto_vk_toolkit.hpp>
+
+
+/// <summary>
+/// Checkpoints of long accumulations (`--checkpoint <path>`). Every `--checkpoint-interval` seconds (at the end of a sweep, see
+/// time_slicer), the raw rgba32f camera and light images, whose alphas count the samples of every pixel, the guides of the
+/// denoiser, which are averaged over the same samples, and the second moments of adaptive sampling are copied into a host
+/// visible staging buffer. The copy is submitted with a fence and not waited for, `poll()` hands the finished copy to a
+/// writer thread. The file is written next to the checkpoint and renamed over it once
+/// complete, so a crash while writing keeps the previous checkpoint. A checkpoint which is due while the previous one is still
+/// being written is skipped.
+/// Besides the images, the file stores the camera, the scene hash (see model_loader::scene_hash), the launch count, which is
+/// the frame index of the random numbers (the samplers of the pixels continue from the alphas), and the accumulation time.
+/// At startup, `resume()` uploads a checkpoint whose resolutions and scene match, the renderer then continues with its camera
+/// and counts. Render settings which change the image (BDPT, SMS, ...) are not checked, resuming with other ones mixes both.
+/// </summary>
+class accumulation_checkpoint
+{
+public:
+	// Bump whenever the file layout changes, older checkpoints are ignored then
+	static constexpr uint32_t VERSION = 2;
+
+	// Everything besides the images
+	struct state {
+		glm::mat4 mCameraTransform;
+		uint64_t mSceneHash;
+		uint32_t mSamplesPerPixel; // launches, i.e. the frame index of the random numbers
+		double mSeconds;           // accumulation time so far, s.t. time budgets continue
+	};
+
+	// An empty path disables checkpoints
+	accumulation_checkpoint(avk::queue &aQueue, const std::string &aPath, double aIntervalSeconds);
+	~accumulation_checkpoint();
+
+	accumulation_checkpoint(const accumulation_checkpoint &) = delete;
+	accumulation_checkpoint &operator=(const accumulation_checkpoint &) = delete;
+
+	inline bool enabled() const { return !mPath.empty(); }
+
+	// Creates the staging buffer for images of the given sizes (the moment and guide images may be 1x1)
+	void create_resources(glm::uvec2 aResolution, glm::uvec2 aMomentResolution, glm::uvec2 aGuideResolution);
+
+	// Uploads the checkpoint into the images and returns its state, waits for the GPU. Nothing if there is no checkpoint
+	// or it belongs to other resolutions (including those of the moment and guide images) or another scene.
+	std::optional<state> resume(const avk::image_view &aCameraImageView, const avk::image_view &aLightImageView, const avk::image_view &aMomentImageView,
+		const avk::image_view &aAlbedoImageView, const avk::image_view &aNormalDepthImageView, uint64_t aSceneHash);
+
+	// Whether the interval has passed since the last checkpoint (or the start)
+	bool due() const;
+
+	// Copies the images into the staging buffer and returns immediately, false if the previous checkpoint is still being written
+	bool save(const avk::image_view &aCameraImageView, const avk::image_view &aLightImageView, const avk::image_view &aMomentImageView,
+		const avk::image_view &aAlbedoImageView, const avk::image_view &aNormalDepthImageView, const state &aState);
+
+	// Starts writing a finished copy, to be called once per frame
+	void poll();
+
+	// Blocks until the last checkpoint has been written
+	void flush();
+
+private:
+	enum struct save_state {
+		idle,
+		copying, // submitted, mFence not yet signalled
+		writing  // mWriting is running on the writer thread
+	};
+
+	// One region per image, in the order of the staging buffer and the file: camera, light, albedo, normal/depth, moments
+	std::array<vk::BufferImageCopy, 5> regions() const;
+	uint64_t staging_size() const;
+
+	void write(const state &aState);
+
+	avk::queue *mQueue;
+	std::string mPath;
+	double mIntervalSeconds;
+	std::chrono::steady_clock::time_point mLastSave;
+
+	glm::uvec2 mResolution = {};
+	glm::uvec2 mMomentResolution = {};
+	glm::uvec2 mGuideResolution = {};
+	std::optional<avk::buffer> mStagingBuffer; // the texels of all images, one after another, see regions()
+
+	save_state mState = save_state::idle;
+	state mSavedState = {};
+	std::optional<avk::fence> mFence;
+	task_group mWriting;
+	task_system mWriter;
+};
@@ -0,0 +1,109 @@
+#include "adaptive_sampler.h"
+
+
+adaptive_sampler::adaptive_sampler(float aThreshold)
+	: mThreshold{aThreshold}
+	, mMode{aThreshold > 0.0f ? mode::all_pixels : mode::off}
+{
+}
+
+
+avk::image adaptive_sampler::create_moment_image(glm::uvec2 aResolution) const
+{
+	glm::uvec2 size = enabled() ? aResolution : glm::uvec2(1, 1);
+	return avk::context().create_image(size.x, size.y, vk::Format::eR32Sfloat, 1, avk::memory_usage::device, avk::image_usage::general_storage_image);
+}
+
+void adaptive_sampler::create_resources(avk::queue &aQueue, glm::uvec2 aResolution, const avk::image_view &aCameraImageView, const avk::image_view &aMomentImageView)
+{
+	mQueue = &aQueue;
+	mTileCount = enabled() ? (aResolution + TILE_SIZE - 1u) / TILE_SIZE : glm::uvec2(1, 1);
+
+	mTileBuffer = avk::context().create_buffer(
+		avk::memory_usage::device,
+		vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eTransferSrc,
+		avk::storage_buffer_meta::create_from_size(sizeof(uint32_t) * (1 + mTileCount.x * mTileCount.y))
+	);
+
+	if (!enabled()) {
+		return;
+	}
+
+	mCountReadback = avk::context().create_buffer(
+		avk::memory_usage::host_visible,
+		vk::BufferUsageFlagBits::eTransferDst,
+		avk::generic_buffer_meta::create_from_size(sizeof(uint32_t))
+	);
+
+	mPipeline = avk::context().create_compute_pipeline_for(
+		avk::compute_shader("shaders/adaptive_tiles.comp"),
+		avk::push_constant_binding_data{avk::shader_type::compute, 0, sizeof(float)},
+		avk::descriptor_binding(0, 0, aCameraImageView->as_storage_image(avk::layout::general)),
+		avk::descriptor_binding(0, 1, aMomentImageView->as_storage_image(avk::layout::general)),
+		avk::descriptor_binding(0, 2, mTileBuffer)
+	);
+}
+
+
+void adaptive_sampler::restart()
+{
+	if (enabled()) {
+		mMode = mode::all_pixels;
+		mActiveTileCount = 0;
+	}
+}
+
+void adaptive_sampler::evaluate(avk::descriptor_cache &aDescriptorCache, const avk::image_view &aCameraImageView, const avk::image_view &aMomentImageView)
+{
+	vk::Buffer tiles = mTileBuffer->handle();
+	vk::Buffer readback = mCountReadback->handle();
+
+	avk::context().record_and_submit_with_fence({
+		// The previous launches still read the old tile list and write the accumulation
+		avk::command::custom_commands([tiles](avk::command_buffer_t &cb) {
+			cb.handle().pipelineBarrier(
+				vk::PipelineStageFlagBits::eRayTracingShaderKHR, vk::PipelineStageFlagBits::eTransfer | vk::PipelineStageFlagBits::eComputeShader, {},
+				vk::MemoryBarrier{ vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eShaderRead, vk::AccessFlagBits::eTransferWrite | vk::AccessFlagBits::eShaderRead },
+				nullptr, nullptr, cb.root_ptr()->dispatch_loader_core());
+			cb.handle().fillBuffer(tiles, 0, sizeof(uint32_t), 0, cb.root_ptr()->dispatch_loader_core());
+			cb.handle().pipelineBarrier(
+				vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader, {},
+				vk::MemoryBarrier{ vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite },
+				nullptr, nullptr, cb.root_ptr()->dispatch_loader_core());
+		}),
+
+		avk::command::bind_pipeline(mPipeline.as_reference()),
+		avk::command::bind_descriptors(mPipeline->layout(), aDescriptorCache->get_or_create_descriptor_sets({
+			avk::descriptor_binding(0, 0, aCameraImageView->as_storage_image(avk::layout::general)),
+			avk::descriptor_binding(0, 1, aMomentImageView->as_storage_image(avk::layout::general)),
+			avk::descriptor_binding(0, 2, mTileBuffer)
+		})),
+		avk::command::push_constants(mPipeline->layout(), mThreshold, avk::shader_type::compute),
+		avk::command::dispatch(mTileCount.x, mTileCount.y, 1),
+
+		// The count for the host, the list for the following launches, which must not accumulate before the images have been read
+		avk::command::custom_commands([tiles, readback](avk::command_buffer_t &cb) {
+			cb.handle().pipelineBarrier(
+				vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eTransfer | vk::PipelineStageFlagBits::eRayTracingShaderKHR, {},
+				vk::MemoryBarrier{ vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eTransferRead | vk::AccessFlagBits::eShaderRead },
+				nullptr, nullptr, cb.root_ptr()->dispatch_loader_core());
+			cb.handle().copyBuffer(tiles, readback, vk::BufferCopy{ 0, 0, sizeof(uint32_t) }, cb.root_ptr()->dispatch_loader_core());
+			cb.handle().pipelineBarrier(
+				vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eHost, {},
+				vk::MemoryBarrier{ vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eHostRead },
+				nullptr, nullptr, cb.root_ptr()->dispatch_loader_core());
+		})
+	}, *mQueue)->wait_until_signalled();
+
+	auto mapping = mCountReadback->map_memory(avk::mapping_access::read);
+	mActiveTileCount = *static_cast<const uint32_t *>(mapping.get());
+	mMode = mode::active_tiles;
+}
+
+vk::Extent3D adaptive_sampler::launch_size(glm::uvec2 aResolution) const
+{
+	if (mMode == mode::active_tiles) {
+		return { TILE_SIZE * TILE_SIZE, mActiveTileCount, 1 };
+	}
+	return { aResolution.x, aResolution.y, 1 };
+}
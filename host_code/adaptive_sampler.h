@@ -0,0 +1,69 @@
+#pragma once
+
+#include <auto_vk_toolkit.hpp>
+
+
+/// <summary>
+/// Adaptive sampling (`--adaptive <threshold>`): the ray generation shader additionally accumulates the mean of the squared
+/// luminance into a moment image. After MIN_SAMPLES launches, and then every EVALUATION_INTERVAL launches, a compute shader
+/// (shaders/adaptive_tiles.comp) estimates the standard error of every pixel in display units and compacts the 16x16 tiles
+/// whose largest error exceeds the threshold into a tile list. Until the next evaluation, trace_rays is launched with one
+/// invocation per pixel of these tiles only, converged tiles stop consuming rays. Once the list is empty, the image has
+/// converged: nothing is traced anymore and headless rendering stops.
+/// The launch size is read back on the host, which waits for the GPU once per evaluation.
+/// </summary>
+class adaptive_sampler
+{
+public:
+	// Same as TILE_SIZE in adaptive_tiles.comp and ADAPTIVE_TILE_SIZE in ray_gen_shader.rgen
+	static constexpr uint32_t TILE_SIZE = 16;
+	static constexpr uint32_t MIN_SAMPLES = 16;
+	static constexpr uint32_t EVALUATION_INTERVAL = 8;
+
+	// Values of pushConstants.mAdaptiveMode, the same as the ADAPTIVE_* defines in ray_gen_shader.rgen
+	enum struct mode : uint32_t {
+		off = 0,
+		all_pixels = 1,   // every pixel is sampled, the moments are tracked
+		active_tiles = 2  // only the tiles in the tile list are sampled
+	};
+
+	// A threshold of 0 disables adaptive sampling
+	explicit adaptive_sampler(float aThreshold);
+
+	inline bool enabled() const { return mThreshold > 0.0f; }
+
+	// The moment image has the size of the accumulation if enabled, 1x1 otherwise (the shader declares it anyway)
+	avk::image create_moment_image(glm::uvec2 aResolution) const;
+
+	// Creates the tile list (bound also if disabled) and the compaction pipeline
+	void create_resources(avk::queue &aQueue, glm::uvec2 aResolution, const avk::image_view &aCameraImageView, const avk::image_view &aMomentImageView);
+
+	inline const avk::buffer &tile_buffer() const { return mTileBuffer; }
+
+	// The accumulation restarted, every pixel is sampled again until the next evaluation
+	void restart();
+
+	inline bool due(uint32_t launches) const { return enabled() && launches >= MIN_SAMPLES && (launches - MIN_SAMPLES) % EVALUATION_INTERVAL == 0; }
+
+	// Rebuilds the tile list from the accumulation after `launches` launches, waits for the GPU
+	void evaluate(avk::descriptor_cache &aDescriptorCache, const avk::image_view &aCameraImageView, const avk::image_view &aMomentImageView);
+
+	inline mode current_mode() const { return mMode; }
+	inline bool converged() const { return mMode == mode::active_tiles && mActiveTileCount == 0; }
+	inline uint32_t active_tile_count() const { return mActiveTileCount; }
+
+	// trace_rays launch size, one invocation per pixel of every active tile in active_tiles mode
+	vk::Extent3D launch_size(glm::uvec2 aResolution) const;
+
+private:
+	float mThreshold;
+	avk::queue *mQueue = nullptr;
+
+	glm::uvec2 mTileCount = {};
+	avk::buffer mTileBuffer; // uint count, uint tiles[]
+	avk::buffer mCountReadback;
+	avk::compute_pipeline mPipeline;
+
+	mode mMode;
+	uint32_t mActiveTileCount = 0;
+};
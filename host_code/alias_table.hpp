@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+/// <summary>
+/// Walker's alias method (built with Vose's algorithm): draws index i with probability weights[i] / sum(weights) from a single
+/// uniform number in O(1). Every bin j is picked uniformly, then stays j with probability mThreshold or becomes mAlias. The
+/// sampling code lives in the shaders, see `sampleEmissiveTriangle` in ray_gen_shader.rgen.
+/// </summary>
+namespace alias_table {
+
+	struct bin {
+		float mProbability; // weights[j] / sum(weights), the pdf of drawing j
+		float mThreshold;
+		uint32_t mAlias;
+	};
+
+	// Empty if there are no weights or they sum up to 0
+	inline std::vector<bin> build(std::span<const float> weights)
+	{
+		double sum = 0.0;
+		for (float w : weights) {
+			sum += w;
+		}
+		if (weights.empty() || !(sum > 0.0)) {
+			return {};
+		}
+
+		const size_t n = weights.size();
+		std::vector<bin> bins(n);
+		std::vector<double> scaled(n);
+		std::vector<uint32_t> small, large;
+		for (size_t i = 0; i < n; i++) {
+			bins[i].mProbability = static_cast<float>(weights[i] / sum);
+			scaled[i] = weights[i] / sum * n;
+			(scaled[i] < 1.0 ? small : large).push_back(static_cast<uint32_t>(i));
+		}
+
+		while (!small.empty() && !large.empty()) {
+			uint32_t s = small.back();
+			small.pop_back();
+			uint32_t l = large.back();
+
+			bins[s].mThreshold = static_cast<float>(scaled[s]);
+			bins[s].mAlias = l;
+
+			// The large bin gives away what the small one lacks
+			scaled[l] -= 1.0 - scaled[s];
+			if (scaled[l] < 1.0) {
+				large.pop_back();
+				small.push_back(l);
+			}
+		}
+
+		// Whatever is left is full up to rounding
+		for (uint32_t i : small) {
+			bins[i].mThreshold = 1.0f;
+			bins[i].mAlias = i;
+		}
+		for (uint32_t i : large) {
+			bins[i].mThreshold = 1.0f;
+			bins[i].mAlias = i;
+		}
+		return bins;
+	}
+}
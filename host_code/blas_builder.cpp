@@ -0,0 +1,206 @@
+#include "blas_builder.h"
+
+#include <conversion_utils.hpp>
+
+
+namespace {
+	// Builds are batched s.t. their scratch memory fits into this arena, unless a single build needs more
+	constexpr uint64_t SCRATCH_ARENA_SIZE = 64 * 1024 * 1024;
+	// VkAccelerationStructureCreateInfoKHR::offset has to be a multiple of 256
+	constexpr uint64_t STORAGE_ALIGNMENT = 256;
+
+	const vk::BuildAccelerationStructureFlagsKHR BUILD_FLAGS = vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace | vk::BuildAccelerationStructureFlagBitsKHR::eAllowCompaction;
+
+	uint64_t align(uint64_t value, uint64_t alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	avk::buffer create_device_buffer(uint64_t size, vk::BufferUsageFlags usage)
+	{
+		return avk::context().create_buffer(
+			avk::memory_usage::device,
+			usage | vk::BufferUsageFlagBits::eShaderDeviceAddress,
+			avk::generic_buffer_meta::create_from_size(size)
+		);
+	}
+
+	// Makes the results of all acceleration structure builds and copies so far visible to later builds and copies
+	void acceleration_structure_barrier(avk::command_buffer_t &cb, vk::PipelineStageFlags dstStages)
+	{
+		cb.handle().pipelineBarrier(
+			vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, dstStages, {},
+			vk::MemoryBarrier{ vk::AccessFlagBits::eAccelerationStructureWriteKHR, vk::AccessFlagBits::eAccelerationStructureReadKHR | vk::AccessFlagBits::eAccelerationStructureWriteKHR },
+			nullptr, nullptr);
+	}
+}
+
+
+blas_builder::blas_builder(avk::queue &aQueue)
+	: mQueue{&aQueue}
+{
+}
+
+
+void blas_builder::add(const avk::buffer &positions, uint32_t vertexCount, const avk::buffer &indices, uint32_t indexCount, std::vector<avk::recorded_commands_t> uploads)
+{
+	mPending.push_back(pending_blas{ positions->device_address(), vertexCount, indices->device_address(), indexCount });
+	mUploads.insert(mUploads.end(), std::make_move_iterator(uploads.begin()), std::make_move_iterator(uploads.end()));
+}
+
+
+void blas_builder::build()
+{
+	if (mPending.empty()) {
+		return;
+	}
+	auto start = std::chrono::steady_clock::now();
+
+	vk::Device device = avk::context().device();
+	auto &dispatch = avk::context().dynamic_dispatch();
+	auto properties = avk::context().physical_device().getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceAccelerationStructurePropertiesKHR>();
+	const uint64_t scratchAlignment = std::max<uint64_t>(1, properties.get<vk::PhysicalDeviceAccelerationStructurePropertiesKHR>().minAccelerationStructureScratchOffsetAlignment);
+
+	// Geometry descriptions and sizes, the same for the size query and the build
+	const size_t count = mPending.size();
+	std::vector<vk::AccelerationStructureGeometryKHR> geometries(count);
+	std::vector<vk::AccelerationStructureBuildRangeInfoKHR> ranges(count);
+	std::vector<const vk::AccelerationStructureBuildRangeInfoKHR *> rangePointers(count);
+	std::vector<vk::AccelerationStructureBuildSizesInfoKHR> sizes(count);
+	for (size_t i = 0; i < count; i++) {
+		const pending_blas &p = mPending[i];
+		vk::AccelerationStructureGeometryTrianglesDataKHR triangles{
+			vk::Format::eR32G32B32Sfloat, p.mPositions, sizeof(glm::vec3), std::max(1u, p.mVertexCount) - 1,
+			vk::IndexType::eUint32, p.mIndices, {}
+		};
+		geometries[i] = vk::AccelerationStructureGeometryKHR{ vk::GeometryTypeKHR::eTriangles, triangles, vk::GeometryFlagBitsKHR::eOpaque };
+		ranges[i] = vk::AccelerationStructureBuildRangeInfoKHR{ p.mIndexCount / 3, 0, 0, 0 };
+		rangePointers[i] = &ranges[i];
+
+		vk::AccelerationStructureBuildGeometryInfoKHR info{ vk::AccelerationStructureTypeKHR::eBottomLevel, BUILD_FLAGS, vk::BuildAccelerationStructureModeKHR::eBuild, {}, {}, 1, &geometries[i] };
+		sizes[i] = device.getAccelerationStructureBuildSizesKHR(vk::AccelerationStructureBuildTypeKHR::eDevice, info, ranges[i].primitiveCount, dispatch);
+	}
+
+	// The uncompacted BLAS only live until they have been compacted, they share one buffer
+	uint64_t originalBytes = 0;
+	uint64_t totalScratch = 0;
+	uint64_t largestScratch = 0;
+	std::vector<uint64_t> originalOffsets(count);
+	for (size_t i = 0; i < count; i++) {
+		originalOffsets[i] = originalBytes;
+		originalBytes += align(sizes[i].accelerationStructureSize, STORAGE_ALIGNMENT);
+		totalScratch += align(sizes[i].buildScratchSize, scratchAlignment);
+		largestScratch = std::max(largestScratch, align(sizes[i].buildScratchSize, scratchAlignment));
+	}
+	avk::buffer originalStorage = create_device_buffer(originalBytes, vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR);
+	std::vector<unique_acceleration_structure> originals;
+	std::vector<vk::AccelerationStructureKHR> originalHandles;
+	for (size_t i = 0; i < count; i++) {
+		originals.push_back(device.createAccelerationStructureKHRUnique(
+			vk::AccelerationStructureCreateInfoKHR{ {}, originalStorage->handle(), originalOffsets[i], sizes[i].accelerationStructureSize, vk::AccelerationStructureTypeKHR::eBottomLevel },
+			nullptr, dispatch));
+		originalHandles.push_back(originals.back().get());
+	}
+
+	// Consecutive builds are batched as long as their scratch ranges fit into the arena
+	const uint64_t scratchSize = std::min(totalScratch, std::max(SCRATCH_ARENA_SIZE, largestScratch));
+	avk::buffer scratch = create_device_buffer(scratchSize + scratchAlignment, vk::BufferUsageFlagBits::eStorageBuffer);
+	const vk::DeviceAddress scratchAddress = align(scratch->device_address(), scratchAlignment);
+
+	std::vector<vk::AccelerationStructureBuildGeometryInfoKHR> infos(count);
+	std::vector<std::pair<size_t, size_t>> batches;
+	uint64_t scratchUsed = 0;
+	size_t batchStart = 0;
+	for (size_t i = 0; i < count; i++) {
+		uint64_t scratchNeeded = align(sizes[i].buildScratchSize, scratchAlignment);
+		if (i > batchStart && scratchUsed + scratchNeeded > scratchSize) {
+			batches.emplace_back(batchStart, i);
+			batchStart = i;
+			scratchUsed = 0;
+		}
+		infos[i] = vk::AccelerationStructureBuildGeometryInfoKHR{
+			vk::AccelerationStructureTypeKHR::eBottomLevel, BUILD_FLAGS, vk::BuildAccelerationStructureModeKHR::eBuild,
+			{}, originals[i].get(), 1, &geometries[i], nullptr, scratchAddress + scratchUsed
+		};
+		scratchUsed += scratchNeeded;
+	}
+	batches.emplace_back(batchStart, count);
+
+	auto queryPool = device.createQueryPoolUnique(vk::QueryPoolCreateInfo{ {}, vk::QueryType::eAccelerationStructureCompactedSizeKHR, static_cast<uint32_t>(count) }, nullptr, dispatch);
+
+	// First submission: all uploads, all builds and the compacted size queries
+	std::vector<avk::recorded_commands_t> commands = std::move(mUploads);
+	mUploads.clear();
+	commands.push_back(avk::sync::global_memory_barrier(avk::stage::transfer >> avk::stage::acceleration_structure_build, avk::access::transfer_write >> avk::access::acceleration_structure_write));
+	// The custom commands are recorded right away, referencing the local arrays is fine
+	commands.push_back(avk::command::custom_commands([&](avk::command_buffer_t &cb) {
+		cb.handle().resetQueryPool(queryPool.get(), 0, static_cast<uint32_t>(count));
+		for (size_t b = 0; b < batches.size(); b++) {
+			if (b > 0) {
+				// The next batch reuses the scratch arena
+				acceleration_structure_barrier(cb, vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR);
+			}
+			auto [first, end] = batches[b];
+			cb.handle().buildAccelerationStructuresKHR(static_cast<uint32_t>(end - first), infos.data() + first, rangePointers.data() + first, dispatch);
+		}
+		acceleration_structure_barrier(cb, vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR);
+		cb.handle().writeAccelerationStructuresPropertiesKHR(originalHandles, vk::QueryType::eAccelerationStructureCompactedSizeKHR, queryPool.get(), 0, dispatch);
+	}));
+	avk::context().record_and_submit_with_fence(std::move(commands), *mQueue)->wait_until_signalled();
+	auto built = std::chrono::steady_clock::now();
+
+	std::vector<vk::DeviceSize> compactedSizes(count);
+	if (device.getQueryPoolResults(queryPool.get(), 0, static_cast<uint32_t>(count), sizeof(vk::DeviceSize) * count, compactedSizes.data(), sizeof(vk::DeviceSize),
+		vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait, dispatch) != vk::Result::eSuccess) {
+		throw std::runtime_error("Could not query the compacted sizes of the bottom level acceleration structures");
+	}
+
+	// Second submission: copy every BLAS into its compacted counterpart, all of them share one buffer
+	uint64_t compactedBytes = 0;
+	std::vector<uint64_t> compactedOffsets(count);
+	for (size_t i = 0; i < count; i++) {
+		compactedOffsets[i] = compactedBytes;
+		compactedBytes += align(compactedSizes[i], STORAGE_ALIGNMENT);
+	}
+	avk::buffer &storage = mStorage.emplace_back(create_device_buffer(compactedBytes, vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR));
+	const size_t firstBlas = mBlas.size();
+	for (size_t i = 0; i < count; i++) {
+		mBlas.push_back(device.createAccelerationStructureKHRUnique(
+			vk::AccelerationStructureCreateInfoKHR{ {}, storage->handle(), compactedOffsets[i], compactedSizes[i], vk::AccelerationStructureTypeKHR::eBottomLevel },
+			nullptr, dispatch));
+	}
+
+	commands.clear();
+	commands.push_back(avk::command::custom_commands([&](avk::command_buffer_t &cb) {
+		for (size_t i = 0; i < count; i++) {
+			cb.handle().copyAccelerationStructureKHR(vk::CopyAccelerationStructureInfoKHR{ originals[i].get(), mBlas[firstBlas + i].get(), vk::CopyAccelerationStructureModeKHR::eCompact }, dispatch);
+		}
+		// TLAS builds and ray tracing shaders read the compacted BLAS
+		acceleration_structure_barrier(cb, vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR | vk::PipelineStageFlagBits::eRayTracingShaderKHR);
+	}));
+	avk::context().record_and_submit_with_fence(std::move(commands), *mQueue)->wait_until_signalled();
+
+	for (size_t i = 0; i < count; i++) {
+		mDeviceAddresses.push_back(device.getAccelerationStructureAddressKHR(vk::AccelerationStructureDeviceAddressInfoKHR{ mBlas[firstBlas + i].get() }, dispatch));
+	}
+
+	auto compacted = std::chrono::steady_clock::now();
+	printf("Built %zu BLAS in %zu batches with a %.1f MiB scratch arena in %.2lf ms (including the geometry upload), compacted from %.1f MiB to %.1f MiB in %.2lf ms\n",
+		count, batches.size(), scratchSize / (1024.0 * 1024.0), std::chrono::duration<double, std::milli>(built - start).count(),
+		originalBytes / (1024.0 * 1024.0), compactedBytes / (1024.0 * 1024.0), std::chrono::duration<double, std::milli>(compacted - built).count());
+
+	mPending.clear();
+	// The uncompacted BLAS, their buffer and the scratch arena are freed here
+}
+
+
+avk::geometry_instance blas_builder::geometry_instance(size_t index) const
+{
+	avk::geometry_instance instance{};
+	instance.set_transform_column_major(avk::to_array(glm::mat4(1.0f)));
+	instance.set_custom_index(0);
+	instance.set_mask(0xFF);
+	instance.set_instance_offset(0);
+	instance.mAccelerationStructureDeviceHandle = mDeviceAddresses[index];
+	return instance;
+}
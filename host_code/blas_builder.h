@@ -0,0 +1,45 @@
+#pragma once
+
+#include <auto_vk_toolkit.hpp>
+
+
+/// <summary>
+/// Builds the bottom level acceleration structures of all draw calls with two submissions instead of one round trip per draw call:
+/// the first one uploads all geometry and builds every BLAS, the second one compacts them. The builds share one scratch arena,
+/// as many of them as fit into it are recorded into a single vkCmdBuildAccelerationStructuresKHR, consecutive batches are separated
+/// by a barrier. Once the compacted sizes are known, every BLAS is copied into one tightly packed buffer and the originals are freed.
+/// avk neither exposes the compaction flag nor the size query, hence the acceleration structures are managed through Vulkan directly.
+/// </summary>
+class blas_builder
+{
+public:
+	explicit blas_builder(avk::queue &aQueue);
+
+	// Queues a BLAS over one triangle geometry. `uploads` fill the two buffers, they are submitted together with the builds.
+	void add(const avk::buffer &positions, uint32_t vertexCount, const avk::buffer &indices, uint32_t indexCount, std::vector<avk::recorded_commands_t> uploads);
+	inline size_t size() const { return mPending.size() + mBlas.size(); }
+
+	// Uploads, builds and compacts all queued BLAS and waits until the GPU is done with them
+	void build();
+
+	// Only valid after build(). Same defaults as `avk::root::create_geometry_instance`, the custom index still has to be set.
+	avk::geometry_instance geometry_instance(size_t index) const;
+
+private:
+	using unique_acceleration_structure = vk::UniqueHandle<vk::AccelerationStructureKHR, vk::DispatchLoaderDynamic>;
+
+	struct pending_blas {
+		vk::DeviceAddress mPositions;
+		uint32_t mVertexCount;
+		vk::DeviceAddress mIndices;
+		uint32_t mIndexCount;
+	};
+
+	avk::queue *mQueue;
+	std::vector<pending_blas> mPending;
+	std::vector<avk::recorded_commands_t> mUploads;
+
+	std::vector<avk::buffer> mStorage; // the compacted BLAS of every build(), one after another
+	std::vector<unique_acceleration_structure> mBlas;
+	std::vector<vk::DeviceAddress> mDeviceAddresses;
+};
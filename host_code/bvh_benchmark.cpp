@@ -0,0 +1,179 @@
+#include "bvh_benchmark.h"
+
+
+namespace {
+	// Keep in sync with ray_gen_shader.rgen
+	const glm::vec3 lightPosition = glm::vec3(15, 20, 2);
+	constexpr float EPSILON = 0.001f;
+
+	// Rays are traced in chunks of this size per task
+	constexpr uint32_t CHUNK_SIZE = 4096;
+
+	// Measurements are repeated and the fastest one is reported
+	constexpr int REPETITIONS = 3;
+
+	// The binary kernel tests triangles with Moeller-Trumbore, the wide kernels with the watertight test, rays grazing shared
+	// edges may hit in one and miss in the other. Hit counts may differ by this fraction (at least one hit).
+	constexpr double HIT_TOLERANCE = 1e-4;
+
+	bool hit_counts_agree(uint64_t reference, uint64_t hitCount)
+	{
+		uint64_t difference = reference > hitCount ? reference - hitCount : hitCount - reference;
+		return static_cast<double>(difference) <= std::max(1.0, HIT_TOLERANCE * static_cast<double>(reference));
+	}
+
+	glm::vec3 hash(glm::uvec3 x) {
+		const uint32_t k = 1103515245U;
+		x = ((x >> 8U) ^ glm::uvec3(x.y, x.z, x.x)) * k;
+		x = ((x >> 8U) ^ glm::uvec3(x.y, x.z, x.x)) * k;
+		x = ((x >> 8U) ^ glm::uvec3(x.y, x.z, x.x)) * k;
+
+		return glm::vec3(x) * (1.0f / float(0xffffffffU));
+	}
+
+	glm::vec3 geometric_normal(const host_scene &scene, const host_hit &hit)
+	{
+		const host_scene::geometry &geo = scene.geometries()[hit.mGeometryIndex];
+		const glm::vec3 &v0 = geo.mPositions[geo.mIndices[3 * hit.mPrimitiveIndex + 0]];
+		const glm::vec3 &v1 = geo.mPositions[geo.mIndices[3 * hit.mPrimitiveIndex + 1]];
+		const glm::vec3 &v2 = geo.mPositions[geo.mIndices[3 * hit.mPrimitiveIndex + 2]];
+		return glm::normalize(glm::cross(v1 - v0, v2 - v0));
+	}
+}
+
+
+std::vector<bvh_benchmark::ray_set> bvh_benchmark::generate_ray_sets(const host_scene &scene, const render_settings &settings, task_system &tasks)
+{
+	const glm::uvec2 resolution = settings.mResolution;
+	const uint32_t pixelCount = resolution.x * resolution.y;
+
+	ray_set primary{ "primary", std::vector<host_ray>(pixelCount), false };
+
+	// Same camera model as ray_gen_shader.rgen, through the pixel centers
+	const glm::mat4 &cameraTransform = settings.mCameraTransform;
+	const float cameraHalfFovAngle = static_cast<float>(((90 / 2.0) / 180.0) * glm::pi<double>());
+	const float aspectRatio = float(resolution.x) / float(resolution.y);
+	for (uint32_t y = 0; y < resolution.y; y++) {
+		for (uint32_t x = 0; x < resolution.x; x++) {
+			const glm::vec2 uv = (glm::vec2(float(x), float(y)) + glm::vec2(0.5f)) / glm::vec2(resolution);
+			const glm::vec2 xyDir = uv * 2.0f - 1.0f;
+			glm::vec3 rayDirection = glm::normalize(glm::vec3(xyDir.x * aspectRatio, -xyDir.y, -1 / std::tan(cameraHalfFovAngle)));
+			rayDirection = glm::normalize(glm::mat3(cameraTransform) * rayDirection);
+			primary.mRays[y * resolution.x + x] = host_ray{ glm::vec3(cameraTransform[3]), rayDirection, 0.0f, 1000.0f };
+		}
+	}
+
+	// Secondary rays start at the primary hits
+	std::vector<host_hit> hits(pixelCount);
+	std::vector<uint8_t> hasHit(pixelCount);
+	tasks.parallel_for(0, pixelCount, CHUNK_SIZE, [&](uint32_t i) {
+		hasHit[i] = scene.intersect(primary.mRays[i], hits[i], false) ? 1 : 0;
+	});
+
+	ray_set shadow{ "shadow", {}, true };
+	ray_set diffuse{ "diffuse", {}, false };
+	for (uint32_t i = 0; i < pixelCount; i++) {
+		if (!hasHit[i]) {
+			continue;
+		}
+		const host_ray &ray = primary.mRays[i];
+		glm::vec3 position = ray.mOrigin + ray.mDirection * hits[i].mT;
+		glm::vec3 normal = geometric_normal(scene, hits[i]);
+		if (glm::dot(normal, ray.mDirection) > 0.0f) {
+			normal = -normal;
+		}
+		glm::vec3 origin = position + normal * EPSILON;
+
+		glm::vec3 toLight = lightPosition - origin;
+		float distance = glm::length(toLight);
+		shadow.mRays.push_back(host_ray{ origin, toLight / distance, 0.0f, distance - EPSILON });
+
+		// cosine distributed around the geometric normal
+		glm::vec3 random = hash(glm::uvec3(i % resolution.x, i / resolution.x, 1));
+		float angle = random.x * 2.0f * glm::pi<float>();
+		float radius = std::sqrt(random.y);
+		glm::vec3 tangent = glm::normalize(glm::cross(normal, std::abs(normal.x) > 0.9f ? glm::vec3(0, 1, 0) : glm::vec3(1, 0, 0)));
+		glm::vec3 bitangent = glm::cross(normal, tangent);
+		glm::vec3 direction = tangent * (std::cos(angle) * radius) + bitangent * (std::sin(angle) * radius) + normal * std::sqrt(std::max(0.0f, 1.0f - radius * radius));
+		diffuse.mRays.push_back(host_ray{ origin, glm::normalize(direction), 0.0f, 1000.0f });
+	}
+
+	std::vector<ray_set> sets;
+	sets.push_back(std::move(primary));
+	sets.push_back(std::move(shadow));
+	sets.push_back(std::move(diffuse));
+	return sets;
+}
+
+
+double bvh_benchmark::measure(const host_scene &scene, const ray_set &rays, task_system &tasks, uint64_t &hitCount)
+{
+	const uint32_t rayCount = static_cast<uint32_t>(rays.mRays.size());
+	const uint32_t chunkCount = (rayCount + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+	double bestSeconds = std::numeric_limits<double>::max();
+	for (int repetition = 0; repetition < REPETITIONS; repetition++) {
+		std::atomic<uint64_t> hits = 0;
+
+		auto start = std::chrono::steady_clock::now();
+		tasks.parallel_for(0, chunkCount, 1, [&](uint32_t chunk) {
+			uint64_t chunkHits = 0;
+			host_hit hit;
+			for (uint32_t i = chunk * CHUNK_SIZE; i < std::min(rayCount, (chunk + 1) * CHUNK_SIZE); i++) {
+				chunkHits += scene.intersect(rays.mRays[i], hit, rays.mAnyHit) ? 1 : 0;
+			}
+			hits += chunkHits;
+		});
+		bestSeconds = std::min(bestSeconds, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+		hitCount = hits;
+	}
+	return bestSeconds;
+}
+
+
+int bvh_benchmark::run(const render_settings &aSettings)
+{
+	host_scene scene;
+	scene.load_models_from_ini(aSettings);
+	scene.build_acceleration_structures();
+
+	task_system tasks(aSettings.mThreadCount);
+	std::vector<ray_set> sets = generate_ray_sets(scene, aSettings, tasks);
+	printf("BVH benchmark at %ux%u on %u threads:\n", aSettings.mResolution.x, aSettings.mResolution.y, tasks.thread_count());
+
+	// The hit counts of all kernels have to agree with the scalar reference, up to HIT_TOLERANCE
+	std::vector<uint64_t> referenceHits;
+	bool consistent = true;
+
+	const host_scene::traversal_kernel kernels[] = {
+		host_scene::traversal_kernel::binary,
+		host_scene::traversal_kernel::bvh4_sse4,
+		host_scene::traversal_kernel::bvh8_avx2
+	};
+	for (auto kernel : kernels) {
+		if (!host_scene::kernel_supported(kernel)) {
+			printf("  %-20s not supported by this CPU\n", host_scene::kernel_name(kernel));
+			continue;
+		}
+		scene.set_traversal_kernel(kernel);
+
+		printf("  %-20s", host_scene::kernel_name(kernel));
+		for (size_t s = 0; s < sets.size(); s++) {
+			uint64_t hitCount = 0;
+			double seconds = measure(scene, sets[s], tasks, hitCount);
+			printf("  %s: %7.2f Mrays/s", sets[s].mName, sets[s].mRays.size() / seconds * 1e-6);
+
+			if (referenceHits.size() <= s) {
+				referenceHits.push_back(hitCount);
+			}
+			else if (!hit_counts_agree(referenceHits[s], hitCount)) {
+				printf(" (%llu instead of %llu hits)", static_cast<unsigned long long>(hitCount), static_cast<unsigned long long>(referenceHits[s]));
+				consistent = false;
+			}
+		}
+		printf("\n");
+	}
+
+	return consistent ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "host_scene.h"
+#include "render_settings.h"
+
+
+/// <summary>
+/// Measures the host traversal kernels on ray sets generated from the camera in the settings (by default the sponza view):
+/// primary rays through every pixel center, shadow rays from the primary hits towards the light of the ray generation shader
+/// (any hit queries) and cosine distributed diffuse bounces from the primary hits (closest hit queries).
+/// </summary>
+class bvh_benchmark
+{
+public:
+	// Loads the scene from the settings, prints Mrays/s for every supported kernel and ray set, returns the process exit code.
+	static int run(const render_settings &aSettings);
+
+private:
+	struct ray_set {
+		const char *mName;
+		std::vector<host_ray> mRays;
+		bool mAnyHit;
+	};
+
+	static std::vector<ray_set> generate_ray_sets(const host_scene &scene, const render_settings &settings, task_system &tasks);
+	static double measure(const host_scene &scene, const ray_set &rays, task_system &tasks, uint64_t &hitCount);
+};
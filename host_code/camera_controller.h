@@ -49,6 +49,6 @@ public:
 private:
 	avk::orbit_camera mOrbitCam;
 	avk::quake_camera mQuakeCam;
-	bool mMoved;
+	bool mMoved = true; // the accumulation images start out undefined
 	glm::mat4 mPreviousTransform;
 };
@@ -0,0 +1,240 @@
+#include "camera_path_benchmark.h"
+
+#include <filesystem>
+#include <fstream>
+#include <stb_image.h>
+#include <stb_image_write.h>
+
+
+namespace {
+	struct frame_statistics {
+		double mMean = 0.0;
+		double mP50 = 0.0;
+		double mP90 = 0.0;
+		double mP99 = 0.0;
+		double mMax = 0.0;
+		double mTotal = 0.0;
+	};
+
+	// Nearest-rank percentiles
+	frame_statistics statistics(std::vector<double> milliseconds)
+	{
+		frame_statistics result;
+		if (milliseconds.empty()) {
+			return result;
+		}
+		std::sort(milliseconds.begin(), milliseconds.end());
+		auto percentile = [&](double p) {
+			size_t rank = static_cast<size_t>(std::ceil(p * milliseconds.size()));
+			return milliseconds[std::clamp<size_t>(rank, 1, milliseconds.size()) - 1];
+		};
+		for (double ms : milliseconds) {
+			result.mTotal += ms;
+		}
+		result.mMean = result.mTotal / milliseconds.size();
+		result.mP50 = percentile(0.5);
+		result.mP90 = percentile(0.9);
+		result.mP99 = percentile(0.99);
+		result.mMax = milliseconds.back();
+		return result;
+	}
+
+	void write_statistics(std::ostream &out, const frame_statistics &s)
+	{
+		out << "{\"mean\": " << s.mMean << ", \"p50\": " << s.mP50 << ", \"p90\": " << s.mP90 << ", \"p99\": " << s.mP99 << ", \"max\": " << s.mMax << "}";
+	}
+
+	std::string json_string(const std::string &value)
+	{
+		std::string result = "\"";
+		for (char c : value) {
+			if (c == '"' || c == '\\') {
+				result += '\\';
+			}
+			result += c;
+		}
+		return result + "\"";
+	}
+}
+
+
+camera_path_benchmark::camera_path_benchmark(const render_settings &aSettings)
+	: mPath{aSettings.mBenchmarkPath}
+	, mReportPath{aSettings.mBenchmarkReportPath.empty() ? "./results/benchmark.json" : aSettings.mBenchmarkReportPath}
+	, mReferenceDirectory{aSettings.mBenchmarkReferenceDirectory}
+	, mMaxRmse{aSettings.mBenchmarkMaxRmse}
+	, mResolution{aSettings.mResolution}
+{
+	std::ifstream file(mPath);
+	if (!file) {
+		throw std::runtime_error("Could not read the camera path " + mPath);
+	}
+
+	std::string line;
+	int lineNumber = 0;
+	while (std::getline(file, line)) {
+		lineNumber++;
+		std::stringstream stream(line);
+		view v;
+		std::string matrix;
+		if (!(stream >> v.mName) || v.mName[0] == '#') {
+			continue;
+		}
+		bool valid = false;
+		try {
+			valid = static_cast<bool>(stream >> v.mSamplesPerPixel >> matrix) && v.mSamplesPerPixel > 0 && render_settings::parse_matrix(matrix, v.mCameraTransform);
+		}
+		catch (std::logic_error &) {} // std::stof
+		if (!valid) {
+			throw std::runtime_error(mPath + ":" + std::to_string(lineNumber) + ": expected <name> <spp> <m0,m1,...,m15>");
+		}
+		mViews.push_back(v);
+	}
+	if (mViews.empty()) {
+		throw std::runtime_error("The camera path " + mPath + " has no views");
+	}
+	mResults.resize(mViews.size());
+}
+
+
+bool camera_path_benchmark::next_view()
+{
+	if (mStarted) {
+		mCurrentView++;
+	}
+	mStarted = true;
+	if (mCurrentView >= mViews.size()) {
+		mCurrentView = mViews.size() - 1;
+		return false;
+	}
+
+	printf("Benchmark view %zu/%zu: %s, %u spp\n", mCurrentView + 1, mViews.size(), mViews[mCurrentView].mName.c_str(), mViews[mCurrentView].mSamplesPerPixel);
+	return true;
+}
+
+void camera_path_benchmark::add_frame(double milliseconds, uint64_t tracedPixels)
+{
+	mResults[mCurrentView].mFrameMilliseconds.push_back(milliseconds);
+	mResults[mCurrentView].mTracedPixels += tracedPixels;
+}
+
+void camera_path_benchmark::finish_view(const uint8_t *rgba, uint32_t samplesPerPixel)
+{
+	view_result &result = mResults[mCurrentView];
+	result.mSamplesPerPixel = samplesPerPixel;
+	if (mReferenceDirectory.empty()) {
+		return;
+	}
+
+	std::string referencePath = (std::filesystem::path(mReferenceDirectory) / (mViews[mCurrentView].mName + ".png")).string();
+	if (!std::filesystem::exists(referencePath)) {
+		std::filesystem::create_directories(mReferenceDirectory);
+		if (stbi_write_png(referencePath.c_str(), mResolution.x, mResolution.y, 4, rgba, mResolution.x * 4) == 0) {
+			result.mError = "could not write the reference " + referencePath;
+		}
+		else {
+			result.mReferenceCreated = true;
+			printf("  created reference %s\n", referencePath.c_str());
+		}
+		return;
+	}
+
+	int width, height, channels;
+	stbi_uc *reference = stbi_load(referencePath.c_str(), &width, &height, &channels, 4);
+	if (reference == nullptr) {
+		result.mError = "could not read the reference " + referencePath;
+		return;
+	}
+	if (static_cast<uint32_t>(width) != mResolution.x || static_cast<uint32_t>(height) != mResolution.y) {
+		result.mError = "the reference " + referencePath + " has a different resolution";
+		free(reference);
+		return;
+	}
+
+	// Over the tonemapped rgb values in [0, 1]
+	double sum = 0.0;
+	const size_t pixelCount = size_t(mResolution.x) * mResolution.y;
+	for (size_t i = 0; i < pixelCount; i++) {
+		for (size_t c = 0; c < 3; c++) {
+			double difference = (double(rgba[4 * i + c]) - double(reference[4 * i + c])) / 255.0;
+			sum += difference * difference;
+		}
+	}
+	free(reference); // stb_image uses malloc()
+
+	result.mRmse = std::sqrt(sum / (3.0 * pixelCount));
+	printf("  RMSE against %s: %.6lf\n", referencePath.c_str(), *result.mRmse);
+}
+
+
+bool camera_path_benchmark::passed() const
+{
+	for (const view_result &result : mResults) {
+		if (!result.mError.empty() || result.mFrameMilliseconds.empty()) {
+			return false;
+		}
+		if (mMaxRmse > 0.0 && result.mRmse && *result.mRmse > mMaxRmse) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool camera_path_benchmark::write_report() const
+{
+	std::filesystem::path reportPath(mReportPath);
+	if (reportPath.has_parent_path()) {
+		std::filesystem::create_directories(reportPath.parent_path());
+	}
+	std::ofstream out(mReportPath);
+	if (!out) {
+		return false;
+	}
+
+	std::vector<double> allFrames;
+	double allSamples = 0.0;
+
+	out << "{\n";
+	out << "  \"camera_path\": " << json_string(mPath) << ",\n";
+	out << "  \"resolution\": [" << mResolution.x << ", " << mResolution.y << "],\n";
+	out << "  \"startup_ms\": " << mStartupMilliseconds << ",\n";
+	out << "  \"views\": [\n";
+	for (size_t i = 0; i < mViews.size(); i++) {
+		const view_result &result = mResults[i];
+		frame_statistics frames = statistics(result.mFrameMilliseconds);
+		double samples = double(result.mTracedPixels);
+		allFrames.insert(allFrames.end(), result.mFrameMilliseconds.begin(), result.mFrameMilliseconds.end());
+		allSamples += samples;
+
+		out << "    {\"name\": " << json_string(mViews[i].mName) << ", \"spp\": " << result.mSamplesPerPixel << ", \"frames\": " << result.mFrameMilliseconds.size();
+		out << ", \"frame_ms\": ";
+		write_statistics(out, frames);
+		out << ", \"samples_per_second\": " << (frames.mTotal > 0.0 ? samples / (frames.mTotal * 1e-3) : 0.0);
+		out << ", \"rmse\": ";
+		if (result.mRmse) {
+			out << *result.mRmse;
+		}
+		else {
+			out << "null";
+		}
+		out << ", \"reference_created\": " << (result.mReferenceCreated ? "true" : "false");
+		if (!result.mError.empty()) {
+			out << ", \"error\": " << json_string(result.mError);
+		}
+		out << "}" << (i + 1 < mViews.size() ? "," : "") << "\n";
+	}
+	out << "  ],\n";
+
+	frame_statistics frames = statistics(allFrames);
+	out << "  \"frame_ms\": ";
+	write_statistics(out, frames);
+	out << ",\n";
+	out << "  \"samples_per_second\": " << (frames.mTotal > 0.0 ? allSamples / (frames.mTotal * 1e-3) : 0.0) << ",\n";
+	out << "  \"max_rmse\": " << mMaxRmse << ",\n";
+	out << "  \"passed\": " << (passed() ? "true" : "false") << "\n";
+	out << "}\n";
+
+	printf("Benchmark %s: startup %.1lf ms, frame p50 %.3lf ms, p99 %.3lf ms, %.3lf Msamples/sec, report written to %s\n",
+		passed() ? "passed" : "FAILED", mStartupMilliseconds, frames.mP50, frames.mP99, frames.mTotal > 0.0 ? allSamples / (frames.mTotal * 1e-3) * 1e-6 : 0.0, mReportPath.c_str());
+	return static_cast<bool>(out);
+}
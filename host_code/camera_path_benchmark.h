@@ -0,0 +1,62 @@
+#pragma once
+
+#include "render_settings.h"
+
+
+/// <summary>
+/// Renders a scripted sequence of views headless and reports startup time, frame time percentiles, samples/sec and the RMSE of every
+/// view against a stored reference image as JSON, s.t. deployments can be gated on it. The camera path file has one view per line,
+/// `<name> <spp> <m0,m1,...,m15>` with the camera matrix in the format of `--camera`, lines starting with # are ignored.
+/// Every view restarts the accumulation, the random numbers only depend on pixel and sample index, hence runs are deterministic.
+/// </summary>
+class camera_path_benchmark
+{
+public:
+	struct view {
+		std::string mName;
+		uint32_t mSamplesPerPixel;
+		glm::mat4 mCameraTransform;
+	};
+
+	// Throws std::runtime_error if the camera path cannot be read
+	explicit camera_path_benchmark(const render_settings &aSettings);
+
+	// Starts the next view, false once all views are done
+	bool next_view();
+	const view &current_view() const { return mViews[mCurrentView]; }
+
+	void set_startup_time(double milliseconds) { mStartupMilliseconds = milliseconds; }
+	// Wall-clock time of one submitted frame (submission until the fence is signalled) and the pixels it traced,
+	// with --frame-budget or --adaptive a frame may cover only a part of the image
+	void add_frame(double milliseconds, uint64_t tracedPixels);
+	// Compares the tonemapped result of the current view (RGBA8, the resolution of the settings) with its reference image,
+	// `samplesPerPixel` are the completed sweeps over the image
+	void finish_view(const uint8_t *rgba, uint32_t samplesPerPixel);
+
+	// Writes the JSON report, returns false if the file cannot be written
+	bool write_report() const;
+	bool passed() const;
+
+private:
+	struct view_result {
+		std::vector<double> mFrameMilliseconds;
+		uint64_t mTracedPixels = 0;
+		uint32_t mSamplesPerPixel = 0;
+		std::optional<double> mRmse;
+		bool mReferenceCreated = false;
+		std::string mError;
+	};
+
+	std::string mPath;
+	std::string mReportPath;
+	std::string mReferenceDirectory;
+	double mMaxRmse;
+	glm::uvec2 mResolution;
+
+	std::vector<view> mViews;
+	std::vector<view_result> mResults;
+	size_t mCurrentView = 0;
+	bool mStarted = false;
+
+	double mStartupMilliseconds = 0.0;
+};
@@ -0,0 +1,111 @@
+#include "convergence_monitor.h"
+
+
+namespace {
+	// Same as TILE_SIZE in convergence_error.comp
+	constexpr uint32_t TILE_SIZE = 16;
+}
+
+
+convergence_monitor::convergence_monitor(const render_settings &aSettings)
+	: mInterval{aSettings.mErrorInterval}
+	, mTargetError{aSettings.mTargetError}
+{
+	auto reference = pfm_image::read(aSettings.mReferencePath);
+	if (!reference) {
+		throw std::runtime_error("Could not read the reference " + aSettings.mReferencePath + " (expected a little endian RGB PFM)");
+	}
+	mReference = std::move(*reference);
+
+	if (!aSettings.mErrorLogPath.empty()) {
+		mLog.open(aSettings.mErrorLogPath);
+		if (!mLog) {
+			throw std::runtime_error("Could not write the error log " + aSettings.mErrorLogPath);
+		}
+		mLog << "spp,seconds,mse,relmse\n";
+	}
+}
+
+
+void convergence_monitor::create_resources(avk::queue &aQueue, const avk::image_view &aCameraImageView)
+{
+	mQueue = &aQueue;
+
+	const auto &cameraImage = aCameraImageView->get_image();
+	if (cameraImage.width() != mReference.mWidth || cameraImage.height() != mReference.mHeight) {
+		throw std::runtime_error("The reference is " + std::to_string(mReference.mWidth) + "x" + std::to_string(mReference.mHeight)
+			+ ", but the accumulation is " + std::to_string(cameraImage.width()) + "x" + std::to_string(cameraImage.height()));
+	}
+
+	mReferenceBuffer = avk::context().create_buffer(
+		avk::memory_usage::device, {},
+		avk::storage_buffer_meta::create_from_data(mReference.mTexels)
+	);
+	avk::context().record_and_submit_with_fence({
+		mReferenceBuffer->fill(mReference.mTexels.data(), 0)
+	}, *mQueue)->wait_until_signalled();
+	// Only needed on the GPU from now on
+	mReference.mTexels = {};
+
+	mGroupCount = glm::uvec2((mReference.mWidth + TILE_SIZE - 1) / TILE_SIZE, (mReference.mHeight + TILE_SIZE - 1) / TILE_SIZE);
+	mPartialsBuffer = avk::context().create_buffer(
+		avk::memory_usage::host_visible, {},
+		avk::storage_buffer_meta::create_from_size(sizeof(glm::vec2) * mGroupCount.x * mGroupCount.y)
+	);
+
+	mPipeline = avk::context().create_compute_pipeline_for(
+		avk::compute_shader("shaders/convergence_error.comp"),
+		avk::descriptor_binding(0, 0, aCameraImageView->as_storage_image(avk::layout::general)),
+		avk::descriptor_binding(0, 1, mReferenceBuffer),
+		avk::descriptor_binding(0, 2, mPartialsBuffer)
+	);
+}
+
+
+void convergence_monitor::restart()
+{
+	mMeasurementSeconds = 0.0;
+}
+
+bool convergence_monitor::measure(avk::descriptor_cache &aDescriptorCache, const avk::image_view &aCameraImageView, uint32_t samplesPerPixel, double seconds)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	avk::context().record_and_submit_with_fence({
+		avk::sync::global_memory_barrier(
+			avk::stage::ray_tracing_shader >> avk::stage::compute_shader,
+			avk::access::shader_write >> avk::access::shader_read
+		),
+		avk::command::bind_pipeline(mPipeline.as_reference()),
+		avk::command::bind_descriptors(mPipeline->layout(), aDescriptorCache->get_or_create_descriptor_sets({
+			avk::descriptor_binding(0, 0, aCameraImageView->as_storage_image(avk::layout::general)),
+			avk::descriptor_binding(0, 1, mReferenceBuffer),
+			avk::descriptor_binding(0, 2, mPartialsBuffer)
+		})),
+		avk::command::dispatch(mGroupCount.x, mGroupCount.y, 1),
+		// The next frame must not accumulate into the camera image before it has been read
+		avk::sync::global_execution_barrier(avk::stage::compute_shader >> avk::stage::ray_tracing_shader)
+	}, *mQueue)->wait_until_signalled();
+
+	// The tiles are summed in double precision, a float sum over millions of pixels would lose the small errors
+	glm::dvec2 sum(0.0);
+	{
+		auto mapping = mPartialsBuffer->map_memory(avk::mapping_access::read);
+		const glm::vec2 *partials = static_cast<const glm::vec2 *>(mapping.get());
+		for (uint32_t i = 0; i < mGroupCount.x * mGroupCount.y; i++) {
+			sum += glm::dvec2(partials[i]);
+		}
+	}
+	glm::dvec2 error = sum / (3.0 * mReference.mWidth * mReference.mHeight);
+
+	// `seconds` was taken before this measurement, but includes all earlier ones
+	double renderSeconds = seconds - mMeasurementSeconds;
+	mMeasurementSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	printf("%u spp, %.3lf s: MSE %.6g, relMSE %.6g\n", samplesPerPixel, renderSeconds, error.x, error.y);
+	if (mLog.is_open()) {
+		mLog << samplesPerPixel << "," << renderSeconds << "," << error.x << "," << error.y << "\n";
+	}
+
+	return mTargetError > 0.0 && error.y <= mTargetError;
+}
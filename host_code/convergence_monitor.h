@@ -0,0 +1,47 @@
+#pragma once
+
+#include "pfm_image.hpp"
+#include "render_settings.h"
+
+#include <auto_vk_toolkit.hpp>
+
+
+/// <summary>
+/// Measures how fast the accumulation converges: every `--error-interval` samples, the camera image is compared with a high spp
+/// reference (a PFM, e.g. written with `--output reference.pfm`) by a compute shader (shaders/convergence_error.comp) which reduces
+/// the squared and the relative squared error of each 16x16 tile. The host only sums the tiles. Every measurement is printed and
+/// optionally logged as CSV, which gives an error-vs-time curve. The time excludes the measurements themselves.
+/// relMSE = mean((c - r)^2 / (r^2 + 0.01)) over all pixels and rgb channels, MSE the same without the denominator.
+/// </summary>
+class convergence_monitor
+{
+public:
+	// Throws std::runtime_error if the reference cannot be read or the error log cannot be opened
+	explicit convergence_monitor(const render_settings &aSettings);
+
+	// Uploads the reference and creates the reduction pipeline, throws std::runtime_error if the resolution differs from the reference
+	void create_resources(avk::queue &aQueue, const avk::image_view &aCameraImageView);
+
+	inline bool due(uint32_t samplesPerPixel) const { return samplesPerPixel > 0 && samplesPerPixel % mInterval == 0; }
+
+	// The accumulation restarted (camera moved), the curve starts over
+	void restart();
+
+	// Waits for the GPU, returns true once the relMSE is at or below the target error
+	bool measure(avk::descriptor_cache &aDescriptorCache, const avk::image_view &aCameraImageView, uint32_t samplesPerPixel, double seconds);
+
+private:
+	avk::queue *mQueue = nullptr;
+	pfm_image::image mReference;
+	uint32_t mInterval;
+	double mTargetError;
+
+	avk::buffer mReferenceBuffer;
+	avk::buffer mPartialsBuffer; // vec2(squared error, relative squared error) per 16x16 tile
+	glm::uvec2 mGroupCount;
+	avk::compute_pipeline mPipeline;
+
+	double mMeasurementSeconds = 0.0; // spent in measure() since the last restart
+
+	std::ofstream mLog;
+};
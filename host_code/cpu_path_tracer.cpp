@@ -0,0 +1,1122 @@
+#include "cpu_path_tracer.h"
+
+#include "exr_image.hpp"
+#include "pfm_image.hpp"
+
+#include <stb_image_write.h>
+#include <deque>
+#include <thread>
+
+
+// The functions in this anonymous namespace intentionally keep the names, structure and quirks of their GLSL counterparts,
+// s.t. both can be compared side by side. Whenever the shaders change, change these as well.
+namespace {
+
+	// Keep in sync with the defines at the top of ray_gen_shader.rgen
+	constexpr float EPSILON = 0.001f;
+	constexpr float PI = 3.1415926353f;
+	constexpr float INV_PI = 0.31830988618f;
+	constexpr float INV_TWO_PI = 0.15915494309f;
+	constexpr float TWO_PI = 6.28318530718f;
+
+	constexpr int MAX_DEPTH = 10;
+
+	constexpr bool RR = true; // russian roulette
+	constexpr bool NNE = true; // next event estimation
+	constexpr bool SMS = true; // specular manifold sampling
+
+	constexpr float DIFFUSE_CONE_SPREAD = 0.1f;
+	// BDPT is off by default in the shader and not ported
+
+	const glm::vec3 lightPosition = glm::vec3(15, 20, 2);
+	const glm::vec3 lightValue = glm::vec3(500000);
+	constexpr float lightSize = 0.2f;
+	const glm::vec3 skyboxColor = glm::vec3(0.5f, 0.7f, 1.0f) * 10.0f;
+
+	constexpr uint32_t TILE_SIZE = 32;
+
+	// Subset of the ray flags used by the shaders
+	constexpr uint32_t gl_RayFlagsOpaqueEXT = 0x01;
+	constexpr uint32_t gl_RayFlagsTerminateOnFirstHitEXT = 0x04;
+	constexpr uint32_t gl_RayFlagsSkipClosestHitShaderEXT = 0x08;
+
+
+	struct Ray {
+		glm::vec3 origin;
+		glm::vec3 direction;
+		float tmin;
+		float tmax;
+	};
+
+	struct BSDF {
+		glm::vec3 albedo;
+		glm::vec3 emission;
+		float roughness;
+		float metalness;
+		float transmission;
+	};
+
+	struct RayPayloadType {
+		BSDF bsdf;
+		glm::vec3 normal;
+		glm::vec3 position;
+		bool hit;
+		glm::vec2 cone;
+		float emitterPdf;
+	};
+
+
+	//////////////////// HELPER FUNCTIONS ////////////////////
+
+	float max3(glm::vec3 v) {
+		return std::max(std::max(v.x, v.y), v.z);
+	}
+
+	//////////////////// SAMPLER ////////////////////
+
+	// Sampler dimensions, the same as the DIMENSION_* defines in ray_gen_shader.rgen
+	constexpr uint32_t DIMENSION_PIXEL = 0;
+	constexpr uint32_t DIMENSION_CAMERA_PATH = 16;
+	constexpr uint32_t DIMENSION_SMS = 256;
+	constexpr uint32_t DIMENSIONS_PER_BOUNCE = 6;
+	constexpr uint32_t DIMENSIONS_PER_SMS = 64;
+	constexpr uint32_t DIMENSION_BSDF = 0;
+	constexpr uint32_t DIMENSION_NEE = 1;
+	constexpr uint32_t DIMENSION_RR = 2;
+	constexpr uint32_t DIMENSION_EMISSIVE_SELECT = 3;
+	constexpr uint32_t DIMENSION_EMISSIVE_POINT = 4;
+	constexpr uint32_t DIMENSION_ENVIRONMENT = 5;
+
+	struct Sampler {
+		uint32_t seed; // per pixel
+		uint32_t index; // per sample
+	};
+
+	uint32_t bitfieldReverse(uint32_t x) {
+		x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+		x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+		x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+		x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+		return (x >> 16) | (x << 16);
+	}
+
+	uint32_t pcgHash(uint32_t v) {
+		uint32_t state = v * 747796405u + 2891336453u;
+		uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+		return (word >> 22u) ^ word;
+	}
+
+	uint32_t nestedUniformScramble(uint32_t x, uint32_t seed) {
+		x = bitfieldReverse(x);
+		// Laine-Karras permutation
+		x += seed;
+		x ^= x * 0x6c50b47cu;
+		x ^= x * 0xb82f1e52u;
+		x ^= x * 0xc7afe638u;
+		x ^= x * 0x8d22f6e6u;
+		return bitfieldReverse(x);
+	}
+
+	glm::uvec2 sobol2D(uint32_t index) {
+		uint32_t y = 0;
+		uint32_t direction = 1u << 31;
+		for (uint32_t i = index; i != 0; i >>= 1) {
+			if ((i & 1u) != 0) {
+				y ^= direction;
+			}
+			direction ^= direction >> 1;
+		}
+		return glm::uvec2(bitfieldReverse(index), y);
+	}
+
+	Sampler createSampler(glm::ivec2 pixel, uint32_t sampleIndex) {
+		return Sampler{ pcgHash(uint32_t(pixel.x) ^ pcgHash(uint32_t(pixel.y))), sampleIndex };
+	}
+
+	glm::vec2 sample2D(Sampler samples, uint32_t dimension) {
+		uint32_t seed = pcgHash(samples.seed ^ pcgHash(dimension));
+		glm::uvec2 sobol = sobol2D(nestedUniformScramble(samples.index, seed));
+		sobol = glm::uvec2(nestedUniformScramble(sobol.x, pcgHash(seed)), nestedUniformScramble(sobol.y, pcgHash(seed + 1)));
+		return glm::vec2(sobol >> 8u) * (1.0f / 16777216.0f);
+	}
+
+	float sample1D(Sampler samples, uint32_t dimension) {
+		return sample2D(samples, dimension).x;
+	}
+
+	uint32_t cameraPathDimension(int depth, uint32_t purpose) {
+		return DIMENSION_CAMERA_PATH + uint32_t(depth) * DIMENSIONS_PER_BOUNCE + purpose;
+	}
+
+	uint32_t smsDimension(int depth) {
+		return DIMENSION_SMS + uint32_t(depth) * DIMENSIONS_PER_SMS;
+	}
+
+	//////////////////// WARP ////////////////////
+
+	glm::vec3 squareToUniformSphere(glm::vec2 random) {
+		float cosTheta = random.y * 2.0f - 1.0f;
+		float sinTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+		float phi = TWO_PI * random.x;
+
+		return glm::vec3(std::cos(phi) * sinTheta, cosTheta, std::sin(phi) * sinTheta);
+	}
+
+	glm::vec2 squareToUniformDisk(glm::vec2 random) {
+		float angle = random.x * PI * 2;
+		float dist = std::sqrt(random.y);
+		return glm::vec2(std::sin(angle) * dist, std::cos(angle) * dist);
+	}
+
+	glm::vec3 squareToCosineHemisphere(glm::vec2 random) {
+		glm::vec2 disc = squareToUniformDisk(random);
+		float y = std::sqrt(std::max(0.0f, 1 - disc.x * disc.x - disc.y * disc.y));
+		return glm::vec3(disc.x, y, disc.y);
+	}
+
+	float squareToCosineHemispherePdf(glm::vec3 vector) {
+		float cosTheta = glm::dot(vector, glm::vec3(0, 1, 0));
+		return vector.y > 0 ? cosTheta * INV_PI : 0;
+	}
+
+	//////////////////// MATERIALS ////////////////////
+
+	glm::vec3 reflect(glm::vec3 i, glm::vec3 n) {
+		return i - 2.0f * glm::dot(n, i) * n;
+	}
+
+	float fresnelDielectric(float cosTheta_i, float eta) {
+		if (cosTheta_i < 0) {
+			eta = 1.0f / eta;
+			cosTheta_i = -cosTheta_i;
+		}
+
+		float sin2Theta_i = 1.0f - cosTheta_i * cosTheta_i;
+		float sin2Theta_t = sin2Theta_i / (eta * eta);
+		if (sin2Theta_t >= 1)
+			return 1.0f;
+
+		float cosTheta_t = std::sqrt(1 - sin2Theta_t);
+
+		float r_parl = (eta * cosTheta_i - cosTheta_t) / (eta * cosTheta_i + cosTheta_t);
+		float r_perp = (cosTheta_i - eta * cosTheta_t) / (cosTheta_i + eta * cosTheta_t);
+		return (r_parl * r_parl + r_perp * r_perp) / 2.0f;
+	}
+
+	bool refractDielectric(float cosTheta_i, glm::vec3 wi, glm::vec3 n, float eta, glm::vec3 &wt) {
+		if (cosTheta_i < 0) {
+			eta = 1.0f / eta;
+			cosTheta_i = -cosTheta_i;
+			n = -n;
+		}
+
+		float sin2Theta_i = std::max(0.0f, 1.0f - cosTheta_i * cosTheta_i);
+		float sin2Theta_t = sin2Theta_i / (eta * eta);
+		if (sin2Theta_t >= 1)
+			return false;
+
+		float cosTheta_t = std::sqrt(1.0f - sin2Theta_t);
+
+		wt = -wi / eta + (cosTheta_i / eta - cosTheta_t) * n;
+
+		return true;
+	}
+
+	glm::vec3 evaluateBSDF(BSDF bsdf, glm::vec3 normal, glm::vec3 wi, glm::vec2 random, bool overrideFresnel, glm::vec3 &wo, bool &isTransmission) {
+		float cosTheta;
+
+		if (bsdf.transmission == 1) {
+			float extIOR = 1.33f; //water //1.5046; //glass
+			float intIOR = 1.000277f; // air
+			float eta = extIOR / intIOR;
+
+			float cosTheta_i = glm::dot(-wi, normal);
+
+			if (overrideFresnel) {
+				if (isTransmission) {
+					isTransmission = true;
+					bool success = refractDielectric(cosTheta_i, -wi, normal, eta, wo);
+					if (!success) {
+						wo = glm::vec3(0);
+						return glm::vec3(0);
+					}
+				} else {
+					isTransmission = false;
+					wo = reflect(wi, normal);
+				}
+			} else {
+				float R = fresnelDielectric(cosTheta_i, eta);
+				if (random.x > R) {
+					isTransmission = true;
+					bool success = refractDielectric(cosTheta_i, -wi, normal, eta, wo);
+					if (!success) {
+						wo = glm::vec3(0);
+						return glm::vec3(0);
+					}
+				} else {
+					isTransmission = false;
+					wo = reflect(wi, normal);
+				}
+			}
+
+			return bsdf.albedo;
+		}
+
+		isTransmission = false;
+
+		if (bsdf.metalness == 0) {
+			glm::vec3 tangent = glm::normalize(glm::cross(normal, glm::vec3(1, 0, 0)));
+			if (std::abs(glm::dot(normal, glm::vec3(1, 0, 0))) > 0.9f) {
+				tangent = glm::normalize(glm::cross(normal, glm::vec3(0, 1, 0)));
+			}
+			glm::vec3 bitangent = glm::cross(normal, tangent);
+			glm::mat3 TNB = glm::mat3(tangent, normal, bitangent);
+
+			glm::vec3 hemisphere = squareToCosineHemisphere(random);
+
+			wo = TNB * hemisphere;
+			cosTheta = glm::dot(wo, normal);
+			return (INV_PI * bsdf.albedo * cosTheta) / squareToCosineHemispherePdf(hemisphere);
+		}
+
+		if (bsdf.metalness == 1) {
+			wo = reflect(wi, normal);
+			return bsdf.albedo;
+		}
+
+		// The shader falls off the end here (undefined result), treat such materials as black
+		wo = glm::vec3(0);
+		return glm::vec3(0);
+	}
+
+	bool isDiscrete(BSDF bsdf) {
+		return bsdf.metalness == 1 || bsdf.transmission == 1;
+	}
+
+	//////////////////// EMISSIVE LIGHTS ////////////////////
+
+	float powerHeuristic(float pdfA, float pdfB) {
+		float a = pdfA * pdfA;
+		float b = pdfB * pdfB;
+		return a + b > 0.0f ? a / (a + b) : 0.0f;
+	}
+
+	//////////////////// ENVIRONMENT ////////////////////
+
+	glm::vec2 directionToEquirect(glm::vec3 direction) {
+		return glm::vec2(std::atan2(direction.z, direction.x) * INV_TWO_PI + 0.5f, std::acos(glm::clamp(direction.y, -1.0f, 1.0f)) * INV_PI);
+	}
+
+	glm::vec3 equirectToDirection(glm::vec2 uv) {
+		float phi = (uv.x - 0.5f) * TWO_PI;
+		float theta = uv.y * PI;
+		return glm::vec3(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+	}
+
+	// First of the `count` CDF entries from `first` on which exceeds u
+	uint32_t searchCdf(std::span<const float> cdf, uint32_t first, uint32_t count, float u) {
+		uint32_t low = 0;
+		uint32_t high = count - 1;
+		while (low < high) {
+			uint32_t middle = (low + high) / 2;
+			if (cdf[first + middle] > u) {
+				high = middle;
+			} else {
+				low = middle + 1;
+			}
+		}
+		return low;
+	}
+
+	// Where u lies within the CDF step of the given entry, in [0, 1)
+	float withinCdfStep(std::span<const float> cdf, uint32_t first, uint32_t index, float u) {
+		float start = index > 0 ? cdf[first + index - 1] : 0.0f;
+		float size = cdf[first + index] - start;
+		return size > 0.0f ? glm::clamp((u - start) / size, 0.0f, 0.99999f) : 0.5f;
+	}
+
+	float continuationPdf(const RayPayloadType &hit, glm::vec3 wo) {
+		if (!NNE || isDiscrete(hit.bsdf)) {
+			return 0.0f;
+		}
+		return std::max(0.0f, glm::dot(wo, hit.normal)) * INV_PI;
+	}
+
+	// This method has no checks!
+	glm::vec3 rayPlaneIntersection(Ray ray, glm::vec3 planeOrigin, glm::vec3 normal) {
+		float denom = glm::dot(normal, ray.direction);
+		float t = glm::dot(planeOrigin - ray.origin, normal) / denom;
+		return ray.origin + t * ray.direction;
+	}
+
+	float error(Ray correct, Ray wish) {
+		return 1.0f - std::abs(glm::dot(glm::normalize(correct.direction), glm::normalize(wish.direction)));
+	}
+
+
+	/// <summary>
+	/// State of one ray generation shader invocation. `payload` behaves like the shader's global `rayPayloadEXT`: it is written
+	/// by the "closest hit shader" and the "miss shader", and stays untouched when a ray hits with the closest hit shader skipped.
+	/// </summary>
+	struct invocation {
+		const host_scene &mScene;
+		float mPixelSpreadAngle; // pushConstants.mPixelSpreadAngle
+		RayPayloadType payload{};
+		float coneLod = 0.0f;
+
+		void traceRayEXT(uint32_t rayFlags, const Ray &ray) {
+			host_hit hit;
+			bool anyHit = (rayFlags & gl_RayFlagsTerminateOnFirstHitEXT) != 0;
+
+			if (!mScene.intersect(host_ray{ ray.origin, ray.direction, ray.tmin, ray.tmax }, hit, anyHit)) {
+				missShader();
+				return;
+			}
+			if ((rayFlags & gl_RayFlagsSkipClosestHitShaderEXT) != 0) {
+				return;
+			}
+			closestHitShader(ray, hit);
+		}
+
+		//////////////////// miss_shader.rmiss ////////////////////
+
+		void missShader() {
+			payload.bsdf = BSDF{ glm::vec3(0), glm::vec3(0), 0, 0, 0 };
+			payload.normal = glm::vec3(0.0f);
+			payload.position = glm::vec3(0.0f);
+			payload.hit = false;
+			payload.emitterPdf = 0.0f;
+		}
+
+		//////////////////// closest_hit_shader.rchit ////////////////////
+
+		glm::vec4 textureLod(int texIndex, glm::vec2 texCoords, float lod) const {
+			return mScene.textures()[texIndex].sample(texCoords, lod);
+		}
+
+		float lod_for_texture(int texIndex, glm::vec4 offsetTiling) const {
+			const host_image &image = *mScene.textures()[texIndex].mImage;
+			glm::vec2 size = glm::vec2(float(image.mWidth), float(image.mHeight)) * glm::vec2(offsetTiling.z, offsetTiling.w);
+			return coneLod + 0.5f * std::log2(std::abs(size.x * size.y));
+		}
+
+		glm::vec4 sample_from_diffuse_texture(int matIndex, glm::vec2 uv) const {
+			const auto &material = mScene.materials()[matIndex];
+			glm::vec2 texCoords = uv * glm::vec2(material.mDiffuseTexOffsetTiling.z, material.mDiffuseTexOffsetTiling.w) + glm::vec2(material.mDiffuseTexOffsetTiling.x, material.mDiffuseTexOffsetTiling.y);
+			glm::vec4 result = textureLod(material.mDiffuseTexIndex, texCoords, lod_for_texture(material.mDiffuseTexIndex, material.mDiffuseTexOffsetTiling));
+
+			if (glm::vec3(result) == glm::vec3(1.0f)) {
+				result = material.mDiffuseReflectivity;
+			}
+			return result;
+		}
+
+		glm::vec3 sample_from_pbr_texture(int matIndex, glm::vec2 uv) const {
+			const auto &material = mScene.materials()[matIndex];
+			glm::vec2 texCoords = uv * glm::vec2(material.mLightmapTexOffsetTiling.z, material.mLightmapTexOffsetTiling.w) + glm::vec2(material.mLightmapTexOffsetTiling.x, material.mLightmapTexOffsetTiling.y);
+			glm::vec3 pbrFromTexture = glm::vec3(textureLod(material.mLightmapTexIndex, texCoords, lod_for_texture(material.mLightmapTexIndex, material.mLightmapTexOffsetTiling)));
+
+			float ambientOcclusion = pbrFromTexture.x;
+			float roughness = pbrFromTexture.y;
+			float metalness = pbrFromTexture.z;
+
+			if (pbrFromTexture == glm::vec3(1, 1, 1)) {
+				ambientOcclusion = 0;
+				roughness = material.mRoughness;
+				metalness = material.mMetallic;
+			}
+			return glm::vec3(ambientOcclusion, roughness, metalness);
+		}
+
+		glm::vec4 sample_from_emission_texture(int matIndex, glm::vec2 uv) const {
+			const auto &material = mScene.materials()[matIndex];
+			glm::vec2 texCoords = uv * glm::vec2(material.mEmissiveTexOffsetTiling.z, material.mEmissiveTexOffsetTiling.w) + glm::vec2(material.mEmissiveTexOffsetTiling.x, material.mEmissiveTexOffsetTiling.y);
+			glm::vec4 result = textureLod(material.mEmissiveTexIndex, texCoords, lod_for_texture(material.mEmissiveTexIndex, material.mEmissiveTexOffsetTiling));
+
+			if (glm::vec3(result) == glm::vec3(1.0f)) {
+				result = material.mEmissiveColor;
+			}
+			return result;
+		}
+
+		glm::vec4 sample_from_normal_texture(int matIndex, glm::vec2 uv) const {
+			const auto &material = mScene.materials()[matIndex];
+			glm::vec2 texCoords = uv * glm::vec2(material.mNormalsTexOffsetTiling.z, material.mNormalsTexOffsetTiling.w) + glm::vec2(material.mNormalsTexOffsetTiling.x, material.mNormalsTexOffsetTiling.y);
+			glm::vec4 result = textureLod(material.mNormalsTexIndex, texCoords, lod_for_texture(material.mNormalsTexIndex, material.mNormalsTexOffsetTiling));
+
+			// z is reconstructed like in the shader
+			glm::vec2 xy = glm::vec2(result) * 2.0f - 1.0f;
+			result.z = 0.5f + 0.5f * std::sqrt(std::max(0.0f, 1.0f - glm::dot(xy, xy)));
+			return result;
+		}
+
+		void closestHitShader(const Ray &ray, const host_hit &hit) {
+			const glm::vec3 bary = glm::vec3(1.0f - hit.mBarycentrics.x - hit.mBarycentrics.y, hit.mBarycentrics.x, hit.mBarycentrics.y);
+
+			// Like the shader, the custom index (= geometry index) doubles as material index
+			const int customIndex = static_cast<int>(hit.mGeometryIndex);
+			const host_scene::geometry &geometry = mScene.geometries()[customIndex];
+
+			const uint32_t i0 = geometry.mIndices[3 * hit.mPrimitiveIndex + 0];
+			const uint32_t i1 = geometry.mIndices[3 * hit.mPrimitiveIndex + 1];
+			const uint32_t i2 = geometry.mIndices[3 * hit.mPrimitiveIndex + 2];
+
+			const glm::vec2 uv = bary.x * geometry.mTexCoords[i0] + bary.y * geometry.mTexCoords[i1] + bary.z * geometry.mTexCoords[i2];
+
+			// Ray cone texture LOD, see getObjectHitInfo
+			const glm::vec2 uv0 = geometry.mTexCoords[i0];
+			const glm::vec2 uv1 = geometry.mTexCoords[i1];
+			const glm::vec2 uv2 = geometry.mTexCoords[i2];
+			const glm::mat3 objectToWorld = glm::mat3(mScene.instances()[hit.mInstanceIndex].mTransform);
+			const glm::vec3 faceNormal = glm::cross(objectToWorld * (geometry.mPositions[i1] - geometry.mPositions[i0]), objectToWorld * (geometry.mPositions[i2] - geometry.mPositions[i0]));
+			const float worldArea = glm::length(faceNormal);
+			const float uvArea = std::abs((uv1.x - uv0.x) * (uv2.y - uv0.y) - (uv2.x - uv0.x) * (uv1.y - uv0.y));
+			const float coneWidth = payload.cone.x + payload.cone.y * hit.mT;
+			const float cosTheta = std::abs(glm::dot(ray.direction, faceNormal)) / worldArea;
+			coneLod = -1000.0f; // without a footprint, always sample level 0
+			if (coneWidth > 0.0f && uvArea > 0.0f && cosTheta > 0.0f) {
+				coneLod = 0.5f * std::log2(uvArea / worldArea) + std::log2(coneWidth / cosTheta);
+			}
+
+			// Density of emissive NEE, see getObjectHitInfo
+			float emitterPdf = 0.0f;
+			const float radiance = emissive_lights::luminance(glm::vec3(mScene.materials()[customIndex].mEmissiveColor));
+			const float totalPower = mScene.lights().total_power();
+			if (radiance > 0.0f && totalPower > 0.0f && cosTheta > 0.0f) {
+				const float objectArea = glm::length(glm::cross(geometry.mPositions[i1] - geometry.mPositions[i0], geometry.mPositions[i2] - geometry.mPositions[i0]));
+				emitterPdf = radiance * objectArea / (totalPower * worldArea) * hit.mT * hit.mT / cosTheta;
+			}
+			glm::vec3 normalWS = bary.x * geometry.mNormals[i0] + bary.y * geometry.mNormals[i1] + bary.z * geometry.mNormals[i2];
+			glm::vec3 tangentWS = bary.x * geometry.mTangents[i0] + bary.y * geometry.mTangents[i1] + bary.z * geometry.mTangents[i2];
+			glm::vec3 bitangentWS = bary.x * geometry.mBitangents[i0] + bary.y * geometry.mBitangents[i1] + bary.z * geometry.mBitangents[i2];
+
+			glm::vec3 normal = glm::vec3(sample_from_normal_texture(customIndex, uv));
+
+			glm::vec3 T = glm::normalize(tangentWS);
+			glm::vec3 B = glm::normalize(bitangentWS);
+			glm::vec3 N = glm::normalize(normalWS);
+			glm::mat3 TBN = glm::mat3(T, B, N);
+
+			normal = normal * 2.0f - 1.0f;
+			normal = glm::normalize(TBN * normal);
+
+			glm::vec3 pbrData = sample_from_pbr_texture(customIndex, uv);
+
+			payload.bsdf = BSDF{
+				glm::vec3(sample_from_diffuse_texture(customIndex, uv)),
+				glm::vec3(sample_from_emission_texture(customIndex, uv)),
+				pbrData.y,
+				pbrData.z,
+				mScene.materials()[customIndex].mTransmission
+			};
+			payload.normal = normal;
+			payload.position = ray.origin + ray.direction * hit.mT;
+			payload.hit = true;
+			payload.emitterPdf = emitterPdf;
+		}
+
+		//////////////////// ray_gen_shader.rgen: emissive lights ////////////////////
+
+		emissive_lights::gpu_triangle selectEmissiveTriangle(float u) const {
+			const auto &triangles = mScene.lights().triangles();
+			float scaled = u * float(triangles.size());
+			uint32_t bin = std::min(uint32_t(scaled), uint32_t(triangles.size() - 1));
+			emissive_lights::gpu_triangle triangle = triangles[bin];
+			if (scaled - float(bin) >= triangle.mThreshold) {
+				triangle = triangles[triangle.mAlias];
+			}
+			return triangle;
+		}
+
+		glm::vec3 sampleEmissiveTriangle(const emissive_lights::gpu_triangle &triangle, glm::vec2 random) const {
+			const host_scene::geometry &geometry = mScene.geometries()[triangle.mGeometryIndex];
+			const glm::vec3 &p0 = geometry.mPositions[geometry.mIndices[3 * triangle.mPrimitiveIndex + 0]];
+			const glm::vec3 &p1 = geometry.mPositions[geometry.mIndices[3 * triangle.mPrimitiveIndex + 1]];
+			const glm::vec3 &p2 = geometry.mPositions[geometry.mIndices[3 * triangle.mPrimitiveIndex + 2]];
+
+			float su = std::sqrt(random.x);
+			glm::vec3 position = (1.0f - su) * p0 + su * (1.0f - random.y) * p1 + su * random.y * p2;
+			// One instance per geometry, like the transforms buffer of the shader
+			return glm::vec3(mScene.instances()[triangle.mGeometryIndex].mTransform * glm::vec4(position, 1.0f));
+		}
+
+		glm::vec3 emissiveNEE(const RayPayloadType &hit, Sampler samples, int depth) {
+			if (mScene.lights().size() == 0) {
+				return glm::vec3(0);
+			}
+
+			emissive_lights::gpu_triangle triangle = selectEmissiveTriangle(sample1D(samples, cameraPathDimension(depth, DIMENSION_EMISSIVE_SELECT)));
+			glm::vec3 samplePosition = sampleEmissiveTriangle(triangle, sample2D(samples, cameraPathDimension(depth, DIMENSION_EMISSIVE_POINT)));
+
+			glm::vec3 rayOrigin = hit.position + hit.normal * EPSILON;
+			glm::vec3 w = samplePosition - rayOrigin;
+			float dist = glm::length(w);
+			w /= dist;
+
+			float cosThetaX = glm::dot(hit.normal, w);
+			if (cosThetaX <= 0.0f) {
+				return glm::vec3(0);
+			}
+
+			RayPayloadType previousPayload = payload;
+			payload.cone = glm::vec2(0.0f);
+			traceRayEXT(gl_RayFlagsOpaqueEXT, Ray{ rayOrigin, w, 0.0f, dist + EPSILON });
+			RayPayloadType lightPayload = payload;
+			payload = previousPayload;
+
+			if (!lightPayload.hit || glm::distance(lightPayload.position, samplePosition) > EPSILON * std::max(1.0f, dist) || !(lightPayload.emitterPdf > 0.0f)) {
+				return glm::vec3(0);
+			}
+
+			float bsdfPdf = cosThetaX * INV_PI;
+			glm::vec3 bsdfValue = hit.bsdf.albedo * INV_PI * cosThetaX;
+			return bsdfValue * lightPayload.bsdf.emission * powerHeuristic(lightPayload.emitterPdf, bsdfPdf) / lightPayload.emitterPdf;
+		}
+
+		//////////////////// ENVIRONMENT ////////////////////
+
+		uint32_t environmentTexel(glm::vec2 uv) const {
+			const environment_map &env = mScene.environment();
+			glm::uvec2 texel = glm::min(glm::uvec2(uv * glm::vec2(env.width(), env.height())), glm::uvec2(env.width() - 1, env.height() - 1));
+			return texel.y * env.width() + texel.x;
+		}
+
+		float environmentPdf(uint32_t texel, float theta) const {
+			const environment_map &env = mScene.environment();
+			float sinTheta = std::sin(theta);
+			if (sinTheta <= 0.0f) {
+				return 0.0f;
+			}
+			return env.texels()[texel].w * float(env.width() * env.height()) / (2.0f * PI * PI * sinTheta);
+		}
+
+		float environmentPdf(glm::vec3 direction) const {
+			if (!mScene.environment().enabled()) {
+				return 0.0f;
+			}
+			glm::vec2 uv = directionToEquirect(direction);
+			return environmentPdf(environmentTexel(uv), uv.y * PI);
+		}
+
+		glm::vec3 sampleEnvironment(glm::vec2 random, glm::vec3 &radiance, float &pdf) const {
+			const environment_map &env = mScene.environment();
+			const uint32_t envWidth = env.width();
+			const uint32_t envHeight = env.height();
+			uint32_t row = searchCdf(env.cdf(), 0, envHeight, random.y);
+			uint32_t first = envHeight + row * envWidth;
+			uint32_t column = searchCdf(env.cdf(), first, envWidth, random.x);
+
+			glm::vec2 uv = glm::vec2(float(column) + withinCdfStep(env.cdf(), first, column, random.x), float(row) + withinCdfStep(env.cdf(), 0, row, random.y)) / glm::vec2(envWidth, envHeight);
+			uint32_t texel = row * envWidth + column;
+			radiance = glm::vec3(env.texels()[texel]) * env.intensity();
+			pdf = environmentPdf(texel, uv.y * PI);
+			return equirectToDirection(uv);
+		}
+
+		glm::vec3 evaluateSkybox(glm::vec3 direction) const {
+			const environment_map &env = mScene.environment();
+			if (env.enabled()) {
+				return glm::vec3(env.texels()[environmentTexel(directionToEquirect(direction))]) * env.intensity();
+			}
+			return skyboxColor;
+		}
+
+		glm::vec3 environmentNEE(const RayPayloadType &hit, Sampler samples, int depth) {
+			if (!mScene.environment().enabled()) {
+				return glm::vec3(0);
+			}
+
+			glm::vec3 radiance;
+			float lightPdf;
+			glm::vec3 w = sampleEnvironment(sample2D(samples, cameraPathDimension(depth, DIMENSION_ENVIRONMENT)), radiance, lightPdf);
+
+			float cosThetaX = glm::dot(hit.normal, w);
+			if (cosThetaX <= 0.0f || !(lightPdf > 0.0f)) {
+				return glm::vec3(0);
+			}
+
+			RayPayloadType previousPayload = payload;
+			payload.hit = true;
+			traceRayEXT(gl_RayFlagsOpaqueEXT | gl_RayFlagsTerminateOnFirstHitEXT | gl_RayFlagsSkipClosestHitShaderEXT, Ray{ hit.position + hit.normal * EPSILON, w, 0.0f, 1000.0f });
+			bool occluded = payload.hit;
+			payload = previousPayload;
+			if (occluded) {
+				return glm::vec3(0);
+			}
+
+			float bsdfPdf = cosThetaX * INV_PI;
+			glm::vec3 bsdfValue = hit.bsdf.albedo * INV_PI * cosThetaX;
+			return bsdfValue * radiance * powerHeuristic(lightPdf, bsdfPdf) / lightPdf;
+		}
+
+		//////////////////// ray_gen_shader.rgen ////////////////////
+
+		glm::vec3 specularManifoldSampling(
+			Ray diffuseRay,
+			RayPayloadType diffusePayload,
+			glm::vec3 diffuseBSDFValue,
+			glm::vec2 inSquare,
+			Ray specularRay,
+			RayPayloadType specularPayload,
+			Sampler samples,
+			uint32_t firstDimension
+		) {
+			int maxNewtonSteps = 10;
+			uint32_t dimension = firstDimension;
+			Ray ray = specularRay;
+			float alpha = inSquare.x;
+			float beta = inSquare.y;
+
+			for (int i = 0; i < maxNewtonSteps; i++) {
+				// we have found a ray that intersects something specular (reflection or transmission)
+				glm::vec3 wo;
+				bool specularBounceIsTransmission;
+				glm::vec3 specularInBSDFValue = evaluateBSDF(payload.bsdf, payload.normal, ray.direction, sample2D(samples, dimension++), false, wo, specularBounceIsTransmission);
+
+				// compute error
+				Ray correctRay = Ray{ payload.position, wo, 0, 1000 };
+				Ray wishRay = Ray{ payload.position + payload.normal * EPSILON, glm::normalize(lightPosition - payload.position), 0, 1000 };
+				float errorSample = error(correctRay, wishRay);
+
+				if (errorSample < 0.0001f) {
+					uint32_t rayFlags = gl_RayFlagsOpaqueEXT | gl_RayFlagsSkipClosestHitShaderEXT;
+					traceRayEXT(rayFlags, wishRay);
+
+					if (payload.hit) {
+						return glm::vec3(0);
+					} else {
+						float dist = glm::length(wishRay.origin - lightPosition);
+						float emitterPdf = 1.0f / (PI * lightSize * lightSize);
+						return 50.0f * lightValue * diffuseBSDFValue * specularInBSDFValue / (dist * dist * emitterPdf);
+					}
+				}
+
+				// create derivative samples
+				float angleStep = 0.01f;
+				glm::vec3 woAlpha1, woAlpha2, woBeta1, woBeta2;
+				bool isTransmission;
+				evaluateBSDF(diffusePayload.bsdf, diffusePayload.normal, diffuseRay.direction, glm::vec2(alpha - angleStep, beta), false, woAlpha1, isTransmission);
+				evaluateBSDF(diffusePayload.bsdf, diffusePayload.normal, diffuseRay.direction, glm::vec2(alpha + angleStep, beta), false, woAlpha2, isTransmission);
+				evaluateBSDF(diffusePayload.bsdf, diffusePayload.normal, diffuseRay.direction, glm::vec2(alpha, beta - angleStep), false, woBeta1, isTransmission);
+				evaluateBSDF(diffusePayload.bsdf, diffusePayload.normal, diffuseRay.direction, glm::vec2(alpha, beta + angleStep), false, woBeta2, isTransmission);
+
+				Ray rayAlpha1 = Ray{ diffusePayload.position, woAlpha1, 0, 1000 };
+				Ray rayAlpha2 = Ray{ diffusePayload.position, woAlpha2, 0, 1000 };
+				Ray rayBeta1 = Ray{ diffusePayload.position, woBeta1, 0, 1000 };
+				Ray rayBeta2 = Ray{ diffusePayload.position, woBeta2, 0, 1000 };
+
+				glm::vec3 hitPointAlpha1 = rayPlaneIntersection(rayAlpha1, payload.position, payload.normal);
+				glm::vec3 hitPointAlpha2 = rayPlaneIntersection(rayAlpha2, payload.position, payload.normal);
+				glm::vec3 hitPointBeta1 = rayPlaneIntersection(rayBeta1, payload.position, payload.normal);
+				glm::vec3 hitPointBeta2 = rayPlaneIntersection(rayBeta2, payload.position, payload.normal);
+
+				// build correct and wish derivative samples
+				glm::vec3 refractedWoAlpha1, refractedWoAlpha2, refractedWoBeta1, refractedWoBeta2;
+				evaluateBSDF(payload.bsdf, payload.normal, rayAlpha1.direction, sample2D(samples, dimension++), true, refractedWoAlpha1, specularBounceIsTransmission);
+				evaluateBSDF(payload.bsdf, payload.normal, rayAlpha2.direction, sample2D(samples, dimension++), true, refractedWoAlpha2, specularBounceIsTransmission);
+				evaluateBSDF(payload.bsdf, payload.normal, rayBeta1.direction, sample2D(samples, dimension++), true, refractedWoBeta1, specularBounceIsTransmission);
+				evaluateBSDF(payload.bsdf, payload.normal, rayBeta2.direction, sample2D(samples, dimension++), true, refractedWoBeta2, specularBounceIsTransmission);
+
+				Ray correctRayAlpha1 = Ray{ hitPointAlpha1, refractedWoAlpha1, 0, 1000 };
+				Ray correctRayAlpha2 = Ray{ hitPointAlpha2, refractedWoAlpha2, 0, 1000 };
+				Ray correctRayBeta1 = Ray{ hitPointBeta1, refractedWoBeta1, 0, 1000 };
+				Ray correctRayBeta2 = Ray{ hitPointBeta2, refractedWoBeta2, 0, 1000 };
+
+				Ray wishRayAlpha1 = Ray{ hitPointAlpha1, glm::normalize(lightPosition - hitPointAlpha1), 0, 1000 };
+				Ray wishRayAlpha2 = Ray{ hitPointAlpha2, glm::normalize(lightPosition - hitPointAlpha2), 0, 1000 };
+				Ray wishRayBeta1 = Ray{ hitPointBeta1, glm::normalize(lightPosition - hitPointBeta1), 0, 1000 };
+				Ray wishRayBeta2 = Ray{ hitPointBeta2, glm::normalize(lightPosition - hitPointBeta2), 0, 1000 };
+
+				float errorAlpha1 = error(correctRayAlpha1, wishRayAlpha1);
+				float errorAlpha2 = error(correctRayAlpha2, wishRayAlpha2);
+				float errorBeta1 = error(correctRayBeta1, wishRayBeta1);
+				float errorBeta2 = error(correctRayBeta2, wishRayBeta2);
+
+				float errorAlphaDerivative = (errorAlpha1 - errorAlpha2) / (angleStep + angleStep);
+				float errorBetaDerivative = (errorBeta1 - errorBeta2) / (angleStep + angleStep);
+
+				glm::vec3 tangent = glm::normalize(glm::vec3(
+					-errorAlphaDerivative,
+					-errorBetaDerivative,
+					-(errorAlphaDerivative * errorAlphaDerivative + errorBetaDerivative * errorBetaDerivative)
+				));
+
+				float t = 0;
+				if (std::abs(tangent.z) > 0.01f) {
+					t = -errorSample / tangent.z;
+				}
+
+				alpha += tangent.x * t;
+				beta += tangent.y * t;
+
+				evaluateBSDF(diffusePayload.bsdf, diffusePayload.normal, diffuseRay.direction, glm::vec2(alpha, beta), false, wo, isTransmission);
+
+				ray = Ray{ diffusePayload.position + diffusePayload.normal * 0.01f, wo, 0, 1000 };
+
+				uint32_t rayFlags = gl_RayFlagsOpaqueEXT;
+
+				payload.cone = glm::vec2(0.0f);
+				traceRayEXT(rayFlags, ray);
+				if (!payload.hit || !(payload.bsdf.metalness == 1 || payload.bsdf.transmission == 1)) {
+					break; // did not hit a discretely sampled object -> reroll
+				}
+			}
+
+			return glm::vec3(0);
+		}
+
+		glm::vec3 traceCameraRay(Ray inRay, Sampler samples) {
+			int depth = 0;
+			glm::vec3 throughput = glm::vec3(1.0f);
+			glm::vec3 color = glm::vec3(0.0f);
+			Ray ray = inRay;
+			bool inside = false;
+
+			Ray previousRay{};
+			RayPayloadType previousPayload{};
+			float previousAlpha = 0, previousBeta = 0;
+			glm::vec3 previousBSDFValue{};
+			float previousBSDFPdf = 0.0f;
+
+			// The cone starts with the footprint of one pixel and grows with every bounce
+			glm::vec2 cone = glm::vec2(0.0f, mPixelSpreadAngle);
+
+			while (true) {
+				uint32_t rayFlags = gl_RayFlagsOpaqueEXT;
+
+				payload.cone = cone;
+				traceRayEXT(rayFlags, ray);
+				RayPayloadType primaryPayload = payload;
+				if (!primaryPayload.hit) {
+					glm::vec3 sky = evaluateSkybox(ray.direction);
+					if (previousBSDFPdf > 0.0f) {
+						sky *= powerHeuristic(previousBSDFPdf, environmentPdf(ray.direction));
+					}
+					color += sky * throughput;
+					break;
+				}
+
+				if (depth >= MAX_DEPTH) {
+					break;
+				}
+
+				glm::vec3 wo;
+				bool isTransmission = false;
+
+				glm::vec2 square = sample2D(samples, cameraPathDimension(depth, DIMENSION_BSDF));
+				float alpha = square.x;
+				float beta = square.y;
+
+				glm::vec3 bsdfValue = evaluateBSDF(primaryPayload.bsdf, primaryPayload.normal, ray.direction, square, false, wo, isTransmission);
+
+				glm::vec3 emission = primaryPayload.bsdf.emission;
+				if (previousBSDFPdf > 0.0f && primaryPayload.emitterPdf > 0.0f) {
+					emission *= powerHeuristic(previousBSDFPdf, primaryPayload.emitterPdf);
+				}
+				glm::vec3 direct = glm::vec3(0);
+
+				if (SMS && depth > 0 && depth <= 2 && !isDiscrete(previousPayload.bsdf) && isDiscrete(primaryPayload.bsdf)) {
+					direct += specularManifoldSampling(previousRay, previousPayload, previousBSDFValue, glm::vec2(previousAlpha, previousBeta), ray, primaryPayload, samples, smsDimension(depth));
+				}
+
+				if (NNE && !isDiscrete(primaryPayload.bsdf)) {
+					direct += emissiveNEE(primaryPayload, samples, depth);
+					direct += environmentNEE(primaryPayload, samples, depth);
+
+					glm::vec3 samplePosition = lightPosition + squareToUniformSphere(sample2D(samples, cameraPathDimension(depth, DIMENSION_NEE))) * lightSize;
+
+					glm::vec3 w = samplePosition - primaryPayload.position;
+					float dist = glm::length(w);
+					w /= dist;
+
+					float cosThetaX = std::max(0.0f, glm::dot(primaryPayload.normal, w));
+					float cosThetaY = 1;//max(0.0, dot(sampleNormal, w));
+
+					glm::vec3 rayOrigin = primaryPayload.position + primaryPayload.normal * EPSILON;
+					glm::vec3 rayDirection = glm::normalize(samplePosition - rayOrigin);
+
+					Ray secondaryRay = Ray{ rayOrigin, rayDirection, 0, dist - EPSILON };
+
+					uint32_t shadowRayFlags = gl_RayFlagsOpaqueEXT | gl_RayFlagsSkipClosestHitShaderEXT;
+
+					traceRayEXT(shadowRayFlags, secondaryRay);
+					if (!payload.hit) {
+						glm::vec3 directEmission = lightValue;
+						glm::vec3 nneBsdfValue = (INV_PI * primaryPayload.bsdf.albedo * cosThetaX) / INV_TWO_PI;
+
+						if (lightSize == 0) {
+							direct += nneBsdfValue * directEmission;
+						} else {
+							float emitterPdf = 1.0f / (PI * lightSize * lightSize);
+							direct += (nneBsdfValue * directEmission * cosThetaX * cosThetaY) / (dist * dist * emitterPdf);
+						}
+					}
+				}
+
+				color += (emission + direct) * throughput;
+
+				if (!RR && depth + 1 >= MAX_DEPTH) {
+					break;
+				}
+
+				if (bsdfValue == glm::vec3(0)) {
+					break;
+				}
+
+				float rrProb = 1.0f;
+				if (RR && depth + 1 >= 4) {
+					rrProb = max3(throughput);
+				}
+				if (RR && sample1D(samples, cameraPathDimension(depth, DIMENSION_RR)) >= rrProb) {
+					break;
+				}
+
+				throughput *= bsdfValue / rrProb;
+				throughput = glm::vec3(std::min(1.0f, throughput.x),
+				                       std::min(1.0f, throughput.y),
+				                       std::min(1.0f, throughput.z));
+
+				if (isTransmission) {
+					inside = !inside;
+				}
+
+				float offsetDirection = inside ? -1.0f : 1.0f;
+				if (payload.bsdf.transmission != 1) {
+					offsetDirection = 1;
+				}
+
+				previousRay = ray;
+				previousPayload = primaryPayload;
+				previousAlpha = alpha;
+				previousBeta = beta;
+				previousBSDFValue = bsdfValue;
+				previousBSDFPdf = continuationPdf(primaryPayload, wo);
+
+				// Specular bounces keep the spread angle (the surfaces are treated as flat), diffuse ones widen it
+				cone.x += cone.y * glm::length(primaryPayload.position - ray.origin);
+				if (cone.y > 0 && !isDiscrete(primaryPayload.bsdf)) {
+					cone.y = std::max(cone.y, DIFFUSE_CONE_SPREAD);
+				}
+
+				ray.origin = primaryPayload.position + offsetDirection * primaryPayload.normal * EPSILON;
+				ray.direction = wo;
+
+				depth++;
+			}
+
+			return color;
+		}
+	};
+
+
+	/// <summary>
+	/// Every worker owns a queue of tiles, initially a contiguous block of the image (for locality).
+	/// Workers take tiles from the front of their own queue and, once it ran dry, steal from the back of the others.
+	/// </summary>
+	class tile_scheduler {
+	public:
+		tile_scheduler(uint32_t numWorkers, uint32_t numTiles)
+			: mQueues(numWorkers)
+		{
+			for (uint32_t w = 0; w < numWorkers; w++) {
+				uint32_t begin = static_cast<uint32_t>(static_cast<uint64_t>(numTiles) * w / numWorkers);
+				uint32_t end = static_cast<uint32_t>(static_cast<uint64_t>(numTiles) * (w + 1) / numWorkers);
+				for (uint32_t tile = begin; tile < end; tile++) {
+					mQueues[w].mTiles.push_back(tile);
+				}
+			}
+		}
+
+		bool next_tile(uint32_t worker, uint32_t &tile) {
+			{
+				worker_queue &own = mQueues[worker];
+				std::lock_guard<std::mutex> lock(own.mMutex);
+				if (!own.mTiles.empty()) {
+					tile = own.mTiles.front();
+					own.mTiles.pop_front();
+					return true;
+				}
+			}
+
+			for (size_t offset = 1; offset < mQueues.size(); offset++) {
+				worker_queue &victim = mQueues[(worker + offset) % mQueues.size()];
+				std::lock_guard<std::mutex> lock(victim.mMutex);
+				if (!victim.mTiles.empty()) {
+					tile = victim.mTiles.back();
+					victim.mTiles.pop_back();
+					return true;
+				}
+			}
+
+			return false;
+		}
+
+	private:
+		struct worker_queue {
+			std::mutex mMutex;
+			std::deque<uint32_t> mTiles;
+		};
+
+		std::vector<worker_queue> mQueues;
+	};
+}
+
+
+cpu_path_tracer::cpu_path_tracer(const host_scene &aScene, const render_settings &aSettings)
+	: mScene(&aScene)
+	, mSettings(aSettings)
+	, mResolution(aSettings.mResolution)
+{
+	mThreadCount = aSettings.mThreadCount > 0 ? aSettings.mThreadCount : std::max(1u, std::thread::hardware_concurrency());
+	mAccumulation.assign(static_cast<size_t>(mResolution.x) * mResolution.y, glm::vec4(0.0f));
+}
+
+
+void cpu_path_tracer::render()
+{
+	auto start = std::chrono::steady_clock::now();
+	double seconds = 0.0;
+
+	while (true) {
+		render_pass(mSamplesPerPixel);
+		mSamplesPerPixel++;
+
+		seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		bool samplesReached = mSettings.mTargetSamplesPerPixel > 0 && mSamplesPerPixel >= mSettings.mTargetSamplesPerPixel;
+		bool timeReached = mSettings.mTimeBudgetSeconds > 0.0 && seconds >= mSettings.mTimeBudgetSeconds;
+		if (samplesReached || timeReached) {
+			break;
+		}
+	}
+
+	double samples = static_cast<double>(mSamplesPerPixel) * mResolution.x * mResolution.y;
+	printf("CPU: rendered %u spp at %ux%u on %u threads in %.3lf s: %.3lf Msamples/sec\n", mSamplesPerPixel, mResolution.x, mResolution.y, mThreadCount, seconds, samples / seconds * 1e-6);
+}
+
+
+void cpu_path_tracer::render_pass(uint32_t sampleIndex)
+{
+	uint32_t tilesX = (mResolution.x + TILE_SIZE - 1) / TILE_SIZE;
+	uint32_t tilesY = (mResolution.y + TILE_SIZE - 1) / TILE_SIZE;
+	tile_scheduler scheduler(mThreadCount, tilesX * tilesY);
+
+	std::vector<std::thread> workers;
+	workers.reserve(mThreadCount);
+	for (uint32_t w = 0; w < mThreadCount; w++) {
+		workers.emplace_back([this, &scheduler, w, sampleIndex]() {
+			uint32_t tile;
+			while (scheduler.next_tile(w, tile)) {
+				render_tile(tile, sampleIndex);
+			}
+		});
+	}
+	for (auto &worker : workers) {
+		worker.join();
+	}
+}
+
+
+void cpu_path_tracer::render_tile(uint32_t tileIndex, uint32_t sampleIndex)
+{
+	uint32_t tilesX = (mResolution.x + TILE_SIZE - 1) / TILE_SIZE;
+	uint32_t x0 = (tileIndex % tilesX) * TILE_SIZE;
+	uint32_t y0 = (tileIndex / tilesX) * TILE_SIZE;
+
+	const glm::mat4 &cameraTransform = mSettings.mCameraTransform;
+	const float cameraHalfFovAngle = static_cast<float>(((90 / 2.0) / 180.0) * glm::pi<double>());
+	const float aspectRatio = float(mResolution.x) / float(mResolution.y);
+
+	invocation shader{ *mScene, mSettings.pixel_spread_angle(cameraHalfFovAngle) };
+
+	for (uint32_t y = y0; y < std::min(y0 + TILE_SIZE, mResolution.y); y++) {
+		for (uint32_t x = x0; x < std::min(x0 + TILE_SIZE, mResolution.x); x++) {
+			// The shader derives the sample index from cameraImage.a, which grows by two per sample
+			Sampler samples = createSampler(glm::ivec2(x, y), sampleIndex);
+
+			const glm::vec2 pixelCenter = glm::vec2(float(x), float(y)) + sample2D(samples, DIMENSION_PIXEL);
+			const glm::vec2 uv = pixelCenter / glm::vec2(mResolution);
+			glm::vec2 xyDir = uv * 2.0f - 1.0f;
+
+			glm::vec3 rayDirection = glm::normalize(glm::vec3(xyDir.x * aspectRatio, -xyDir.y, -1 / std::tan(cameraHalfFovAngle)));
+
+			glm::vec3 rayOrigin = glm::vec3(cameraTransform[3]);
+			rayDirection = glm::normalize(glm::mat3(cameraTransform) * rayDirection);
+
+			Ray primaryRay = Ray{ rayOrigin, rayDirection, 0, 1000.0f };
+			glm::vec3 color = shader.traceCameraRay(primaryRay, samples);
+
+			if (std::isnan(color.x) || std::isnan(color.y) || std::isnan(color.z) ||
+				color.x < 0 || color.y < 0 || color.z < 0) {
+				color = glm::vec3(0, 0, 0);
+			}
+
+			glm::vec4 &average = mAccumulation[static_cast<size_t>(y) * mResolution.x + x];
+			float count = average.w + 1.0f;
+			glm::vec3 mean = glm::vec3(average) + (color - glm::vec3(average)) / count;
+			average = glm::vec4(mean, count);
+		}
+	}
+}
+
+
+bool cpu_path_tracer::write_result_image(const std::string &fileName) const
+{
+	auto endsWith = [&](const std::string &suffix) {
+		return fileName.size() >= suffix.size() && fileName.compare(fileName.size() - suffix.size(), suffix.size(), suffix) == 0;
+	};
+	// Like the GPU path, .pfm and .exr outputs hold the untonemapped accumulation (the sample count in .w is dropped)
+	if (endsWith(".pfm") || endsWith(".exr")) {
+		bool written = endsWith(".exr")
+			? exr_image::write(fileName, mResolution.x, mResolution.y, mAccumulation.data())
+			: pfm_image::write(fileName, mResolution.x, mResolution.y, mAccumulation.data());
+		if (!written) {
+			std::cerr << "could not write " << fileName << std::endl;
+			return false;
+		}
+		std::cout << "wrote " << fileName << std::endl;
+		return true;
+	}
+
+	std::vector<glm::u8vec4> pixels(mAccumulation.size());
+	for (size_t i = 0; i < mAccumulation.size(); i++) {
+		glm::vec3 outputColor = glm::vec3(mAccumulation[i]);
+		outputColor = outputColor / (outputColor + glm::vec3(1.0f));
+		outputColor = glm::pow(outputColor, glm::vec3(1.0f / 2.2f));
+		pixels[i] = glm::u8vec4(glm::vec4(glm::clamp(outputColor, 0.0f, 1.0f) * 255.0f + 0.5f, 255.0f));
+	}
+
+	int channels = 4;
+	int result = stbi_write_png(fileName.c_str(), mResolution.x, mResolution.y, channels, pixels.data(), mResolution.x * channels);
+	if (result == 0) {
+		std::cerr << "could not write " << fileName << std::endl;
+		return false;
+	}
+	std::cout << "wrote " << fileName << std::endl;
+	return true;
+}
+
+
+int cpu_path_tracer::render_to_file(const render_settings &aSettings)
+{
+	auto loadStart = std::chrono::steady_clock::now();
+
+	host_scene scene;
+	scene.load_models_from_ini(aSettings);
+	scene.build_acceleration_structures();
+
+	double loadSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - loadStart).count();
+	printf("CPU: loaded %s and built acceleration structures in %.3lf s\n", aSettings.mScenePath.c_str(), loadSeconds);
+
+	cpu_path_tracer tracer(scene, aSettings);
+	tracer.render();
+
+	std::string fileName = aSettings.mOutputPath;
+	if (fileName.empty()) {
+		const auto timestamp = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+		std::stringstream defaultFileName;
+		defaultFileName << "./results/" << timestamp << "_cpu.png";
+		fileName = defaultFileName.str();
+	}
+
+	return tracer.write_result_image(fileName) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
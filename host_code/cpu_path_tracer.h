@@ -0,0 +1,41 @@
+#pragma once
+
+#include "host_scene.h"
+#include "render_settings.h"
+
+
+/// <summary>
+/// CPU reference backend: a line-by-line port of `traceCameraRay` & co. from `ray_gen_shader.rgen` and of the hit shading in
+/// `closest_hit_shader.rchit`, fed with the same geometry and materials the GPU gets (see `host_scene`).
+/// It uses the same random number generator and seeds as the shaders, so it doubles as a correctness oracle for the GPU path.
+/// Pixels are rendered in tiles, distributed over all cores by a work-stealing scheduler.
+/// </summary>
+class cpu_path_tracer
+{
+public:
+	cpu_path_tracer(const host_scene &aScene, const render_settings &aSettings);
+
+	// Accumulates passes of one sample per pixel until the budget from the settings is reached.
+	void render();
+
+	// Same tonemapping as the ray generation shader
+	bool write_result_image(const std::string &fileName) const;
+
+	// Mean radiance per pixel (rgb) and the number of samples (a), laid out like `cameraImage`
+	inline const std::vector<glm::vec4> &accumulation() const { return mAccumulation; }
+
+	// Loads the scene from the settings, renders and writes the result, returns the process exit code.
+	static int render_to_file(const render_settings &aSettings);
+
+private:
+	void render_pass(uint32_t sampleIndex);
+	void render_tile(uint32_t tileIndex, uint32_t sampleIndex);
+
+	const host_scene *mScene;
+	render_settings mSettings;
+	glm::uvec2 mResolution;
+	uint32_t mThreadCount;
+
+	std::vector<glm::vec4> mAccumulation;
+	uint32_t mSamplesPerPixel = 0;
+};
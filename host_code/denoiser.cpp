@@ -0,0 +1,115 @@
+#include "denoiser.h"
+
+
+denoiser::denoiser(bool aAvailable, bool aActive)
+	: mAvailable{aAvailable}
+	, mActive{aActive}
+{
+}
+
+
+bool denoiser::toggle()
+{
+	if (!mAvailable) {
+		return false;
+	}
+	mActive = !mActive;
+	return true;
+}
+
+void denoiser::create_resources(avk::queue &aQueue, glm::uvec2 aResolution, const avk::image_view &aCameraImageView, const avk::image_view &aResultImageView)
+{
+	glm::uvec2 size = mAvailable ? aResolution : glm::uvec2(1, 1);
+	mGroupCount = (size + GROUP_SIZE - 1u) / GROUP_SIZE;
+
+	avk::image albedoImage = avk::context().create_image(size.x, size.y, vk::Format::eR16G16B16A16Sfloat, 1, avk::memory_usage::device, avk::image_usage::general_storage_image);
+	avk::image normalDepthImage = avk::context().create_image(size.x, size.y, vk::Format::eR16G16B16A16Sfloat, 1, avk::memory_usage::device, avk::image_usage::general_storage_image);
+	std::vector<avk::recorded_commands_t> transitions = {
+		avk::sync::image_memory_barrier(albedoImage.as_reference(),
+										avk::stage::none >> avk::stage::none,
+										avk::access::none >> avk::access::none).with_layout_transition(avk::layout::undefined >> avk::layout::general),
+		avk::sync::image_memory_barrier(normalDepthImage.as_reference(),
+										avk::stage::none >> avk::stage::none,
+										avk::access::none >> avk::access::none).with_layout_transition(avk::layout::undefined >> avk::layout::general)
+	};
+
+	std::array<avk::image, 2> pingPongImages;
+	if (mAvailable) {
+		for (avk::image &image : pingPongImages) {
+			image = avk::context().create_image(size.x, size.y, vk::Format::eR32G32B32A32Sfloat, 1, avk::memory_usage::device, avk::image_usage::general_storage_image);
+			transitions.push_back(avk::sync::image_memory_barrier(image.as_reference(),
+				avk::stage::none >> avk::stage::none,
+				avk::access::none >> avk::access::none).with_layout_transition(avk::layout::undefined >> avk::layout::general));
+		}
+	}
+	avk::context().record_and_submit_with_fence(std::move(transitions), aQueue)->wait_until_signalled();
+
+	mAlbedoImageView = avk::context().create_image_view(albedoImage);
+	mNormalDepthImageView = avk::context().create_image_view(normalDepthImage);
+	mAlbedoImageView.enable_shared_ownership();
+	mNormalDepthImageView.enable_shared_ownership();
+
+	if (!mAvailable) {
+		return;
+	}
+
+	for (size_t i = 0; i < pingPongImages.size(); i++) {
+		mPingPongImageViews[i] = avk::context().create_image_view(pingPongImages[i]);
+	}
+
+	mPipeline = avk::context().create_compute_pipeline_for(
+		avk::compute_shader("shaders/denoise_atrous.comp"),
+		avk::push_constant_binding_data{avk::shader_type::compute, 0, sizeof(push_constant_data)},
+		avk::descriptor_binding(0, 0, aCameraImageView->as_storage_image(avk::layout::general)),
+		avk::descriptor_binding(0, 1, mAlbedoImageView->as_storage_image(avk::layout::general)),
+		avk::descriptor_binding(0, 2, mNormalDepthImageView->as_storage_image(avk::layout::general)),
+		avk::descriptor_binding(0, 3, mPingPongImageViews[0]->as_storage_image(avk::layout::general)),
+		avk::descriptor_binding(0, 4, mPingPongImageViews[1]->as_storage_image(avk::layout::general)),
+		avk::descriptor_binding(0, 5, aResultImageView->as_storage_image(avk::layout::general))
+	);
+}
+
+
+std::vector<avk::recorded_commands_t> denoiser::commands(avk::descriptor_cache &aDescriptorCache, const avk::image_view &aCameraImageView, const avk::image_view &aResultImageView)
+{
+	if (!active()) {
+		return {};
+	}
+
+	std::vector<avk::recorded_commands_t> commands = {
+		// The accumulation, the guides and the result of this frame's launches
+		avk::sync::global_memory_barrier(
+			avk::stage::ray_tracing_shader >> avk::stage::compute_shader,
+			avk::access::shader_write >> (avk::access::shader_read | avk::access::shader_write)
+		),
+		avk::command::bind_pipeline(mPipeline.as_reference()),
+		avk::command::bind_descriptors(mPipeline->layout(), aDescriptorCache->get_or_create_descriptor_sets({
+			avk::descriptor_binding(0, 0, aCameraImageView->as_storage_image(avk::layout::general)),
+			avk::descriptor_binding(0, 1, mAlbedoImageView->as_storage_image(avk::layout::general)),
+			avk::descriptor_binding(0, 2, mNormalDepthImageView->as_storage_image(avk::layout::general)),
+			avk::descriptor_binding(0, 3, mPingPongImageViews[0]->as_storage_image(avk::layout::general)),
+			avk::descriptor_binding(0, 4, mPingPongImageViews[1]->as_storage_image(avk::layout::general)),
+			avk::descriptor_binding(0, 5, aResultImageView->as_storage_image(avk::layout::general))
+		}))
+	};
+
+	// Pass 0 prepares the first filter pass
+	for (uint32_t iteration = 0; iteration <= ITERATIONS; iteration++) {
+		if (iteration > 0) {
+			// Each pass reads the neighbourhood the previous one wrote
+			commands.push_back(avk::sync::global_memory_barrier(
+				avk::stage::compute_shader >> avk::stage::compute_shader,
+				avk::access::shader_write >> (avk::access::shader_read | avk::access::shader_write)
+			));
+		}
+		commands.push_back(avk::command::push_constants(mPipeline->layout(), push_constant_data{ iteration, ITERATIONS }, avk::shader_type::compute));
+		commands.push_back(avk::command::dispatch(mGroupCount.x, mGroupCount.y, 1));
+	}
+
+	// The blit reads the result, the next launches write the accumulation, the guides and the result again
+	commands.push_back(avk::sync::global_memory_barrier(
+		avk::stage::compute_shader >> (avk::stage::ray_tracing_shader | avk::stage::blit),
+		avk::access::shader_write >> (avk::access::shader_read | avk::access::shader_write | avk::access::transfer_read)
+	));
+	return commands;
+}
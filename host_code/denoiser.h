@@ -0,0 +1,59 @@
+#pragma once
+
+#include <auto_vk_toolkit.hpp>
+
+
+/// <summary>
+/// Edge-aware à-trous denoiser for the interactive preview (Dammertz et al. 2010, with the luminance weights of SVGF, Schied et
+/// al. 2017). The ray generation shader writes the first hit of every camera ray into two guide images, averaged over the samples
+/// like the accumulation: the albedo and the normal with the distance from the camera. After trace_rays, a compute shader
+/// (shaders/denoise_atrous.comp) divides the accumulation by the albedo, estimates the luminance variance from the 3x3
+/// neighbourhood and filters it with ITERATIONS 5x5 passes of growing step size, whose weights stop at depth, normal and
+/// luminance edges. The last pass multiplies the albedo back in and overwrites the tonemapped result image.
+/// The temporal part is the accumulation itself, which temporal_reprojection carries across small camera moves. Only the
+/// displayed result is filtered, the accumulation and everything read from it (.pfm outputs, the convergence monitor, adaptive
+/// sampling) stay unbiased.
+/// The guides and the pipeline exist for every windowed run (`n` toggles the filter) and for headless runs with `--denoise`.
+/// </summary>
+class denoiser
+{
+public:
+	// Same as GROUP_SIZE in denoise_atrous.comp
+	static constexpr uint32_t GROUP_SIZE = 8;
+	static constexpr uint32_t ITERATIONS = 5;
+
+	// Push constants of denoise_atrous.comp
+	struct push_constant_data {
+		uint32_t mIteration;
+		uint32_t mIterationCount;
+	};
+
+	denoiser(bool aAvailable, bool aActive);
+
+	// Whether the guides are written, also while the filter is toggled off
+	inline bool available() const { return mAvailable; }
+	// Whether the result is filtered
+	inline bool active() const { return mAvailable && mActive; }
+	// Returns false if the denoiser is not available
+	bool toggle();
+
+	// The guide images have the size of the accumulation if available, 1x1 otherwise (the shader declares them anyway). Creates
+	// the filter pipeline with its two intermediate images.
+	void create_resources(avk::queue &aQueue, glm::uvec2 aResolution, const avk::image_view &aCameraImageView, const avk::image_view &aResultImageView);
+
+	inline const avk::image_view &albedo_image_view() const { return mAlbedoImageView; }
+	inline const avk::image_view &normal_depth_image_view() const { return mNormalDepthImageView; }
+
+	// Filters the accumulation into the result image, to be recorded after trace_rays (nothing if not active)
+	std::vector<avk::recorded_commands_t> commands(avk::descriptor_cache &aDescriptorCache, const avk::image_view &aCameraImageView, const avk::image_view &aResultImageView);
+
+private:
+	bool mAvailable;
+	bool mActive;
+
+	glm::uvec2 mGroupCount = {};
+	avk::image_view mAlbedoImageView;
+	avk::image_view mNormalDepthImageView;
+	std::array<avk::image_view, 2> mPingPongImageViews; // rgb: demodulated color, a: luminance variance
+	avk::compute_pipeline mPipeline;
+};
@@ -0,0 +1,98 @@
+#include "dynamic_resolution.h"
+
+
+dynamic_resolution::dynamic_resolution(double aTargetFramesPerSecond)
+	: mTargetFramesPerSecond{aTargetFramesPerSecond}
+{
+}
+
+
+void dynamic_resolution::create_resources(glm::uvec2 aResolution, const avk::image_view &aCameraImageView, const avk::image_view &aResultImageView)
+{
+	mResolution = aResolution;
+	if (!enabled()) {
+		return;
+	}
+	mGroupCount = (aResolution + GROUP_SIZE - 1u) / GROUP_SIZE;
+
+	mPipeline = avk::context().create_compute_pipeline_for(
+		avk::compute_shader("shaders/preview_upsample.comp"),
+		avk::push_constant_binding_data{avk::shader_type::compute, 0, sizeof(uint32_t)},
+		avk::descriptor_binding(0, 0, aCameraImageView->as_storage_image(avk::layout::general)),
+		avk::descriptor_binding(0, 1, aResultImageView->as_storage_image(avk::layout::general))
+	);
+}
+
+
+void dynamic_resolution::add_measurement(const gpu_profiler::measurement &aMeasurement)
+{
+	if (aMeasurement.mFrame <= mLastMeasuredFrame) {
+		return;
+	}
+	const issued_frame &issued = mIssued[aMeasurement.mFrame % mIssued.size()];
+	if (issued.mFrame != aMeasurement.mFrame || issued.mPathCount == 0) {
+		return;
+	}
+	mLastMeasuredFrame = aMeasurement.mFrame;
+
+	double millisecondsPerPath = aMeasurement.mMilliseconds / issued.mPathCount;
+	mMillisecondsPerPath = mMillisecondsPerPath > 0.0 ? glm::mix(mMillisecondsPerPath, millisecondsPerPath, SMOOTHING) : millisecondsPerPath;
+}
+
+uint32_t dynamic_resolution::next_frame(bool aCameraMoved)
+{
+	mFactor = 1;
+	if (!enabled() || !aCameraMoved || mMillisecondsPerPath <= 0.0) {
+		return mFactor;
+	}
+
+	double budget = 1000.0 / mTargetFramesPerSecond;
+	double pixels = static_cast<double>(mResolution.x) * mResolution.y;
+	while (mFactor < MAX_FACTOR && mMillisecondsPerPath * pixels / (mFactor * mFactor) > budget) {
+		mFactor *= 2;
+	}
+	return mFactor;
+}
+
+void dynamic_resolution::add_frame(uint64_t aFrame, uint32_t aPathCount)
+{
+	if (enabled()) {
+		mIssued[aFrame % mIssued.size()] = { aFrame, aPathCount };
+	}
+}
+
+
+vk::Extent3D dynamic_resolution::launch_size(glm::uvec2 aResolution) const
+{
+	glm::uvec2 size = (aResolution + mFactor - 1u) / mFactor;
+	return { size.x, size.y, 1 };
+}
+
+
+std::vector<avk::recorded_commands_t> dynamic_resolution::commands(avk::descriptor_cache &aDescriptorCache, const avk::image_view &aCameraImageView, const avk::image_view &aResultImageView)
+{
+	if (!active()) {
+		return {};
+	}
+
+	return {
+		// The samples of this frame's launch
+		avk::sync::global_memory_barrier(
+			avk::stage::ray_tracing_shader >> avk::stage::compute_shader,
+			avk::access::shader_write >> (avk::access::shader_read | avk::access::shader_write)
+		),
+		avk::command::bind_pipeline(mPipeline.as_reference()),
+		avk::command::bind_descriptors(mPipeline->layout(), aDescriptorCache->get_or_create_descriptor_sets({
+			avk::descriptor_binding(0, 0, aCameraImageView->as_storage_image(avk::layout::general)),
+			avk::descriptor_binding(0, 1, aResultImageView->as_storage_image(avk::layout::general))
+		})),
+		avk::command::push_constants(mPipeline->layout(), mFactor, avk::shader_type::compute),
+		avk::command::dispatch(mGroupCount.x, mGroupCount.y, 1),
+
+		// The blit reads the result, the next launches write the accumulation and the result again
+		avk::sync::global_memory_barrier(
+			avk::stage::compute_shader >> (avk::stage::ray_tracing_shader | avk::stage::blit),
+			avk::access::shader_write >> (avk::access::shader_read | avk::access::shader_write | avk::access::transfer_read)
+		)
+	};
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "gpu_profiler.h"
+
+#include <auto_vk_toolkit.hpp>
+
+
+/// <summary>
+/// Reduced resolution preview while the camera moves (`--preview-fps <fps>`, windowed only). Every frame in which the camera
+/// moved picks the smallest factor out of 1, 2, 4 and MAX_FACTOR s.t. the predicted trace_rays time stays within the frame
+/// time of the target rate. With a factor above 1, every invocation traces one sample through a random point of its square of
+/// factor x factor pixels into the top left pixel of the square, with ray cones as wide as the square, and a compute shader
+/// (shaders/preview_upsample.comp) interpolates the squares into the result image instead of the denoiser.
+/// The prediction uses the GPU cost per path of earlier frames (RING_SIZE frames late, see gpu_profiler), smoothed like the
+/// tiles per frame of time_slicer. Without timestamp support, the preview keeps the full resolution.
+/// Previews neither reproject nor get sliced, the first frame after the camera settles restarts the accumulation at full
+/// resolution. With BDPT, previews show the camera paths only.
+/// </summary>
+class dynamic_resolution
+{
+public:
+	// Same as GROUP_SIZE in preview_upsample.comp
+	static constexpr uint32_t GROUP_SIZE = 8;
+	static constexpr uint32_t MAX_FACTOR = 8;
+	static constexpr double SMOOTHING = 0.25; // weight of a new measurement in the cost per path
+
+	// A target of 0 disables the preview
+	explicit dynamic_resolution(double aTargetFramesPerSecond);
+
+	inline bool enabled() const { return mTargetFramesPerSecond > 0.0; }
+
+	// Creates the upsampling pipeline if enabled
+	void create_resources(glm::uvec2 aResolution, const avk::image_view &aCameraImageView, const avk::image_view &aResultImageView);
+
+	// Updates the cost per path with the time of trace_rays in an earlier frame, measurements of unknown frames are ignored
+	void add_measurement(const gpu_profiler::measurement &aMeasurement);
+
+	// Picks the factor of the frame which starts now, 1 unless the camera moved. Returns the factor.
+	uint32_t next_frame(bool aCameraMoved);
+
+	// The paths which frame `aFrame` traced, for the next measurements
+	void add_frame(uint64_t aFrame, uint32_t aPathCount);
+
+	inline uint32_t factor() const { return mFactor; }
+	inline bool active() const { return mFactor > 1; }
+
+	// trace_rays launch size of a preview, one invocation per square
+	vk::Extent3D launch_size(glm::uvec2 aResolution) const;
+
+	// Interpolates the preview into the result image, to be recorded after trace_rays (nothing if not active)
+	std::vector<avk::recorded_commands_t> commands(avk::descriptor_cache &aDescriptorCache, const avk::image_view &aCameraImageView, const avk::image_view &aResultImageView);
+
+private:
+	// The paths traced in a frame, kept until its measurement arrives
+	struct issued_frame {
+		uint64_t mFrame = 0;
+		uint32_t mPathCount = 0;
+	};
+
+	double mTargetFramesPerSecond;
+	glm::uvec2 mResolution = {};
+	uint32_t mFactor = 1;
+
+	double mMillisecondsPerPath = 0.0; // 0 before the first measurement
+	uint64_t mLastMeasuredFrame = 0;
+	std::array<issued_frame, 2 * gpu_profiler::RING_SIZE> mIssued = {};
+
+	glm::uvec2 mGroupCount = {};
+	avk::compute_pipeline mPipeline;
+};
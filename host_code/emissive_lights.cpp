@@ -0,0 +1,60 @@
+#include "emissive_lights.h"
+
+
+void emissive_lights::add_geometry(uint32_t geometryIndex, std::span<const glm::vec3> positions, std::span<const uint32_t> indices, const avk::material_gpu_data &material)
+{
+	// Same factor as the emitterPdf in the closest hit shader
+	const float radiance = luminance(glm::vec3(material.mEmissiveColor));
+	if (!(radiance > 0.0f)) {
+		return;
+	}
+
+	for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+		const glm::vec3 &p0 = positions[indices[t + 0]];
+		const glm::vec3 &p1 = positions[indices[t + 1]];
+		const glm::vec3 &p2 = positions[indices[t + 2]];
+		float area = 0.5f * glm::length(glm::cross(p1 - p0, p2 - p0));
+		if (!(area > 0.0f)) {
+			continue; // can never be hit
+		}
+
+		mTriangles.push_back(gpu_triangle{ geometryIndex, static_cast<uint32_t>(t / 3), 1.0f, 0 });
+		mPowers.push_back(radiance * area);
+	}
+}
+
+
+void emissive_lights::build()
+{
+	std::vector<alias_table::bin> bins = alias_table::build(mPowers);
+
+	mTotalPower = 0.0f;
+	for (size_t i = 0; i < bins.size(); i++) {
+		mTotalPower += mPowers[i];
+		mTriangles[i].mThreshold = bins[i].mThreshold;
+		mTriangles[i].mAlias = bins[i].mAlias;
+	}
+
+	printf("Emissive lights: %zu triangles, total power %.1f\n", mTriangles.size(), mTotalPower);
+}
+
+
+avk::buffer emissive_lights::create_buffer(avk::queue &aQueue) const
+{
+	// uint count, float total power, then the triangles (std430)
+	std::vector<uint32_t> data(2 + 4 * std::max<size_t>(mTriangles.size(), 1), 0);
+	data[0] = size();
+	std::memcpy(&data[1], &mTotalPower, sizeof(float));
+	if (!mTriangles.empty()) {
+		std::memcpy(&data[2], mTriangles.data(), sizeof(gpu_triangle) * mTriangles.size());
+	}
+
+	avk::buffer buffer = avk::context().create_buffer(
+		avk::memory_usage::device, {},
+		avk::storage_buffer_meta::create_from_size(sizeof(uint32_t) * data.size())
+	);
+	avk::context().record_and_submit_with_fence({
+		buffer->fill(data.data(), 0)
+	}, aQueue)->wait_until_signalled();
+	return buffer;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "alias_table.hpp"
+
+#include <auto_vk_toolkit.hpp>
+
+#include <span>
+
+
+/// <summary>
+/// All triangles of emissive materials, collected at load time by `model_loader` (and `host_scene` for the CPU reference), with
+/// a power-weighted alias table over them. Next event estimation draws a triangle in O(1), a uniform point on it, and traces a
+/// shadow ray with the closest hit shader towards it, which returns the (possibly textured) emission and the density with which
+/// the point was sampled. BSDF-sampled hits of the same triangles get the same density, both strategies are combined with the
+/// power heuristic.
+/// The power of a triangle is the luminance of `mEmissiveColor` times its area, textures are ignored, which only costs variance.
+/// Areas are taken in object space, the densities use the current world space areas, s.t. moved models stay unbiased.
+/// </summary>
+class emissive_lights
+{
+public:
+	// Same layout as EmissiveTriangle in ray_gen_shader.rgen
+	struct gpu_triangle {
+		uint32_t mGeometryIndex; // gl_InstanceCustomIndexEXT, also the index of the material and the transform
+		uint32_t mPrimitiveIndex;
+		float mThreshold;
+		uint32_t mAlias;
+	};
+
+	static float luminance(glm::vec3 color) { return glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f)); }
+
+	// Adds every triangle of the geometry if its material emits
+	void add_geometry(uint32_t geometryIndex, std::span<const glm::vec3> positions, std::span<const uint32_t> indices, const avk::material_gpu_data &material);
+
+	// Builds the alias table once all geometries have been added
+	void build();
+
+	inline uint32_t size() const { return static_cast<uint32_t>(mTriangles.size()); }
+	inline float total_power() const { return mTotalPower; }
+	inline const std::vector<gpu_triangle> &triangles() const { return mTriangles; }
+
+	// Storage buffer with the count, the total power and the triangles, also if there are none (the shaders declare it anyway)
+	avk::buffer create_buffer(avk::queue &aQueue) const;
+
+private:
+	std::vector<gpu_triangle> mTriangles;
+	std::vector<float> mPowers;
+	float mTotalPower = 0.0f;
+};
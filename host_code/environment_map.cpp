@@ -0,0 +1,239 @@
+#include "environment_map.h"
+
+#include "pfm_image.hpp"
+#include "..\third_party\INIReader.h"
+
+#include <stb_image.h>
+
+#include <filesystem>
+#include <fstream>
+#include <random>
+
+
+namespace {
+	constexpr uint32_t MAGIC = 0x56455450; // "PTEV"
+
+	// The texels start at the second cache line, the CDFs follow right after them
+	constexpr uint64_t TEXEL_OFFSET = 64;
+
+	struct file_header {
+		uint32_t mMagic;
+		uint32_t mVersion;
+		uint64_t mContentHash;
+		uint32_t mWidth;
+		uint32_t mHeight;
+		uint64_t mFileSize;
+	};
+
+	// rgb radiance of every texel, top row first
+	std::vector<glm::vec4> load_image(const std::string &imagePath, uint32_t &width, uint32_t &height)
+	{
+		if (std::filesystem::path(imagePath).extension() == ".pfm") {
+			std::optional<pfm_image::image> image = pfm_image::read(imagePath);
+			if (!image) {
+				throw std::runtime_error("Could not read the environment map " + imagePath);
+			}
+			width = image->mWidth;
+			height = image->mHeight;
+			return std::move(image->mTexels);
+		}
+
+		int w = 0, h = 0, channels = 0;
+		float *data = stbi_loadf(imagePath.c_str(), &w, &h, &channels, 3);
+		if (data == nullptr) {
+			throw std::runtime_error("Could not read the environment map " + imagePath);
+		}
+		width = static_cast<uint32_t>(w);
+		height = static_cast<uint32_t>(h);
+		std::vector<glm::vec4> texels(size_t(width) * height);
+		for (size_t i = 0; i < texels.size(); i++) {
+			texels[i] = glm::vec4(data[3 * i + 0], data[3 * i + 1], data[3 * i + 2], 1.0f);
+		}
+		free(data); // stb_image uses malloc()
+		return texels;
+	}
+
+	float luminance(glm::vec3 color)
+	{
+		return glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+	}
+}
+
+
+void environment_map::load(const render_settings &settings)
+{
+	INIReader reader(settings.mScenePath);
+	std::string imagePath = reader.Get(INI_SECTION, "path", "");
+	if (imagePath.empty()) {
+		return;
+	}
+	mIntensity = static_cast<float>(reader.GetReal(INI_SECTION, "intensity", 1.0));
+
+	auto start = std::chrono::steady_clock::now();
+
+	mapped_file image;
+	if (!image.open(imagePath)) {
+		throw std::runtime_error("Could not open " + imagePath);
+	}
+	uint64_t hash = scene_cache::content_hash(image);
+	image.close();
+
+	std::string cachePath = cache_path(imagePath, hash);
+	bool hit = read(cachePath, hash);
+	if (!hit) {
+		write(imagePath, cachePath, hash);
+		if (!read(cachePath, hash)) {
+			throw std::runtime_error("Could not read back the environment cache " + cachePath);
+		}
+	}
+
+	printf("Environment %s: %s, %ux%u, %.2lf ms\n", hit ? "cache hit" : "cache miss", cachePath.c_str(), mWidth, mHeight,
+		std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1000.0);
+}
+
+
+avk::buffer environment_map::create_texel_buffer(avk::queue &aQueue) const
+{
+	// uint width, uint height, float intensity, padding, then the texels (std430)
+	std::vector<glm::vec4> data(1 + std::max<size_t>(mTexels.size(), 1), glm::vec4(0.0f));
+	glm::uvec2 size(mWidth, mHeight);
+	std::memcpy(&data[0], &size, sizeof(size));
+	std::memcpy(&data[0].z, &mIntensity, sizeof(float));
+	std::copy(mTexels.begin(), mTexels.end(), data.begin() + 1);
+
+	avk::buffer buffer = avk::context().create_buffer(
+		avk::memory_usage::device, {},
+		avk::storage_buffer_meta::create_from_size(sizeof(glm::vec4) * data.size())
+	);
+	avk::context().record_and_submit_with_fence({
+		buffer->fill(data.data(), 0)
+	}, aQueue)->wait_until_signalled();
+	return buffer;
+}
+
+
+avk::buffer environment_map::create_cdf_buffer(avk::queue &aQueue) const
+{
+	std::vector<float> data(std::max<size_t>(mCdf.size(), 1), 1.0f);
+	std::copy(mCdf.begin(), mCdf.end(), data.begin());
+
+	avk::buffer buffer = avk::context().create_buffer(
+		avk::memory_usage::device, {},
+		avk::storage_buffer_meta::create_from_size(sizeof(float) * data.size())
+	);
+	avk::context().record_and_submit_with_fence({
+		buffer->fill(data.data(), 0)
+	}, aQueue)->wait_until_signalled();
+	return buffer;
+}
+
+
+std::string environment_map::cache_path(const std::string &imagePath, uint64_t hash)
+{
+	char name[17];
+	snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(hash));
+	return (std::filesystem::path(scene_cache::CACHE_DIRECTORY) / (std::filesystem::path(imagePath).stem().string() + "-" + name + ".env")).string();
+}
+
+
+void environment_map::write(const std::string &imagePath, const std::string &cachePath, uint64_t hash)
+{
+	uint32_t width = 0, height = 0;
+	std::vector<glm::vec4> texels = load_image(imagePath, width, height);
+
+	// Weights of the texels: luminance times the sine of theta at the row center, the Jacobian of the equirectangular mapping
+	std::vector<float> cdf(height + size_t(width) * height);
+	std::vector<double> rowSums(height, 0.0);
+	double total = 0.0;
+	for (uint32_t y = 0; y < height; y++) {
+		float sinTheta = std::sin(glm::pi<float>() * (y + 0.5f) / height);
+		float *conditional = &cdf[height + size_t(y) * width];
+		for (uint32_t x = 0; x < width; x++) {
+			glm::vec4 &texel = texels[size_t(y) * width + x];
+			texel.w = std::max(0.0f, luminance(glm::vec3(texel))) * sinTheta;
+			rowSums[y] += texel.w;
+			conditional[x] = static_cast<float>(rowSums[y]);
+		}
+		for (uint32_t x = 0; x < width; x++) {
+			conditional[x] = rowSums[y] > 0.0 ? static_cast<float>(conditional[x] / rowSums[y]) : float(x + 1) / width;
+		}
+		conditional[width - 1] = 1.0f;
+		total += rowSums[y];
+	}
+
+	double running = 0.0;
+	for (uint32_t y = 0; y < height; y++) {
+		running += rowSums[y];
+		cdf[y] = total > 0.0 ? static_cast<float>(running / total) : float(y + 1) / height;
+	}
+	cdf[height - 1] = 1.0f;
+
+	// The probabilities of the texels, consistent with the CDFs also for black rows or a black image
+	for (uint32_t y = 0; y < height; y++) {
+		float rowProbability = cdf[y] - (y > 0 ? cdf[y - 1] : 0.0f);
+		const float *conditional = &cdf[height + size_t(y) * width];
+		for (uint32_t x = 0; x < width; x++) {
+			texels[size_t(y) * width + x].w = rowProbability * (conditional[x] - (x > 0 ? conditional[x - 1] : 0.0f));
+		}
+	}
+
+	file_header header{};
+	header.mMagic = MAGIC;
+	header.mVersion = VERSION;
+	header.mContentHash = hash;
+	header.mWidth = width;
+	header.mHeight = height;
+	header.mFileSize = TEXEL_OFFSET + sizeof(glm::vec4) * texels.size() + sizeof(float) * cdf.size();
+
+	std::filesystem::create_directories(scene_cache::CACHE_DIRECTORY);
+
+	// Like scene_cache::write, a temporary file renamed afterwards, s.t. a crash never leaves a half-written cache behind
+	std::string temporaryPath = cachePath + "." + std::to_string(std::random_device{}()) + ".tmp";
+	{
+		std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+		std::vector<char> padding(TEXEL_OFFSET - sizeof(header), 0);
+		file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+		file.write(padding.data(), padding.size());
+		file.write(reinterpret_cast<const char *>(texels.data()), sizeof(glm::vec4) * texels.size());
+		file.write(reinterpret_cast<const char *>(cdf.data()), sizeof(float) * cdf.size());
+		if (!file.good()) {
+			file.close();
+			std::filesystem::remove(temporaryPath);
+			throw std::runtime_error("Could not write the environment cache " + temporaryPath);
+		}
+	}
+	std::error_code error;
+	std::filesystem::rename(temporaryPath, cachePath, error);
+	if (error) {
+		std::filesystem::remove(temporaryPath, error);
+		throw std::runtime_error("Could not replace the environment cache " + cachePath);
+	}
+}
+
+
+bool environment_map::read(const std::string &cachePath, uint64_t hash)
+{
+	// Every failure unmaps the file again, write() replaces it next
+	if (!mFile.open(cachePath)) {
+		return false;
+	}
+	if (mFile.size() < TEXEL_OFFSET) {
+		mFile.close();
+		return false;
+	}
+
+	file_header header;
+	std::memcpy(&header, mFile.data(), sizeof(header));
+	size_t texelCount = size_t(header.mWidth) * header.mHeight;
+	if (header.mMagic != MAGIC || header.mVersion != VERSION || header.mContentHash != hash || header.mFileSize != mFile.size()
+		|| texelCount == 0 || header.mFileSize != TEXEL_OFFSET + sizeof(glm::vec4) * texelCount + sizeof(float) * (header.mHeight + texelCount)) {
+		mFile.close();
+		return false;
+	}
+
+	mWidth = header.mWidth;
+	mHeight = header.mHeight;
+	mTexels = std::span<const glm::vec4>(reinterpret_cast<const glm::vec4 *>(mFile.data() + TEXEL_OFFSET), texelCount);
+	mCdf = std::span<const float>(reinterpret_cast<const float *>(mFile.data() + TEXEL_OFFSET + sizeof(glm::vec4) * texelCount), mHeight + texelCount);
+	return true;
+}
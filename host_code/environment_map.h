@@ -0,0 +1,54 @@
+#pragma once
+
+#include "render_settings.h"
+#include "scene_cache.h"
+
+#include <auto_vk_toolkit.hpp>
+
+#include <span>
+
+
+/// <summary>
+/// HDR environment of the scene file: an equirectangular .hdr or .pfm, given by an `[environment]` section with a `path` and an
+/// optional `intensity`. The distribution for next event estimation is piecewise constant over the texels and proportional to
+/// luminance times sin(theta): a marginal CDF over the rows and a conditional CDF per row, sampled by binary search (Pharr et
+/// al., "Physically Based Rendering", 3rd edition, 14.2.4). Radiance, texel probabilities and CDFs are stored in `cache/`,
+/// keyed by the content hash of the image like the scene cache, so later runs only map that file.
+/// Without an environment the sky keeps the constant color of ray_gen_shader.rgen and is not sampled by NEE.
+/// Texels are looked up without filtering, s.t. radiance and sampling density are constant over the same texel.
+/// </summary>
+class environment_map
+{
+public:
+	static constexpr const char *INI_SECTION = "environment";
+	// Bump whenever the file layout or the preprocessing changes
+	static constexpr uint32_t VERSION = 1;
+
+	// Loads the environment of `mScenePath` if it has one, (re)builds the cache file first if necessary
+	void load(const render_settings &settings);
+
+	inline bool enabled() const { return mWidth > 0; }
+	inline uint32_t width() const { return mWidth; }
+	inline uint32_t height() const { return mHeight; }
+	inline float intensity() const { return mIntensity; }
+	// Row major, top row first, i.e. theta = 0 is +y. rgb: radiance, a: probability of drawing the texel
+	inline std::span<const glm::vec4> texels() const { return mTexels; }
+	// The marginal CDF over the `height` rows, then a conditional CDF of `width` entries per row, each one ends with 1
+	inline std::span<const float> cdf() const { return mCdf; }
+
+	// Header (width, height, intensity) and texels, and the CDFs. A single element each if disabled (the shader declares them anyway).
+	avk::buffer create_texel_buffer(avk::queue &aQueue) const;
+	avk::buffer create_cdf_buffer(avk::queue &aQueue) const;
+
+private:
+	static std::string cache_path(const std::string &imagePath, uint64_t hash);
+	static void write(const std::string &imagePath, const std::string &cachePath, uint64_t hash);
+	bool read(const std::string &cachePath, uint64_t hash);
+
+	mapped_file mFile;
+	uint32_t mWidth = 0;
+	uint32_t mHeight = 0;
+	float mIntensity = 1.0f;
+	std::span<const glm::vec4> mTexels;
+	std::span<const float> mCdf;
+};
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <auto_vk_toolkit.hpp>
+
+#include <cstring>
+#include <fstream>
+
+/// <summary>
+/// Writing of uncompressed single-part scanline OpenEXR files with 32 bit float RGB channels, the linear counterpart of the
+/// screenshot PNGs (see screenshot_writer). Just enough of the format for every EXR reader, no compression and no tiles.
+/// </summary>
+namespace exr_image {
+
+	namespace detail {
+		template <typename T>
+		inline void put(std::ofstream &file, T value)
+		{
+			file.write(reinterpret_cast<const char *>(&value), sizeof(T)); // EXR is little endian like every target of this renderer
+		}
+
+		inline void put_attribute(std::ofstream &file, const char *name, const char *type, int32_t size)
+		{
+			file.write(name, std::strlen(name) + 1);
+			file.write(type, std::strlen(type) + 1);
+			put(file, size);
+		}
+	}
+
+	// `texels` are `width` * `height` rgba values, top row first, the alpha is dropped. Returns false if the file cannot be written.
+	inline bool write(const std::string &path, uint32_t width, uint32_t height, const glm::vec4 *texels)
+	{
+		using detail::put;
+		using detail::put_attribute;
+
+		std::ofstream file(path, std::ios::binary);
+		put<uint32_t>(file, 20000630); // magic number
+		put<uint32_t>(file, 2);        // version 2, single-part scanline image
+
+		// The channels have to be sorted by name, every one is FLOAT (2), not linearly perceived, not subsampled
+		const char *channels[] = { "B", "G", "R" };
+		put_attribute(file, "channels", "chlist", 3 * (2 + 16) + 1);
+		for (const char *channel : channels) {
+			file.write(channel, 2);
+			put<int32_t>(file, 2);
+			put<uint8_t>(file, 0);
+			put<uint8_t>(file, 0);
+			put<uint8_t>(file, 0);
+			put<uint8_t>(file, 0);
+			put<int32_t>(file, 1);
+			put<int32_t>(file, 1);
+		}
+		put<uint8_t>(file, 0);
+
+		put_attribute(file, "compression", "compression", 1);
+		put<uint8_t>(file, 0); // NO_COMPRESSION, one scanline per chunk
+		for (const char *window : { "dataWindow", "displayWindow" }) {
+			put_attribute(file, window, "box2i", 16);
+			put<int32_t>(file, 0);
+			put<int32_t>(file, 0);
+			put<int32_t>(file, static_cast<int32_t>(width) - 1);
+			put<int32_t>(file, static_cast<int32_t>(height) - 1);
+		}
+		put_attribute(file, "lineOrder", "lineOrder", 1);
+		put<uint8_t>(file, 0); // INCREASING_Y
+		put_attribute(file, "pixelAspectRatio", "float", 4);
+		put<float>(file, 1.0f);
+		put_attribute(file, "screenWindowCenter", "v2f", 8);
+		put<float>(file, 0.0f);
+		put<float>(file, 0.0f);
+		put_attribute(file, "screenWindowWidth", "float", 4);
+		put<float>(file, 1.0f);
+		put<uint8_t>(file, 0); // end of the header
+
+		// Offset table, then every scanline as its y, its size in bytes and the channels one after another
+		uint64_t lineBytes = uint64_t(3) * width * sizeof(float);
+		uint64_t firstLine = static_cast<uint64_t>(file.tellp()) + sizeof(uint64_t) * height;
+		for (uint32_t y = 0; y < height; y++) {
+			put<uint64_t>(file, firstLine + y * (2 * sizeof(int32_t) + lineBytes));
+		}
+
+		std::vector<float> line(size_t(3) * width);
+		for (uint32_t y = 0; y < height; y++) {
+			const glm::vec4 *row = texels + size_t(y) * width;
+			for (uint32_t x = 0; x < width; x++) {
+				line[x] = row[x].z;
+				line[width + x] = row[x].y;
+				line[2 * width + x] = row[x].x;
+			}
+			put<int32_t>(file, static_cast<int32_t>(y));
+			put<int32_t>(file, static_cast<int32_t>(lineBytes));
+			file.write(reinterpret_cast<const char *>(line.data()), lineBytes);
+		}
+		return static_cast<bool>(file);
+	}
+}
@@ -0,0 +1,229 @@
+#include "gpu_profiler.h"
+
+
+namespace {
+	constexpr uint32_t QUERIES_PER_PASS = 2;
+
+	uint32_t first_query(gpu_pass pass)
+	{
+		return static_cast<uint32_t>(pass) * QUERIES_PER_PASS;
+	}
+
+	bool ends_with(const std::string &value, const std::string &suffix)
+	{
+		return value.size() >= suffix.size() && value.compare(value.size() - suffix.size(), suffix.size(), suffix) == 0;
+	}
+}
+
+
+void gpu_profiler::rolling_average::add(double value)
+{
+	if (mCount == AVERAGE_WINDOW) {
+		mSum -= mSamples[mNext];
+	}
+	else {
+		mCount++;
+	}
+	mSamples[mNext] = value;
+	mSum += value;
+	mNext = (mNext + 1) % AVERAGE_WINDOW;
+}
+
+
+gpu_profiler::gpu_profiler(avk::queue &aQueue, const std::string &aLogPath)
+{
+	auto queueFamilies = avk::context().physical_device().getQueueFamilyProperties();
+	uint32_t validBits = queueFamilies[aQueue.family_index()].timestampValidBits;
+	mSupported = validBits > 0;
+	if (!mSupported) {
+		std::cerr << "The queue does not support timestamps, GPU times are not measured" << std::endl;
+		return;
+	}
+	mTimestampMask = validBits >= 64 ? ~uint64_t(0) : (uint64_t(1) << validBits) - 1;
+	mNanosecondsPerTick = avk::context().physical_device().getProperties().limits.timestampPeriod;
+
+	vk::Device device = avk::context().device();
+	for (frame_slot &slot : mSlots) {
+		slot.mPool = device.createQueryPoolUnique(vk::QueryPoolCreateInfo{ {}, vk::QueryType::eTimestamp, static_cast<uint32_t>(PASS_COUNT) * QUERIES_PER_PASS }, nullptr, avk::context().dynamic_dispatch());
+	}
+
+	if (!aLogPath.empty()) {
+		mLog.open(aLogPath);
+		if (!mLog) {
+			std::cerr << "Could not write " << aLogPath << std::endl;
+		}
+		mJson = ends_with(aLogPath, ".json");
+		if (mJson) {
+			mLog << "[\n";
+		}
+		else {
+			mLog << "frame";
+			for (size_t p = 0; p < PASS_COUNT; p++) {
+				mLog << "," << name(static_cast<gpu_pass>(p)) << "_ms";
+			}
+			mLog << "\n";
+		}
+	}
+}
+
+gpu_profiler::~gpu_profiler()
+{
+	if (mSupported) {
+		// Whatever the last frames left behind, oldest first, as far as it is available without waiting
+		for (uint64_t frame = mFrame + 1; frame <= mFrame + RING_SIZE; frame++) {
+			collect(mSlots[frame % RING_SIZE]);
+		}
+	}
+	if (mLog.is_open() && mJson) {
+		mLog << (mFirstRow ? "]\n" : "\n]\n");
+	}
+}
+
+
+void gpu_profiler::next_frame()
+{
+	mFrame++;
+	frame_slot &slot = mSlots[mFrame % RING_SIZE];
+	if (mSupported) {
+		collect(slot);
+	}
+	slot.mFrame = mFrame;
+}
+
+void gpu_profiler::collect(frame_slot &slot)
+{
+	bool anyRecorded = std::find(slot.mRecorded.begin(), slot.mRecorded.end(), true) != slot.mRecorded.end();
+	if (!anyRecorded) {
+		return;
+	}
+
+	vk::Device device = avk::context().device();
+	std::array<std::optional<double>, PASS_COUNT> milliseconds;
+	bool complete = true;
+	for (size_t p = 0; p < PASS_COUNT; p++) {
+		if (!slot.mRecorded[p]) {
+			continue;
+		}
+		// begin and end, each followed by its availability
+		std::array<uint64_t, 2 * QUERIES_PER_PASS> data = {};
+		vk::Result result = device.getQueryPoolResults(slot.mPool.get(), first_query(static_cast<gpu_pass>(p)), QUERIES_PER_PASS, sizeof(data), data.data(), 2 * sizeof(uint64_t),
+			vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWithAvailability, avk::context().dynamic_dispatch());
+		if (result != vk::Result::eSuccess || data[1] == 0 || data[3] == 0) {
+			complete = false;
+			break;
+		}
+		uint64_t ticks = (data[2] - data[0]) & mTimestampMask;
+		milliseconds[p] = static_cast<double>(ticks) * mNanosecondsPerTick * 1e-6;
+	}
+	slot.mRecorded = {};
+
+	if (!complete) {
+		mDroppedFrames++;
+		return;
+	}
+	for (size_t p = 0; p < PASS_COUNT; p++) {
+		if (milliseconds[p]) {
+			mAverages[p].add(*milliseconds[p]);
+			mLatest[p] = measurement{ slot.mFrame, *milliseconds[p] };
+		}
+	}
+	write_row(slot.mFrame, milliseconds);
+}
+
+void gpu_profiler::write_row(uint64_t frame, const std::array<std::optional<double>, PASS_COUNT> &milliseconds)
+{
+	if (!mLog.is_open()) {
+		return;
+	}
+
+	if (mJson) {
+		mLog << (mFirstRow ? "  {" : ",\n  {") << "\"frame\": " << frame;
+		for (size_t p = 0; p < PASS_COUNT; p++) {
+			if (milliseconds[p]) {
+				mLog << ", \"" << name(static_cast<gpu_pass>(p)) << "_ms\": " << *milliseconds[p];
+			}
+		}
+		mLog << "}";
+	}
+	else {
+		// Passes which were not recorded in this frame stay empty
+		mLog << frame;
+		for (size_t p = 0; p < PASS_COUNT; p++) {
+			mLog << ",";
+			if (milliseconds[p]) {
+				mLog << *milliseconds[p];
+			}
+		}
+		mLog << "\n";
+	}
+	mFirstRow = false;
+}
+
+
+avk::recorded_commands_t gpu_profiler::begin(gpu_pass pass)
+{
+	if (!mSupported) {
+		return avk::command::custom_commands([](avk::command_buffer_t &) {});
+	}
+
+	frame_slot &slot = mSlots[mFrame % RING_SIZE];
+	slot.mRecorded[static_cast<size_t>(pass)] = true;
+
+	vk::QueryPool pool = slot.mPool.get();
+	uint32_t query = first_query(pass);
+	return avk::command::custom_commands([pool, query](avk::command_buffer_t &cb) {
+		// Each pass resets its own queries, s.t. passes which are skipped in a frame need no commands at all
+		cb.handle().resetQueryPool(pool, query, QUERIES_PER_PASS, cb.root_ptr()->dispatch_loader_core());
+		cb.handle().writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, pool, query, cb.root_ptr()->dispatch_loader_core());
+	});
+}
+
+avk::recorded_commands_t gpu_profiler::end(gpu_pass pass)
+{
+	if (!mSupported) {
+		return avk::command::custom_commands([](avk::command_buffer_t &) {});
+	}
+
+	vk::QueryPool pool = mSlots[mFrame % RING_SIZE].mPool.get();
+	uint32_t query = first_query(pass) + 1;
+	return avk::command::custom_commands([pool, query](avk::command_buffer_t &cb) {
+		cb.handle().writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, pool, query, cb.root_ptr()->dispatch_loader_core());
+	});
+}
+
+
+double gpu_profiler::average_milliseconds(gpu_pass pass) const
+{
+	const rolling_average &average = mAverages[static_cast<size_t>(pass)];
+	return average.mCount > 0 ? average.mSum / average.mCount : 0.0;
+}
+
+std::optional<gpu_profiler::measurement> gpu_profiler::latest(gpu_pass pass) const
+{
+	return mLatest[static_cast<size_t>(pass)];
+}
+
+void gpu_profiler::print_averages() const
+{
+	if (!mSupported) {
+		return;
+	}
+	printf("GPU time (average of the last %u frames):", AVERAGE_WINDOW);
+	for (size_t p = 0; p < PASS_COUNT; p++) {
+		printf(" %s %.3lf ms%s", name(static_cast<gpu_pass>(p)), average_milliseconds(static_cast<gpu_pass>(p)), p + 1 < PASS_COUNT ? "," : "");
+	}
+	printf(" (%llu frames dropped)\n", static_cast<unsigned long long>(mDroppedFrames));
+}
+
+const char *gpu_profiler::name(gpu_pass pass)
+{
+	switch (pass) {
+		case gpu_pass::accumulation_clear: return "accumulation_clear";
+		case gpu_pass::trace_rays: return "trace_rays";
+		case gpu_pass::result_blit: return "result_blit";
+		case gpu_pass::tlas_rebuild: return "tlas_rebuild";
+		case gpu_pass::denoise: return "denoise";
+		case gpu_pass::preview: return "preview";
+		default: return "unknown";
+	}
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <auto_vk_toolkit.hpp>
+
+#include <fstream>
+
+
+// The stages of a frame which are timed on the GPU
+enum struct gpu_pass : uint32_t {
+	accumulation_clear = 0, // the clears of the camera and light images (and their barriers), also recorded if the camera did not move
+	trace_rays = 1,
+	result_blit = 2,        // windowed only
+	tlas_rebuild = 3,       // only in frames in which the geometry selection changed
+	denoise = 4,            // only while the denoiser is active
+	preview = 5,            // only in frames traced at reduced resolution (see dynamic_resolution)
+	count = 6
+};
+
+
+/// <summary>
+/// Measures the GPU time of every `gpu_pass` with timestamp queries. Every frame writes into its own query pool out of a ring
+/// which is larger than the number of frames in flight, s.t. the results of a pool are long available when it is reused:
+/// `next_frame()` collects them without waiting and drops a frame rather than stalling if they are not (yet) there.
+/// The collected times are kept as rolling averages over the last `AVERAGE_WINDOW` frames and, if a log path is given,
+/// written per frame to a CSV file (or a JSON array if the path ends with .json).
+/// </summary>
+class gpu_profiler
+{
+public:
+	static constexpr uint32_t RING_SIZE = 4;       // one more than the three frames in flight (see renderer::mViewProjBuffers)
+	static constexpr uint32_t AVERAGE_WINDOW = 64;
+
+	// The time of a pass in one frame
+	struct measurement {
+		uint64_t mFrame;
+		double mMilliseconds;
+	};
+
+	gpu_profiler(avk::queue &aQueue, const std::string &aLogPath);
+	~gpu_profiler();
+
+	gpu_profiler(const gpu_profiler &) = delete;
+	gpu_profiler &operator=(const gpu_profiler &) = delete;
+
+	// Collects the results of the pool which is reused by the frame that starts now. Has to be called once per frame before any begin().
+	void next_frame();
+
+	// Timestamps around the commands of `pass`, both have to end up in the same command buffer
+	avk::recorded_commands_t begin(gpu_pass pass);
+	avk::recorded_commands_t end(gpu_pass pass);
+
+	// Rolling average over the frames in which the pass was recorded, 0 if there were none
+	double average_milliseconds(gpu_pass pass) const;
+	// The most recently collected time of the pass, RING_SIZE frames old at best, none before the first one
+	std::optional<measurement> latest(gpu_pass pass) const;
+	// The frame which the recorded commands belong to, counted by next_frame()
+	inline uint64_t frame() const { return mFrame; }
+	void print_averages() const;
+
+	static const char *name(gpu_pass pass);
+
+private:
+	using unique_query_pool = vk::UniqueHandle<vk::QueryPool, vk::DispatchLoaderDynamic>;
+	static constexpr size_t PASS_COUNT = static_cast<size_t>(gpu_pass::count);
+
+	struct frame_slot {
+		unique_query_pool mPool; // two queries per pass, begin and end
+		uint64_t mFrame = 0;
+		std::array<bool, PASS_COUNT> mRecorded = {};
+	};
+
+	struct rolling_average {
+		std::array<double, AVERAGE_WINDOW> mSamples = {};
+		uint32_t mCount = 0;
+		uint32_t mNext = 0;
+		double mSum = 0.0;
+
+		void add(double value);
+	};
+
+	void collect(frame_slot &slot);
+	void write_row(uint64_t frame, const std::array<std::optional<double>, PASS_COUNT> &milliseconds);
+
+	bool mSupported = false;
+	double mNanosecondsPerTick = 1.0;
+	uint64_t mTimestampMask = ~uint64_t(0);
+
+	std::array<frame_slot, RING_SIZE> mSlots;
+	uint64_t mFrame = 0;
+	uint64_t mDroppedFrames = 0;
+
+	std::array<rolling_average, PASS_COUNT> mAverages;
+	std::array<std::optional<measurement>, PASS_COUNT> mLatest;
+
+	std::ofstream mLog;
+	bool mJson = false;
+	bool mFirstRow = true;
+};
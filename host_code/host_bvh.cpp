@@ -0,0 +1,301 @@
+#include "host_bvh.h"
+
+
+namespace {
+	constexpr uint32_t MAX_LEAF_SIZE = 4;
+	constexpr uint32_t BIN_COUNT = 16;
+
+	// SAH splits below this depth, object median splits further down. Every median split at least halves
+	// the primitive count, so the total depth stays below host_bvh::MAX_STACK_SIZE for up to 2^32 primitives.
+	constexpr int MAX_SAH_DEPTH = 32;
+
+	// Subtrees with fewer primitives are not worth a task of their own
+	constexpr uint32_t PARALLEL_THRESHOLD = 4096;
+
+	constexpr float TRAVERSAL_COST = 1.0f;
+	constexpr float INTERSECTION_COST = 1.0f;
+
+	struct bin {
+		host_aabb mBounds;
+		uint32_t mCount = 0;
+	};
+
+	// Clamped in float, large products must not reach the conversion (undefined for values beyond uint32_t)
+	uint32_t bin_index(float offset, float scale)
+	{
+		return static_cast<uint32_t>(std::min(offset * scale, static_cast<float>(BIN_COUNT - 1)));
+	}
+
+	// Moeller-Trumbore, u and v are the weights of v1 and v2 just like the hit attributes in the shaders
+	bool intersect_triangle(const host_ray &ray, const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2, float tMax, float &t, glm::vec2 &uv)
+	{
+		glm::vec3 e1 = v1 - v0;
+		glm::vec3 e2 = v2 - v0;
+		glm::vec3 p = glm::cross(ray.mDirection, e2);
+		float det = glm::dot(e1, p);
+		if (det == 0.0f) {
+			return false;
+		}
+		float invDet = 1.0f / det;
+
+		glm::vec3 s = ray.mOrigin - v0;
+		float u = glm::dot(s, p) * invDet;
+		if (u < 0.0f || u > 1.0f) {
+			return false;
+		}
+
+		glm::vec3 q = glm::cross(s, e1);
+		float v = glm::dot(ray.mDirection, q) * invDet;
+		if (v < 0.0f || u + v > 1.0f) {
+			return false;
+		}
+
+		t = glm::dot(e2, q) * invDet;
+		if (t < ray.mTMin || t > tMax) {
+			return false;
+		}
+		uv = glm::vec2(u, v);
+		return true;
+	}
+}
+
+
+host_bvh::build_statistics host_bvh::build(const std::vector<glm::vec3> &positions, const std::vector<uint32_t> &indices, task_system &tasks)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	uint32_t numTriangles = static_cast<uint32_t>(indices.size() / 3);
+	std::vector<host_aabb> triangleBounds(numTriangles);
+	tasks.parallel_for(0, numTriangles, PARALLEL_THRESHOLD, [&](uint32_t i) {
+		triangleBounds[i].grow(positions[indices[3 * i + 0]]);
+		triangleBounds[i].grow(positions[indices[3 * i + 1]]);
+		triangleBounds[i].grow(positions[indices[3 * i + 2]]);
+	});
+
+	build_nodes(triangleBounds, tasks);
+
+	// Store the vertices in leaf order s.t. leaves reference contiguous ranges:
+	mTriangles.resize(3 * static_cast<size_t>(numTriangles));
+	tasks.parallel_for(0, numTriangles, PARALLEL_THRESHOLD, [&](uint32_t i) {
+		uint32_t prim = mPrimitiveIndices[i];
+		mTriangles[3 * i + 0] = positions[indices[3 * prim + 0]];
+		mTriangles[3 * i + 1] = positions[indices[3 * prim + 1]];
+		mTriangles[3 * i + 2] = positions[indices[3 * prim + 2]];
+	});
+
+	build_statistics statistics;
+	statistics.mSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	statistics.mNodeCount = static_cast<uint32_t>(mNodes.size());
+	statistics.mSahCost = sah_cost();
+	return statistics;
+}
+
+
+host_bvh::build_statistics host_bvh::build(const std::vector<host_aabb> &primitiveBounds, task_system &tasks)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	mTriangles.clear();
+	build_nodes(primitiveBounds, tasks);
+
+	build_statistics statistics;
+	statistics.mSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	statistics.mNodeCount = static_cast<uint32_t>(mNodes.size());
+	statistics.mSahCost = sah_cost();
+	return statistics;
+}
+
+
+void host_bvh::build_nodes(const std::vector<host_aabb> &primitiveBounds, task_system &tasks)
+{
+	uint32_t numPrimitives = static_cast<uint32_t>(primitiveBounds.size());
+
+	mNodes.clear();
+	mPrimitiveIndices.resize(numPrimitives);
+	std::iota(mPrimitiveIndices.begin(), mPrimitiveIndices.end(), 0u);
+	if (numPrimitives == 0) {
+		return;
+	}
+
+	std::vector<glm::vec3> centroids(numPrimitives);
+	for (uint32_t i = 0; i < numPrimitives; i++) {
+		centroids[i] = primitiveBounds[i].center();
+	}
+
+	// A binary tree with n leaves has at most 2n - 1 nodes. Children are allocated pairwise from an atomic counter,
+	// so that subtrees can be built concurrently into the same array.
+	mNodes.resize(2 * static_cast<size_t>(numPrimitives) - 1);
+	std::atomic<uint32_t> nodeCount = 1;
+	build_recursive(0, 0, numPrimitives, 0, primitiveBounds, centroids, nodeCount, tasks);
+	mNodes.resize(nodeCount);
+}
+
+
+void host_bvh::build_recursive(uint32_t nodeIndex, uint32_t first, uint32_t count, int depth, const std::vector<host_aabb> &primitiveBounds, const std::vector<glm::vec3> &centroids, std::atomic<uint32_t> &nodeCount, task_system &tasks)
+{
+	host_aabb bounds;
+	host_aabb centroidBounds;
+	for (uint32_t i = first; i < first + count; i++) {
+		uint32_t prim = mPrimitiveIndices[i];
+		bounds.grow(primitiveBounds[prim]);
+		centroidBounds.grow(centroids[prim]);
+	}
+
+	node &current = mNodes[nodeIndex];
+	current.mMin = bounds.mMin;
+	current.mMax = bounds.mMax;
+	current.mFirst = first;
+	current.mCount = count;
+
+	if (count == 1) {
+		return;
+	}
+
+	glm::vec3 extent = centroidBounds.mMax - centroidBounds.mMin;
+	int largestAxis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+	if (count <= MAX_LEAF_SIZE && (extent[largestAxis] <= 0.0f || depth >= MAX_SAH_DEPTH)) {
+		return;
+	}
+
+	uint32_t middle = first;
+
+	if (depth < MAX_SAH_DEPTH && extent[largestAxis] > 0.0f) {
+		// Binned SAH: bin the centroids along every axis and sweep over the bin boundaries
+		int bestAxis = -1;
+		uint32_t bestSplit = 0;
+		float bestCost = std::numeric_limits<float>::max();
+
+		// One pass over the primitives fills the bins of all three axes
+		std::array<std::array<bin, BIN_COUNT>, 3> bins;
+		// Axes without extent (axis-aligned quads, coincident centroids) get scale 0, i.e. everything in bin 0, and are skipped
+		// by the sweep. Denormal extents would overflow the division, the scale stays finite s.t. offset 0 never gives NaN.
+		glm::vec3 scale = glm::vec3(0.0f);
+		for (int axis = 0; axis < 3; axis++) {
+			if (extent[axis] > 0.0f) {
+				scale[axis] = std::min(static_cast<float>(BIN_COUNT) / extent[axis], std::numeric_limits<float>::max());
+			}
+		}
+		for (uint32_t i = first; i < first + count; i++) {
+			uint32_t prim = mPrimitiveIndices[i];
+			for (int axis = 0; axis < 3; axis++) {
+				bin &target = bins[axis][bin_index(centroids[prim][axis] - centroidBounds.mMin[axis], scale[axis])];
+				target.mBounds.grow(primitiveBounds[prim]);
+				target.mCount++;
+			}
+		}
+
+		for (int axis = 0; axis < 3; axis++) {
+			if (extent[axis] <= 0.0f) {
+				continue;
+			}
+
+			// right to left sweep first, then evaluate while sweeping left to right
+			std::array<float, BIN_COUNT> rightCost;
+			host_aabb rightBounds;
+			uint32_t rightCount = 0;
+			for (uint32_t b = BIN_COUNT - 1; b > 0; b--) {
+				rightBounds.grow(bins[axis][b].mBounds);
+				rightCount += bins[axis][b].mCount;
+				rightCost[b] = rightBounds.half_area() * rightCount;
+			}
+
+			host_aabb leftBounds;
+			uint32_t leftCount = 0;
+			for (uint32_t b = 0; b < BIN_COUNT - 1; b++) {
+				leftBounds.grow(bins[axis][b].mBounds);
+				leftCount += bins[axis][b].mCount;
+				float cost = leftBounds.half_area() * leftCount + rightCost[b + 1];
+				if (leftCount > 0 && leftCount < count && cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = b + 1;
+				}
+			}
+		}
+
+		float leafCost = INTERSECTION_COST * count;
+		float splitCost = TRAVERSAL_COST + INTERSECTION_COST * bestCost / bounds.half_area();
+		if (count <= MAX_LEAF_SIZE && (bestAxis < 0 || leafCost <= splitCost)) {
+			return;
+		}
+		if (bestAxis >= 0) {
+			float minimum = centroidBounds.mMin[bestAxis];
+			float axisScale = scale[bestAxis];
+			middle = static_cast<uint32_t>(std::partition(mPrimitiveIndices.begin() + first, mPrimitiveIndices.begin() + first + count,
+				[&](uint32_t prim) {
+					return bin_index(centroids[prim][bestAxis] - minimum, axisScale) < bestSplit;
+				}) - mPrimitiveIndices.begin());
+		}
+	}
+
+	if (middle == first || middle == first + count) {
+		// Object median split along the largest centroid extent (also for coincident centroids):
+		middle = first + count / 2;
+		std::nth_element(mPrimitiveIndices.begin() + first, mPrimitiveIndices.begin() + middle, mPrimitiveIndices.begin() + first + count,
+			[&centroids, largestAxis](uint32_t a, uint32_t b) { return centroids[a][largestAxis] < centroids[b][largestAxis]; });
+	}
+
+	uint32_t leftChild = nodeCount.fetch_add(2);
+	current.mFirst = leftChild;
+	current.mCount = 0;
+
+	uint32_t leftCount = middle - first;
+	uint32_t rightCount = first + count - middle;
+	if (leftCount >= PARALLEL_THRESHOLD && rightCount >= PARALLEL_THRESHOLD) {
+		task_group group;
+		tasks.run(group, [&, leftChild, first, leftCount, depth]() {
+			build_recursive(leftChild, first, leftCount, depth + 1, primitiveBounds, centroids, nodeCount, tasks);
+		});
+		build_recursive(leftChild + 1, middle, rightCount, depth + 1, primitiveBounds, centroids, nodeCount, tasks);
+		tasks.wait(group);
+	}
+	else {
+		build_recursive(leftChild, first, leftCount, depth + 1, primitiveBounds, centroids, nodeCount, tasks);
+		build_recursive(leftChild + 1, middle, rightCount, depth + 1, primitiveBounds, centroids, nodeCount, tasks);
+	}
+}
+
+
+float host_bvh::sah_cost() const
+{
+	if (mNodes.empty()) {
+		return 0.0f;
+	}
+
+	float rootArea = host_aabb{ mNodes[0].mMin, mNodes[0].mMax }.half_area();
+	if (rootArea <= 0.0f) {
+		return 0.0f;
+	}
+
+	double cost = 0.0;
+	for (const node &n : mNodes) {
+		float area = host_aabb{ n.mMin, n.mMax }.half_area();
+		cost += n.mCount == 0 ? TRAVERSAL_COST * area : INTERSECTION_COST * n.mCount * area;
+	}
+	return static_cast<float>(cost / rootArea);
+}
+
+
+bool host_bvh::intersect(const host_ray &ray, float &tMax, uint32_t &primitiveIndex, glm::vec2 &barycentrics, bool anyHit) const
+{
+	bool found = false;
+
+	traverse(ray, tMax, [&](uint32_t first, uint32_t count) {
+		for (uint32_t i = first; i < first + count; i++) {
+			float t;
+			glm::vec2 uv;
+			if (intersect_triangle(ray, mTriangles[3 * i + 0], mTriangles[3 * i + 1], mTriangles[3 * i + 2], tMax, t, uv)) {
+				tMax = t;
+				primitiveIndex = mPrimitiveIndices[i];
+				barycentrics = uv;
+				found = true;
+				if (anyHit) {
+					return true;
+				}
+			}
+		}
+		return false;
+	});
+
+	return found;
+}
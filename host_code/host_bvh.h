@@ -0,0 +1,165 @@
+#pragma once
+
+#include "task_system.h"
+
+#include <auto_vk_toolkit.hpp>
+
+struct host_ray {
+	glm::vec3 mOrigin;
+	glm::vec3 mDirection;
+	float mTMin;
+	float mTMax;
+};
+
+/// <summary>
+/// Result of a ray/triangle query, mirrors what the closest hit shader gets to see:
+/// `mBarycentrics` is `hitAttributeEXT` (weights of the second and third vertex), `mGeometryIndex` is `gl_InstanceCustomIndexEXT`
+/// and `mInstanceIndex` is `gl_InstanceID`.
+/// </summary>
+struct host_hit {
+	float mT;
+	uint32_t mGeometryIndex;
+	uint32_t mInstanceIndex;
+	uint32_t mPrimitiveIndex;
+	glm::vec2 mBarycentrics;
+};
+
+struct host_aabb {
+	glm::vec3 mMin = glm::vec3(std::numeric_limits<float>::max());
+	glm::vec3 mMax = glm::vec3(-std::numeric_limits<float>::max());
+
+	inline void grow(const glm::vec3 &point) { mMin = glm::min(mMin, point); mMax = glm::max(mMax, point); }
+	inline void grow(const host_aabb &other) { mMin = glm::min(mMin, other.mMin); mMax = glm::max(mMax, other.mMax); }
+	inline glm::vec3 center() const { return (mMin + mMax) * 0.5f; }
+
+	// Half the surface area, which is all the SAH needs
+	inline float half_area() const {
+		if (mMin.x > mMax.x) {
+			return 0.0f;
+		}
+		glm::vec3 extent = mMax - mMin;
+		return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+	}
+};
+
+/// <summary>
+/// Binary bounding volume hierarchy built with binned SAH. Over the triangles of one `model_loader::data_for_draw_call` it is
+/// the host-side stand-in for a bottom level acceleration structure, over instance bounds for the top level one.
+/// Subtrees are built in parallel on a `task_system`.
+/// </summary>
+class host_bvh
+{
+public:
+	struct node {
+		glm::vec3 mMin;
+		uint32_t mFirst; // inner node: index of the first child (the second one directly follows), leaf: first primitive
+		glm::vec3 mMax;
+		uint32_t mCount; // 0 for inner nodes
+	};
+
+	struct build_statistics {
+		double mSeconds = 0.0;
+		uint32_t mNodeCount = 0;
+		float mSahCost = 0.0f;
+	};
+
+	// Deeper subtrees are split at the object median, which keeps the traversal stack bounded
+	static constexpr int MAX_STACK_SIZE = 64;
+
+	// Over the triangles of one draw call, the results of intersect() refer to triangle indices
+	build_statistics build(const std::vector<glm::vec3> &positions, const std::vector<uint32_t> &indices, task_system &tasks);
+
+	// Over arbitrary primitives given by their bounds, leaves reference ranges of primitive_indices()
+	build_statistics build(const std::vector<host_aabb> &primitiveBounds, task_system &tasks);
+
+	// Closest hit (or any hit if `anyHit` is set) within [mTMin, tMax], updates tMax on success.
+	bool intersect(const host_ray &ray, float &tMax, uint32_t &primitiveIndex, glm::vec2 &barycentrics, bool anyHit) const;
+
+	// Calls `leaf(first, count)` for every leaf the ray enters within [mTMin, tMax], near child first.
+	// `tMax` may be shortened by the callback, returning true from it terminates the traversal.
+	template <typename F>
+	void traverse(const host_ray &ray, const float &tMax, F &&leaf) const;
+
+	// Expected cost of a random ray, with traversal and intersection costs of 1
+	float sah_cost() const;
+
+	inline const std::vector<node> &nodes() const { return mNodes; }
+	inline const std::vector<uint32_t> &primitive_indices() const { return mPrimitiveIndices; }
+	inline const std::vector<glm::vec3> &triangles() const { return mTriangles; }
+	inline host_aabb bounds() const { return mNodes.empty() ? host_aabb{} : host_aabb{ mNodes[0].mMin, mNodes[0].mMax }; }
+	inline bool empty() const { return mNodes.empty(); }
+
+private:
+	void build_nodes(const std::vector<host_aabb> &primitiveBounds, task_system &tasks);
+	void build_recursive(uint32_t nodeIndex, uint32_t first, uint32_t count, int depth, const std::vector<host_aabb> &primitiveBounds, const std::vector<glm::vec3> &centroids, std::atomic<uint32_t> &nodeCount, task_system &tasks);
+
+	// Entry distance of the ray into the box or infinity if it misses [tMin, tMax]
+	static inline float entry_distance(const host_ray &ray, const glm::vec3 &invDirection, const node &box, float tMax) {
+		glm::vec3 t0 = (box.mMin - ray.mOrigin) * invDirection;
+		glm::vec3 t1 = (box.mMax - ray.mOrigin) * invDirection;
+		glm::vec3 tNear = glm::min(t0, t1);
+		glm::vec3 tFar = glm::max(t0, t1);
+		float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, ray.mTMin));
+		float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, tMax));
+		return enter <= exit ? enter : std::numeric_limits<float>::infinity();
+	}
+
+	std::vector<node> mNodes;
+	std::vector<uint32_t> mPrimitiveIndices;
+	std::vector<glm::vec3> mTriangles; // three vertices per triangle, in the order of mPrimitiveIndices
+};
+
+
+template <typename F>
+void host_bvh::traverse(const host_ray &ray, const float &tMax, F &&leaf) const
+{
+	if (mNodes.empty()) {
+		return;
+	}
+
+	glm::vec3 invDirection = 1.0f / ray.mDirection;
+
+	// Nodes are pushed with their entry distance, s.t. they can be skipped once tMax got shorter than that
+	struct stack_entry {
+		uint32_t mNode;
+		float mDistance;
+	};
+	stack_entry stack[MAX_STACK_SIZE];
+	int stackSize = 0;
+
+	float rootDistance = entry_distance(ray, invDirection, mNodes[0], tMax);
+	if (rootDistance == std::numeric_limits<float>::infinity()) {
+		return;
+	}
+	stack[stackSize++] = { 0, rootDistance };
+
+	while (stackSize > 0) {
+		const stack_entry entry = stack[--stackSize];
+		if (entry.mDistance > tMax) {
+			continue;
+		}
+		const node &current = mNodes[entry.mNode];
+
+		if (current.mCount > 0) {
+			if (leaf(current.mFirst, current.mCount)) {
+				return;
+			}
+			continue;
+		}
+
+		float distanceNear = entry_distance(ray, invDirection, mNodes[current.mFirst], tMax);
+		float distanceFar = entry_distance(ray, invDirection, mNodes[current.mFirst + 1], tMax);
+		uint32_t nearChild = current.mFirst;
+		uint32_t farChild = current.mFirst + 1;
+		if (distanceFar < distanceNear) {
+			std::swap(distanceNear, distanceFar);
+			std::swap(nearChild, farChild);
+		}
+		if (distanceFar != std::numeric_limits<float>::infinity()) {
+			stack[stackSize++] = { farChild, distanceFar };
+		}
+		if (distanceNear != std::numeric_limits<float>::infinity()) {
+			stack[stackSize++] = { nearChild, distanceNear };
+		}
+	}
+}
@@ -0,0 +1,235 @@
+#include "host_scene.h"
+
+#include "material_helper.hpp"
+#include "..\third_party\INIReader.h"
+
+
+
+void host_scene::load_models_from_ini(const render_settings &settings)
+{
+	std::vector<texture_timing> textureTimings;
+
+	// Same traversal as model_loader::load_models_from_ini => same geometry, material and texture indices
+	INIReader reader(settings.mScenePath);
+	std::set<std::string> sections = reader.Sections();
+	size_t modelIndex = 0;
+	for (std::set<std::string>::iterator it = sections.begin(); it != sections.end(); ++it)
+	{
+		if (*it == environment_map::INI_SECTION) {
+			continue;
+		}
+		std::string modelGLBPath = reader.Get(*it, "path", "");
+		load_single_model(modelGLBPath, modelIndex, settings, textureTimings);
+		modelIndex++;
+	}
+
+	// Same as in model_loader, the geometry index doubles as material index
+	for (size_t i = 0; i < mGeometries.size() && i < mMaterials.size(); i++) {
+		mLights.add_geometry(static_cast<uint32_t>(i), mGeometries[i].mPositions, mGeometries[i].mIndices, mMaterials[i]);
+	}
+	mLights.build();
+	mEnvironment.load(settings);
+
+	if (!settings.mTextureLogPath.empty() && !texture_timing::write_csv(settings.mTextureLogPath, textureTimings)) {
+		std::cerr << "Could not write " << settings.mTextureLogPath << std::endl;
+	}
+}
+
+
+void host_scene::load_single_model(const std::string &filePath, size_t modelIndex, const render_settings &settings, std::vector<texture_timing> &textureTimings)
+{
+	// The cache holds exactly the arrays that model_loader::load_single_model uploads
+	scene_cache cache = scene_cache::open(filePath, settings);
+	cache.print_statistics();
+	textureTimings.insert(textureTimings.end(), cache.decode_timings().begin(), cache.decode_timings().end());
+
+	size_t materialIndexOffset = mMaterials.size();
+
+	for (const auto &dc : cache.draw_calls()) {
+		auto &newElement = mGeometries.emplace_back();
+		newElement.mMaterialIndex = static_cast<int>(dc.mMaterialIndex + materialIndexOffset);
+
+		newElement.mPositions.assign(dc.mPositions.begin(), dc.mPositions.end());
+		// Decoded exactly like the closest hit shader does it, s.t. both see the same quantized attributes
+		newElement.mTexCoords.resize(dc.mVertices.size());
+		newElement.mNormals.resize(dc.mVertices.size());
+		newElement.mTangents.resize(dc.mVertices.size());
+		newElement.mBitangents.resize(dc.mVertices.size());
+		for (size_t v = 0; v < dc.mVertices.size(); v++) {
+			vertex_layout::unpack(dc.mVertices[v], newElement.mNormals[v], newElement.mTangents[v], newElement.mBitangents[v], newElement.mTexCoords[v]);
+		}
+		newElement.mIndices.assign(dc.mIndices.begin(), dc.mIndices.end());
+
+		mInstances.push_back(instance{ glm::mat4(1.0f), glm::mat4(1.0f), static_cast<uint32_t>(mGeometries.size() - 1), modelIndex });
+	}
+
+	auto [materials, textures] = material_helper::convert_for_host_usage(cache, mTextures.size());
+	mMaterials.insert(mMaterials.end(), materials.begin(), materials.end());
+	mTextures.insert(mTextures.end(), textures.begin(), textures.end());
+}
+
+
+void host_scene::build_acceleration_structures()
+{
+	auto start = std::chrono::steady_clock::now();
+
+	// One task per geometry; large geometries additionally build their subtrees in parallel
+	std::vector<host_bvh::build_statistics> statistics(mGeometries.size());
+	mTasks.parallel_for(0, static_cast<uint32_t>(mGeometries.size()), 1, [this, &statistics](uint32_t i) {
+		statistics[i] = mGeometries[i].mBvh.build(mGeometries[i].mPositions, mGeometries[i].mIndices, mTasks);
+	});
+
+	uint64_t triangleCount = 0;
+	uint64_t nodeCount = 0;
+	double weightedSahCost = 0.0;
+	for (size_t i = 0; i < mGeometries.size(); i++) {
+		triangleCount += mGeometries[i].mIndices.size() / 3;
+		nodeCount += statistics[i].mNodeCount;
+		weightedSahCost += statistics[i].mSahCost * (mGeometries[i].mIndices.size() / 3);
+	}
+	double geometrySeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	host_bvh::build_statistics instanceStatistics = build_instance_bvh();
+
+	if (kernel_supported(traversal_kernel::bvh8_avx2)) {
+		set_traversal_kernel(traversal_kernel::bvh8_avx2);
+	}
+	else if (kernel_supported(traversal_kernel::bvh4_sse4)) {
+		set_traversal_kernel(traversal_kernel::bvh4_sse4);
+	}
+	else {
+		set_traversal_kernel(traversal_kernel::binary);
+	}
+
+	printf("Host BVHs: %zu geometries, %llu triangles, %llu nodes, mean SAH cost %.2f, built in %.2lf ms on %u threads\n",
+		mGeometries.size(), static_cast<unsigned long long>(triangleCount), static_cast<unsigned long long>(nodeCount),
+		triangleCount > 0 ? weightedSahCost / triangleCount : 0.0, geometrySeconds * 1000.0, mTasks.thread_count());
+	printf("Host instance BVH: %zu instances, %u nodes, SAH cost %.2f, built in %.2lf ms\n",
+		mInstances.size(), instanceStatistics.mNodeCount, instanceStatistics.mSahCost, instanceStatistics.mSeconds * 1000.0);
+	printf("Host traversal kernel: %s\n", kernel_name(mTraversalKernel));
+}
+
+
+void host_scene::set_traversal_kernel(traversal_kernel kernel)
+{
+	assert(kernel_supported(kernel));
+	mTraversalKernel = kernel;
+
+	mTasks.parallel_for(0, static_cast<uint32_t>(mGeometries.size()), 1, [this, kernel](uint32_t i) {
+		geometry &geo = mGeometries[i];
+		if (kernel == traversal_kernel::bvh4_sse4 && geo.mBvh4.empty()) {
+			geo.mBvh4.build(geo.mBvh);
+		}
+		if (kernel == traversal_kernel::bvh8_avx2 && geo.mBvh8.empty()) {
+			geo.mBvh8.build(geo.mBvh);
+		}
+	});
+}
+
+
+bool host_scene::kernel_supported(traversal_kernel kernel)
+{
+	switch (kernel) {
+	case traversal_kernel::bvh4_sse4:
+		return host_wide_bvh<4>::supported();
+	case traversal_kernel::bvh8_avx2:
+		return host_wide_bvh<8>::supported();
+	default:
+		return true;
+	}
+}
+
+
+const char *host_scene::kernel_name(traversal_kernel kernel)
+{
+	switch (kernel) {
+	case traversal_kernel::bvh4_sse4:
+		return "BVH4 (SSE4)";
+	case traversal_kernel::bvh8_avx2:
+		return "BVH8 (AVX2)";
+	default:
+		return "binary BVH (scalar)";
+	}
+}
+
+
+void host_scene::update_transform_for_model(size_t modelIndex, glm::mat4 newTransform)
+{
+	for (auto &inst : mInstances) {
+		if (inst.mModelIndex == modelIndex) {
+			inst.mTransform = newTransform;
+			inst.mInverseTransform = glm::inverse(newTransform);
+		}
+	}
+	build_instance_bvh();
+}
+
+
+host_bvh::build_statistics host_scene::build_instance_bvh()
+{
+	std::vector<host_aabb> instanceBounds(mInstances.size());
+	for (size_t i = 0; i < mInstances.size(); i++) {
+		host_aabb local = mGeometries[mInstances[i].mGeometryIndex].mBvh.bounds();
+		if (local.mMin.x > local.mMax.x) {
+			continue; // empty geometry
+		}
+		// World space bounds of the eight transformed corners
+		for (int corner = 0; corner < 8; corner++) {
+			glm::vec3 point = glm::vec3(
+				(corner & 1) ? local.mMax.x : local.mMin.x,
+				(corner & 2) ? local.mMax.y : local.mMin.y,
+				(corner & 4) ? local.mMax.z : local.mMin.z);
+			instanceBounds[i].grow(glm::vec3(mInstances[i].mTransform * glm::vec4(point, 1.0f)));
+		}
+	}
+	return mInstanceBvh.build(instanceBounds, mTasks);
+}
+
+
+bool host_scene::intersect(const host_ray &ray, host_hit &hit, bool anyHit) const
+{
+	bool found = false;
+	float tMax = ray.mTMax;
+
+	mInstanceBvh.traverse(ray, tMax, [&](uint32_t first, uint32_t count) {
+		for (uint32_t i = first; i < first + count; i++) {
+			const uint32_t instanceIndex = mInstanceBvh.primitive_indices()[i];
+			const instance &inst = mInstances[instanceIndex];
+
+			// The direction is not renormalized, so t is the same in object and world space
+			host_ray objectRay = ray;
+			objectRay.mOrigin = glm::vec3(inst.mInverseTransform * glm::vec4(ray.mOrigin, 1.0f));
+			objectRay.mDirection = glm::mat3(inst.mInverseTransform) * ray.mDirection;
+
+			const geometry &geo = mGeometries[inst.mGeometryIndex];
+			uint32_t primitiveIndex;
+			glm::vec2 barycentrics;
+			bool geometryHit;
+			switch (mTraversalKernel) {
+			case traversal_kernel::bvh8_avx2:
+				geometryHit = geo.mBvh8.intersect(objectRay, tMax, primitiveIndex, barycentrics, anyHit);
+				break;
+			case traversal_kernel::bvh4_sse4:
+				geometryHit = geo.mBvh4.intersect(objectRay, tMax, primitiveIndex, barycentrics, anyHit);
+				break;
+			default:
+				geometryHit = geo.mBvh.intersect(objectRay, tMax, primitiveIndex, barycentrics, anyHit);
+				break;
+			}
+			if (geometryHit) {
+				hit.mT = tMax;
+				hit.mGeometryIndex = inst.mGeometryIndex;
+				hit.mInstanceIndex = instanceIndex;
+				hit.mPrimitiveIndex = primitiveIndex;
+				hit.mBarycentrics = barycentrics;
+				found = true;
+				if (anyHit) {
+					return true;
+				}
+			}
+		}
+		return false;
+	});
+
+	return found;
+}
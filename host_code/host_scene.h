@@ -0,0 +1,90 @@
+#pragma once
+
+#include "emissive_lights.h"
+#include "environment_map.h"
+#include "host_bvh.h"
+#include "host_wide_bvh.h"
+#include "host_texture.hpp"
+#include "scene_cache.h"
+
+#include <auto_vk_toolkit.hpp>
+
+
+/// <summary>
+/// Host-side copy of everything `model_loader` uploads to the GPU: the same per-material geometry (in the same order, so a
+/// geometry index equals `gl_InstanceCustomIndexEXT`), the same materials and one texture per image sampler.
+/// Like on the GPU, there is one BVH per geometry and an instance BVH over all geometry instances on top.
+/// Loading does not require a Vulkan device.
+/// </summary>
+class host_scene
+{
+public:
+	enum struct traversal_kernel { binary, bvh4_sse4, bvh8_avx2 };
+
+	struct geometry
+	{
+		std::vector<glm::vec3> mPositions;
+		std::vector<glm::vec2> mTexCoords;
+		std::vector<glm::vec3> mNormals;
+		std::vector<glm::vec3> mTangents;
+		std::vector<glm::vec3> mBitangents;
+		std::vector<uint32_t> mIndices;
+
+		int mMaterialIndex;
+
+		host_bvh mBvh;
+		host_wide_bvh<4> mBvh4; // collapsed from mBvh when the respective kernel is selected
+		host_wide_bvh<8> mBvh8;
+	};
+
+	// Counterpart of model_loader's geometry instances
+	struct instance
+	{
+		glm::mat4 mTransform;
+		glm::mat4 mInverseTransform;
+		uint32_t mGeometryIndex;
+		size_t mModelIndex;
+	};
+
+	// Loads the models of `mScenePath` through the scene cache
+	void load_models_from_ini(const render_settings &settings);
+
+	// Builds the BVHs of all geometries in parallel, then the instance BVH. Reports build times, node counts and SAH costs.
+	void build_acceleration_structures();
+
+	// Geometry BVHs are traversed with the given kernel, which must be supported by the CPU. The default is the widest supported one.
+	void set_traversal_kernel(traversal_kernel kernel);
+	inline traversal_kernel get_traversal_kernel() const { return mTraversalKernel; }
+	static bool kernel_supported(traversal_kernel kernel);
+	static const char *kernel_name(traversal_kernel kernel);
+
+	// Same as model_loader::update_transform_for_model, rebuilds the instance BVH
+	void update_transform_for_model(size_t modelIndex, glm::mat4 newTransform);
+
+	// Closest hit (or any hit if `anyHit` is set) of all geometries within [mTMin, mTMax]
+	bool intersect(const host_ray &ray, host_hit &hit, bool anyHit) const;
+
+	// getters
+	inline const std::vector<geometry> &geometries() const { return mGeometries; }
+	inline const std::vector<instance> &instances() const { return mInstances; }
+	inline const host_bvh &instance_bvh() const { return mInstanceBvh; }
+	inline const std::vector<avk::material_gpu_data> &materials() const { return mMaterials; }
+	inline const std::vector<host_texture> &textures() const { return mTextures; }
+	inline const emissive_lights &lights() const { return mLights; }
+	inline const environment_map &environment() const { return mEnvironment; }
+
+private:
+	void load_single_model(const std::string &filePath, size_t modelIndex, const render_settings &settings, std::vector<texture_timing> &textureTimings);
+	host_bvh::build_statistics build_instance_bvh();
+
+	task_system mTasks;
+	traversal_kernel mTraversalKernel = traversal_kernel::binary;
+
+	std::vector<geometry> mGeometries;
+	std::vector<instance> mInstances;
+	host_bvh mInstanceBvh;
+	std::vector<avk::material_gpu_data> mMaterials;
+	std::vector<host_texture> mTextures;
+	emissive_lights mLights;
+	environment_map mEnvironment;
+};
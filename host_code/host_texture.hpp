@@ -0,0 +1,93 @@
+#pragma once
+
+#include "mip_chain.hpp"
+
+#include <auto_vk_toolkit.hpp>
+
+/// <summary>
+/// Decoded texels of one embedded image. Shared between all `host_texture`s that reference it with different border handling modes.
+/// </summary>
+struct host_image {
+	uint32_t mWidth = 0;
+	uint32_t mHeight = 0;
+	uint32_t mLevelCount = 1;
+	std::vector<glm::u8vec4> mTexels; // full mip chain, see mip_chain.hpp
+	std::vector<size_t> mLevelOffsets;
+};
+
+/// <summary>
+/// Host-side counterpart of an `avk::image_sampler`. The CPU path tracer indexes these exactly like the shaders index `textures[]`,
+/// so the texture indices stored in `avk::material_gpu_data` can be used unchanged.
+/// </summary>
+struct host_texture {
+	std::shared_ptr<const host_image> mImage;
+	std::array<avk::border_handling_mode, 2> mBorderHandlingModes = { avk::border_handling_mode::repeat, avk::border_handling_mode::repeat };
+	bool mNearestNeighbor = false;
+
+	/// Equivalent of `textureLod(tex, uv, lod)` for the samplers created in `material_helper`: trilinear filtering between the
+	/// two nearest levels, nearest neighbor samplers only ever read level 0 (their images have a single level anyway).
+	glm::vec4 sample(glm::vec2 uv, float lod) const
+	{
+		const host_image &image = *mImage;
+
+		if (mNearestNeighbor) {
+			int x = wrap(static_cast<int>(std::floor(uv.x * image.mWidth)), image.mWidth, mBorderHandlingModes[0]);
+			int y = wrap(static_cast<int>(std::floor(uv.y * image.mHeight)), image.mHeight, mBorderHandlingModes[1]);
+			return texel(0, x, y);
+		}
+
+		// NaN (no footprint) ends up at level 0 as well
+		lod = lod > 0.0f ? std::min(lod, static_cast<float>(image.mLevelCount - 1)) : 0.0f;
+		uint32_t level = static_cast<uint32_t>(lod);
+		float t = lod - static_cast<float>(level);
+		if (t == 0.0f) {
+			return bilinear(level, uv);
+		}
+		return glm::mix(bilinear(level, uv), bilinear(level + 1, uv), t);
+	}
+
+private:
+	glm::vec4 bilinear(uint32_t level, glm::vec2 uv) const
+	{
+		glm::uvec2 extent = mip_chain::level_extent(mImage->mWidth, mImage->mHeight, level);
+
+		// Texel centers are at (i + 0.5) / size, just like on the GPU:
+		float fx = uv.x * extent.x - 0.5f;
+		float fy = uv.y * extent.y - 0.5f;
+		float x0f = std::floor(fx);
+		float y0f = std::floor(fy);
+		float tx = fx - x0f;
+		float ty = fy - y0f;
+
+		int x0 = wrap(static_cast<int>(x0f), extent.x, mBorderHandlingModes[0]);
+		int x1 = wrap(static_cast<int>(x0f) + 1, extent.x, mBorderHandlingModes[0]);
+		int y0 = wrap(static_cast<int>(y0f), extent.y, mBorderHandlingModes[1]);
+		int y1 = wrap(static_cast<int>(y0f) + 1, extent.y, mBorderHandlingModes[1]);
+
+		// a + (b - a) * t keeps uniform areas exact, which the shaders rely on when they compare against vec3(1.0)
+		glm::vec4 top = glm::mix(texel(level, x0, y0), texel(level, x1, y0), tx);
+		glm::vec4 bottom = glm::mix(texel(level, x0, y1), texel(level, x1, y1), tx);
+		return glm::mix(top, bottom, ty);
+	}
+
+	glm::vec4 texel(uint32_t level, int x, int y) const
+	{
+		uint32_t width = std::max(1u, mImage->mWidth >> level);
+		return glm::vec4(mImage->mTexels[mImage->mLevelOffsets[level] + static_cast<size_t>(y) * width + x]) / 255.0f;
+	}
+
+	static int wrap(int i, uint32_t size, avk::border_handling_mode mode)
+	{
+		int n = static_cast<int>(size);
+		switch (mode) {
+		case avk::border_handling_mode::repeat:
+			return ((i % n) + n) % n;
+		case avk::border_handling_mode::mirrored_repeat: {
+			int period = ((i % (2 * n)) + 2 * n) % (2 * n);
+			return period < n ? period : 2 * n - 1 - period;
+		}
+		default:
+			return std::clamp(i, 0, n - 1);
+		}
+	}
+};
@@ -0,0 +1,245 @@
+#include "host_wide_bvh.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+
+namespace {
+	struct cpu_features {
+		bool mSse41 = false;
+		bool mAvx2 = false; // including FMA and OS support for the YMM registers
+	};
+
+	cpu_features detect_cpu_features()
+	{
+		cpu_features features;
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 0);
+		int maxLeaf = info[0];
+
+		__cpuid(info, 1);
+		features.mSse41 = (info[2] & (1 << 19)) != 0;
+		bool fma = (info[2] & (1 << 12)) != 0;
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+		bool avx = (info[2] & (1 << 28)) != 0;
+
+		if (maxLeaf >= 7 && fma && osxsave && avx && (_xgetbv(0) & 0x6) == 0x6) {
+			__cpuidex(info, 7, 0);
+			features.mAvx2 = (info[1] & (1 << 5)) != 0;
+		}
+#else
+		features.mSse41 = __builtin_cpu_supports("sse4.1");
+		features.mAvx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+		return features;
+	}
+
+	const cpu_features &get_cpu_features()
+	{
+		static const cpu_features features = detect_cpu_features();
+		return features;
+	}
+
+	// Smallest exponent e with extent / 2^e <= 255
+	int8_t quantization_exponent(float extent)
+	{
+		int exponent = -126;
+		if (extent > 0.0f) {
+			exponent = std::max(-126, static_cast<int>(std::ceil(std::log2(extent / 255.0f))));
+			while (extent > std::ldexp(255.0f, exponent)) {
+				exponent++;
+			}
+		}
+		return static_cast<int8_t>(std::min(exponent, 127));
+	}
+}
+
+
+template <uint32_t N>
+bool host_wide_bvh<N>::supported()
+{
+	return N == 8 ? get_cpu_features().mAvx2 : get_cpu_features().mSse41;
+}
+
+
+template <uint32_t N>
+void host_wide_bvh<N>::build(const host_bvh &bvh)
+{
+	mNodes.clear();
+	mBlocks.clear();
+	if (bvh.empty()) {
+		return;
+	}
+
+	// Range of primitives below every binary node. Children always have larger indices than their parents.
+	const auto &binaryNodes = bvh.nodes();
+	std::vector<glm::uvec2> ranges(binaryNodes.size());
+	for (size_t i = binaryNodes.size(); i-- > 0;) {
+		const host_bvh::node &current = binaryNodes[i];
+		if (current.mCount > 0) {
+			ranges[i] = glm::uvec2(current.mFirst, current.mCount);
+		}
+		else {
+			ranges[i] = glm::uvec2(ranges[current.mFirst].x, ranges[current.mFirst].y + ranges[current.mFirst + 1].y);
+		}
+	}
+
+	mNodes.reserve(binaryNodes.size() / (N / 2) + 1);
+	mBlocks.reserve(ranges[0].y / (N / 2) + 1);
+	create_node(bvh, 0, ranges);
+}
+
+
+template <uint32_t N>
+uint32_t host_wide_bvh<N>::create_node(const host_bvh &bvh, uint32_t binaryNode, const std::vector<glm::uvec2> &ranges)
+{
+	const auto &binaryNodes = bvh.nodes();
+	auto area = [&binaryNodes](uint32_t index) {
+		return host_aabb{ binaryNodes[index].mMin, binaryNodes[index].mMax }.half_area();
+	};
+
+	// Pull up grandchildren until there are N children, always opening the largest child which is too big for one leaf.
+	// Small enough subtrees become leaves, the root too if the whole hierarchy fits into one.
+	std::vector<uint32_t> children;
+	if (ranges[binaryNode].y <= N) {
+		children.push_back(binaryNode);
+	}
+	else {
+		children.push_back(binaryNodes[binaryNode].mFirst);
+		children.push_back(binaryNodes[binaryNode].mFirst + 1);
+	}
+	while (children.size() < N) {
+		int largest = -1;
+		for (int i = 0; i < static_cast<int>(children.size()); i++) {
+			if (ranges[children[i]].y > N && (largest < 0 || area(children[i]) > area(children[largest]))) {
+				largest = i;
+			}
+		}
+		if (largest < 0) {
+			break;
+		}
+		uint32_t opened = children[largest];
+		children[largest] = binaryNodes[opened].mFirst;
+		children.push_back(binaryNodes[opened].mFirst + 1);
+	}
+
+	// Children are created before this node is filled, mNodes may reallocate in between
+	uint32_t nodeIndex = static_cast<uint32_t>(mNodes.size());
+	mNodes.emplace_back();
+
+	std::array<uint32_t, N> childReferences;
+	for (size_t i = 0; i < children.size(); i++) {
+		childReferences[i] = ranges[children[i]].y <= N
+			? (WIDE_BVH_LEAF_FLAG | create_block(bvh, ranges[children[i]]))
+			: create_node(bvh, children[i], ranges);
+	}
+
+	host_aabb bounds;
+	for (uint32_t child : children) {
+		bounds.grow(host_aabb{ binaryNodes[child].mMin, binaryNodes[child].mMax });
+	}
+
+	node &current = mNodes[nodeIndex];
+	std::memset(&current, 0, sizeof(node));
+	current.mChildCount = static_cast<uint8_t>(children.size());
+
+	float scales[3];
+	for (int axis = 0; axis < 3; axis++) {
+		current.mOrigin[axis] = bounds.mMin[axis];
+		current.mExponent[axis] = quantization_exponent(bounds.mMax[axis] - bounds.mMin[axis]);
+		scales[axis] = std::ldexp(1.0f, current.mExponent[axis]);
+	}
+
+	for (uint32_t i = 0; i < N; i++) {
+		if (i >= children.size()) {
+			current.mChildren[i] = WIDE_BVH_EMPTY_CHILD;
+			continue;
+		}
+		current.mChildren[i] = childReferences[i];
+
+		const host_bvh::node &child = binaryNodes[children[i]];
+		for (int axis = 0; axis < 3; axis++) {
+			// Round outwards, then fix up what float rounding of origin + q * scale got wrong
+			float origin = current.mOrigin[axis];
+			int lower = static_cast<int>(std::floor((child.mMin[axis] - origin) / scales[axis]));
+			int upper = static_cast<int>(std::ceil((child.mMax[axis] - origin) / scales[axis]));
+			lower = std::clamp(lower, 0, 255);
+			upper = std::clamp(upper, 0, 255);
+			while (lower > 0 && origin + lower * scales[axis] > child.mMin[axis]) {
+				lower--;
+			}
+			while (upper < 255 && origin + upper * scales[axis] < child.mMax[axis]) {
+				upper++;
+			}
+			current.mLower[axis][i] = static_cast<uint8_t>(lower);
+			current.mUpper[axis][i] = static_cast<uint8_t>(upper);
+		}
+	}
+
+	return nodeIndex;
+}
+
+
+template <uint32_t N>
+uint32_t host_wide_bvh<N>::create_block(const host_bvh &bvh, glm::uvec2 range)
+{
+	const auto &triangles = bvh.triangles();
+	const auto &primitiveIndices = bvh.primitive_indices();
+
+	uint32_t blockIndex = static_cast<uint32_t>(mBlocks.size());
+	triangle_block &block = mBlocks.emplace_back();
+
+	for (uint32_t lane = 0; lane < N; lane++) {
+		bool used = lane < range.y;
+		uint32_t i = range.x + lane;
+		for (int axis = 0; axis < 3; axis++) {
+			block.mV0[axis][lane] = used ? triangles[3 * i + 0][axis] : std::numeric_limits<float>::quiet_NaN();
+			block.mV1[axis][lane] = used ? triangles[3 * i + 1][axis] : std::numeric_limits<float>::quiet_NaN();
+			block.mV2[axis][lane] = used ? triangles[3 * i + 2][axis] : std::numeric_limits<float>::quiet_NaN();
+		}
+		block.mPrimitiveIndices[lane] = used ? primitiveIndices[i] : std::numeric_limits<uint32_t>::max();
+	}
+
+	return blockIndex;
+}
+
+
+template <uint32_t N>
+bool host_wide_bvh<N>::intersect(const host_ray &ray, float &tMax, uint32_t &primitiveIndex, glm::vec2 &barycentrics, bool anyHit) const
+{
+	if (mNodes.empty()) {
+		return false;
+	}
+
+	wide_bvh_query query;
+	query.mOrigin[0] = ray.mOrigin.x;
+	query.mOrigin[1] = ray.mOrigin.y;
+	query.mOrigin[2] = ray.mOrigin.z;
+	query.mDirection[0] = ray.mDirection.x;
+	query.mDirection[1] = ray.mDirection.y;
+	query.mDirection[2] = ray.mDirection.z;
+	query.mTMin = ray.mTMin;
+	query.mTMax = tMax;
+	query.mAnyHit = anyHit;
+
+	bool hit;
+	if constexpr (N == 8) {
+		hit = intersect_bvh8_avx2(mNodes.data(), mBlocks.data(), query);
+	}
+	else {
+		hit = intersect_bvh4_sse4(mNodes.data(), mBlocks.data(), query);
+	}
+
+	if (hit) {
+		tMax = query.mTMax;
+		primitiveIndex = query.mPrimitiveIndex;
+		barycentrics = glm::vec2(query.mBarycentrics[0], query.mBarycentrics[1]);
+	}
+	return hit;
+}
+
+
+template class host_wide_bvh<4>;
+template class host_wide_bvh<8>;
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "host_bvh.h"
+#include "host_wide_bvh_layout.hpp"
+
+#include <auto_vk_toolkit.hpp>
+
+
+/// <summary>
+/// N-ary BVH (BVH4 for the SSE4 kernel, BVH8 for the AVX2 kernel), collapsed from a binary host_bvh.
+/// Child bounds are quantized, nodes are cache line aligned and every leaf is one block of up to N triangles,
+/// which are tested at once with a watertight ray/triangle test.
+/// </summary>
+template <uint32_t N>
+class host_wide_bvh
+{
+public:
+	using node = wide_bvh_node<N>;
+	using triangle_block = wide_bvh_triangle_block<N>;
+
+	// Whether the CPU supports the instruction set of the kernel for this width
+	static bool supported();
+
+	void build(const host_bvh &bvh);
+
+	// Closest hit (or any hit if `anyHit` is set) within [mTMin, tMax], updates tMax on success.
+	bool intersect(const host_ray &ray, float &tMax, uint32_t &primitiveIndex, glm::vec2 &barycentrics, bool anyHit) const;
+
+	inline const std::vector<node> &nodes() const { return mNodes; }
+	inline const std::vector<triangle_block> &blocks() const { return mBlocks; }
+	inline bool empty() const { return mNodes.empty(); }
+
+private:
+	uint32_t create_node(const host_bvh &bvh, uint32_t binaryNode, const std::vector<glm::uvec2> &ranges);
+	uint32_t create_block(const host_bvh &bvh, glm::uvec2 range);
+
+	std::vector<node> mNodes;
+	std::vector<triangle_block> mBlocks;
+};
@@ -0,0 +1,45 @@
+// Compiled with /arch:AVX2 and without the precompiled header (see renderer.vcxproj). Only called after
+// host_wide_bvh<8>::supported() confirmed AVX2 and FMA at runtime, so keep this file free of other includes.
+#include "host_wide_bvh_kernels.hpp"
+
+#include <immintrin.h>
+
+
+namespace {
+	struct simd_avx2 {
+		static constexpr uint32_t WIDTH = 8;
+		using vfloat = __m256;
+
+		static vfloat zero() { return _mm256_setzero_ps(); }
+		static vfloat set1(float value) { return _mm256_set1_ps(value); }
+		static vfloat load(const float *values) { return _mm256_load_ps(values); }
+		static void store(float *values, vfloat v) { _mm256_store_ps(values, v); }
+		static vfloat load_u8(const uint8_t *values) {
+			return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(values))));
+		}
+
+		static vfloat add(vfloat a, vfloat b) { return _mm256_add_ps(a, b); }
+		static vfloat sub(vfloat a, vfloat b) { return _mm256_sub_ps(a, b); }
+		static vfloat mul(vfloat a, vfloat b) { return _mm256_mul_ps(a, b); }
+		static vfloat fmadd(vfloat a, vfloat b, vfloat c) { return _mm256_fmadd_ps(a, b, c); }
+		static vfloat min(vfloat a, vfloat b) { return _mm256_min_ps(a, b); }
+		static vfloat max(vfloat a, vfloat b) { return _mm256_max_ps(a, b); }
+
+		static vfloat cmplt(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+		static vfloat cmple(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+		static vfloat cmpgt(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+		static vfloat cmpge(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+
+		static vfloat and_(vfloat a, vfloat b) { return _mm256_and_ps(a, b); }
+		static vfloat or_(vfloat a, vfloat b) { return _mm256_or_ps(a, b); }
+		static vfloat xor_(vfloat a, vfloat b) { return _mm256_xor_ps(a, b); }
+		static vfloat andnot_(vfloat a, vfloat b) { return _mm256_andnot_ps(a, b); } // ~a & b
+		static int movemask(vfloat v) { return _mm256_movemask_ps(v); }
+	};
+}
+
+
+bool intersect_bvh8_avx2(const wide_bvh_node<8> *nodes, const wide_bvh_triangle_block<8> *blocks, wide_bvh_query &query)
+{
+	return wide_bvh_kernel<simd_avx2>::intersect(nodes, blocks, query);
+}
@@ -0,0 +1,217 @@
+#pragma once
+
+// Traversal of a wide_bvh_node<N> hierarchy, included by host_wide_bvh_sse4.cpp and host_wide_bvh_avx2.cpp only.
+// Each of them passes its own translation-unit-local SIMD wrapper as `S`. Everything in here is a template over `S` on purpose:
+// the instantiations then have internal linkage, so the linker can never pick an AVX2 compiled copy for the other kernels.
+#include "host_wide_bvh_layout.hpp"
+
+#include <cstring>
+
+template <typename S>
+struct wide_bvh_kernel
+{
+	static constexpr uint32_t N = S::WIDTH;
+
+	// Collapsing never adds levels, so the depth stays below host_bvh::MAX_STACK_SIZE, and every level pushes at most N entries
+	static constexpr int STACK_SIZE = 64 * N;
+
+	// Slab distances are widened by 2 * gamma(3) (see PBRT, 3rd ed., 3.9.2) to stay conservative despite rounding
+	static constexpr float ROUND_DOWN = 1.0f - 2.0f * 3.0f * 5.96046448e-08f;
+	static constexpr float ROUND_UP = 1.0f + 2.0f * 3.0f * 5.96046448e-08f;
+
+	struct stack_entry {
+		uint32_t mChild;
+		float mDistance;
+	};
+
+	// Per ray constants of the watertight ray/triangle test (Woop et al. 2013, "Watertight Ray/Triangle Intersection")
+	struct shear {
+		int kx, ky, kz;
+		float Sx, Sy, Sz;
+	};
+
+	static float power_of_two(int8_t exponent)
+	{
+		uint32_t bits = static_cast<uint32_t>(exponent + 127) << 23;
+		float result;
+		std::memcpy(&result, &bits, sizeof(result));
+		return result;
+	}
+
+	static bool intersect_block(const wide_bvh_triangle_block<N> &block, const shear &sh, wide_bvh_query &query)
+	{
+		using vfloat = typename S::vfloat;
+
+		const vfloat ox = S::set1(query.mOrigin[sh.kx]);
+		const vfloat oy = S::set1(query.mOrigin[sh.ky]);
+		const vfloat oz = S::set1(query.mOrigin[sh.kz]);
+		const vfloat Sx = S::set1(sh.Sx);
+		const vfloat Sy = S::set1(sh.Sy);
+		const vfloat Sz = S::set1(sh.Sz);
+
+		// vertices relative to the ray origin, sheared and scaled s.t. the ray points along +z
+		const vfloat az = S::sub(S::load(block.mV0[sh.kz]), oz);
+		const vfloat bz = S::sub(S::load(block.mV1[sh.kz]), oz);
+		const vfloat cz = S::sub(S::load(block.mV2[sh.kz]), oz);
+		const vfloat Ax = S::sub(S::sub(S::load(block.mV0[sh.kx]), ox), S::mul(Sx, az));
+		const vfloat Ay = S::sub(S::sub(S::load(block.mV0[sh.ky]), oy), S::mul(Sy, az));
+		const vfloat Bx = S::sub(S::sub(S::load(block.mV1[sh.kx]), ox), S::mul(Sx, bz));
+		const vfloat By = S::sub(S::sub(S::load(block.mV1[sh.ky]), oy), S::mul(Sy, bz));
+		const vfloat Cx = S::sub(S::sub(S::load(block.mV2[sh.kx]), ox), S::mul(Sx, cz));
+		const vfloat Cy = S::sub(S::sub(S::load(block.mV2[sh.ky]), oy), S::mul(Sy, cz));
+
+		// scaled barycentrics: U belongs to v0, V to v1 and W to v2
+		const vfloat U = S::sub(S::mul(Cx, By), S::mul(Cy, Bx));
+		const vfloat V = S::sub(S::mul(Ax, Cy), S::mul(Ay, Cx));
+		const vfloat W = S::sub(S::mul(Bx, Ay), S::mul(By, Ax));
+
+		const vfloat zero = S::zero();
+		const vfloat anyNegative = S::or_(S::or_(S::cmplt(U, zero), S::cmplt(V, zero)), S::cmplt(W, zero));
+		const vfloat anyPositive = S::or_(S::or_(S::cmpgt(U, zero), S::cmpgt(V, zero)), S::cmpgt(W, zero));
+
+		const vfloat det = S::add(S::add(U, V), W);
+		const vfloat T = S::add(S::add(S::mul(U, S::mul(Sz, az)), S::mul(V, S::mul(Sz, bz))), S::mul(W, S::mul(Sz, cz)));
+
+		// Compare T against [tMin, tMax] * det without dividing; NaN lanes fail all of these
+		const vfloat signMask = S::set1(-0.0f);
+		const vfloat absDet = S::andnot_(signMask, det);
+		const vfloat signedT = S::xor_(T, S::and_(det, signMask));
+		vfloat valid = S::andnot_(S::and_(anyNegative, anyPositive), S::cmpgt(absDet, zero));
+		valid = S::and_(valid, S::cmpge(signedT, S::mul(S::set1(query.mTMin), absDet)));
+		valid = S::and_(valid, S::cmple(signedT, S::mul(S::set1(query.mTMax), absDet)));
+
+		int mask = S::movemask(valid);
+		if (mask == 0) {
+			return false;
+		}
+
+		alignas(32) float lanesT[N];
+		alignas(32) float lanesV[N];
+		alignas(32) float lanesW[N];
+		alignas(32) float lanesDet[N];
+		S::store(lanesT, T);
+		S::store(lanesV, V);
+		S::store(lanesW, W);
+		S::store(lanesDet, det);
+
+		bool found = false;
+		for (uint32_t lane = 0; lane < N; lane++) {
+			if (((mask >> lane) & 1) == 0) {
+				continue;
+			}
+			float invDet = 1.0f / lanesDet[lane];
+			float t = lanesT[lane] * invDet;
+			if (t > query.mTMax) {
+				continue;
+			}
+			query.mTMax = t;
+			query.mPrimitiveIndex = block.mPrimitiveIndices[lane];
+			query.mBarycentrics[0] = lanesV[lane] * invDet;
+			query.mBarycentrics[1] = lanesW[lane] * invDet;
+			found = true;
+			if (query.mAnyHit) {
+				return true;
+			}
+		}
+		return found;
+	}
+
+	static bool intersect(const wide_bvh_node<N> *nodes, const wide_bvh_triangle_block<N> *blocks, wide_bvh_query &query)
+	{
+		using vfloat = typename S::vfloat;
+
+		float invDirection[3];
+		bool negative[3];
+		for (int axis = 0; axis < 3; axis++) {
+			// Avoid 0 * inf = NaN in the slab test for axis aligned rays
+			float d = query.mDirection[axis];
+			if (d > -1e-20f && d < 1e-20f) {
+				d = d < 0.0f ? -1e-20f : 1e-20f;
+			}
+			invDirection[axis] = 1.0f / d;
+			negative[axis] = invDirection[axis] < 0.0f;
+		}
+
+		shear sh;
+		float absX = query.mDirection[0] < 0.0f ? -query.mDirection[0] : query.mDirection[0];
+		float absY = query.mDirection[1] < 0.0f ? -query.mDirection[1] : query.mDirection[1];
+		float absZ = query.mDirection[2] < 0.0f ? -query.mDirection[2] : query.mDirection[2];
+		sh.kz = absX > absY ? (absX > absZ ? 0 : 2) : (absY > absZ ? 1 : 2);
+		sh.kx = (sh.kz + 1) % 3;
+		sh.ky = (sh.kx + 1) % 3;
+		if (query.mDirection[sh.kz] < 0.0f) {
+			int swap = sh.kx;
+			sh.kx = sh.ky;
+			sh.ky = swap;
+		}
+		sh.Sx = query.mDirection[sh.kx] / query.mDirection[sh.kz];
+		sh.Sy = query.mDirection[sh.ky] / query.mDirection[sh.kz];
+		sh.Sz = 1.0f / query.mDirection[sh.kz];
+
+		bool found = false;
+
+		stack_entry stack[STACK_SIZE];
+		int stackSize = 0;
+		stack[stackSize++] = { 0, query.mTMin };
+
+		while (stackSize > 0) {
+			const stack_entry entry = stack[--stackSize];
+			if (entry.mDistance > query.mTMax) {
+				continue;
+			}
+
+			if ((entry.mChild & WIDE_BVH_LEAF_FLAG) != 0) {
+				if (intersect_block(blocks[entry.mChild & ~WIDE_BVH_LEAF_FLAG], sh, query)) {
+					found = true;
+					if (query.mAnyHit) {
+						return true;
+					}
+				}
+				continue;
+			}
+
+			// Slab test against all children at once
+			const wide_bvh_node<N> &current = nodes[entry.mChild];
+			vfloat nearPlanes[3];
+			vfloat farPlanes[3];
+			for (int axis = 0; axis < 3; axis++) {
+				const vfloat scale = S::set1(power_of_two(current.mExponent[axis]) * invDirection[axis]);
+				const vfloat offset = S::set1((current.mOrigin[axis] - query.mOrigin[axis]) * invDirection[axis]);
+				nearPlanes[axis] = S::fmadd(S::load_u8(negative[axis] ? current.mUpper[axis] : current.mLower[axis]), scale, offset);
+				farPlanes[axis] = S::fmadd(S::load_u8(negative[axis] ? current.mLower[axis] : current.mUpper[axis]), scale, offset);
+			}
+			vfloat tNear = S::mul(S::max(S::max(nearPlanes[0], nearPlanes[1]), nearPlanes[2]), S::set1(ROUND_DOWN));
+			vfloat tFar = S::mul(S::min(S::min(farPlanes[0], farPlanes[1]), farPlanes[2]), S::set1(ROUND_UP));
+			tNear = S::max(tNear, S::set1(query.mTMin));
+			tFar = S::min(tFar, S::set1(query.mTMax));
+
+			int mask = S::movemask(S::cmple(tNear, tFar));
+			if (mask == 0) {
+				continue;
+			}
+
+			alignas(32) float distances[N];
+			S::store(distances, tNear);
+
+			// Sort the hit children far to near, so that the nearest one ends up on top of the stack
+			stack_entry hits[N];
+			int hitCount = 0;
+			for (uint32_t i = 0; i < current.mChildCount; i++) {
+				if (((mask >> i) & 1) == 0) {
+					continue;
+				}
+				int j = hitCount++;
+				while (j > 0 && hits[j - 1].mDistance < distances[i]) {
+					hits[j] = hits[j - 1];
+					j--;
+				}
+				hits[j] = { current.mChildren[i], distances[i] };
+			}
+			for (int i = 0; i < hitCount; i++) {
+				stack[stackSize++] = hits[i];
+			}
+		}
+
+		return found;
+	}
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+// Plain data shared by host_wide_bvh and the SIMD kernels. It must not depend on glm or any other header with inline functions,
+// because host_wide_bvh_avx2.cpp is compiled with a different instruction set and without the precompiled header.
+#include <cstdint>
+
+constexpr uint32_t WIDE_BVH_EMPTY_CHILD = 0xFFFFFFFFu;
+constexpr uint32_t WIDE_BVH_LEAF_FLAG = 0x80000000u;
+
+/// <summary>
+/// Node with N children whose bounds are quantized to 8 bits: child bounds are mOrigin + q * 2^mExponent per axis,
+/// rounded outwards. 64 bytes for N = 4, 128 bytes for N = 8, always starting at a cache line.
+/// </summary>
+template <uint32_t N>
+struct alignas(64) wide_bvh_node {
+	float mOrigin[3];
+	int8_t mExponent[3];
+	uint8_t mChildCount;
+	uint8_t mLower[3][N];
+	uint8_t mUpper[3][N];
+	uint32_t mChildren[N]; // index of an inner node, WIDE_BVH_LEAF_FLAG | index of a triangle block, or WIDE_BVH_EMPTY_CHILD
+};
+
+/// <summary>
+/// The triangles of one leaf in SoA layout, s.t. all N of them are tested at once. Unused lanes hold NaNs which never hit.
+/// </summary>
+template <uint32_t N>
+struct alignas(32) wide_bvh_triangle_block {
+	float mV0[3][N];
+	float mV1[3][N];
+	float mV2[3][N];
+	uint32_t mPrimitiveIndices[N];
+};
+
+struct wide_bvh_query {
+	float mOrigin[3];
+	float mDirection[3];
+	float mTMin;
+	float mTMax; // shortened to the closest hit
+	bool mAnyHit; // terminate on first hit
+
+	uint32_t mPrimitiveIndex;
+	float mBarycentrics[2];
+};
+
+// Closest (or any) hit within [mTMin, mTMax], see host_wide_bvh_kernels.hpp.
+bool intersect_bvh4_sse4(const wide_bvh_node<4> *nodes, const wide_bvh_triangle_block<4> *blocks, wide_bvh_query &query);
+bool intersect_bvh8_avx2(const wide_bvh_node<8> *nodes, const wide_bvh_triangle_block<8> *blocks, wide_bvh_query &query);
@@ -0,0 +1,46 @@
+#include "host_wide_bvh_kernels.hpp"
+
+#include <smmintrin.h>
+
+
+namespace {
+	// 4 lanes with SSE4.1, which every x64 CPU of the last decade supports (checked by host_wide_bvh<4>::supported)
+	struct simd_sse4 {
+		static constexpr uint32_t WIDTH = 4;
+		using vfloat = __m128;
+
+		static vfloat zero() { return _mm_setzero_ps(); }
+		static vfloat set1(float value) { return _mm_set1_ps(value); }
+		static vfloat load(const float *values) { return _mm_load_ps(values); }
+		static void store(float *values, vfloat v) { _mm_store_ps(values, v); }
+		static vfloat load_u8(const uint8_t *values) {
+			int32_t packed;
+			std::memcpy(&packed, values, sizeof(packed));
+			return _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(packed)));
+		}
+
+		static vfloat add(vfloat a, vfloat b) { return _mm_add_ps(a, b); }
+		static vfloat sub(vfloat a, vfloat b) { return _mm_sub_ps(a, b); }
+		static vfloat mul(vfloat a, vfloat b) { return _mm_mul_ps(a, b); }
+		static vfloat fmadd(vfloat a, vfloat b, vfloat c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+		static vfloat min(vfloat a, vfloat b) { return _mm_min_ps(a, b); }
+		static vfloat max(vfloat a, vfloat b) { return _mm_max_ps(a, b); }
+
+		static vfloat cmplt(vfloat a, vfloat b) { return _mm_cmplt_ps(a, b); }
+		static vfloat cmple(vfloat a, vfloat b) { return _mm_cmple_ps(a, b); }
+		static vfloat cmpgt(vfloat a, vfloat b) { return _mm_cmpgt_ps(a, b); }
+		static vfloat cmpge(vfloat a, vfloat b) { return _mm_cmpge_ps(a, b); }
+
+		static vfloat and_(vfloat a, vfloat b) { return _mm_and_ps(a, b); }
+		static vfloat or_(vfloat a, vfloat b) { return _mm_or_ps(a, b); }
+		static vfloat xor_(vfloat a, vfloat b) { return _mm_xor_ps(a, b); }
+		static vfloat andnot_(vfloat a, vfloat b) { return _mm_andnot_ps(a, b); } // ~a & b
+		static int movemask(vfloat v) { return _mm_movemask_ps(v); }
+	};
+}
+
+
+bool intersect_bvh4_sse4(const wide_bvh_node<4> *nodes, const wide_bvh_triangle_block<4> *blocks, wide_bvh_query &query)
+{
+	return wide_bvh_kernel<simd_sse4>::intersect(nodes, blocks, query);
+}
@@ -1,25 +1,61 @@
 
 
 #include "renderer.h"
+#include "render_settings.h"
+#include "cpu_path_tracer.h"
+#include "bvh_benchmark.h"
+#include "scene_cache_benchmark.h"
 
 
-int main() {
+int main(int argc, char *argv[]) {
 
 	int result = EXIT_FAILURE;
 
+	std::optional<render_settings> settings = render_settings::parse_command_line(argc, argv);
+	if (!settings) {
+		return result;
+	}
+
+	if (settings->mBvhBenchmark) {
+		return bvh_benchmark::run(*settings);
+	}
+
+	if (settings->mSceneCacheBenchmark) {
+		return scene_cache_benchmark::run(*settings);
+	}
+
+	if (settings->mCpuReference) {
+		// Neither a window nor a Vulkan device is needed for the CPU reference
+		return cpu_path_tracer::render_to_file(*settings);
+	}
+
+#ifdef GLFW_PLATFORM_NULL
+	// The context initializes GLFW on first use. Headless render nodes usually have no display at all,
+	// so ask for GLFW's null platform before that happens (only available since GLFW 3.4).
+	if (settings->mHeadless) {
+		glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+	}
+#endif
+
 	try {
-		avk::window* mainWnd = avk::context().create_window("Renderer");
-		mainWnd->set_resolution({ 960, 540 }); //1920, 1080
-		mainWnd->enable_resizing(false);
-		mainWnd->set_presentaton_mode(avk::presentation_mode::mailbox);
-		mainWnd->set_number_of_concurrent_frames(1u);
-		mainWnd->open();
+		avk::window* mainWnd = nullptr;
+		if (!settings->mHeadless) {
+			mainWnd = avk::context().create_window("Renderer");
+			mainWnd->set_resolution({ 960, 540 }); //1920, 1080
+			mainWnd->enable_resizing(false);
+			mainWnd->set_presentaton_mode(avk::presentation_mode::mailbox);
+			mainWnd->set_number_of_concurrent_frames(1u);
+			mainWnd->open();
+		}
 
+		// Without a window, no presentation support is required from the queue:
 		avk::queue& singleQueue = avk::context().create_queue({}, avk::queue_selection_preference::versatile_queue, mainWnd);
-		mainWnd->set_queue_family_ownership(singleQueue.family_index());
-		mainWnd->set_present_queue(singleQueue);
+		if (mainWnd) {
+			mainWnd->set_queue_family_ownership(singleQueue.family_index());
+			mainWnd->set_present_queue(singleQueue);
+		}
 
-		renderer app = renderer(singleQueue, { 3840, 2160 });
+		renderer app = renderer(singleQueue, *settings);
 
 		auto composition = configure_and_compose(
 			avk::application_name("Renderer"),
@@ -32,6 +68,11 @@ int main() {
 				.add_extension(VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME)
 				.add_extension(VK_KHR_DEFERRED_HOST_OPERATIONS_EXTENSION_NAME)
 				.add_extension(VK_KHR_GET_MEMORY_REQUIREMENTS_2_EXTENSION_NAME),
+			[](vk::PhysicalDeviceFeatures& aPhysicalDeviceFeatures) {
+				// The scene cache stores BC1/BC5/BC7 textures. Only enabled where available, otherwise the texture_uploader decodes them to RGBA8:
+				vk::PhysicalDeviceFeatures supported = avk::context().physical_device().getFeatures(avk::context().dispatch_loader_core());
+				aPhysicalDeviceFeatures.setTextureCompressionBC(supported.textureCompressionBC);
+			},
 			[](vk::PhysicalDeviceVulkan12Features& aVulkan12Featues) {
 				// Also this Vulkan 1.2 feature is required for ray tracing:
 				aVulkan12Featues.setBufferDeviceAddress(VK_TRUE);
@@ -74,10 +115,13 @@ int main() {
 				});
 			}
 		);
-		result = EXIT_SUCCESS;
+		result = app.succeeded() ? EXIT_SUCCESS : EXIT_FAILURE;
 	}
 	catch (avk::logic_error&) {}
 	catch (avk::runtime_error&) {}
+	catch (std::runtime_error& e) {
+		std::cerr << e.what() << std::endl;
+	}
 
 	return result;
 }
\ No newline at end of file
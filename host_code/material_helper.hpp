@@ -1,6 +1,8 @@
 #pragma once
 
 #include "compressed_image_data.hpp"
+#include "host_texture.hpp"
+#include "scene_cache.h"
 
 #include <auto_vk_toolkit.hpp>
 #include <material_image_helpers.hpp>
@@ -8,27 +10,207 @@
 
 
 /// <summary>
-/// Effectively identical to `convert_for_gpu_usage_cached` from `material_image_helpers.hpp` just wrapped in a class.
-/// The notable change is the use of the `compressed_image_data` to use the images already loaded from assimp.
-/// Every other change is just cutting down complexity of the function, e.g. removing the serializer.
+/// Derived from `convert_for_gpu_usage_cached` from `material_image_helpers.hpp`, split into the part which determines the
+/// material data and images of a model for the `scene_cache` and the parts which turn a cache into image samplers for the
+/// GPU or host textures for the CPU path tracer. The embedded images are referenced straight from assimp.
 /// </summary>
 class material_helper {
 
+	/// <summary>
+	/// The material data together with all places which still need a texture index assigned.
+	/// The usage-pointers point into `mMaterials`, so this must only ever be moved, never copied.
+	/// </summary>
+	struct texture_usages {
+		std::vector<avk::material_gpu_data> mMaterials;
+
+		// These are the texture names loaded from file -> mapped to vector of usage-pointers
+		std::unordered_map<std::string, std::vector<std::tuple<std::array<avk::border_handling_mode, 2>, std::vector<int *>>>> mTexNamesToBorderHandlingToUsages;
+
+		// However, if some textures are missing, provide 1x1 px textures in those spots
+		std::vector<int *> mWhiteTexUsages;				// Provide a 1x1 px almost everywhere in those cases,
+		std::vector<int *> mStraightUpNormalTexUsages;	// except for normal maps, provide a normal pointing straight up there.
+	};
+
   public:
 
-	static std::tuple<std::vector<avk::material_gpu_data>, std::vector<avk::image_sampler>, avk::command::action_type_command> convert_for_gpu_usage(
+	/// <summary>
+	/// Where the texels of an image of the `scene_cache` come from
+	/// </summary>
+	struct image_source {
+		aiTexture *mTexture;    // compressed embedded image, nullptr for the 1x1 px images
+		glm::u8vec4 mColor;     // the texel of the 1x1 px images
+		texture_format mFormat; // how the scene cache stores it, see texture_format_for_usages
+	};
+
+	/// <summary>
+	/// The material data, the images and one sampler for every image sampler of the model, in the order of
+	/// `convert_for_gpu_usage_cached`. Hence, texture indices match.
+	/// This is what `scene_cache` stores, the images are decoded there. With `textureCompression`, every embedded image gets
+	/// the block compressed format of its role, otherwise all of them stay RGBA8.
+	/// </summary>
+	static std::tuple<std::vector<avk::material_gpu_data>, std::vector<image_source>, std::vector<scene_cache::sampler>> gather_images_for_cache(
 		  const aiScene *scene,
 		  std::vector<avk::material_config> &allMatConfigs,
+		  size_t materialIndexOffset,
+		  bool textureCompression
+	) {
+		texture_usages texUsages = gather_texture_usages(allMatConfigs);
+
+		std::vector<image_source> images;
+		std::vector<scene_cache::sampler> samplers;
+
+		auto assignIndex = [&](const std::vector<int *> &bUsages) {
+			int index = static_cast<int>(samplers.size() - 1);
+			for (auto *img : bUsages) {
+				*img = materialIndexOffset + index;
+			}
+		};
+
+		if (!texUsages.mWhiteTexUsages.empty()) {
+			images.push_back({ nullptr, {255, 255, 255, 255}, texture_format::rgba8 });
+			samplers.push_back({ static_cast<uint32_t>(images.size() - 1), { avk::border_handling_mode::repeat, avk::border_handling_mode::repeat }, true });
+			assignIndex(texUsages.mWhiteTexUsages);
+		}
+
+		if (!texUsages.mStraightUpNormalTexUsages.empty()) {
+			images.push_back({ nullptr, {127, 127, 255, 0}, texture_format::rgba8 });
+			samplers.push_back({ static_cast<uint32_t>(images.size() - 1), { avk::border_handling_mode::repeat, avk::border_handling_mode::repeat }, true });
+			assignIndex(texUsages.mStraightUpNormalTexUsages);
+		}
+
+		// Same iteration order as in convert_for_gpu_usage_cached => same indices
+		for (auto &pair : texUsages.mTexNamesToBorderHandlingToUsages) {
+			unsigned int textureIndex = embedded_texture_index(pair.first);
+			assert(textureIndex < scene->mNumTextures);
+
+			std::vector<int *> allUsages;
+			for (auto &[bhModes, bUsages] : pair.second) {
+				allUsages.insert(allUsages.end(), bUsages.begin(), bUsages.end());
+			}
+			texture_format format = textureCompression ? texture_format_for_usages(texUsages.mMaterials, allUsages) : texture_format::rgba8;
+
+			images.push_back({ scene->mTextures[textureIndex], {}, format });
+			for (auto &[bhModes, bUsages] : pair.second) {
+				samplers.push_back({ static_cast<uint32_t>(images.size() - 1), bhModes, false });
+				assignIndex(bUsages);
+			}
+		}
+
+		return std::make_tuple(std::move(texUsages.mMaterials), std::move(images), std::move(samplers));
+	}
+
+	/// <summary>
+	/// The material data and image samplers of a `scene_cache` whose images have already been uploaded by a
+	/// `texture_uploader`: `imageViews` holds one view per image of the cache.
+	/// </summary>
+	static std::tuple<std::vector<avk::material_gpu_data>, std::vector<avk::image_sampler>> convert_for_gpu_usage(
+		  const scene_cache &cache,
+		  std::vector<avk::image_view> imageViews,
 		  size_t materialIndexOffset
 	) {
+		assert(imageViews.size() == cache.images().size());
+
+		// The image view is shared among all samplers of an image:
+		std::vector<int> numDifferentSamplers(cache.images().size(), 0);
+		for (const auto &smplr : cache.samplers()) {
+			numDifferentSamplers[smplr.mImageIndex]++;
+		}
 
-		avk::image_usage imageUsage = avk::image_usage::general_texture;
-		avk::filter_mode textureFilterMode = avk::filter_mode::trilinear;
+		std::vector<avk::image_sampler> imageSamplers;
+		imageSamplers.reserve(cache.samplers().size());
 
-		avk::command::action_type_command commandsToReturn{};
+		for (const auto &smplr : cache.samplers()) {
+			auto &imgView = imageViews[smplr.mImageIndex];
 
-		// These are the texture names loaded from file -> mapped to vector of usage-pointers
-		std::unordered_map<std::string, std::vector<std::tuple<std::array<avk::border_handling_mode, 2>, std::vector<int *>>>> texNamesToBorderHandlingToUsages;
+			avk::sampler sampler = avk::context().create_sampler(smplr.mNearestNeighbor ? avk::filter_mode::nearest_neighbor : avk::filter_mode::trilinear, smplr.mBorderHandlingModes);
+			if (numDifferentSamplers[smplr.mImageIndex] > 1) {
+				imageSamplers.push_back(avk::context().create_image_sampler(imgView, std::move(sampler)));
+			}
+			else {
+				imageSamplers.push_back(avk::context().create_image_sampler(std::move(imgView), std::move(sampler)));
+			}
+		}
+
+		return std::make_tuple(cache.materials(static_cast<int>(materialIndexOffset)), std::move(imageSamplers));
+	}
+
+	/// <summary>
+	/// Host-side twin of `convert_for_gpu_usage` for the CPU path tracer: identical material data
+	/// and one `host_texture` for every image sampler, in the same order. No Vulkan device is required.
+	/// </summary>
+	static std::tuple<std::vector<avk::material_gpu_data>, std::vector<host_texture>> convert_for_host_usage(
+		  const scene_cache &cache,
+		  size_t materialIndexOffset
+	) {
+		std::vector<std::shared_ptr<const host_image>> images;
+		images.reserve(cache.images().size());
+		for (const auto &img : cache.images()) {
+			auto image = std::make_shared<host_image>();
+			image->mWidth = img.mWidth;
+			image->mHeight = img.mHeight;
+			image->mLevelCount = img.mLevelCount;
+			// Block compressed levels are decoded, s.t. the CPU path tracer sees the same texels as the GPU
+			image->mTexels.resize(mip_chain::texel_count(img.mWidth, img.mHeight));
+			for (uint32_t level = 0; level < img.mLevelCount; level++) {
+				glm::uvec2 extent = mip_chain::level_extent(img.mWidth, img.mHeight, level);
+				image->mLevelOffsets.push_back(mip_chain::level_offset(img.mWidth, img.mHeight, level));
+				texture_compression::decode(img.mFormat, extent.x, extent.y, img.level(level).data(), image->mTexels.data() + image->mLevelOffsets.back());
+			}
+			images.push_back(std::move(image));
+		}
+
+		std::vector<host_texture> textures;
+		textures.reserve(cache.samplers().size());
+		for (const auto &smplr : cache.samplers()) {
+			textures.push_back({ images[smplr.mImageIndex], smplr.mBorderHandlingModes, smplr.mNearestNeighbor });
+		}
+
+		return std::make_tuple(cache.materials(static_cast<int>(materialIndexOffset)), std::move(textures));
+	}
+
+  private:
+
+	// The role of an image follows from the material fields it is referenced by. Images with several roles stay uncompressed.
+	static texture_format texture_format_for_usages(const std::vector<avk::material_gpu_data> &materials, const std::vector<int *> &usages)
+	{
+		auto fieldOf = [&](const int *usage) {
+			return (reinterpret_cast<const char *>(usage) - reinterpret_cast<const char *>(materials.data())) % sizeof(avk::material_gpu_data);
+		};
+		auto allOf = [&](size_t field) {
+			return std::all_of(usages.begin(), usages.end(), [&](const int *usage) { return fieldOf(usage) == field; });
+		};
+		auto noneOf = [&](size_t field) {
+			return std::none_of(usages.begin(), usages.end(), [&](const int *usage) { return fieldOf(usage) == field; });
+		};
+
+		const size_t normals = offsetof(avk::material_gpu_data, mNormalsTexIndex);
+		const size_t lightmap = offsetof(avk::material_gpu_data, mLightmapTexIndex); // packed ambient occlusion, roughness, metalness
+		if (allOf(normals)) {
+			return texture_format::bc5;
+		}
+		if (allOf(lightmap)) {
+			return texture_format::bc1;
+		}
+		if (noneOf(normals) && noneOf(lightmap)) {
+			return texture_format::bc7;
+		}
+		return texture_format::rgba8;
+	}
+
+	// Embedded textures are referenced as "<file>/*<index>"
+	static unsigned int embedded_texture_index(const std::string &path)
+	{
+		std::string delimiter = "/*";
+		std::string pathNumber = path.substr(path.find(delimiter) + delimiter.length());
+		return std::stoi(pathNumber);
+	}
+
+	static texture_usages gather_texture_usages(std::vector<avk::material_config> &allMatConfigs)
+	{
+		texture_usages gathered;
+		auto &texNamesToBorderHandlingToUsages = gathered.mTexNamesToBorderHandlingToUsages;
+		auto &whiteTexUsages = gathered.mWhiteTexUsages;
+		auto &straightUpNormalTexUsages = gathered.mStraightUpNormalTexUsages;
 
 		auto addTexUsage = [&texNamesToBorderHandlingToUsages](const std::string &bPath, const std::array<avk::border_handling_mode, 2> &bBhMode, int *bUsage) {
 			auto &vct = texNamesToBorderHandlingToUsages[bPath];
@@ -42,11 +224,7 @@ class material_helper {
 			vct.emplace_back(bBhMode, std::vector<int *>{ bUsage });
 			};
 
-		// However, if some textures are missing, provide 1x1 px textures in those spots
-		std::vector<int *> whiteTexUsages;				// Provide a 1x1 px almost everywhere in those cases,
-		std::vector<int *> straightUpNormalTexUsages;	// except for normal maps, provide a normal pointing straight up there.
-
-		std::vector<avk::material_gpu_data> result;
+		std::vector<avk::material_gpu_data> &result = gathered.mMaterials;
 		
 		size_t materialConfigSize = allMatConfigs.size();
 		result.reserve(materialConfigSize); // important because of the pointers
@@ -195,105 +373,6 @@ class material_helper {
 			mgd.mExtraTexOffsetTiling = mc.mExtraTexOffsetTiling;
 		}
 
-		size_t numTexUsages = 0;
-		for (const auto &entry : texNamesToBorderHandlingToUsages) {
-			numTexUsages += entry.second.size();
-		}
-
-		size_t numWhiteTexUsages = whiteTexUsages.empty() ? 0 : 1;
-		size_t numStraightUpNormalTexUsages = (straightUpNormalTexUsages.empty() ? 0 : 1);
-		size_t numTexNamesToBorderHandlingToUsages = texNamesToBorderHandlingToUsages.size();
-		auto numImageViews = numTexNamesToBorderHandlingToUsages + numWhiteTexUsages + numStraightUpNormalTexUsages;
-
-		const auto numSamplers = numTexUsages + numWhiteTexUsages + numStraightUpNormalTexUsages;
-		std::vector<avk::image_sampler> imageSamplers;
-		imageSamplers.reserve(numSamplers);
-
-		// Create the white texture and assign its index to all usages
-		if (numWhiteTexUsages > 0) {
-			auto [tex, cmds] = avk::create_1px_texture({255, 255, 255, 255}, avk::layout::shader_read_only_optimal, vk::Format::eR8G8B8A8Unorm, avk::memory_usage::device, imageUsage);
-			commandsToReturn.mNestedCommandsAndSyncInstructions.push_back(std::move(cmds));
-			auto imgView = avk::context().create_image_view(std::move(tex));
-			avk::sampler smplr;
-
-			smplr = avk::context().create_sampler(avk::filter_mode::nearest_neighbor, avk::border_handling_mode::repeat);
-			
-			imageSamplers.push_back(avk::context().create_image_sampler(std::move(imgView), std::move(smplr)));
-
-			int index = static_cast<int>(imageSamplers.size() - 1);
-			for (auto *img : whiteTexUsages) {
-				*img = materialIndexOffset + index;
-			}
-		}
-
-		// Create the normal texture, containing a normal pointing straight up, and assign to all usages
-		if (numStraightUpNormalTexUsages > 0) {
-			auto [tex, cmds] = avk::create_1px_texture({127, 127, 255, 0}, avk::layout::shader_read_only_optimal, vk::Format::eR8G8B8A8Unorm, avk::memory_usage::device, imageUsage);
-			commandsToReturn.mNestedCommandsAndSyncInstructions.push_back(std::move(cmds));
-			auto imgView = avk::context().create_image_view(std::move(tex));
-			avk::sampler smplr;
-
-			smplr = avk::context().create_sampler(avk::filter_mode::nearest_neighbor, avk::border_handling_mode::repeat);
-
-			imageSamplers.push_back(avk::context().create_image_sampler(std::move(imgView), std::move(smplr)));
-
-			// Assign this image_sampler's index wherever it is referenced:
-
-			int index = static_cast<int>(imageSamplers.size() - 1);
-			for (auto *img : straightUpNormalTexUsages) {
-				*img = materialIndexOffset + index;
-			}
-		}
-
-		// Load all the images from file, and assign them to all usages
-		for (auto &pair : texNamesToBorderHandlingToUsages) {
-			assert(!pair.first.empty());
-			
-			std::string path = pair.first;
-			std::string delimiter = "/*";
-			std::string pathNumber = path.substr(path.find(delimiter) + delimiter.length());
-			unsigned int textureIndex = std::stoi(pathNumber);
-
-			assert(textureIndex < scene->mNumTextures);
-
-			aiTexture* compressedData = scene->mTextures[textureIndex];
-			conpressed_image_data imageData(compressedData, false, false, true, 4);
-			auto [tex, cmds] = avk::create_image_from_image_data_cached(imageData, avk::layout::shader_read_only_optimal, avk::memory_usage::device, imageUsage);
-
-			commandsToReturn.mNestedCommandsAndSyncInstructions.push_back(std::move(cmds));
-			auto imgView = avk::context().create_image_view(std::move(tex));
-			assert(!pair.second.empty());
-
-			// It is now possible that an image can be referenced from different samplers, which adds support for different
-			// usages of an image, e.g. once it is used as a tiled texture, at a different place it is clamped to edge, etc.
-			// If we are serializing, we need to store how many different samplers are referencing the image:
-			auto numDifferentSamplers = static_cast<int>(pair.second.size());
-
-			// There can be different border handling types specified for the textures
-			for (auto &[bhModes, usages] : pair.second) {
-				assert(!usages.empty());
-
-				avk::sampler smplr;
-				smplr = avk::context().create_sampler(textureFilterMode, bhModes);
-
-				if (numDifferentSamplers > 1) {
-					// If we indeed have different border handling modes, create multiple samplers and share the image view resource among them:
-					imageSamplers.push_back(avk::context().create_image_sampler(imgView, std::move(smplr)));
-				}
-				else {
-					// There is only one border handling mode:
-					imageSamplers.push_back(avk::context().create_image_sampler(std::move(imgView), std::move(smplr)));
-				}
-
-				// Assign the texture usages:
-				auto index = static_cast<int>(imageSamplers.size() - 1);
-				for (auto *img : usages) {
-					*img = materialIndexOffset + index;
-				}
-			}
-		}
-
-		// Hand over ownership to the caller
-		return std::make_tuple(std::move(result), std::move(imageSamplers), std::move(commandsToReturn));
+		return gathered;
 	}
 };
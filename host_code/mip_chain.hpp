@@ -0,0 +1,70 @@
+#pragma once
+
+#include <auto_vk_toolkit.hpp>
+
+/// <summary>
+/// Layout of the full mip chains stored by `scene_cache` and used by `host_texture` and `texture_uploader`: all levels are
+/// tightly packed one after another, level 0 first. Every level is half the size of the previous one (rounded down, at least 1)
+/// down to 1x1, which is the same chain Vulkan expects for an image with `mip_level_count` levels.
+/// </summary>
+namespace mip_chain {
+
+	inline uint32_t level_count(uint32_t width, uint32_t height)
+	{
+		uint32_t levels = 1;
+		for (uint32_t size = std::max(width, height); size > 1; size /= 2) {
+			levels++;
+		}
+		return levels;
+	}
+
+	inline glm::uvec2 level_extent(uint32_t width, uint32_t height, uint32_t level)
+	{
+		return glm::uvec2(std::max(1u, width >> level), std::max(1u, height >> level));
+	}
+
+	// Index of the first texel of `level` within the chain
+	inline size_t level_offset(uint32_t width, uint32_t height, uint32_t level)
+	{
+		size_t offset = 0;
+		for (uint32_t l = 0; l < level; l++) {
+			glm::uvec2 extent = level_extent(width, height, l);
+			offset += static_cast<size_t>(extent.x) * extent.y;
+		}
+		return offset;
+	}
+
+	inline size_t texel_count(uint32_t width, uint32_t height)
+	{
+		return level_offset(width, height, level_count(width, height));
+	}
+
+	// Fills levels 1 to n-1 of `chain` from level 0 with a 2x2 box filter. For odd sizes the last row or column is
+	// clamped, like a linear blit does it.
+	inline void generate(uint32_t width, uint32_t height, glm::u8vec4 *chain)
+	{
+		const glm::u8vec4 *source = chain;
+		glm::uvec2 sourceExtent(width, height);
+		uint32_t levels = level_count(width, height);
+
+		for (uint32_t level = 1; level < levels; level++) {
+			glm::u8vec4 *destination = chain + level_offset(width, height, level);
+			glm::uvec2 extent = level_extent(width, height, level);
+
+			for (uint32_t y = 0; y < extent.y; y++) {
+				uint32_t y0 = std::min(2 * y, sourceExtent.y - 1);
+				uint32_t y1 = std::min(2 * y + 1, sourceExtent.y - 1);
+				for (uint32_t x = 0; x < extent.x; x++) {
+					uint32_t x0 = std::min(2 * x, sourceExtent.x - 1);
+					uint32_t x1 = std::min(2 * x + 1, sourceExtent.x - 1);
+					glm::uvec4 sum = glm::uvec4(source[y0 * sourceExtent.x + x0]) + glm::uvec4(source[y0 * sourceExtent.x + x1])
+						+ glm::uvec4(source[y1 * sourceExtent.x + x0]) + glm::uvec4(source[y1 * sourceExtent.x + x1]);
+					destination[y * extent.x + x] = glm::u8vec4((sum + 2u) / 4u);
+				}
+			}
+
+			source = destination;
+			sourceExtent = extent;
+		}
+	}
+}
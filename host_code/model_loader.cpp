@@ -1,6 +1,7 @@
 #include "model_loader.h"
 
 #include "material_helper.hpp"
+#include "texture_uploader.h"
 #include "..\third_party\INIReader.h"
 
 #include <model.hpp>
@@ -9,35 +10,128 @@
 #include <conversion_utils.hpp>
 
 
+namespace {
+	// Device buffer over an array of the scene cache, described by every one of `Metas` as an array of `T`. The returned
+	// command uploads straight from the mapping of the cache file.
+	template <typename T, typename... Metas>
+	std::tuple<avk::buffer, avk::command::action_type_command> create_buffer_from_cache(std::span<const T> data, avk::content_description content)
+	{
+		avk::buffer result = avk::context().create_buffer(
+			avk::memory_usage::device, {},
+			Metas::create_from_element_size(sizeof(T), data.size()).describe_only_member(T{}, content)...
+		);
+		auto command = result->fill(data.data(), 0);
+		return std::make_tuple(std::move(result), std::move(command));
+	}
+}
+
+
 model_loader::model_loader(avk::queue *aQueue)
 	: mQueue{aQueue}
+	, mBlas{*aQueue}
 {}
 
 
 void model_loader::load_models_from_ini(
-	std::string iniPath
+	const render_settings &settings
 ) {
 
 	std::vector<avk::material_gpu_data> gpuMaterials;
 	std::vector<avk::image_sampler> imageSamplers;
-	avk::command::action_type_command materialCommands;
+	size_t materialIndexOffset = 0;
 	size_t modelIndex = 0;
 
-	INIReader reader(iniPath);
+	// The textures of all models are uploaded together, straight from the mapped cache files, which stay open until then
+	std::vector<scene_cache> caches;
+	std::vector<size_t> firstImageOfModel;
+	texture_uploader uploader(*mQueue, settings);
+	std::vector<texture_timing> textureTimings;
+
+	INIReader reader(settings.mScenePath);
 	std::set<std::string> sections = reader.Sections();
 	for (std::set<std::string>::iterator it = sections.begin(); it != sections.end(); ++it)
 	{
+		if (*it == environment_map::INI_SECTION) {
+			continue;
+		}
 		std::string modelGLBPath = reader.Get(*it, "path", "");
 		// TODO add model position and scale
 
-		auto [gpuMaterialsData, imageSamplersData, materialCommandsData] = load_single_model(modelGLBPath, imageSamplers.size(), gpuMaterials.size(), modelIndex);
+		const scene_cache &cache = caches.emplace_back(scene_cache::open(modelGLBPath, settings));
+		cache.print_statistics();
+		mSceneHash = (mSceneHash ^ cache.hash()) * 1099511628211ull; // FNV-1a over the models in the order they are loaded
+		textureTimings.insert(textureTimings.end(), cache.decode_timings().begin(), cache.decode_timings().end());
+
+		load_single_model(cache, materialIndexOffset, modelIndex);
+		materialIndexOffset += cache.material_count();
+
+		std::string modelName = std::filesystem::path(modelGLBPath).filename().string();
+		firstImageOfModel.push_back(uploader.size());
+		for (uint32_t i = 0; i < cache.images().size(); i++) {
+			uploader.add(cache.images()[i], modelName, i);
+		}
+
+		modelIndex++;
+	}
+
+	// All geometry uploads and BLAS builds of the whole ini at once
+	mBlas.build();
+
+	size_t vertexCount = 0;
+	for (const scene_cache &cache : caches) {
+		for (const auto &dc : cache.draw_calls()) {
+			vertexCount += dc.mVertices.size();
+		}
+	}
+	printf("Vertex attributes: %.1f MiB interleaved and quantized instead of %.1f MiB as separate float arrays (positions: %.1f MiB)\n",
+		vertexCount * sizeof(vertex_layout::packed_vertex) / (1024.0 * 1024.0),
+		vertexCount * (sizeof(glm::vec2) + 3 * sizeof(glm::vec3)) / (1024.0 * 1024.0),
+		vertexCount * sizeof(glm::vec3) / (1024.0 * 1024.0));
+	for (size_t i = 0; i < mBlas.size(); i++) {
+		mAllGeometryInstances.push_back(
+			mBlas.geometry_instance(i)
+			// Set this instance's custom index, which is especially important since we'll use it in shaders
+			// to refer to the right material and also vertex data (these two are aligned index-wise):
+			.set_custom_index(static_cast<uint32_t>(i))
+		);
+	}
+
+	std::vector<avk::image_view> imageViews = uploader.upload();
+	textureTimings.insert(textureTimings.end(), uploader.timings().begin(), uploader.timings().end());
+	if (!settings.mTextureLogPath.empty() && !texture_timing::write_csv(settings.mTextureLogPath, textureTimings)) {
+		std::cerr << "Could not write " << settings.mTextureLogPath << std::endl;
+	}
+
+	// For all the different materials, transfer them in structs which are well suited for GPU-usage
+	// and provide access to the uploaded images via samplers:
+	for (size_t m = 0; m < caches.size(); m++) {
+		auto firstImage = imageViews.begin() + firstImageOfModel[m];
+		std::vector<avk::image_view> modelImageViews(std::make_move_iterator(firstImage), std::make_move_iterator(firstImage + caches[m].images().size()));
+
+		auto [gpuMaterialsData, imageSamplersData] = material_helper::convert_for_gpu_usage(caches[m], std::move(modelImageViews), imageSamplers.size());
 
 		gpuMaterials.insert(gpuMaterials.end(), gpuMaterialsData.begin(), gpuMaterialsData.end());
 		imageSamplers.insert(imageSamplers.end(), imageSamplersData.begin(), imageSamplersData.end());
-		materialCommands.mNestedCommandsAndSyncInstructions.push_back(std::move(materialCommandsData));
+	}
 
-		modelIndex++;
+	// The closest hit shader indexes the materials with the custom index, i.e. the index of the draw call
+	emissive_lights emissiveLights;
+	uint32_t geometryIndex = 0;
+	for (const scene_cache &cache : caches) {
+		for (const auto &dc : cache.draw_calls()) {
+			if (geometryIndex < gpuMaterials.size()) {
+				emissiveLights.add_geometry(geometryIndex, dc.mPositions, dc.mIndices, gpuMaterials[geometryIndex]);
+			}
+			geometryIndex++;
+		}
 	}
+	emissiveLights.build();
+	mEmissiveLightBuffer = emissiveLights.create_buffer(*mQueue);
+
+	environment_map environment;
+	environment.load(settings);
+	mEnvironmentTexelBuffer = environment.create_texel_buffer(*mQueue);
+	mEnvironmentCdfBuffer = environment.create_cdf_buffer(*mQueue);
 
 	mActiveGeometryInstances.insert(std::begin(mActiveGeometryInstances), std::begin(mAllGeometryInstances), std::end(mAllGeometryInstances));
 	mTlasUpdateRequired = true;
@@ -51,9 +145,8 @@ void model_loader::load_models_from_ini(
 		avk::storage_buffer_meta::create_from_data(gpuMaterials)
 	);
 
-	// Submit the commands material commands and the materials buffer fill to the device:
+	// Submit the materials buffer fill to the device:
 	avk::context().record_and_submit_with_fence({
-		std::move(materialCommands),
 		mMaterialBuffer->fill(gpuMaterials.data(), 0)
 	}, *mQueue)->wait_until_signalled();
 
@@ -109,83 +202,49 @@ void model_loader::update()
 }
 
 
-std::tuple<std::vector<avk::material_gpu_data>, std::vector<avk::image_sampler>, avk::command::action_type_command> model_loader::load_single_model(
-	std::string filePath,
-	size_t samplerIndexOffset,
+void model_loader::load_single_model(
+	const scene_cache &cache,
 	size_t materialIndexOffset,
 	size_t modelIndex
 ) {
-	auto model = avk::model_t::load_from_file(filePath, aiProcess_Triangulate | aiProcess_PreTransformVertices);
-
-	// Get all the different materials of the model:
-	auto distinctMaterials = model->distinct_material_configs();
-
-	// The following might be a bit tedious still, but maybe it's not. For what it's worth, it is expressive.
-	// The following loop gathers all the vertex and index data PER MATERIAL and constructs the buffers and materials.
-	// Later, we'll use ONE draw call PER MATERIAL to draw the whole scene.
-	std::vector<avk::material_config> allMatConfigs;
-
-	for (const auto &[materialConfig, indices] : distinctMaterials) {
+	// The scene cache contains the vertex and index data PER MATERIAL, exactly as avk::create_*_buffer would produce it
+	// from the distinct material configs of the model. We'll use ONE draw call PER MATERIAL to draw the whole scene.
+	for (const auto &dc : cache.draw_calls()) {
 		auto &newElement = mDrawCalls.emplace_back();
-		allMatConfigs.push_back(materialConfig);
-		newElement.mMaterialIndex = static_cast<int>(allMatConfigs.size() - 1 + materialIndexOffset);
-
-		auto selection = avk::make_model_references_and_mesh_indices_selection(model, indices);
+		newElement.mMaterialIndex = static_cast<int>(dc.mMaterialIndex + materialIndexOffset);
 
-		auto [posBfr, idxBfr, posIdxCmds] = avk::create_vertex_and_index_buffers<
-			avk::uniform_texel_buffer_meta, 
-			avk::read_only_input_to_acceleration_structure_builds_buffer_meta>(selection);
-		auto [nrmBfr, nrmCmds] = avk::create_normals_buffer<
-			avk::uniform_texel_buffer_meta,
-			avk::vertex_buffer_meta>(selection);
-		auto [tngBfr, tngCmds] = avk::create_tangents_buffer<
-			avk::uniform_texel_buffer_meta,
-			avk::vertex_buffer_meta>(selection);
-		auto [bitngBfr, bitngCmds] = avk::create_bitangents_buffer<
-			avk::uniform_texel_buffer_meta,
-			avk::vertex_buffer_meta>(selection);
-		auto [texBfr, texCmds] = avk::create_2d_texture_coordinates_buffer<
+		auto [posBfr, posCmds] = create_buffer_from_cache<glm::vec3,
+			avk::vertex_buffer_meta,
 			avk::uniform_texel_buffer_meta,
-			avk::vertex_buffer_meta>(selection);
-
-		newElement.mPositionsBuffer = posBfr;
-		newElement.mIndexBuffer = idxBfr;
-		newElement.mNormalsBuffer = nrmBfr;
-		newElement.mTangentsBuffer = tngBfr;
-		newElement.mBitangentsBuffer = bitngBfr;
-		newElement.mTexCoordsBuffer = texBfr;
+			avk::read_only_input_to_acceleration_structure_builds_buffer_meta>(dc.mPositions, avk::content_description::position);
 
+		// All other attributes are interleaved and quantized, the closest hit shader fetches one uvec4 per vertex:
+		avk::buffer vtxBfr = avk::context().create_buffer(
+			avk::memory_usage::device, {},
+			avk::uniform_texel_buffer_meta::create_from_element_size(sizeof(vertex_layout::packed_vertex), dc.mVertices.size()).describe_only_member(glm::uvec4{}, avk::content_description::user_defined_01)
+		);
+		auto vtxCmds = vtxBfr->fill(dc.mVertices.data(), 0);
 
-		// Create a bottom level acceleration structure instance with this geometry.
-		auto blas = avk::context().create_bottom_level_acceleration_structure(
-			{avk::acceleration_structure_size_requirements::from_buffers(avk::vertex_index_buffer_pair{ posBfr, idxBfr })},
-			false // no need to allow updates for static geometry
+		// The closest hit shader fetches one uvec3 per triangle, the BLAS build reads single 32 bit indices:
+		avk::buffer idxBfr = avk::context().create_buffer(
+			avk::memory_usage::device, {},
+			avk::uniform_texel_buffer_meta::create_from_element_size(sizeof(glm::uvec3), dc.mIndices.size() / 3).describe_only_member(glm::uvec3{}, avk::content_description::index),
+			avk::read_only_input_to_acceleration_structure_builds_buffer_meta::create_from_element_size(sizeof(uint32_t), dc.mIndices.size()).describe_only_member(uint32_t{}, avk::content_description::index)
 		);
+		auto idxCmds = idxBfr->fill(dc.mIndices.data(), 0);
 
-		// Upload the data, represented by commands:
-		avk::context().record_and_submit_with_fence({
-			std::move(posIdxCmds),
-			std::move(nrmCmds),
-			std::move(tngCmds),
-			std::move(bitngCmds),
-			std::move(texCmds),
-			// Gotta wait until all buffers have been transfered before we can start the BLAS build:
-			avk::sync::global_memory_barrier(avk::stage::transfer >> avk::stage::acceleration_structure_build, avk::access::transfer_write >> avk::access::acceleration_structure_write),
-			blas->build({ avk::vertex_index_buffer_pair{ posBfr, idxBfr } })
-		}, *mQueue)->wait_until_signalled();
+		newElement.mPositionsBuffer = posBfr;
+		newElement.mVerticesBuffer = vtxBfr;
+		newElement.mIndexBuffer = idxBfr;
 
 
-		auto bufferViewIndex = static_cast<uint32_t>(mTexCoordsBufferViews.size());
-
-		// Maybe TODO: for all instances:
-		mAllGeometryInstances.push_back(
-			avk::context().create_geometry_instance(blas.as_reference())
-			// Set this instance's custom index, which is especially important since we'll use it in shaders
-			// to refer to the right material and also vertex data (these two are aligned index-wise):
-			.set_custom_index(bufferViewIndex)
-			// Set this instance's transformation matrix:
-			//.set_transform_column_major(avk::to_array(avk::matrix_from_transforms(inst.mTranslation, glm::quat(inst.mRotation), inst.mScaling)))
-		);
+		// Queue a bottom level acceleration structure over this geometry, the uploads are submitted together with all builds.
+		// The BLAS index equals the index of the draw call and of its buffer views.
+		std::vector<avk::recorded_commands_t> uploads;
+		uploads.push_back(std::move(posCmds));
+		uploads.push_back(std::move(vtxCmds));
+		uploads.push_back(std::move(idxCmds));
+		mBlas.add(posBfr, static_cast<uint32_t>(dc.mPositions.size()), idxBfr, static_cast<uint32_t>(dc.mIndices.size()), std::move(uploads));
 
 		mMaterialModelMapping.push_back(modelIndex);
 		mTransforms.push_back(glm::mat4(1.0));
@@ -193,21 +252,10 @@ std::tuple<std::vector<avk::material_gpu_data>, std::vector<avk::image_sampler>,
 		// State that this geometry instance shall be included in TLAS generation by default:
 		mGeometryInstanceActive.push_back(true);
 
-		mBlas.push_back(std::move(blas)); // Move this BLAS s.t. we don't have to enable_shared_ownership. We're done with it here.
-
-		// After we have used positions and indices for building the BLAS, still need to create buffer views which allow us to access
+		// Besides building the BLAS from positions and indices, we still need to create buffer views which allow us to access
 		// the per vertex data in ray tracing shaders, where they will be accessible via samplerBuffer- or usamplerBuffer-type uniforms.
 		mPositionsBufferViews.push_back(avk::context().create_buffer_view(posBfr));
+		mVerticesBufferViews.push_back(avk::context().create_buffer_view(vtxBfr));
 		mIndexBufferViews.push_back(avk::context().create_buffer_view(idxBfr));
-		mNormalsBufferViews.push_back(avk::context().create_buffer_view(nrmBfr));
-		mTangentsBufferViews.push_back(avk::context().create_buffer_view(tngBfr));
-		mBitangentsBufferViews.push_back(avk::context().create_buffer_view(bitngBfr));
-		mTexCoordsBufferViews.push_back(avk::context().create_buffer_view(texBfr));
 	}
-
-	// For all the different materials, transfer them in structs which are well
-	// suited for GPU-usage (proper alignment, and containing only the relevant data),
-	// also load all the referenced images from file and provide access to them
-	// via samplers;
-	return material_helper::convert_for_gpu_usage(model->handle(), allMatConfigs, samplerIndexOffset);
 }
@@ -1,6 +1,11 @@
 #pragma once
 
+#include "blas_builder.h"
 #include "camera_controller.h"
+#include "emissive_lights.h"
+#include "environment_map.h"
+#include "render_settings.h"
+#include "scene_cache.h"
 
 #include <auto_vk_toolkit.hpp>
 #include <invokee.hpp>
@@ -14,10 +19,7 @@ public:
 	struct data_for_draw_call
 	{
 		avk::buffer mPositionsBuffer;
-		avk::buffer mTexCoordsBuffer;
-		avk::buffer mNormalsBuffer;
-		avk::buffer mTangentsBuffer;
-		avk::buffer mBitangentsBuffer;
+		avk::buffer mVerticesBuffer; // vertex_layout::packed_vertex
 		avk::buffer mIndexBuffer;
 
 		int mMaterialIndex;
@@ -26,7 +28,8 @@ public:
 
 	model_loader(avk::queue* aQueue);
 
-	void load_models_from_ini(std::string iniPath);
+	// Loads the models of `mScenePath` through the scene cache
+	void load_models_from_ini(const render_settings &settings);
 
 	void update_transform_for_model(size_t modelIndex, glm::mat4 newTransform);
 
@@ -37,24 +40,27 @@ public:
 	inline const std::vector<data_for_draw_call> &draw_calls() const { return mDrawCalls; }
 	inline const avk::buffer &material_buffer() const { return mMaterialBuffer; }
 	inline const avk::buffer &transforms_buffer() const { return mTransformsBuffer; };
+	inline const avk::buffer &emissive_light_buffer() const { return mEmissiveLightBuffer; }
+	inline const avk::buffer &environment_texel_buffer() const { return mEnvironmentTexelBuffer; }
+	inline const avk::buffer &environment_cdf_buffer() const { return mEnvironmentCdfBuffer; }
 	inline const std::vector<avk::image_sampler> &image_samplers() const { return mImageSamplers; }
 	inline const std::vector<avk::combined_image_sampler_descriptor_info> &combined_image_sampler_descriptor_infos() const { return mCombinedImageSamplerDescriptorInfos; }
 	inline const std::vector<avk::buffer_view> &position_buffer_views() const { return mPositionsBufferViews; }
-	inline const std::vector<avk::buffer_view> &tex_coords_buffer_views() const { return mTexCoordsBufferViews; }
-	inline const std::vector<avk::buffer_view> &normals_buffer_views() const { return mNormalsBufferViews; }
-	inline const std::vector<avk::buffer_view> &tangents_buffer_views() const { return mTangentsBufferViews; }
-	inline const std::vector<avk::buffer_view> &bitangents_buffer_views() const { return mBitangentsBufferViews; }
+	inline const std::vector<avk::buffer_view> &vertices_buffer_views() const { return mVerticesBufferViews; }
 	inline const std::vector<avk::buffer_view> &index_buffer_views() const { return mIndexBufferViews; }
 	inline const bool has_updated_geometry_for_tlas() const { return mTlasUpdateRequired; }
+	// Identifies the loaded models, combines the content hashes of their .glb files (see scene_cache)
+	inline uint64_t scene_hash() const { return mSceneHash; }
 	
 	const std::vector<avk::geometry_instance> get_active_geometry_instances_for_tlas_build();
 
 
 
 private:
-	std::tuple<std::vector<avk::material_gpu_data>, std::vector<avk::image_sampler>, avk::command::action_type_command> load_single_model(
-		std::string filePath,
-		size_t samplerIndexOffset,
+	// Geometry of every draw call, the BLAS are built once all models have been queued and the materials are created once
+	// all textures have been uploaded
+	void load_single_model(
+		const scene_cache &cache,
 		size_t materialIndexOffset,
 		size_t modelIndex
 	);
@@ -63,17 +69,17 @@ private:
 	std::vector<data_for_draw_call> mDrawCalls;
 	avk::buffer mMaterialBuffer;
 	avk::buffer mTransformsBuffer;
+	avk::buffer mEmissiveLightBuffer;
+	avk::buffer mEnvironmentTexelBuffer;
+	avk::buffer mEnvironmentCdfBuffer;
 	std::vector<avk::image_sampler> mImageSamplers;
 
-	std::vector<avk::bottom_level_acceleration_structure> mBlas;
+	blas_builder mBlas;
 
 	std::vector<avk::combined_image_sampler_descriptor_info> mCombinedImageSamplerDescriptorInfos;
 
 	std::vector<avk::buffer_view> mPositionsBufferViews;
-	std::vector<avk::buffer_view> mTexCoordsBufferViews;
-	std::vector<avk::buffer_view> mNormalsBufferViews;
-	std::vector<avk::buffer_view> mTangentsBufferViews;
-	std::vector<avk::buffer_view> mBitangentsBufferViews;
+	std::vector<avk::buffer_view> mVerticesBufferViews;
 	std::vector<avk::buffer_view> mIndexBufferViews;
 
 	std::vector<size_t> mMaterialModelMapping;
@@ -82,6 +88,7 @@ private:
 	std::vector<avk::geometry_instance> mAllGeometryInstances;
 	std::vector<bool> mGeometryInstanceActive;
 	bool mTlasUpdateRequired = true;
+	uint64_t mSceneHash = 14695981039346656037ull;
 	std::vector<avk::geometry_instance> mActiveGeometryInstances;
 
 };
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <auto_vk_toolkit.hpp>
+
+#include <fstream>
+
+/// <summary>
+/// Reading and writing of little endian RGB Portable Float Maps, the HDR format of the convergence references (see
+/// convergence_monitor). PFM stores the rows bottom to top, in memory they are top to bottom like in the accumulation images.
+/// </summary>
+namespace pfm_image {
+
+	struct image {
+		uint32_t mWidth = 0;
+		uint32_t mHeight = 0;
+		std::vector<glm::vec4> mTexels; // alpha is 1
+	};
+
+	// Returns an empty optional if the file does not exist or is no RGB PFM
+	inline std::optional<image> read(const std::string &path)
+	{
+		std::ifstream file(path, std::ios::binary);
+		std::string magic;
+		int width = 0, height = 0;
+		float scale = 0.0f;
+		if (!(file >> magic >> width >> height >> scale) || magic != "PF" || width <= 0 || height <= 0 || scale >= 0.0f) {
+			return {}; // grayscale (Pf) and big endian (positive scale) files are not supported
+		}
+		file.get(); // the single whitespace character in front of the data
+
+		image result{ static_cast<uint32_t>(width), static_cast<uint32_t>(height), std::vector<glm::vec4>(size_t(width) * height) };
+		std::vector<glm::vec3> row(width);
+		for (int y = height - 1; y >= 0; y--) {
+			if (!file.read(reinterpret_cast<char *>(row.data()), sizeof(glm::vec3) * width)) {
+				return {};
+			}
+			for (int x = 0; x < width; x++) {
+				result.mTexels[size_t(y) * width + x] = glm::vec4(row[x], 1.0f);
+			}
+		}
+		return result;
+	}
+
+	// `texels` are `width` * `height` rgba values, top row first. Returns false if the file cannot be written.
+	inline bool write(const std::string &path, uint32_t width, uint32_t height, const glm::vec4 *texels)
+	{
+		std::ofstream file(path, std::ios::binary);
+		file << "PF\n" << width << " " << height << "\n-1.0\n";
+
+		std::vector<glm::vec3> row(width);
+		for (uint32_t y = height; y-- > 0; ) {
+			for (uint32_t x = 0; x < width; x++) {
+				row[x] = glm::vec3(texels[size_t(y) * width + x]);
+			}
+			file.write(reinterpret_cast<const char *>(row.data()), sizeof(glm::vec3) * width);
+		}
+		return static_cast<bool>(file);
+	}
+}
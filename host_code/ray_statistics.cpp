@@ -0,0 +1,142 @@
+#include "ray_statistics.h"
+
+
+namespace {
+	avk::recorded_commands_t no_commands()
+	{
+		return avk::command::custom_commands([](avk::command_buffer_t &) {});
+	}
+}
+
+
+ray_statistics::ray_statistics(bool aEnabled)
+	: mEnabled{aEnabled}
+{
+	const size_t size = sizeof(uint32_t) * COUNTER_COUNT;
+	mCounters = avk::context().create_buffer(
+		avk::memory_usage::device,
+		vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eTransferSrc,
+		avk::storage_buffer_meta::create_from_size(size)
+	);
+
+	if (mEnabled) {
+		for (avk::buffer &buffer : mReadbackBuffers) {
+			buffer = avk::context().create_buffer(
+				avk::memory_usage::host_visible,
+				vk::BufferUsageFlagBits::eTransferDst,
+				avk::generic_buffer_meta::create_from_size(size)
+			);
+		}
+	}
+}
+
+
+void ray_statistics::next_frame()
+{
+	if (!mEnabled) {
+		return;
+	}
+
+	mFrame++;
+	size_t slot = mFrame % RING_SIZE;
+	if (!mPending[slot]) {
+		return;
+	}
+	mPending[slot] = false;
+
+	// Written RING_SIZE frames ago, more than there are frames in flight => the copy has long completed
+	auto mapping = mReadbackBuffers[slot]->map_memory(avk::mapping_access::read);
+	memcpy(mHistory[mHistoryNext].data(), mapping.get(), sizeof(counter_values));
+	mHistoryNext = (mHistoryNext + 1) % AVERAGE_WINDOW;
+	mHistoryCount = std::min(mHistoryCount + 1, AVERAGE_WINDOW);
+}
+
+avk::recorded_commands_t ray_statistics::reset()
+{
+	if (!mEnabled) {
+		return no_commands();
+	}
+
+	vk::Buffer counters = mCounters->handle();
+	return avk::command::custom_commands([counters](avk::command_buffer_t &cb) {
+		// The previous frame may still copy out of the buffer
+		cb.handle().pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer, {}, nullptr, nullptr, nullptr, cb.root_ptr()->dispatch_loader_core());
+		cb.handle().fillBuffer(counters, 0, VK_WHOLE_SIZE, 0, cb.root_ptr()->dispatch_loader_core());
+		cb.handle().pipelineBarrier(
+			vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eRayTracingShaderKHR, {},
+			vk::MemoryBarrier{ vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite },
+			nullptr, nullptr, cb.root_ptr()->dispatch_loader_core());
+	});
+}
+
+avk::recorded_commands_t ray_statistics::read_back()
+{
+	if (!mEnabled) {
+		return no_commands();
+	}
+
+	size_t slot = mFrame % RING_SIZE;
+	mPending[slot] = true;
+
+	vk::Buffer counters = mCounters->handle();
+	vk::Buffer readback = mReadbackBuffers[slot]->handle();
+	return avk::command::custom_commands([counters, readback](avk::command_buffer_t &cb) {
+		cb.handle().pipelineBarrier(
+			vk::PipelineStageFlagBits::eRayTracingShaderKHR, vk::PipelineStageFlagBits::eTransfer, {},
+			vk::MemoryBarrier{ vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eTransferRead },
+			nullptr, nullptr, cb.root_ptr()->dispatch_loader_core());
+		cb.handle().copyBuffer(counters, readback, vk::BufferCopy{ 0, 0, sizeof(counter_values) }, cb.root_ptr()->dispatch_loader_core());
+		cb.handle().pipelineBarrier(
+			vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eHost, {},
+			vk::MemoryBarrier{ vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eHostRead },
+			nullptr, nullptr, cb.root_ptr()->dispatch_loader_core());
+	});
+}
+
+
+void ray_statistics::print_averages(double traceRaysMilliseconds) const
+{
+	if (!mEnabled || mHistoryCount == 0) {
+		return;
+	}
+
+	std::array<double, COUNTER_COUNT> perFrame = {};
+	for (uint32_t f = 0; f < mHistoryCount; f++) {
+		for (size_t c = 0; c < COUNTER_COUNT; c++) {
+			perFrame[c] += mHistory[f][c];
+		}
+	}
+	double total = 0.0;
+	for (size_t c = 0; c < COUNTER_COUNT; c++) {
+		perFrame[c] /= mHistoryCount;
+		if (c < static_cast<size_t>(ray_type::count)) {
+			total += perFrame[c];
+		}
+	}
+
+	// Rays per frame over the GPU time of trace_rays of a frame, 0 if the profiler has no times (yet)
+	auto megaRaysPerSecond = [&](double rays) { return traceRaysMilliseconds > 0.0 ? rays / traceRaysMilliseconds * 1e-3 : 0.0; };
+
+	printf("Rays per frame (average of the last %u frames):\n", mHistoryCount);
+	for (size_t c = 0; c < static_cast<size_t>(ray_type::count); c++) {
+		printf("  %-12s %14.0lf  %6.2lf%%  %9.2lf Mrays/s\n", name(static_cast<ray_type>(c)), perFrame[c], total > 0.0 ? 100.0 * perFrame[c] / total : 0.0, megaRaysPerSecond(perFrame[c]));
+	}
+	printf("  %-12s %14.0lf  %6.2lf%%  %9.2lf Mrays/s\n", "total", total, 100.0, megaRaysPerSecond(total));
+
+	double cameraPaths = perFrame[static_cast<size_t>(ray_type::camera)];
+	printf("Average path depth: %.3lf bounces\n", cameraPaths > 0.0 ? perFrame[static_cast<size_t>(ray_type::count)] / cameraPaths : 0.0);
+}
+
+const char *ray_statistics::name(ray_type type)
+{
+	switch (type) {
+		case ray_type::camera: return "camera";
+		case ray_type::bounce: return "bounce";
+		case ray_type::nee_shadow: return "nee_shadow";
+		case ray_type::sms_newton: return "sms_newton";
+		case ray_type::sms_shadow: return "sms_shadow";
+		case ray_type::light_path: return "light_path";
+		case ray_type::light_nee: return "light_nee";
+		default: return "unknown";
+	}
+}
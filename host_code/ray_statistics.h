@@ -0,0 +1,69 @@
+#pragma once
+
+#include "gpu_profiler.h"
+
+#include <auto_vk_toolkit.hpp>
+
+
+// Indices into the counter buffer, the same as the RAY_* defines in ray_gen_shader.rgen
+enum struct ray_type : uint32_t {
+	camera = 0,      // first hit of every camera path
+	bounce = 1,      // continuation of camera paths
+	nee_shadow = 2,  // next event estimation towards the light
+	sms_newton = 3,  // one per Newton iteration of specular manifold sampling
+	sms_shadow = 4,  // visibility of the light once a manifold walk has converged
+	light_path = 5,  // BDPT only
+	light_nee = 6,   // BDPT only, connections of light path vertices to the camera
+	count = 7
+};
+
+
+/// <summary>
+/// Counts the rays traced per `ray_type` if the ray generation shader is built with RAY_STATISTICS (a specialization
+/// constant, see `--ray-stats`). The shader counts per invocation and adds its counts to a small device buffer once at the end,
+/// which is copied into a host visible buffer out of a ring of `gpu_profiler::RING_SIZE` at the end of every frame.
+/// A copy is only read when its buffer is reused, i.e. long after the frame has finished, s.t. the readback never stalls.
+/// Rays per second are derived from the average GPU time of trace_rays measured by `gpu_profiler`.
+/// </summary>
+class ray_statistics
+{
+public:
+	static constexpr uint32_t RING_SIZE = gpu_profiler::RING_SIZE;
+	static constexpr uint32_t AVERAGE_WINDOW = gpu_profiler::AVERAGE_WINDOW;
+	// One more counter behind the ray types: the sum of the depths at which camera paths terminated
+	static constexpr size_t COUNTER_COUNT = static_cast<size_t>(ray_type::count) + 1;
+
+	explicit ray_statistics(bool aEnabled);
+
+	inline bool enabled() const { return mEnabled; }
+
+	// Bound as storage buffer, also if the statistics are disabled (the shader declares it anyway)
+	inline const avk::buffer &counter_buffer() const { return mCounters; }
+
+	// Reads the counters of the frame whose readback buffer is reused by the frame that starts now
+	void next_frame();
+
+	// Zeroes the counters before trace_rays and copies them out afterwards, both do nothing if the statistics are disabled
+	avk::recorded_commands_t reset();
+	avk::recorded_commands_t read_back();
+
+	// Rays per frame and Mrays/s of every type, average path depth
+	void print_averages(double traceRaysMilliseconds) const;
+
+	static const char *name(ray_type type);
+
+private:
+	using counter_values = std::array<uint32_t, COUNTER_COUNT>;
+
+	bool mEnabled;
+	avk::buffer mCounters;
+
+	std::array<avk::buffer, RING_SIZE> mReadbackBuffers;
+	std::array<bool, RING_SIZE> mPending = {};
+	uint64_t mFrame = 0;
+
+	// The counters of the last AVERAGE_WINDOW frames
+	std::array<counter_values, AVERAGE_WINDOW> mHistory = {};
+	uint32_t mHistoryCount = 0;
+	uint32_t mHistoryNext = 0;
+};
@@ -0,0 +1,296 @@
+#include "render_settings.h"
+
+
+void render_settings::print_usage(const char *executable)
+{
+	std::cout
+		<< "usage: " << executable << " [options]\n"
+		<< "  --headless                 render without a window and exit once the budget is reached\n"
+		<< "  --scene <path.ini>         scene description (default: assets/models.ini)\n"
+		<< "  --camera <m0,m1,...,m15>   camera transformation matrix, 16 comma separated values (column-major)\n"
+		<< "  --resolution <W>x<H>       size of the accumulation images (default: 3840x2160)\n"
+		<< "  --spp <n>                  stop after n samples per pixel (headless only)\n"
+		<< "  --time <seconds>           stop after the given wall-clock time (headless only)\n"
+		<< "  --output <path.png>        where to write the final image (headless only), .pfm/.exr write the untonemapped accumulation\n"
+		<< "  --cpu                      render with the CPU reference path tracer (implies --headless)\n"
+		<< "  --threads <n>              worker threads of the CPU reference and of texture loading (default: all cores)\n"
+		<< "  --texture-budget <MiB>     decoded texels in flight while loading textures (default: 256)\n"
+		<< "  --texture-log <path.csv>   write per-texture decode and upload timings\n"
+		<< "  --no-ray-cones             sample all textures at mip level 0 instead of selecting the level from ray cones\n"
+		<< "  --no-texture-compression   keep all textures RGBA8 instead of block compressing them (BC1/BC5/BC7)\n"
+		<< "  --gpu-profile <path>       write per-frame GPU pass times to a CSV file (or JSON if the path ends with .json)\n"
+		<< "  --ray-stats                count the traced rays per type (camera, NEE, SMS, light paths) and report rays/s\n"
+		<< "  --benchmark <path.txt>     render every view of a camera path to its spp and write a JSON report (implies --headless)\n"
+		<< "  --benchmark-report <path>  where to write the benchmark report (default: results/benchmark.json)\n"
+		<< "  --benchmark-refs <dir>     compare every view with <dir>/<view>.png, missing references are created\n"
+		<< "  --benchmark-max-rmse <x>   fail the benchmark if any view deviates more from its reference (0..1, default: no limit)\n"
+		<< "  --reference <path.pfm>     report MSE/relMSE of the accumulation against this reference every --error-interval spp\n"
+		<< "  --error-interval <n>       samples per pixel between two error measurements (default: 16)\n"
+		<< "  --target-error <relMSE>    stop once the relMSE reaches this value (headless only)\n"
+		<< "  --error-log <path.csv>     write the error-vs-time curve\n"
+		<< "  --adaptive <threshold>     only sample tiles whose standard error exceeds the threshold (display units, e.g. 0.004)\n"
+		<< "  --wavefront                trace with separate generate/extend/shade/shadow stages instead of the megakernel\n"
+		<< "  --denoise                  filter the displayed/written result with the a-trous denoiser (toggle with n)\n"
+		<< "  --no-reprojection          clear the accumulation on every camera move instead of reprojecting it\n"
+		<< "  --frame-budget <ms>        trace only as many tiles per frame as fit into this GPU time, one spp per sweep over the image\n"
+		<< "  --preview-fps <fps>        trace at reduced resolution while the camera moves to hold this frame rate\n"
+		<< "  --linear-screenshots <fmt> also write the untonemapped accumulation next to every .png, exr or pfm\n"
+		<< "  --checkpoint <path>        periodically save the accumulation to <path> and resume from it at startup\n"
+		<< "  --checkpoint-interval <s>  seconds between two checkpoints (default: 300)\n"
+		<< "  --bvh-benchmark            measure the CPU BVH traversal kernels with rays from the camera and exit\n"
+		<< "  --scene-cache-benchmark    measure cold and warm loads of the scene through the scene cache and exit\n";
+}
+
+
+float render_settings::pixel_spread_angle(float cameraHalfFovAngle) const
+{
+	return mRayCones ? std::atan(2.0f * std::tan(cameraHalfFovAngle) / static_cast<float>(mResolution.y)) : 0.0f;
+}
+
+
+bool render_settings::parse_matrix(const std::string &value, glm::mat4 &matrix)
+{
+	std::stringstream stream(value);
+	std::string element;
+	int count = 0;
+	while (std::getline(stream, element, ',')) {
+		if (count >= 16) break;
+		matrix[count / 4][count % 4] = std::stof(element);
+		count++;
+	}
+	return count == 16;
+}
+
+
+std::optional<render_settings> render_settings::parse_command_line(int argc, char *argv[])
+{
+	render_settings settings;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+
+		auto nextValue = [&]() -> std::optional<std::string> {
+			if (i + 1 >= argc) {
+				std::cerr << "missing value for " << arg << std::endl;
+				return {};
+			}
+			return std::string(argv[++i]);
+		};
+
+		try {
+			if (arg == "--headless") {
+				settings.mHeadless = true;
+			}
+			else if (arg == "--scene") {
+				auto value = nextValue();
+				if (!value) return {};
+				settings.mScenePath = *value;
+			}
+			else if (arg == "--camera") {
+				auto value = nextValue();
+				if (!value) return {};
+				if (!parse_matrix(*value, settings.mCameraTransform)) {
+					std::cerr << "--camera expects exactly 16 comma separated values" << std::endl;
+					return {};
+				}
+			}
+			else if (arg == "--resolution") {
+				auto value = nextValue();
+				if (!value) return {};
+
+				size_t separator = value->find('x');
+				if (separator == std::string::npos) {
+					std::cerr << "--resolution expects <width>x<height>" << std::endl;
+					return {};
+				}
+				settings.mResolution.x = static_cast<uint32_t>(std::stoul(value->substr(0, separator)));
+				settings.mResolution.y = static_cast<uint32_t>(std::stoul(value->substr(separator + 1)));
+				if (settings.mResolution.x == 0 || settings.mResolution.y == 0) {
+					std::cerr << "--resolution must not be empty" << std::endl;
+					return {};
+				}
+			}
+			else if (arg == "--spp") {
+				auto value = nextValue();
+				if (!value) return {};
+				settings.mTargetSamplesPerPixel = static_cast<uint32_t>(std::stoul(*value));
+			}
+			else if (arg == "--time") {
+				auto value = nextValue();
+				if (!value) return {};
+				settings.mTimeBudgetSeconds = std::stod(*value);
+			}
+			else if (arg == "--output") {
+				auto value = nextValue();
+				if (!value) return {};
+				settings.mOutputPath = *value;
+			}
+			else if (arg == "--cpu") {
+				settings.mCpuReference = true;
+				settings.mHeadless = true;
+			}
+			else if (arg == "--threads") {
+				auto value = nextValue();
+				if (!value) return {};
+				settings.mThreadCount = static_cast<uint32_t>(std::stoul(*value));
+			}
+			else if (arg == "--texture-budget") {
+				auto value = nextValue();
+				if (!value) return {};
+				settings.mTextureBudgetMiB = static_cast<uint32_t>(std::stoul(*value));
+				if (settings.mTextureBudgetMiB == 0) {
+					std::cerr << "--texture-budget must be at least 1 MiB" << std::endl;
+					return {};
+				}
+			}
+			else if (arg == "--texture-log") {
+				auto value = nextValue();
+				if (!value) return {};
+				settings.mTextureLogPath = *value;
+			}
+			else if (arg == "--no-ray-cones") {
+				settings.mRayCones = false;
+			}
+			else if (arg == "--no-texture-compression") {
+				settings.mTextureCompression = false;
+			}
+			else if (arg == "--gpu-profile") {
+				auto value = nextValue();
+				if (!value) return {};
+				settings.mGpuProfilePath = *value;
+			}
+			else if (arg == "--ray-stats") {
+				settings.mRayStatistics = true;
+			}
+			else if (arg == "--benchmark") {
+				auto value = nextValue();
+				if (!value) return {};
+				settings.mBenchmarkPath = *value;
+				settings.mHeadless = true;
+			}
+			else if (arg == "--benchmark-report") {
+				auto value = nextValue();
+				if (!value) return {};
+				settings.mBenchmarkReportPath = *value;
+			}
+			else if (arg == "--benchmark-refs") {
+				auto value = nextValue();
+				if (!value) return {};
+				settings.mBenchmarkReferenceDirectory = *value;
+			}
+			else if (arg == "--benchmark-max-rmse") {
+				auto value = nextValue();
+				if (!value) return {};
+				settings.mBenchmarkMaxRmse = std::stod(*value);
+			}
+			else if (arg == "--reference") {
+				auto value = nextValue();
+				if (!value) return {};
+				settings.mReferencePath = *value;
+			}
+			else if (arg == "--error-interval") {
+				auto value = nextValue();
+				if (!value) return {};
+				settings.mErrorInterval = static_cast<uint32_t>(std::stoul(*value));
+				if (settings.mErrorInterval == 0) {
+					std::cerr << "--error-interval must be at least 1" << std::endl;
+					return {};
+				}
+			}
+			else if (arg == "--target-error") {
+				auto value = nextValue();
+				if (!value) return {};
+				settings.mTargetError = std::stod(*value);
+			}
+			else if (arg == "--error-log") {
+				auto value = nextValue();
+				if (!value) return {};
+				settings.mErrorLogPath = *value;
+			}
+			else if (arg == "--adaptive") {
+				auto value = nextValue();
+				if (!value) return {};
+				settings.mAdaptiveThreshold = std::stof(*value);
+			}
+			else if (arg == "--wavefront") {
+				settings.mWavefront = true;
+			}
+			else if (arg == "--denoise") {
+				settings.mDenoise = true;
+			}
+			else if (arg == "--no-reprojection") {
+				settings.mReprojection = false;
+			}
+			else if (arg == "--frame-budget") {
+				auto value = nextValue();
+				if (!value) return {};
+				settings.mFrameBudgetMilliseconds = std::stod(*value);
+			}
+			else if (arg == "--preview-fps") {
+				auto value = nextValue();
+				if (!value) return {};
+				settings.mPreviewFramesPerSecond = std::stod(*value);
+			}
+			else if (arg == "--linear-screenshots") {
+				auto value = nextValue();
+				if (!value) return {};
+				if (*value != "exr" && *value != "pfm") {
+					std::cerr << "--linear-screenshots expects exr or pfm" << std::endl;
+					return {};
+				}
+				settings.mLinearScreenshotFormat = *value;
+			}
+			else if (arg == "--checkpoint") {
+				auto value = nextValue();
+				if (!value) return {};
+				settings.mCheckpointPath = *value;
+			}
+			else if (arg == "--checkpoint-interval") {
+				auto value = nextValue();
+				if (!value) return {};
+				settings.mCheckpointIntervalSeconds = std::stod(*value);
+			}
+			else if (arg == "--bvh-benchmark") {
+				settings.mBvhBenchmark = true;
+			}
+			else if (arg == "--scene-cache-benchmark") {
+				settings.mSceneCacheBenchmark = true;
+			}
+			else if (arg == "--help" || arg == "-h") {
+				print_usage(argv[0]);
+				return {};
+			}
+			else {
+				std::cerr << "unknown argument: " << arg << std::endl;
+				print_usage(argv[0]);
+				return {};
+			}
+		}
+		catch (std::logic_error &) { // std::stoul & co. throw std::invalid_argument / std::out_of_range
+			std::cerr << "invalid value for " << arg << std::endl;
+			return {};
+		}
+	}
+
+	if (settings.mCpuReference && settings.mTargetError > 0.0) {
+		std::cerr << "--target-error is not supported with --cpu, pass --spp and/or --time" << std::endl;
+		return {};
+	}
+
+	bool errorBudget = !settings.mReferencePath.empty() && settings.mTargetError > 0.0 && !settings.mCpuReference;
+	// The CPU reference always samples every pixel
+	bool adaptiveBudget = settings.mAdaptiveThreshold > 0.0f && !settings.mCpuReference;
+	if (settings.mHeadless
+		&& settings.mBenchmarkPath.empty() // the camera path of a benchmark brings its own sample counts
+		&& !errorBudget && !adaptiveBudget && settings.mTargetSamplesPerPixel == 0 && settings.mTimeBudgetSeconds <= 0.0) {
+		if (settings.mCpuReference) {
+			std::cerr << "--cpu needs a budget, pass --spp and/or --time" << std::endl;
+		}
+		else {
+			std::cerr << "--headless needs a budget, pass --spp, --time, --adaptive and/or --reference with --target-error" << std::endl;
+		}
+		return {};
+	}
+
+	return settings;
+}
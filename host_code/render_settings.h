@@ -0,0 +1,120 @@
+#pragma once
+
+#include <auto_vk_toolkit.hpp>
+
+/// <summary>
+/// Everything that can be configured from the command line.
+/// Without any arguments the renderer opens a window and accumulates forever, just like before.
+/// With `--headless` no window or swapchain is created and the renderer exits once the sample budget is reached.
+/// </summary>
+struct render_settings {
+
+	bool mHeadless = false;
+	std::string mScenePath = "assets/models.ini";
+
+	// Same (column-major) layout as `glm::mat4`'s constructor, defaults to the view of the flooded sponza.
+	glm::mat4 mCameraTransform = {
+		0.719,		-0.000,	0.695,	0.000,
+		 0.063,		0.996,	-0.065, 0.000,
+		-0.692,		0.091,	0.716,	0.000,
+		-13.311,	2.343,  1.132,  1.000
+	};
+
+	glm::uvec2 mResolution = { 3840, 2160 };
+
+	// Budget for headless rendering, rendering stops as soon as one of them is reached (0 = unlimited).
+	uint32_t mTargetSamplesPerPixel = 0;
+	double mTimeBudgetSeconds = 0.0;
+
+	// Empty => "./results/<timestamp>.png". A .pfm or .exr path gets the untonemapped camera accumulation instead, e.g. as convergence reference.
+	std::string mOutputPath;
+
+	// Render with the CPU reference path tracer instead of the GPU (implies headless, no Vulkan device is needed).
+	bool mCpuReference = false;
+	// Worker threads of the CPU reference path tracer, the BVH benchmark and texture decoding/uploading (0 = one per hardware thread).
+	uint32_t mThreadCount = 0;
+
+	// Textures are decoded and uploaded in batches of at most this many MiB of texels, which bounds the memory needed for them.
+	uint32_t mTextureBudgetMiB = 256;
+	// Per-texture decode and upload timings are written to this CSV file (empty => no log).
+	std::string mTextureLogPath;
+
+	// Mip levels are selected from ray cones. Without them every texture is sampled at level 0, which is what `--no-ray-cones`
+	// restores for before/after comparisons.
+	bool mRayCones = true;
+
+	// Textures are block compressed by role when the scene cache is built (BC7 color, BC5 normals, BC1 packed AO/roughness/metalness).
+	// `--no-texture-compression` keeps them RGBA8, both variants are cached side by side.
+	bool mTextureCompression = true;
+
+	// GPU times of the accumulation clears, trace_rays, the denoiser, the preview, the result blit and TLAS rebuilds are written per
+	// frame to this CSV file, or as JSON array if it ends with .json (empty => no log, the rolling averages are still printed).
+	std::string mGpuProfilePath;
+
+	// Builds the ray generation shader with per-type ray counters, rays/s per type and the average path depth are printed
+	// together with the GPU times.
+	bool mRayStatistics = false;
+
+	// Only measure the host BVH traversal kernels (see bvh_benchmark), no Vulkan device is needed.
+	bool mBvhBenchmark = false;
+
+	// Only measure cold and warm loads of the scene with the scene cache (see scene_cache_benchmark), no Vulkan device is needed.
+	bool mSceneCacheBenchmark = false;
+
+	// Renders every view of this camera path file (see camera_path_benchmark) to its sample count and writes a JSON report (implies headless).
+	std::string mBenchmarkPath;
+	// Empty => "./results/benchmark.json"
+	std::string mBenchmarkReportPath;
+	// Reference images `<dir>/<view>.png` the views are compared with, missing ones are created from the current run (empty => no comparison)
+	std::string mBenchmarkReferenceDirectory;
+	// The benchmark fails (exit code and report) if the RMSE of any view against its reference exceeds this (0 = no limit)
+	double mBenchmarkMaxRmse = 0.0;
+
+	// The accumulation is compared with this reference (RGB PFM) every mErrorInterval samples, see convergence_monitor (empty => off).
+	std::string mReferencePath;
+	uint32_t mErrorInterval = 16;
+	// Headless rendering also stops once the relMSE against the reference is at most this (0 = no target)
+	double mTargetError = 0.0;
+	// The error-vs-time curve is written to this CSV file (empty => only printed)
+	std::string mErrorLogPath;
+
+	// Only tiles whose largest standard error (of the displayed luminance, 0..1) exceeds this are sampled further, see
+	// adaptive_sampler. Headless rendering stops once no tile is left (0 = every pixel gets every sample).
+	float mAdaptiveThreshold = 0.0f;
+
+	// Trace with the wavefront stages (see wavefront_queues) instead of the megakernel, both render the same image.
+	bool mWavefront = false;
+
+	// Filter the displayed result with the edge-aware denoiser (see denoiser), `n` toggles it in the window. Headless runs
+	// without it skip the guide images, the written .png is filtered only with it. The accumulation is never filtered.
+	bool mDenoise = false;
+
+	// Camera moves reproject the accumulation into the new view instead of clearing it (see temporal_reprojection), this needs the
+	// guides of the denoiser, i.e. a window or `--denoise`. `--no-reprojection` always clears.
+	bool mReprojection = true;
+
+	// Every frame traces only as many 16x16 tiles as fit into this many milliseconds of GPU time and the next frame continues
+	// with the following tiles, see time_slicer (0 = the whole image every frame). Turns off the reprojection.
+	double mFrameBudgetMilliseconds = 0.0;
+
+	// While the camera moves, the window shows a preview at 1/2, 1/4 or 1/8 of the resolution whenever the full resolution would
+	// miss this frame rate, see dynamic_resolution (0 = always the full resolution). Ignored by headless runs.
+	double mPreviewFramesPerSecond = 0.0;
+
+	// Screenshots and the headless .png output additionally write the untonemapped camera accumulation in this format, "exr" or
+	// "pfm", next to the .png (empty => only the .png), see screenshot_writer.
+	std::string mLinearScreenshotFormat;
+
+	// Save the raw accumulation to this file every mCheckpointIntervalSeconds and resume from it at startup if resolution and
+	// scene match, see accumulation_checkpoint (empty => no checkpoints).
+	std::string mCheckpointPath;
+	double mCheckpointIntervalSeconds = 300.0;
+
+	// Spread angle of the ray cone through one pixel (Akenine-Moeller et al. 2019), 0 if ray cones are disabled
+	float pixel_spread_angle(float cameraHalfFovAngle) const;
+
+	// 16 comma separated values, column-major, returns false if there are fewer. Throws std::invalid_argument like std::stof.
+	static bool parse_matrix(const std::string &value, glm::mat4 &matrix);
+	static std::optional<render_settings> parse_command_line(int argc, char *argv[]);
+	static void print_usage(const char *executable);
+};
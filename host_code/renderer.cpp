@@ -7,16 +7,33 @@
 #include <vk_convenience_functions.hpp>
 
 #include <glm/gtx/io.hpp>
-#include <stb_image_write.h>
 
 
-renderer::renderer(avk::queue &aQueue, glm::uvec2 resolution)
+renderer::renderer(avk::queue &aQueue, const render_settings &aSettings)
 	: mQueue{&aQueue}
-	, mResolution(resolution)
+	, mSettings(aSettings)
+	, mResolution(aSettings.mResolution)
 	, mModelLoader{mQueue}
+	, mGpuProfiler{aQueue, aSettings.mGpuProfilePath}
+	, mRayStatistics{aSettings.mRayStatistics}
+	, mAdaptiveSampler{aSettings.mAdaptiveThreshold}
+	, mTimeSlicer{aSettings.mFrameBudgetMilliseconds}
+	, mWavefront{aSettings.mWavefront}
+	, mDenoiser{!aSettings.mHeadless || aSettings.mDenoise, aSettings.mDenoise}
+	, mReprojection{aSettings.mReprojection && mDenoiser.available() && !mTimeSlicer.enabled()}
+	, mPreview{aSettings.mHeadless ? 0.0 : aSettings.mPreviewFramesPerSecond}
+	, mScreenshots{aQueue, aSettings.mLinearScreenshotFormat}
+	, mCheckpoint{aQueue, aSettings.mBenchmarkPath.empty() ? aSettings.mCheckpointPath : std::string{}, aSettings.mCheckpointIntervalSeconds}
 {
 	mStartTime = std::chrono::high_resolution_clock::now();
 
+	if (!aSettings.mBenchmarkPath.empty()) {
+		mBenchmark.emplace(aSettings);
+	}
+	if (!aSettings.mReferencePath.empty()) {
+		mConvergence.emplace(aSettings);
+	}
+
 	const auto p1 = std::chrono::system_clock::now();
 	mStartTimestamp = std::chrono::duration_cast<std::chrono::seconds>(p1.time_since_epoch()).count();
 }
@@ -36,6 +53,7 @@ void renderer::create_ray_tracing_prerequisites()
 	avk::image cameraImage = avk::context().create_image(mResolution.x, mResolution.y, vk::Format::eR32G32B32A32Sfloat, 1, avk::memory_usage::device, avk::image_usage::general_storage_image);
 	avk::image lightImage = avk::context().create_image(mResolution.x, mResolution.y, vk::Format::eR32G32B32A32Sfloat, 1, avk::memory_usage::device, avk::image_usage::general_storage_image);
 	avk::image resultImage = avk::context().create_image(mResolution.x, mResolution.y, vk::Format::eB8G8R8A8Unorm, 1, avk::memory_usage::device, avk::image_usage::general_storage_image);
+	avk::image momentImage = mAdaptiveSampler.create_moment_image(mResolution);
 
 
 	avk::context().record_and_submit_with_fence({
@@ -48,11 +66,22 @@ void renderer::create_ray_tracing_prerequisites()
 		avk::sync::image_memory_barrier(resultImage.as_reference(),
 										avk::stage::none >> avk::stage::none,
 										avk::access::none >> avk::access::none).with_layout_transition(avk::layout::undefined >> avk::layout::general),
+		avk::sync::image_memory_barrier(momentImage.as_reference(),
+										avk::stage::none >> avk::stage::none,
+										avk::access::none >> avk::access::none).with_layout_transition(avk::layout::undefined >> avk::layout::general),
 	}, *mQueue)->wait_until_signalled();
 
 	mRayTracingCameraImageView = avk::context().create_image_view(cameraImage);
 	mRayTracingLightImageView = avk::context().create_image_view(lightImage);
 	mRayTracingResultImageView = avk::context().create_image_view(resultImage);
+	mRayTracingMomentImageView = avk::context().create_image_view(momentImage);
+	mAdaptiveSampler.create_resources(*mQueue, mResolution, mRayTracingCameraImageView, mRayTracingMomentImageView);
+	mTimeSlicer.create(mResolution);
+	mDenoiser.create_resources(*mQueue, mResolution, mRayTracingCameraImageView, mRayTracingResultImageView);
+	mReprojection.create_resources(*mQueue, mResolution, mRayTracingCameraImageView, mRayTracingMomentImageView, mDenoiser.normal_depth_image_view(), mRayTracingResultImageView);
+	mPreview.create_resources(mResolution, mRayTracingCameraImageView, mRayTracingResultImageView);
+	mCheckpoint.create_resources(mResolution, glm::uvec2(mRayTracingMomentImageView->get_image().width(), mRayTracingMomentImageView->get_image().height()),
+		glm::uvec2(mDenoiser.albedo_image_view()->get_image().width(), mDenoiser.albedo_image_view()->get_image().height()));
 
 	// Initialize the TLAS (but don't build it yet)
 	mTlas = avk::context().create_top_level_acceleration_structure(
@@ -64,10 +93,22 @@ void renderer::create_ray_tracing_prerequisites()
 
 void renderer::create_ray_tracing_pipeline()
 {
+	// constant_id 0 = RAY_STATISTICS, the instrumentation build with ray counters, constant_id 1 = STAGE, one raygen group per wavefront_stage
+	auto rayGenerationShader = [this](wavefront_stage stage) {
+		return avk::ray_generation_shader(avk::shader_info::describe("shaders/ray_gen_shader.rgen")
+			.set_specialization_constant(0u, static_cast<uint32_t>(mRayStatistics.enabled()))
+			.set_specialization_constant(1u, static_cast<uint32_t>(stage)));
+	};
+
 	mRayTracingPipeline = avk::context().create_ray_tracing_pipeline_for(
 		// Specify all the shaders which participate in rendering in a shader binding table (the order matters):
 		avk::define_shader_table(
-			avk::ray_generation_shader("shaders/ray_gen_shader.rgen"),
+			rayGenerationShader(wavefront_stage::megakernel),
+			rayGenerationShader(wavefront_stage::generate),
+			rayGenerationShader(wavefront_stage::extend),
+			rayGenerationShader(wavefront_stage::shade),
+			rayGenerationShader(wavefront_stage::shadow_connect),
+			rayGenerationShader(wavefront_stage::accumulate),
 			avk::triangles_hit_group::create_with_rchit_only("shaders/closest_hit_shader.rchit"),
 			avk::miss_shader("shaders/miss_shader.rmiss")
 		),
@@ -78,13 +119,23 @@ void renderer::create_ray_tracing_pipeline()
 		avk::descriptor_binding(0, 0, mModelLoader.combined_image_sampler_descriptor_infos()),
 		avk::descriptor_binding(0, 1, mModelLoader.material_buffer()),
 		avk::descriptor_binding(0, 2, avk::as_uniform_texel_buffer_views(mModelLoader.index_buffer_views())),
-		avk::descriptor_binding(0, 3, avk::as_uniform_texel_buffer_views(mModelLoader.tex_coords_buffer_views())),
-		avk::descriptor_binding(0, 4, avk::as_uniform_texel_buffer_views(mModelLoader.normals_buffer_views())),
-		avk::descriptor_binding(0, 5, avk::as_uniform_texel_buffer_views(mModelLoader.tangents_buffer_views())),
-		avk::descriptor_binding(0, 6, avk::as_uniform_texel_buffer_views(mModelLoader.bitangents_buffer_views())),
+		avk::descriptor_binding(0, 3, avk::as_uniform_texel_buffer_views(mModelLoader.vertices_buffer_views())),
+		avk::descriptor_binding(0, 4, avk::as_uniform_texel_buffer_views(mModelLoader.position_buffer_views())),
+		avk::descriptor_binding(0, 5, mModelLoader.transforms_buffer()),
 		avk::descriptor_binding(1, 0, mRayTracingCameraImageView->as_storage_image(avk::layout::general)),
 		avk::descriptor_binding(1, 1, mRayTracingLightImageView->as_storage_image(avk::layout::general)),
 		avk::descriptor_binding(1, 2, mRayTracingResultImageView->as_storage_image(avk::layout::general)),
+		avk::descriptor_binding(1, 3, mRayStatistics.counter_buffer()),
+		avk::descriptor_binding(1, 4, mRayTracingMomentImageView->as_storage_image(avk::layout::general)),
+		avk::descriptor_binding(1, 5, mAdaptiveSampler.tile_buffer()),
+		avk::descriptor_binding(1, 6, mWavefront.counter_buffer()),
+		avk::descriptor_binding(1, 7, mWavefront.queue_buffer()),
+		avk::descriptor_binding(1, 8, mWavefront.path_buffer()),
+		avk::descriptor_binding(1, 9, mModelLoader.emissive_light_buffer()),
+		avk::descriptor_binding(1, 10, mModelLoader.environment_texel_buffer()),
+		avk::descriptor_binding(1, 11, mModelLoader.environment_cdf_buffer()),
+		avk::descriptor_binding(1, 12, mDenoiser.albedo_image_view()->as_storage_image(avk::layout::general)),
+		avk::descriptor_binding(1, 13, mDenoiser.normal_depth_image_view()->as_storage_image(avk::layout::general)),
 		avk::descriptor_binding(2, 0, mTlas) // Bind the TLAS, s.t. we can trace rays against it
 	);
 
@@ -101,6 +152,7 @@ void renderer::prepare_screenshots() {
 		vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst,
 		avk::generic_buffer_meta::create_from_size(mResolution.x * mResolution.y * 4)
 	);
+	mScreenshots.create_resources(mResolution);
 }
 
 
@@ -111,7 +163,7 @@ void renderer::initialize()
 	// Create a descriptor cache that helps us to conveniently create descriptor sets:
 	mDescriptorCache = avk::context().create_descriptor_cache();
 
-	mModelLoader.load_models_from_ini("assets/models.ini");
+	mModelLoader.load_models_from_ini(mSettings);
 
 	// Create a buffer for the transformation matrices in a host coherent memory region (one for each frame in flight):
 	for (int i = 0; i < 3; ++i) {
@@ -124,11 +176,15 @@ void renderer::initialize()
 
 	create_ray_tracing_prerequisites();
 	create_ray_tracing_pipeline();
+	if (mConvergence) {
+		mConvergence->create_resources(*mQueue, mRayTracingCameraImageView);
+	}
 
 	mRayTracingPipeline.enable_shared_ownership();
 	mRayTracingCameraImageView.enable_shared_ownership();
 	mRayTracingLightImageView.enable_shared_ownership();
 	mRayTracingResultImageView.enable_shared_ownership();
+	mRayTracingMomentImageView.enable_shared_ownership();
 
 	prepare_screenshots();
 
@@ -137,74 +193,65 @@ void renderer::initialize()
 	// enable shader hot reloading for all pipelines
 	mUpdater->on(avk::shader_files_changed_event(mRayTracingPipeline.as_reference())).update(mRayTracingPipeline);
 
-	// handle a window resize update
-	avk::updater_config_proxy updaterProxy = mUpdater->on(avk::swapchain_resized_event(avk::context().main_window()));
-	updaterProxy
-		.invoke([this]() {
-			this->mCameraController->set_aspect_ratio(avk::context().main_window()->aspect_ratio());
-		})
-		.update(
-			mRayTracingCameraImageView,
-			mRayTracingLightImageView,
-			mRayTracingResultImageView,
-			mRayTracingPipeline
-		)
-		.then_on(avk::destroying_image_view_event()) // Make sure that our descriptor cache stays cleaned up:
-		.invoke([this](const avk::image_view &aImageViewToBeDestroyed) {
-			mDescriptorCache->remove_sets_with_handle(aImageViewToBeDestroyed->handle());
-		});
-
-
-	// Add the cameras to the composition (and let them handle updates)
-	mCameraController = new camera_controller(avk::context().main_window()->aspect_ratio(), avk::current_composition());
-
-	// setup for automated quake camera
-	auto resolution = avk::context().main_window()->resolution();
-	avk::context().main_window()->set_cursor_pos({resolution[0] / 2.0, resolution[1] / 2.0});
+	if (mSettings.mHeadless) {
+		// There is no window, hence no swapchain which could be resized and no cursor to center
+		mCameraController = new camera_controller(static_cast<float>(mResolution.x) / static_cast<float>(mResolution.y), avk::current_composition());
+	}
+	else {
+		// handle a window resize update
+		avk::updater_config_proxy updaterProxy = mUpdater->on(avk::swapchain_resized_event(avk::context().main_window()));
+		updaterProxy
+			.invoke([this]() {
+				this->mCameraController->set_aspect_ratio(avk::context().main_window()->aspect_ratio());
+			})
+			.update(
+				mRayTracingCameraImageView,
+				mRayTracingLightImageView,
+				mRayTracingResultImageView,
+				mRayTracingMomentImageView,
+				mRayTracingPipeline
+			)
+			.then_on(avk::destroying_image_view_event()) // Make sure that our descriptor cache stays cleaned up:
+			.invoke([this](const avk::image_view &aImageViewToBeDestroyed) {
+				mDescriptorCache->remove_sets_with_handle(aImageViewToBeDestroyed->handle());
+			});
+
+
+		// Add the cameras to the composition (and let them handle updates)
+		mCameraController = new camera_controller(avk::context().main_window()->aspect_ratio(), avk::current_composition());
+
+		// setup for automated quake camera
+		auto resolution = avk::context().main_window()->resolution();
+		avk::context().main_window()->set_cursor_pos({resolution[0] / 2.0, resolution[1] / 2.0});
+	}
 
-	mCameraController->set_global_transformation_matrix({
-		0.719,		-0.000,	0.695,	0.000,
-		 0.063,		0.996,	-0.065, 0.000,
-		-0.692,		0.091,	0.716,	0.000,
-		-13.311,	2.343,  1.132,  1.000
-	});
+	mCameraController->set_global_transformation_matrix(mSettings.mCameraTransform);
+	mResumed = mCheckpoint.resume(mRayTracingCameraImageView, mRayTracingLightImageView, mRayTracingMomentImageView,
+		mDenoiser.albedo_image_view(), mDenoiser.normal_depth_image_view(), mModelLoader.scene_hash());
+	if (mResumed) {
+		mCameraController->set_global_transformation_matrix(mResumed->mCameraTransform);
+	}
 	mCameraController->disable_cams();
 
 	//avk::context().main_window()->switch_to_fullscreen_mode();
 	//mIsFullscreen = true;
 }
 
-void renderer::render()
+std::vector<avk::recorded_commands_t> renderer::accumulation_commands()
 {
-	auto mainWnd = avk::context().main_window();
-	auto inFlightIndex = mainWnd->current_in_flight_index();
-
-	auto currentTime = std::chrono::high_resolution_clock::now();
-	float time = std::chrono::duration<float, std::milli>(currentTime - mStartTime).count();
-
-	auto viewProjMat = mCameraController->projection_and_view_matrix();
-	auto emptyCmd = mViewProjBuffers[inFlightIndex]->fill(glm::value_ptr(viewProjMat), 0);
+	// The trace writes the unfiltered result again
+	mResultDenoised = false;
+	std::vector<avk::recorded_commands_t> commands = {
+		mGpuProfiler.begin(gpu_pass::accumulation_clear),
 
-	// Get a command pool to allocate command buffers from:
-	auto &commandPool = avk::context().get_command_pool_for_single_use_command_buffers(*mQueue);
-
-	// The swap chain provides us with an "image available semaphore" for the current frame.
-	// Only after the swapchain image has become available, we may start rendering into it.
-	auto imageAvailableSemaphore = mainWnd->consume_current_image_available_semaphore();
-
-	// Create a command buffer and render into the *current* swap chain image:
-	auto cmdBfr = commandPool->alloc_command_buffer(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
-
-	avk::context().record({
-
-		// clear camera image on move
+		// clear camera image when the accumulation restarts (on move)
 		avk::sync::image_memory_barrier(mRayTracingCameraImageView->get_image(),
 			avk::stage::ray_tracing_shader >> avk::stage::all_transfer,
 			avk::access::shader_write >> avk::access::transfer_write
 		).with_layout_transition(avk::layout::general >> avk::layout::transfer_dst),
 
 
-		avk::command::conditional([this] { return mCameraController->hasMoved(); },
+		avk::command::conditional([this] { return mClearAccumulation; },
 			[this] {
 				return avk::command::custom_commands([=](avk::command_buffer_t& cb) {
 					auto const clearValue = vk::ClearColorValue{0.0f, 0.0f, 0.0f, 0.0f};
@@ -227,14 +274,14 @@ void renderer::render()
 		).with_layout_transition(avk::layout::transfer_dst >> avk::layout::general),
 
 
-		// clear light image on move
+		// clear light image when the accumulation restarts (on move)
 		avk::sync::image_memory_barrier(mRayTracingLightImageView->get_image(),
 			avk::stage::ray_tracing_shader >> avk::stage::all_transfer,
 			avk::access::shader_write >> avk::access::transfer_write
 		).with_layout_transition(avk::layout::general >> avk::layout::transfer_dst),
 
 
-		avk::command::conditional([this] { return mCameraController->hasMoved(); },
+		avk::command::conditional([this] { return mClearAccumulation; },
 			[this] {
 				return avk::command::custom_commands([=](avk::command_buffer_t& cb) {
 					auto const clearValue = vk::ClearColorValue{0.0f, 0.0f, 0.0f, 0.0f};
@@ -257,42 +304,259 @@ void renderer::render()
 		).with_layout_transition(avk::layout::transfer_dst >> avk::layout::general),
 
 
+		// clear the second moments of adaptive sampling when the accumulation restarts (on move)
+		avk::sync::image_memory_barrier(mRayTracingMomentImageView->get_image(),
+			avk::stage::ray_tracing_shader >> avk::stage::all_transfer,
+			avk::access::shader_write >> avk::access::transfer_write
+		).with_layout_transition(avk::layout::general >> avk::layout::transfer_dst),
+
+
+		avk::command::conditional([this] { return mClearAccumulation; },
+			[this] {
+				return avk::command::custom_commands([=](avk::command_buffer_t& cb) {
+					auto const clearValue = vk::ClearColorValue{0.0f, 0.0f, 0.0f, 0.0f};
+					auto const subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0u, 1u, 0u, 1u);
+					cb.handle().clearColorImage(
+						mRayTracingMomentImageView->get_image().handle(),
+						vk::ImageLayout::eTransferDstOptimal,
+						&clearValue,
+						1,
+						&subresourceRange,
+						cb.root_ptr()->dispatch_loader_core()
+					);
+				});
+			}
+		),
+
+		avk::sync::image_memory_barrier(mRayTracingMomentImageView->get_image(),
+			avk::stage::all_transfer >> avk::stage::ray_tracing_shader,
+			avk::access::transfer_write >> avk::access::shader_write
+		).with_layout_transition(avk::layout::transfer_dst >> avk::layout::general),
+
+		mGpuProfiler.end(gpu_pass::accumulation_clear),
+
 
 		// do ray tracing
+		mRayStatistics.reset(),
+		mGpuProfiler.begin(gpu_pass::trace_rays),
 		avk::command::bind_pipeline(mRayTracingPipeline.as_reference()),
 		avk::command::bind_descriptors(mRayTracingPipeline->layout(), mDescriptorCache->get_or_create_descriptor_sets({
 			avk::descriptor_binding(0, 0, mModelLoader.combined_image_sampler_descriptor_infos()),
 			avk::descriptor_binding(0, 1, mModelLoader.material_buffer()),
 			avk::descriptor_binding(0, 2, avk::as_uniform_texel_buffer_views(mModelLoader.index_buffer_views())),
-			avk::descriptor_binding(0, 3, avk::as_uniform_texel_buffer_views(mModelLoader.tex_coords_buffer_views())),
-			avk::descriptor_binding(0, 4, avk::as_uniform_texel_buffer_views(mModelLoader.normals_buffer_views())),
-			avk::descriptor_binding(0, 5, avk::as_uniform_texel_buffer_views(mModelLoader.tangents_buffer_views())),
-			avk::descriptor_binding(0, 6, avk::as_uniform_texel_buffer_views(mModelLoader.bitangents_buffer_views())),
+			avk::descriptor_binding(0, 3, avk::as_uniform_texel_buffer_views(mModelLoader.vertices_buffer_views())),
+			avk::descriptor_binding(0, 4, avk::as_uniform_texel_buffer_views(mModelLoader.position_buffer_views())),
+			avk::descriptor_binding(0, 5, mModelLoader.transforms_buffer()),
 			avk::descriptor_binding(1, 0, mRayTracingCameraImageView->as_storage_image(avk::layout::general)),
 			avk::descriptor_binding(1, 1, mRayTracingLightImageView->as_storage_image(avk::layout::general)),
 			avk::descriptor_binding(1, 2, mRayTracingResultImageView->as_storage_image(avk::layout::general)),
+			avk::descriptor_binding(1, 3, mRayStatistics.counter_buffer()),
+			avk::descriptor_binding(1, 4, mRayTracingMomentImageView->as_storage_image(avk::layout::general)),
+			avk::descriptor_binding(1, 5, mAdaptiveSampler.tile_buffer()),
+			avk::descriptor_binding(1, 6, mWavefront.counter_buffer()),
+			avk::descriptor_binding(1, 7, mWavefront.queue_buffer()),
+			avk::descriptor_binding(1, 8, mWavefront.path_buffer()),
+			avk::descriptor_binding(1, 9, mModelLoader.emissive_light_buffer()),
+			avk::descriptor_binding(1, 10, mModelLoader.environment_texel_buffer()),
+			avk::descriptor_binding(1, 11, mModelLoader.environment_cdf_buffer()),
+			avk::descriptor_binding(1, 12, mDenoiser.albedo_image_view()->as_storage_image(avk::layout::general)),
+			avk::descriptor_binding(1, 13, mDenoiser.normal_depth_image_view()->as_storage_image(avk::layout::general)),
 			avk::descriptor_binding(2, 0, mTlas)
-		})),
-		avk::command::push_constants(
-			mRayTracingPipeline->layout(),
-			ray_tracing_push_constant_data {
-				mCameraController->global_transformation_matrix(),
-				mCameraController->inverse_global_transformation_matrix(),
-				((90 / 2.0) / 180.0) * glm::pi<float>()
-			},
-			avk::shader_type::ray_generation | avk::shader_type::closest_hit
-		),
+		}))
+	};
+
+	if (mWavefront.enabled()) {
+		// The same paths as the megakernel launch would trace, none once adaptive sampling has converged
+		vk::Extent3D launchSize = launch_size();
+		uint32_t pathCount = mAdaptiveSampler.converged() ? 0 : launchSize.width * launchSize.height;
+
+		auto wavefrontCommands = mWavefront.sample_commands(pathCount, [this](wavefront_stage stage, uint32_t firstPath, uint32_t bounce, uint32_t stagePathCount) {
+			return std::vector<avk::recorded_commands_t>{
+				avk::command::push_constants(
+					mRayTracingPipeline->layout(),
+					push_constant_data(firstPath, bounce),
+					avk::shader_type::ray_generation | avk::shader_type::closest_hit
+				),
+				avk::command::trace_rays(
+					{stagePathCount, 1, 1},
+					mRayTracingPipeline->shader_binding_table(),
+					avk::using_raygen_group_at_index(static_cast<uint32_t>(stage)),
+					avk::using_miss_group_at_index(0),
+					avk::using_hit_group_at_index(0)
+				)
+			};
+		});
+		commands.insert(commands.end(), std::make_move_iterator(wavefrontCommands.begin()), std::make_move_iterator(wavefrontCommands.end()));
+	}
+	else {
+		commands.insert(commands.end(), {
+			avk::command::push_constants(
+				mRayTracingPipeline->layout(),
+				push_constant_data(0, 0),
+				avk::shader_type::ray_generation | avk::shader_type::closest_hit
+			),
+
+			// Do it (only where adaptive sampling has not converged yet):
+			avk::command::conditional([this] { return !mAdaptiveSampler.converged(); },
+				[this] {
+					return avk::command::trace_rays(
+						launch_size(),
+						mRayTracingPipeline->shader_binding_table(),
+						avk::using_raygen_group_at_index(static_cast<uint32_t>(wavefront_stage::megakernel)),
+						avk::using_miss_group_at_index(0),
+						avk::using_hit_group_at_index(0)
+					);
+				}
+			)
+		});
+	}
 
-		// Do it:
-		avk::command::trace_rays(
-			{mResolution.x, mResolution.y, 1},
-			mRayTracingPipeline->shader_binding_table(),
-			avk::using_raygen_group_at_index(0),
-			avk::using_miss_group_at_index(0),
-			avk::using_hit_group_at_index(0)
-		),
+	commands.insert(commands.end(), {
+		mGpuProfiler.end(gpu_pass::trace_rays),
+		mRayStatistics.read_back()
+	});
+
+	if (mReprojection.pending()) {
+		// The history has to be saved before the clears, the new sample is merged with it after trace_rays
+		std::vector<avk::recorded_commands_t> historyCommands = mReprojection.history_commands(mRayTracingCameraImageView, mRayTracingMomentImageView, mDenoiser.normal_depth_image_view());
+		std::vector<avk::recorded_commands_t> mergeCommands = mReprojection.merge_commands(mDescriptorCache, mRayTracingCameraImageView, mRayTracingMomentImageView,
+			mDenoiser.normal_depth_image_view(), mRayTracingResultImageView, push_constant_data(0, 0).mCameraHalfFovAngle);
+		commands.insert(commands.begin(), std::make_move_iterator(historyCommands.begin()), std::make_move_iterator(historyCommands.end()));
+		commands.insert(commands.end(), std::make_move_iterator(mergeCommands.begin()), std::make_move_iterator(mergeCommands.end()));
+	}
+	return commands;
+}
 
+std::vector<avk::recorded_commands_t> renderer::denoise_commands()
+{
+	std::vector<avk::recorded_commands_t> commands = mDenoiser.commands(mDescriptorCache, mRayTracingCameraImageView, mRayTracingResultImageView);
+	commands.insert(commands.begin(), mGpuProfiler.begin(gpu_pass::denoise));
+	commands.push_back(mGpuProfiler.end(gpu_pass::denoise));
+	mResultDenoised = true;
+	return commands;
+}
+
+renderer::ray_tracing_push_constant_data renderer::push_constant_data(uint32_t wavefrontFirstPath, uint32_t wavefrontBounce) const
+{
+	const float cameraHalfFovAngle = ((90 / 2.0) / 180.0) * glm::pi<float>();
+	const bool sliced = mTimeSlicer.enabled() && !mPreview.active();
+
+	return ray_tracing_push_constant_data {
+		mCameraController->global_transformation_matrix(),
+		mCameraController->inverse_global_transformation_matrix(),
+		cameraHalfFovAngle,
+		mSettings.pixel_spread_angle(cameraHalfFovAngle) * mPreview.factor(),
+		mAdaptiveSampler.current_mode(),
+		wavefrontFirstPath,
+		wavefrontBounce,
+		static_cast<uint32_t>(mDenoiser.available()),
+		sliced ? mTimeSlicer.current_slice().mFirstTile : 0,
+		sliced ? mTimeSlicer.current_slice().mTileCount : 0,
+		mPreview.factor()
+	};
+}
+
+vk::Extent3D renderer::launch_size() const
+{
+	if (mPreview.active()) {
+		return mPreview.launch_size(mResolution);
+	}
+	return mTimeSlicer.enabled() ? mTimeSlicer.launch_size() : mAdaptiveSampler.launch_size(mResolution);
+}
+
+void renderer::render()
+{
+	glm::mat4 cameraTransform = mCameraController->global_transformation_matrix();
+	bool previousPreview = mPreview.active();
+	// Setting the camera of a resumed checkpoint is not a move, it must not clear the accumulation
+	bool cameraMoved = mCameraController->hasMoved() && !mResumed;
+	if (mPreview.enabled()) {
+		if (auto traceRays = mGpuProfiler.latest(gpu_pass::trace_rays)) {
+			mPreview.add_measurement(*traceRays);
+		}
+		mPreview.next_frame(cameraMoved);
+	}
+
+	if (mResumed) {
+		// After the initial TLAS build, which resets the sample count
+		mSamplesPerPixel = mResumed->mSamplesPerPixel;
+		mAccumulationStartTime = std::chrono::steady_clock::now() - std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(mResumed->mSeconds));
+		mResumed.reset();
+	}
+
+	// With time slicing, no sample is complete until the end of the first sweep. The samples of a preview are never kept.
+	mClearAccumulation = cameraMoved || previousPreview || (mSamplesPerPixel == 0 && !mTimeSlicer.sweep_in_progress());
+	if (mClearAccumulation) {
+		// Only camera moves may keep the accumulation, explicit restarts (first frame, benchmark views, TLAS rebuilds) always clear it
+		mReprojection.restart(mSamplesPerPixel > 0 && !previousPreview && !mPreview.active(), mPreviousCameraTransform, cameraTransform);
+		mSamplesPerPixel = 0;
+		mAccumulationStartTime = std::chrono::steady_clock::now();
+		if (mConvergence) {
+			mConvergence->restart();
+		}
+		mTargetErrorReached = false;
+		mAdaptiveSampler.restart();
+		mTimeSlicer.restart();
+	}
+	mSweepCompleted = true;
+	if (mTimeSlicer.enabled() && !mPreview.active()) {
+		if (auto traceRays = mGpuProfiler.latest(gpu_pass::trace_rays)) {
+			mTimeSlicer.add_measurement(*traceRays);
+		}
+		bool allTiles = mAdaptiveSampler.current_mode() != adaptive_sampler::mode::active_tiles;
+		mSweepCompleted = mTimeSlicer.next_slice(allTiles ? mTimeSlicer.tile_count() : mAdaptiveSampler.active_tile_count(), allTiles, mGpuProfiler.frame());
+	}
+	if (mSweepCompleted) {
+		mSamplesPerPixel++;
+	}
+	vk::Extent3D launchSize = launch_size();
+	uint32_t tracedPixels = mAdaptiveSampler.converged() ? 0 : launchSize.width * launchSize.height;
+	mPreview.add_frame(mGpuProfiler.frame(), tracedPixels);
+	mPreviousCameraTransform = cameraTransform;
+
+	if (mSettings.mHeadless) {
+		// Nothing to present, just accumulate one more sample and wait for it, s.t. the budget check in update() is exact:
+		auto frameStart = std::chrono::steady_clock::now();
+		avk::context().record_and_submit_with_fence(accumulation_commands(), *mQueue)->wait_until_signalled();
+		if (mBenchmark) {
+			mBenchmark->add_frame(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count(), tracedPixels);
+		}
+		return;
+	}
+
+	auto mainWnd = avk::context().main_window();
+	auto inFlightIndex = mainWnd->current_in_flight_index();
 
+	auto currentTime = std::chrono::high_resolution_clock::now();
+	float time = std::chrono::duration<float, std::milli>(currentTime - mStartTime).count();
+
+	auto viewProjMat = mCameraController->projection_and_view_matrix();
+	auto emptyCmd = mViewProjBuffers[inFlightIndex]->fill(glm::value_ptr(viewProjMat), 0);
+
+	// Get a command pool to allocate command buffers from:
+	auto &commandPool = avk::context().get_command_pool_for_single_use_command_buffers(*mQueue);
+
+	// The swap chain provides us with an "image available semaphore" for the current frame.
+	// Only after the swapchain image has become available, we may start rendering into it.
+	auto imageAvailableSemaphore = mainWnd->consume_current_image_available_semaphore();
+
+	// Create a command buffer and render into the *current* swap chain image:
+	auto cmdBfr = commandPool->alloc_command_buffer(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+
+	std::vector<avk::recorded_commands_t> commands = accumulation_commands();
+	if (mPreview.active()) {
+		// Instead of the denoiser, which needs every pixel
+		std::vector<avk::recorded_commands_t> previewCommands = mPreview.commands(mDescriptorCache, mRayTracingCameraImageView, mRayTracingResultImageView);
+		commands.push_back(mGpuProfiler.begin(gpu_pass::preview));
+		commands.insert(commands.end(), std::make_move_iterator(previewCommands.begin()), std::make_move_iterator(previewCommands.end()));
+		commands.push_back(mGpuProfiler.end(gpu_pass::preview));
+	}
+	else if (mDenoiser.active()) {
+		std::vector<avk::recorded_commands_t> denoiseCommands = denoise_commands();
+		commands.insert(commands.end(), std::make_move_iterator(denoiseCommands.begin()), std::make_move_iterator(denoiseCommands.end()));
+	}
+	commands.insert(commands.end(), {
+		mGpuProfiler.begin(gpu_pass::result_blit),
 		avk::sync::image_memory_barrier(mRayTracingResultImageView->get_image(),
 			avk::stage::ray_tracing_shader >> avk::stage::blit,
 			avk::access::shader_write >> avk::access::transfer_read
@@ -315,9 +579,10 @@ void renderer::render()
 			avk::stage::blit >> avk::stage::color_attachment_output,
 			avk::access::transfer_write >> avk::access::color_attachment_write
 			).with_layout_transition(avk::layout::transfer_dst >> avk::layout::present_src),
-		
-		
-	})
+		mGpuProfiler.end(gpu_pass::result_blit)
+	});
+
+	avk::context().record(std::move(commands))
 	.into_command_buffer(cmdBfr)
 	.then_submit_to(*mQueue)
 	// Do not start to render before the image has become available:
@@ -329,6 +594,17 @@ void renderer::render()
 
 void renderer::update()
 {
+	// update() runs before render(), the TLAS rebuild below already belongs to the new frame:
+	mGpuProfiler.next_frame();
+	mRayStatistics.next_frame();
+	mScreenshots.poll();
+	mCheckpoint.poll();
+
+	if (mSettings.mHeadless) {
+		update_headless();
+		return;
+	}
+
 	static int counter = 0;
 	if (++counter == 4) {
 		auto current = std::chrono::high_resolution_clock::now();
@@ -371,9 +647,147 @@ void renderer::update()
 		take_screenshot();
 	}
 
+	if (avk::input().key_pressed(avk::key_code::n) && mDenoiser.toggle()) {
+		printf("Denoiser %s\n", mDenoiser.active() ? "on" : "off");
+	}
+
+	if (avk::input().key_pressed(avk::key_code::g)) {
+		mGpuProfiler.print_averages();
+		mRayStatistics.print_averages(mGpuProfiler.average_milliseconds(gpu_pass::trace_rays));
+		mTimeSlicer.print_statistics();
+	}
+
+	// The sample count only changes at the end of a sweep
+	if (mSweepCompleted && mConvergence && mConvergence->due(mSamplesPerPixel)) {
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - mAccumulationStartTime).count();
+		if (mConvergence->measure(mDescriptorCache, mRayTracingCameraImageView, mSamplesPerPixel, seconds) && !mTargetErrorReached) {
+			// The window keeps accumulating, reported once per accumulation
+			printf("Target error reached after %u spp in %.3lf s\n", mSamplesPerPixel, seconds);
+			mTargetErrorReached = true;
+		}
+	}
+
+	if (mSweepCompleted && mAdaptiveSampler.due(mSamplesPerPixel)) {
+		bool wasConverged = mAdaptiveSampler.converged();
+		mAdaptiveSampler.evaluate(mDescriptorCache, mRayTracingCameraImageView, mRayTracingMomentImageView);
+		if (mAdaptiveSampler.converged() && !wasConverged) {
+			printf("Adaptive sampling converged after %u launches\n", mSamplesPerPixel);
+		}
+	}
+
+	save_checkpoint_if_due();
+
 	mCameraController->update(avk::input(), avk::current_composition());
 
 
+	rebuild_tlas_if_required();
+}
+
+void renderer::update_headless()
+{
+	if (mBenchmark) {
+		// Before the camera controller notices the new view, s.t. the next frame restarts the accumulation
+		update_benchmark();
+	}
+
+	// No input to react to, but the controller still has to notice that the camera did not move since the last frame:
+	mCameraController->update(avk::input(), avk::current_composition());
+
+	rebuild_tlas_if_required();
+
+	// Every pixel has the same number of samples only at the end of a sweep
+	if (mBenchmark || mSamplesPerPixel == 0 || !mSweepCompleted) {
+		return;
+	}
+	save_checkpoint_if_due();
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - mAccumulationStartTime).count();
+	bool samplesReached = mSettings.mTargetSamplesPerPixel > 0 && mSamplesPerPixel >= mSettings.mTargetSamplesPerPixel;
+	bool timeReached = mSettings.mTimeBudgetSeconds > 0.0 && seconds >= mSettings.mTimeBudgetSeconds;
+	bool errorReached = mConvergence && mConvergence->due(mSamplesPerPixel) && mConvergence->measure(mDescriptorCache, mRayTracingCameraImageView, mSamplesPerPixel, seconds);
+	if (mAdaptiveSampler.due(mSamplesPerPixel)) {
+		mAdaptiveSampler.evaluate(mDescriptorCache, mRayTracingCameraImageView, mRayTracingMomentImageView);
+	}
+	if (!samplesReached && !timeReached && !errorReached && !mAdaptiveSampler.converged()) {
+		return;
+	}
+
+	if (mDenoiser.active() && !mResultDenoised) {
+		// Only the written result is filtered, the accumulation stays untouched. Headless frames never record the filter,
+		// this is its only pass.
+		avk::context().record_and_submit_with_fence(denoise_commands(), *mQueue)->wait_until_signalled();
+	}
+
+	std::string fileName = mSettings.mOutputPath;
+	if (fileName.empty()) {
+		std::stringstream defaultFileName;
+		defaultFileName << "./results/" << mStartTimestamp << ".png";
+		fileName = defaultFileName.str();
+	}
+	write_result_image(fileName);
+
+	double samples = static_cast<double>(mSamplesPerPixel) * mResolution.x * mResolution.y;
+	printf("Rendered %u spp at %ux%u in %.3lf s: %.3lf Msamples/sec\n", mSamplesPerPixel, mResolution.x, mResolution.y, seconds, samples / seconds * 1e-6);
+	mGpuProfiler.print_averages();
+	mRayStatistics.print_averages(mGpuProfiler.average_milliseconds(gpu_pass::trace_rays));
+	mTimeSlicer.print_statistics();
+
+	avk::current_composition()->stop();
+}
+
+void renderer::update_benchmark()
+{
+	bool started = mSamplesPerPixel > 0 || mTimeSlicer.sweep_in_progress();
+	if (!started) {
+		mBenchmark->set_startup_time(std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - mStartTime).count());
+	}
+	else {
+		if (mSamplesPerPixel < mBenchmark->current_view().mSamplesPerPixel) {
+			return;
+		}
+		if (mDenoiser.active() && !mResultDenoised) {
+			// Like the headless output, the filtered view is compared with its reference
+			avk::context().record_and_submit_with_fence(denoise_commands(), *mQueue)->wait_until_signalled();
+		}
+		read_back_result_image();
+		auto mapping = mScreenshotBuffer->map_memory(avk::mapping_access::read);
+		mBenchmark->finish_view(static_cast<const uint8_t *>(mapping.get()), mSamplesPerPixel);
+	}
+
+	if (!mBenchmark->next_view()) {
+		if (!mBenchmark->write_report()) {
+			std::cerr << "Could not write the benchmark report" << std::endl;
+		}
+		mGpuProfiler.print_averages();
+		mRayStatistics.print_averages(mGpuProfiler.average_milliseconds(gpu_pass::trace_rays));
+		avk::current_composition()->stop();
+		return;
+	}
+
+	// Restart the accumulation, also if the view did not move
+	mCameraController->set_global_transformation_matrix(mBenchmark->current_view().mCameraTransform);
+	mSamplesPerPixel = 0;
+	mTimeSlicer.restart();
+}
+
+void renderer::save_checkpoint_if_due()
+{
+	// Mid-sweep, previews and cleared accumulations would store pixels with differing or no samples
+	if (!mCheckpoint.due() || !mSweepCompleted || mPreview.active() || mSamplesPerPixel == 0) {
+		return;
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - mAccumulationStartTime).count();
+	mCheckpoint.save(mRayTracingCameraImageView, mRayTracingLightImageView, mRayTracingMomentImageView, mDenoiser.albedo_image_view(), mDenoiser.normal_depth_image_view(),
+		{ mCameraController->global_transformation_matrix(), mModelLoader.scene_hash(), mSamplesPerPixel, seconds });
+}
+
+bool renderer::succeeded() const
+{
+	return !mBenchmark || mBenchmark->passed();
+}
+
+void renderer::rebuild_tlas_if_required()
+{
 	if (mModelLoader.has_updated_geometry_for_tlas())
 	{
 		// Getometry selection has changed => rebuild the TLAS:
@@ -381,16 +795,15 @@ void renderer::update()
 		std::vector<avk::geometry_instance> activeGeometryInstances = mModelLoader.get_active_geometry_instances_for_tlas_build();
 
 		if (!activeGeometryInstances.empty()) {
-			// Get a command pool to allocate command buffers from:
-			auto &commandPool = avk::context().get_command_pool_for_single_use_command_buffers(*mQueue);
-
-			// Create a command buffer and render into the *current* swap chain image:
-			auto cmdBfr = commandPool->alloc_command_buffer(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+			// The accumulated samples show the old geometry
+			mSamplesPerPixel = 0;
+			mTimeSlicer.restart();
 
-			avk::context().record({
+			std::vector<avk::recorded_commands_t> commands = {
 				// We're using only one TLAS for all frames in flight. Therefore, we need to set up a barrier
 				// affecting the whole queue which waits until all previous ray tracing work has completed:
 				avk::sync::global_execution_barrier(avk::stage::ray_tracing_shader >> avk::stage::acceleration_structure_build),
+				mGpuProfiler.begin(gpu_pass::tlas_rebuild),
 
 				// ...then we can safely update the TLAS with new data:
 				mTlas->build(                // We're not updating existing geometry, but we are changing the geometry => therefore, we need to perform a full rebuild.
@@ -403,8 +816,23 @@ void renderer::update()
 				avk::sync::global_memory_barrier(
 					avk::stage::acceleration_structure_build >> avk::stage::ray_tracing_shader,
 					avk::access::acceleration_structure_write >> avk::access::acceleration_structure_read
-				)
-				})
+				),
+				mGpuProfiler.end(gpu_pass::tlas_rebuild)
+			};
+
+			if (mSettings.mHeadless) {
+				// There is no window which could take care of the command buffer's lifetime:
+				avk::context().record_and_submit_with_fence(std::move(commands), *mQueue)->wait_until_signalled();
+				return;
+			}
+
+			// Get a command pool to allocate command buffers from:
+			auto &commandPool = avk::context().get_command_pool_for_single_use_command_buffers(*mQueue);
+
+			// Create a command buffer and render into the *current* swap chain image:
+			auto cmdBfr = commandPool->alloc_command_buffer(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+
+			avk::context().record(std::move(commands))
 				.into_command_buffer(cmdBfr)
 				.then_submit_to(*mQueue)
 				.submit();
@@ -414,9 +842,7 @@ void renderer::update()
 	}
 }
 
-void renderer::take_screenshot() {
-	std::cout << "taking screenshot" << std::endl;
-
+void renderer::read_back_result_image() {
 	avk::context().record_and_submit_with_fence({
 	avk::sync::image_memory_barrier(mRayTracingResultImageView->get_image(),
 		avk::stage::ray_tracing_shader >> avk::stage::blit,
@@ -442,29 +868,35 @@ void renderer::take_screenshot() {
 
 	avk::copy_image_to_buffer(mScreenshotImage, avk::layout::transfer_src, vk::ImageAspectFlagBits::eColor, mScreenshotBuffer)
 	}, *mQueue)->wait_until_signalled();
+}
 
-	void* data = mScreenshotBuffer->map_memory(avk::mapping_access::read).get();
-
-	std::thread stbiThread([](void* data, glm::uvec2 resolution) {
-		int channels = 4;
-
-		const auto p1 = std::chrono::system_clock::now();
-		const auto timestamp = std::chrono::duration_cast<std::chrono::seconds>(p1.time_since_epoch()).count();
+void renderer::take_screenshot() {
+	std::cout << "taking screenshot" << std::endl;
 
-		std::stringstream fileName;
-		fileName << "./results/" << timestamp << ".png";
+	const auto p1 = std::chrono::system_clock::now();
+	const auto timestamp = std::chrono::duration_cast<std::chrono::seconds>(p1.time_since_epoch()).count();
 
-		int result = stbi_write_png(
-			fileName.str().c_str(),
-			resolution.x,
-			resolution.y,
-			channels,
-			data,
-			resolution.x * channels
-		);
+	std::stringstream fileName;
+	fileName << "./results/" << timestamp;
+	std::string linearFileName = mScreenshots.linear() ? fileName.str() + "." + mScreenshots.linear_format() : std::string{};
+	mScreenshots.capture(mRayTracingResultImageView, mRayTracingCameraImageView, fileName.str() + ".png", linearFileName);
+}
 
-		std::cout << "stbi said: " << result << std::endl;
-	}, data, mResolution);
+void renderer::write_result_image(const std::string &fileName) {
+	std::string pngFileName = fileName;
+	std::string linearFileName;
+	size_t extension = fileName.rfind('.');
+	std::string stem = extension == std::string::npos ? fileName : fileName.substr(0, extension);
+	if (fileName.compare(stem.size(), std::string::npos, ".pfm") == 0 || fileName.compare(stem.size(), std::string::npos, ".exr") == 0) {
+		pngFileName.clear();
+		linearFileName = fileName;
+	}
+	else if (mScreenshots.linear()) {
+		linearFileName = stem + "." + mScreenshots.linear_format();
+	}
 
-	stbiThread.detach();
+	// The earlier screenshots free their slots, then this one is written
+	mScreenshots.flush();
+	mScreenshots.capture(mRayTracingResultImageView, mRayTracingCameraImageView, pngFileName, linearFileName);
+	mScreenshots.flush();
 }
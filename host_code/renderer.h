@@ -1,7 +1,20 @@
 #pragma once
 
+#include "accumulation_checkpoint.h"
+#include "adaptive_sampler.h"
 #include "camera_controller.h"
+#include "camera_path_benchmark.h"
+#include "convergence_monitor.h"
+#include "denoiser.h"
+#include "dynamic_resolution.h"
+#include "gpu_profiler.h"
 #include "model_loader.h"
+#include "ray_statistics.h"
+#include "render_settings.h"
+#include "screenshot_writer.h"
+#include "temporal_reprojection.h"
+#include "time_slicer.h"
+#include "wavefront_queues.h"
 
 #include <auto_vk_toolkit.hpp>
 #include <invokee.hpp>
@@ -19,9 +32,17 @@ public:
 		glm::mat4 mCameraTransform;
 		glm::mat4 mInvCameraTransform;
 		float mCameraHalfFovAngle;
+		float mPixelSpreadAngle;
+		adaptive_sampler::mode mAdaptiveMode;
+		uint32_t mWavefrontFirstPath;
+		uint32_t mWavefrontBounce;
+		uint32_t mWriteGuides;
+		uint32_t mSliceFirstTile;
+		uint32_t mSliceTileCount;
+		uint32_t mPreviewFactor;
 	};
 
-	renderer(avk::queue &aQueue, glm::uvec2 resolution);
+	renderer(avk::queue &aQueue, const render_settings &aSettings);
 
 	// utils
 	avk::image_sampler create_sampler(avk::image_view &imageView);
@@ -36,9 +57,32 @@ public:
 
 	void update() override;
 
+	// returns immediately, the files are written in the background (see screenshot_writer)
 	void take_screenshot();
 
+	// blocks until the tonemapped result has been written to the given png file, or the accumulation to a .pfm/.exr file
+	void write_result_image(const std::string &fileName);
+
+	// false if a benchmark failed, the process exit code depends on it
+	bool succeeded() const;
+
 private:
+	// clears (if the camera moved) and accumulates one more sample per pixel, shared by windowed and headless rendering
+	std::vector<avk::recorded_commands_t> accumulation_commands();
+	// the batch and bounce are only read by the wavefront stages
+	ray_tracing_push_constant_data push_constant_data(uint32_t wavefrontFirstPath, uint32_t wavefrontBounce) const;
+	// of the megakernel, the preview, the current time slice or everything adaptive sampling has not converged on yet
+	vk::Extent3D launch_size() const;
+	// filters the accumulation into the result image if the denoiser is active, with its GPU timing
+	std::vector<avk::recorded_commands_t> denoise_commands();
+	void rebuild_tlas_if_required();
+	// blocks until the result has been copied into mScreenshotBuffer, for the benchmark comparisons
+	void read_back_result_image();
+	void update_headless();
+	void update_benchmark();
+	// saves a checkpoint of the accumulation once it is due and every pixel has the same number of samples
+	void save_checkpoint_if_due();
+
 	std::chrono::high_resolution_clock::time_point mInitTime;
 
 	avk::queue *mQueue;
@@ -47,6 +91,7 @@ private:
 	avk::image_view mRayTracingCameraImageView;
 	avk::image_view mRayTracingLightImageView;
 	avk::image_view mRayTracingResultImageView;
+	avk::image_view mRayTracingMomentImageView;
 	avk::top_level_acceleration_structure mTlas;
 
 	std::array<avk::buffer, 3> mViewProjBuffers;
@@ -56,14 +101,36 @@ private:
 	camera_controller *mCameraController = nullptr;
 
 	model_loader mModelLoader;
+	gpu_profiler mGpuProfiler;
+	ray_statistics mRayStatistics;
+	adaptive_sampler mAdaptiveSampler;
+	time_slicer mTimeSlicer;
+	wavefront_queues mWavefront;
+	denoiser mDenoiser;
+	temporal_reprojection mReprojection; // after mDenoiser, it needs the guides
+	dynamic_resolution mPreview;
 
 	bool mIsFullscreen = false;
 	
 	std::chrono::steady_clock::time_point mStartTime;
 	size_t mStartTimestamp;
 
+	render_settings mSettings;
 	glm::uvec2 mResolution;
 
+	uint32_t mSamplesPerPixel = 0; // completed sweeps with time slicing
+	bool mClearAccumulation = false; // the current frame restarts the accumulation
+	bool mResultDenoised = false; // the result image holds the filtered accumulation of the last trace
+	bool mSweepCompleted = false; // the last frame added one sample to every pixel (always true without time slicing)
+	glm::mat4 mPreviousCameraTransform = glm::mat4(1.0f); // of the last rendered frame
+	std::optional<camera_path_benchmark> mBenchmark;
+	std::optional<convergence_monitor> mConvergence;
+	bool mTargetErrorReached = false; // of the current accumulation, in the window
+	std::chrono::steady_clock::time_point mAccumulationStartTime;
+	accumulation_checkpoint mCheckpoint;
+	std::optional<accumulation_checkpoint::state> mResumed; // continued instead of cleared by the first frame
+
 	avk::image mScreenshotImage;
 	avk::buffer mScreenshotBuffer;
+	screenshot_writer mScreenshots;
 };
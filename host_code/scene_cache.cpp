@@ -0,0 +1,625 @@
+#include "scene_cache.h"
+
+#include "material_helper.hpp"
+#include "task_system.h"
+
+#include <model.hpp>
+
+#include <filesystem>
+#include <fstream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+namespace {
+	constexpr uint32_t MAGIC = 0x43535450; // "PTSC"
+
+	// Every array starts at a cache line, which also satisfies the alignment of every element type
+	constexpr uint64_t ALIGNMENT = 64;
+
+	struct file_array {
+		uint64_t mOffset;
+		uint64_t mCount;
+	};
+
+	struct file_header {
+		uint32_t mMagic;
+		uint32_t mVersion;
+		uint64_t mContentHash;
+		uint32_t mImporterFlags;
+		uint32_t mMaterialSize; // guards against changes of avk::material_gpu_data
+		uint64_t mFileSize;
+		file_array mDrawCalls;
+		file_array mMaterials;
+		file_array mImages;
+		file_array mSamplers;
+	};
+
+	struct file_draw_call {
+		int32_t mMaterialIndex;
+		uint32_t mPadding;
+		file_array mPositions;
+		file_array mVertices;
+		file_array mIndices;
+	};
+
+	struct file_image {
+		uint32_t mWidth;
+		uint32_t mHeight;
+		uint32_t mLevelCount;
+		uint32_t mFormat; // texture_format
+		file_array mData; // all mip levels
+	};
+
+	struct file_sampler {
+		uint32_t mImageIndex;
+		uint32_t mBorderHandlingModes[2];
+		uint32_t mNearestNeighbor;
+	};
+
+	/// <summary>
+	/// Assigns aligned offsets to the arrays of a cache file and writes them in that order. The data of an array may be
+	/// provided after all offsets are known, which allows streaming the decoded textures into the file.
+	/// </summary>
+	class file_writer
+	{
+	public:
+		// Without `data`, provide() has to be called before the array can be flushed
+		template <typename T>
+		file_array add(const T *data, size_t count)
+		{
+			uint64_t offset = (mSize + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+			if (count > 0) {
+				mSize = offset + sizeof(T) * count;
+				mChunks.push_back({ offset, reinterpret_cast<const char *>(data), sizeof(T) * count });
+			}
+			return file_array{ offset, count };
+		}
+
+		template <typename T>
+		file_array add(const std::vector<T> &data) { return add(data.data(), data.size()); }
+
+		void provide(const file_array &array, const void *data)
+		{
+			auto found = std::lower_bound(mChunks.begin(), mChunks.end(), array.mOffset, [](const chunk &c, uint64_t offset) { return c.mOffset < offset; });
+			assert(found != mChunks.end() && found->mOffset == array.mOffset);
+			found->mData = static_cast<const char *>(data);
+		}
+
+		inline uint64_t size() const { return mSize; }
+
+		bool open(const std::string &path)
+		{
+			mFile.open(path, std::ios::binary | std::ios::trunc);
+			return mFile.good();
+		}
+
+		// Writes the arrays in order, up to the first one whose data has not been provided yet
+		bool flush()
+		{
+			const char padding[ALIGNMENT] = {};
+			for (; mFlushed < mChunks.size() && mChunks[mFlushed].mData != nullptr; mFlushed++) {
+				const chunk &c = mChunks[mFlushed];
+				mFile.write(padding, static_cast<std::streamsize>(c.mOffset - mPosition));
+				mFile.write(c.mData, static_cast<std::streamsize>(c.mSize));
+				mPosition = c.mOffset + c.mSize;
+			}
+			return mFile.good();
+		}
+
+		void close() { mFile.close(); }
+
+	private:
+		struct chunk {
+			uint64_t mOffset;
+			const char *mData;
+			size_t mSize;
+		};
+
+		uint64_t mSize = 0;
+		std::vector<chunk> mChunks;
+
+		std::ofstream mFile;
+		size_t mFlushed = 0;
+		uint64_t mPosition = 0;
+	};
+
+	// A truncated or otherwise broken file must never lead to reads outside of the mapping
+	template <typename T>
+	std::span<const T> array_view(const mapped_file &file, const file_array &array, bool &valid)
+	{
+		if (array.mOffset % ALIGNMENT != 0 || array.mOffset > file.size() || array.mCount > (file.size() - array.mOffset) / sizeof(T)) {
+			valid = false;
+			return {};
+		}
+		return std::span<const T>(reinterpret_cast<const T *>(file.data() + array.mOffset), static_cast<size_t>(array.mCount));
+	}
+
+	void offset_texture_indices(avk::material_gpu_data &material, int offset)
+	{
+		for (int *index : {
+			&material.mDiffuseTexIndex, &material.mSpecularTexIndex, &material.mAmbientTexIndex, &material.mEmissiveTexIndex,
+			&material.mHeightTexIndex, &material.mNormalsTexIndex, &material.mShininessTexIndex, &material.mOpacityTexIndex,
+			&material.mDisplacementTexIndex, &material.mReflectionTexIndex, &material.mLightmapTexIndex, &material.mExtraTexIndex }) {
+			if (*index >= 0) {
+				*index += offset;
+			}
+		}
+	}
+}
+
+
+mapped_file::~mapped_file()
+{
+	close();
+}
+
+
+mapped_file::mapped_file(mapped_file &&other) noexcept
+{
+	*this = std::move(other);
+}
+
+
+mapped_file &mapped_file::operator=(mapped_file &&other) noexcept
+{
+	if (this != &other) {
+		close();
+		std::swap(mData, other.mData);
+		std::swap(mSize, other.mSize);
+#ifdef _WIN32
+		std::swap(mFile, other.mFile);
+		std::swap(mMapping, other.mMapping);
+#endif
+	}
+	return *this;
+}
+
+
+bool mapped_file::open(const std::string &path)
+{
+	close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+		CloseHandle(file);
+		return false;
+	}
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping == nullptr) {
+		CloseHandle(file);
+		return false;
+	}
+	void *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (data == nullptr) {
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+	mFile = file;
+	mMapping = mapping;
+	mData = static_cast<const uint8_t *>(data);
+	mSize = static_cast<size_t>(size.QuadPart);
+#else
+	int file = ::open(path.c_str(), O_RDONLY);
+	if (file < 0) {
+		return false;
+	}
+	struct stat status;
+	if (fstat(file, &status) != 0 || status.st_size == 0) {
+		::close(file);
+		return false;
+	}
+	void *data = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+	::close(file); // the mapping keeps the file alive
+	if (data == MAP_FAILED) {
+		return false;
+	}
+	mData = static_cast<const uint8_t *>(data);
+	mSize = static_cast<size_t>(status.st_size);
+#endif
+	return true;
+}
+
+
+void mapped_file::close()
+{
+	if (mData == nullptr) {
+		return;
+	}
+#ifdef _WIN32
+	UnmapViewOfFile(mData);
+	CloseHandle(mMapping);
+	CloseHandle(mFile);
+	mFile = nullptr;
+	mMapping = nullptr;
+#else
+	munmap(const_cast<uint8_t *>(mData), mSize);
+#endif
+	mData = nullptr;
+	mSize = 0;
+}
+
+
+scene_cache scene_cache::open(const std::string &modelPath, const render_settings &settings, bool forceRebuild)
+{
+	scene_cache cache;
+	auto start = std::chrono::steady_clock::now();
+
+	mapped_file model;
+	if (!model.open(modelPath)) {
+		throw std::runtime_error("Could not open " + modelPath);
+	}
+	uint64_t hash = content_hash(model);
+	model.close();
+	cache.mHash = hash;
+
+	auto hashed = std::chrono::steady_clock::now();
+	cache.mStatistics.mHashSeconds = std::chrono::duration<double>(hashed - start).count();
+
+	cache.mPath = cache_path(modelPath, hash, settings.mTextureCompression);
+	cache.mStatistics.mHit = !forceRebuild && cache.read(cache.mPath, hash);
+	if (!cache.mStatistics.mHit) {
+		cache.write(modelPath, hash, settings);
+		hashed = std::chrono::steady_clock::now();
+		if (!cache.read(cache.mPath, hash)) {
+			throw std::runtime_error("Could not read back the scene cache " + cache.mPath);
+		}
+	}
+	cache.mStatistics.mMapSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - hashed).count();
+	cache.mStatistics.mFileSize = cache.mFile.size();
+
+	return cache;
+}
+
+
+std::vector<avk::material_gpu_data> scene_cache::materials(int textureIndexOffset) const
+{
+	std::vector<avk::material_gpu_data> result(mMaterials.begin(), mMaterials.end());
+	for (auto &material : result) {
+		offset_texture_indices(material, textureIndexOffset);
+	}
+	return result;
+}
+
+
+void scene_cache::print_statistics() const
+{
+	if (mStatistics.mHit) {
+		printf("Scene cache hit: %s, %.1f MiB mapped in %.2lf ms (content hash %.2lf ms)\n", mPath.c_str(),
+			mStatistics.mFileSize / (1024.0 * 1024.0), mStatistics.mMapSeconds * 1000.0, mStatistics.mHashSeconds * 1000.0);
+	}
+	else {
+		printf("Scene cache miss: %s, imported in %.2lf ms, %zu textures decoded and compressed in %.2lf ms, %.1f MiB written in %.2lf ms (content hash %.2lf ms)\n", mPath.c_str(),
+			mStatistics.mImportSeconds * 1000.0, mImages.size(), mStatistics.mDecodeSeconds * 1000.0, mStatistics.mFileSize / (1024.0 * 1024.0),
+			mStatistics.mWriteSeconds * 1000.0, mStatistics.mHashSeconds * 1000.0);
+	}
+}
+
+
+bool texture_timing::write_csv(const std::string &path, const std::vector<texture_timing> &timings)
+{
+	std::ofstream file(path, std::ios::trunc);
+	file << "stage,model,image,width,height,batch,milliseconds\n";
+	for (const texture_timing &t : timings) {
+		file << t.mStage << "," << t.mModel << "," << t.mImageIndex << "," << t.mWidth << "," << t.mHeight << "," << t.mBatch << "," << t.mMilliseconds << "\n";
+	}
+	return file.good();
+}
+
+
+uint64_t scene_cache::touch_all_pages() const
+{
+	uint64_t sum = 0;
+	for (size_t i = 0; i < mFile.size(); i += 4096) {
+		sum += mFile.data()[i];
+	}
+	return sum;
+}
+
+
+uint64_t scene_cache::content_hash(const mapped_file &file)
+{
+	// FNV-1a, but over 64 bit words instead of single bytes
+	const uint64_t prime = 1099511628211ull;
+	uint64_t hash = 14695981039346656037ull;
+
+	size_t wordCount = file.size() / sizeof(uint64_t);
+	for (size_t i = 0; i < wordCount; i++) {
+		uint64_t word;
+		std::memcpy(&word, file.data() + i * sizeof(uint64_t), sizeof(word));
+		hash = (hash ^ word) * prime;
+	}
+	for (size_t i = wordCount * sizeof(uint64_t); i < file.size(); i++) {
+		hash = (hash ^ file.data()[i]) * prime;
+	}
+	return (hash ^ file.size()) * prime;
+}
+
+
+std::string scene_cache::cache_path(const std::string &modelPath, uint64_t hash, bool textureCompression)
+{
+	char name[17];
+	snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(hash));
+	// Both variants may be cached side by side, s.t. switching --no-texture-compression back and forth does not rebuild
+	std::string suffix = textureCompression ? "" : "-rgba8";
+	return (std::filesystem::path(CACHE_DIRECTORY) / (std::filesystem::path(modelPath).stem().string() + "-" + name + suffix + ".scene")).string();
+}
+
+
+void scene_cache::write(const std::string &modelPath, uint64_t hash, const render_settings &settings)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	// Exactly what model_loader::load_single_model and host_scene::load_single_model used to do on every start
+	auto model = avk::model_t::load_from_file(modelPath, IMPORTER_FLAGS);
+	auto distinctMaterials = model->distinct_material_configs();
+
+	struct geometry_arrays {
+		int mMaterialIndex;
+		std::vector<glm::vec3> mPositions;
+		std::vector<vertex_layout::packed_vertex> mVertices;
+		std::vector<uint32_t> mIndices;
+	};
+	std::vector<geometry_arrays> geometries;
+	std::vector<avk::material_config> allMatConfigs;
+
+	for (const auto &[materialConfig, indices] : distinctMaterials) {
+		auto &newElement = geometries.emplace_back();
+		allMatConfigs.push_back(materialConfig);
+		newElement.mMaterialIndex = static_cast<int>(allMatConfigs.size() - 1);
+
+		auto selection = avk::make_model_references_and_mesh_indices_selection(model, indices);
+		std::tie(newElement.mPositions, newElement.mIndices) = avk::get_vertices_and_indices(selection);
+		auto normals = avk::get_normals(selection);
+		auto tangents = avk::get_tangents(selection);
+		auto bitangents = avk::get_bitangents(selection);
+		auto texCoords = avk::get_2d_texture_coordinates(selection, 0);
+		newElement.mVertices.resize(newElement.mPositions.size());
+		for (size_t v = 0; v < newElement.mVertices.size(); v++) {
+			newElement.mVertices[v] = vertex_layout::pack(normals[v], tangents[v], bitangents[v], texCoords[v]);
+		}
+	}
+
+	// Texture indices relative to this model, they are shifted when the cache is used
+	auto [materials, sources, samplers] = material_helper::gather_images_for_cache(model->handle(), allMatConfigs, 0, settings.mTextureCompression);
+
+	// The image headers are enough to lay out the whole file, s.t. decoded images can be written as soon as they are ready
+	std::vector<file_image> images(sources.size());
+	for (size_t i = 0; i < sources.size(); i++) {
+		images[i].mWidth = 1;
+		images[i].mHeight = 1;
+		images[i].mLevelCount = 1;
+		images[i].mFormat = static_cast<uint32_t>(sources[i].mFormat);
+		if (sources[i].mTexture != nullptr) {
+			int width, height, channels;
+			if (!stbi_info_from_memory(reinterpret_cast<const stbi_uc *>(sources[i].mTexture->pcData), sources[i].mTexture->mWidth, &width, &height, &channels)) {
+				throw std::runtime_error("Could not read the header of an embedded texture of " + modelPath);
+			}
+			images[i].mWidth = static_cast<uint32_t>(width);
+			images[i].mHeight = static_cast<uint32_t>(height);
+			images[i].mLevelCount = mip_chain::level_count(images[i].mWidth, images[i].mHeight);
+		}
+	}
+
+	auto imported = std::chrono::steady_clock::now();
+	mStatistics.mImportSeconds = std::chrono::duration<double>(imported - start).count();
+
+	file_header header{};
+	file_writer writer;
+	writer.add(&header, 1);
+	header.mMagic = MAGIC;
+	header.mVersion = VERSION;
+	header.mContentHash = hash;
+	header.mImporterFlags = IMPORTER_FLAGS;
+	header.mMaterialSize = sizeof(avk::material_gpu_data);
+
+	// The tables are small and written first, s.t. reading them only touches the first pages
+	std::vector<file_draw_call> drawCalls(geometries.size());
+	std::vector<file_sampler> fileSamplers(samplers.size());
+	for (size_t i = 0; i < samplers.size(); i++) {
+		fileSamplers[i].mImageIndex = samplers[i].mImageIndex;
+		fileSamplers[i].mBorderHandlingModes[0] = static_cast<uint32_t>(samplers[i].mBorderHandlingModes[0]);
+		fileSamplers[i].mBorderHandlingModes[1] = static_cast<uint32_t>(samplers[i].mBorderHandlingModes[1]);
+		fileSamplers[i].mNearestNeighbor = samplers[i].mNearestNeighbor ? 1 : 0;
+	}
+
+	header.mDrawCalls = writer.add(drawCalls);
+	header.mImages = writer.add(images);
+	header.mSamplers = writer.add(fileSamplers);
+	header.mMaterials = writer.add(materials);
+
+	for (size_t i = 0; i < geometries.size(); i++) {
+		const geometry_arrays &geo = geometries[i];
+		file_draw_call &dc = drawCalls[i];
+		dc.mMaterialIndex = geo.mMaterialIndex;
+		dc.mPositions = writer.add(geo.mPositions);
+		dc.mVertices = writer.add(geo.mVertices);
+		dc.mIndices = writer.add(geo.mIndices);
+	}
+	for (file_image &img : images) {
+		img.mData = writer.add(static_cast<const uint8_t *>(nullptr), texture_compression::chain_size(static_cast<texture_format>(img.mFormat), img.mWidth, img.mHeight));
+	}
+	// The writer only keeps pointers, so the header and the tables may still be filled in until they are flushed
+	header.mFileSize = writer.size();
+
+	std::filesystem::create_directories(CACHE_DIRECTORY);
+
+	// Write to a temporary file and rename it afterwards, s.t. concurrent jobs never map a half-written cache. Whatever throws
+	// below (decoding, writing, allocations) removes the temporary file again.
+	std::string temporaryPath = mPath + "." + std::to_string(std::random_device{}()) + ".tmp";
+	double decodeSeconds = 0.0;
+	try {
+		if (!writer.open(temporaryPath) || !writer.flush()) {
+			throw std::runtime_error("Could not write the scene cache " + temporaryPath);
+		}
+
+		// Decode the images, generate their mip chains and block compress them in batches of at most the texture budget, every batch in
+		// parallel, and stream them into the file. Only the current batch is ever kept in memory. An image larger than the budget forms a batch on its own.
+		task_system tasks(settings.mThreadCount);
+		const uint64_t budget = std::max<uint64_t>(1, settings.mTextureBudgetMiB) * 1024 * 1024;
+		std::string modelName = std::filesystem::path(modelPath).filename().string();
+
+		// One "decode" and one "encode" row per image
+		mDecodeTimings.assign(2 * sources.size(), texture_timing{});
+		uint32_t batch = 0;
+		for (size_t first = 0; first < sources.size(); batch++) {
+			auto decodedSize = [&](size_t i) { return mip_chain::texel_count(images[i].mWidth, images[i].mHeight) * sizeof(glm::u8vec4) + images[i].mData.mCount; };
+			size_t end = first;
+			uint64_t batchBytes = 0;
+			while (end < sources.size() && (end == first || batchBytes + decodedSize(end) <= budget)) {
+				batchBytes += decodedSize(end);
+				end++;
+			}
+
+			auto batchStart = std::chrono::steady_clock::now();
+			std::vector<std::vector<uint8_t>> encoded(end - first);
+			std::atomic<bool> failed = false;
+			tasks.parallel_for(static_cast<uint32_t>(first), static_cast<uint32_t>(end), 1, [&](uint32_t i) {
+				auto decodeStart = std::chrono::steady_clock::now();
+				std::vector<glm::u8vec4> chain(mip_chain::texel_count(images[i].mWidth, images[i].mHeight));
+				if (sources[i].mTexture == nullptr) {
+					chain[0] = sources[i].mColor;
+				}
+				else {
+					// Exceptions must not escape a task
+					try {
+						conpressed_image_data imageData(sources[i].mTexture, false, false, true, 4);
+						imageData.load();
+						if (imageData.extent().width == images[i].mWidth && imageData.extent().height == images[i].mHeight) {
+							std::memcpy(chain.data(), imageData.get_data(0, 0, 0), sizeof(glm::u8vec4) * images[i].mWidth * images[i].mHeight);
+							mip_chain::generate(images[i].mWidth, images[i].mHeight, chain.data());
+						}
+						else {
+							failed = true;
+						}
+					}
+					catch (...) {
+						failed = true;
+					}
+				}
+				auto encodeStart = std::chrono::steady_clock::now();
+				double milliseconds = std::chrono::duration<double, std::milli>(encodeStart - decodeStart).count();
+				mDecodeTimings[i] = texture_timing{ "decode", modelName, i, images[i].mWidth, images[i].mHeight, batch, milliseconds };
+
+				// Every level on its own, exactly like the GPU expects them
+				texture_format format = static_cast<texture_format>(images[i].mFormat);
+				auto &data = encoded[i - first];
+				data.resize(images[i].mData.mCount);
+				for (uint32_t level = 0; level < images[i].mLevelCount; level++) {
+					glm::uvec2 extent = mip_chain::level_extent(images[i].mWidth, images[i].mHeight, level);
+					texture_compression::encode(format, extent.x, extent.y, chain.data() + mip_chain::level_offset(images[i].mWidth, images[i].mHeight, level),
+						data.data() + texture_compression::level_offset(format, images[i].mWidth, images[i].mHeight, level));
+				}
+				milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - encodeStart).count();
+				mDecodeTimings[sources.size() + i] = texture_timing{ "encode", modelName, i, images[i].mWidth, images[i].mHeight, batch, milliseconds };
+			});
+			decodeSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - batchStart).count();
+
+			if (failed) {
+				throw std::runtime_error("Could not decode an embedded texture of " + modelPath);
+			}
+
+			for (size_t i = first; i < end; i++) {
+				writer.provide(images[i].mData, encoded[i - first].data());
+			}
+			if (!writer.flush()) {
+				throw std::runtime_error("Could not write the scene cache " + temporaryPath);
+			}
+			first = end;
+		}
+		writer.close();
+
+		// Replacing a mapped file fails on Windows, this instance may still map an outdated cache of the same path
+		mFile.close();
+		std::filesystem::rename(temporaryPath, mPath);
+	}
+	catch (...) {
+		writer.close();
+		std::error_code ignored;
+		std::filesystem::remove(temporaryPath, ignored);
+		throw;
+	}
+
+	mStatistics.mDecodeSeconds = decodeSeconds;
+	mStatistics.mWriteSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - imported).count() - decodeSeconds;
+}
+
+
+bool scene_cache::read(const std::string &cachePath, uint64_t hash)
+{
+	if (!mFile.open(cachePath)) {
+		return false;
+	}
+	if (mFile.size() < sizeof(file_header)) {
+		mFile.close();
+		return false;
+	}
+
+	file_header header;
+	std::memcpy(&header, mFile.data(), sizeof(header));
+	if (header.mMagic != MAGIC || header.mVersion != VERSION || header.mContentHash != hash || header.mImporterFlags != IMPORTER_FLAGS
+		|| header.mMaterialSize != sizeof(avk::material_gpu_data) || header.mFileSize != mFile.size()) {
+		mFile.close();
+		return false;
+	}
+
+	bool valid = true;
+	auto drawCalls = array_view<file_draw_call>(mFile, header.mDrawCalls, valid);
+	auto images = array_view<file_image>(mFile, header.mImages, valid);
+	auto samplers = array_view<file_sampler>(mFile, header.mSamplers, valid);
+	mMaterials = array_view<avk::material_gpu_data>(mFile, header.mMaterials, valid);
+
+	mDrawCalls.clear();
+	for (const file_draw_call &dc : drawCalls) {
+		mDrawCalls.push_back(draw_call{
+			dc.mMaterialIndex,
+			array_view<glm::vec3>(mFile, dc.mPositions, valid),
+			array_view<vertex_layout::packed_vertex>(mFile, dc.mVertices, valid),
+			array_view<uint32_t>(mFile, dc.mIndices, valid)
+		});
+		valid = valid && mDrawCalls.back().mVertices.size() == mDrawCalls.back().mPositions.size();
+	}
+
+	mImages.clear();
+	for (const file_image &img : images) {
+		auto data = array_view<uint8_t>(mFile, img.mData, valid);
+		texture_format format = static_cast<texture_format>(img.mFormat);
+		valid = valid && img.mFormat <= static_cast<uint32_t>(texture_format::bc7) && img.mLevelCount == mip_chain::level_count(img.mWidth, img.mHeight)
+			&& data.size() == texture_compression::chain_size(format, img.mWidth, img.mHeight);
+		mImages.push_back(image{ img.mWidth, img.mHeight, img.mLevelCount, format, data });
+	}
+
+	mSamplers.clear();
+	for (const file_sampler &smplr : samplers) {
+		valid = valid && smplr.mImageIndex < mImages.size();
+		mSamplers.push_back(sampler{
+			smplr.mImageIndex,
+			{ static_cast<avk::border_handling_mode>(smplr.mBorderHandlingModes[0]), static_cast<avk::border_handling_mode>(smplr.mBorderHandlingModes[1]) },
+			smplr.mNearestNeighbor != 0
+		});
+	}
+
+	if (!valid) {
+		mFile.close();
+		mDrawCalls.clear();
+		mImages.clear();
+		mSamplers.clear();
+		mMaterials = {};
+	}
+	return valid;
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include "mip_chain.hpp"
+#include "render_settings.h"
+#include "texture_compression.h"
+#include "vertex_layout.hpp"
+
+#include <auto_vk_toolkit.hpp>
+
+#include <span>
+
+
+/// <summary>
+/// Read-only memory mapping of a whole file. Pages are only read from disk once they are touched.
+/// </summary>
+class mapped_file
+{
+public:
+	mapped_file() = default;
+	~mapped_file();
+
+	mapped_file(mapped_file &&other) noexcept;
+	mapped_file &operator=(mapped_file &&other) noexcept;
+	mapped_file(const mapped_file &) = delete;
+	mapped_file &operator=(const mapped_file &) = delete;
+
+	// false if the file does not exist or cannot be mapped
+	bool open(const std::string &path);
+	void close();
+
+	inline const uint8_t *data() const { return mData; }
+	inline size_t size() const { return mSize; }
+
+private:
+	const uint8_t *mData = nullptr;
+	size_t mSize = 0;
+#ifdef _WIN32
+	void *mFile = nullptr;
+	void *mMapping = nullptr;
+#endif
+};
+
+
+/// <summary>
+/// One row of the per-texture timing log (see `--texture-log`).
+/// </summary>
+struct texture_timing {
+	const char *mStage; // "decode" and "encode" when a cache file is built, "upload" for the copy into the staging ring
+	std::string mModel;
+	uint32_t mImageIndex;
+	uint32_t mWidth;
+	uint32_t mHeight;
+	uint32_t mBatch; // textures are processed in batches of at most the texture budget
+	double mMilliseconds;
+
+	// Writes all rows as CSV, returns false if the file cannot be written
+	static bool write_csv(const std::string &path, const std::vector<texture_timing> &timings);
+};
+
+
+/// <summary>
+/// Preprocessed form of one .glb file: everything `model_loader` and `host_scene` derive from it via Assimp and stb_image,
+/// i.e. the per-material vertex (quantized, see vertex_layout.hpp) and index arrays, the material table and the decoded (and block compressed) mip chains of every
+/// image sampler. The cache file is keyed by the content hash of the .glb, the importer flags and whether textures are compressed. On later runs it is only mapped into memory,
+/// all arrays below point straight into that mapping and can be uploaded without any parsing or conversion.
+/// </summary>
+class scene_cache
+{
+public:
+	// Bump whenever the file layout or the preprocessing changes, stale cache files are rebuilt then
+	static constexpr uint32_t VERSION = 4;
+	static constexpr unsigned int IMPORTER_FLAGS = aiProcess_Triangulate | aiProcess_PreTransformVertices;
+	// Also holds the preprocessed environment maps, see environment_map
+	static constexpr const char *CACHE_DIRECTORY = "cache";
+
+	// Same content as model_loader::data_for_draw_call, before the upload
+	struct draw_call {
+		int mMaterialIndex; // relative to the materials of this model
+		std::span<const glm::vec3> mPositions;
+		std::span<const vertex_layout::packed_vertex> mVertices; // everything else the closest hit shader reads per vertex
+		std::span<const uint32_t> mIndices;
+	};
+
+	// Already flipped like `conpressed_image_data` does it. `mData` holds the full mip chain in `mFormat`, see mip_chain.hpp
+	// and texture_compression.h.
+	struct image {
+		uint32_t mWidth;
+		uint32_t mHeight;
+		uint32_t mLevelCount;
+		texture_format mFormat;
+		std::span<const uint8_t> mData;
+
+		inline std::span<const uint8_t> level(uint32_t l) const {
+			glm::uvec2 extent = mip_chain::level_extent(mWidth, mHeight, l);
+			return mData.subspan(texture_compression::level_offset(mFormat, mWidth, mHeight, l), texture_compression::level_size(mFormat, extent.x, extent.y));
+		}
+	};
+
+	// One per image sampler `material_helper::convert_for_gpu_usage` creates, in the same order
+	struct sampler {
+		uint32_t mImageIndex;
+		std::array<avk::border_handling_mode, 2> mBorderHandlingModes;
+		bool mNearestNeighbor;
+	};
+
+	struct load_statistics {
+		bool mHit = false;
+		double mHashSeconds = 0.0;
+		double mImportSeconds = 0.0; // Assimp, misses only
+		double mDecodeSeconds = 0.0; // stb_image and block compression, misses only
+		double mWriteSeconds = 0.0;  // misses only
+		double mMapSeconds = 0.0;
+		uint64_t mFileSize = 0;
+	};
+
+	// Maps the cache file of the model, (re)building it first if there is none for the current content, flags and version.
+	// Building decodes and compresses the textures on `mThreadCount` threads, with at most `mTextureBudgetMiB` of decoded texels in memory.
+	// `forceRebuild` always goes through Assimp, which is what the startup benchmark needs for its cold loads.
+	static scene_cache open(const std::string &modelPath, const render_settings &settings, bool forceRebuild = false);
+
+	// The materials with all texture indices shifted by `textureIndexOffset`, i.e. the number of samplers of the models before this one
+	std::vector<avk::material_gpu_data> materials(int textureIndexOffset) const;
+
+	inline size_t material_count() const { return mMaterials.size(); }
+	inline const std::vector<draw_call> &draw_calls() const { return mDrawCalls; }
+	inline const std::vector<image> &images() const { return mImages; }
+	inline const std::vector<sampler> &samplers() const { return mSamplers; }
+	inline const std::string &path() const { return mPath; }
+	inline uint64_t hash() const { return mHash; } // content_hash of the .glb
+	inline const load_statistics &statistics() const { return mStatistics; }
+	inline const std::vector<texture_timing> &decode_timings() const { return mDecodeTimings; } // empty for hits
+
+	// One line on stdout: hit or miss and where the time went
+	void print_statistics() const;
+
+	// Reads one byte of every page, s.t. measurements include getting the whole file into memory
+	uint64_t touch_all_pages() const;
+
+	// Key of the cache files, FNV-1a over the whole file
+	static uint64_t content_hash(const mapped_file &file);
+
+private:
+	static std::string cache_path(const std::string &modelPath, uint64_t hash, bool textureCompression);
+	void write(const std::string &modelPath, uint64_t hash, const render_settings &settings);
+	bool read(const std::string &cachePath, uint64_t hash);
+
+	mapped_file mFile;
+	std::string mPath;
+	uint64_t mHash = 0;
+	load_statistics mStatistics;
+	std::vector<texture_timing> mDecodeTimings;
+
+	std::span<const avk::material_gpu_data> mMaterials;
+	std::vector<draw_call> mDrawCalls;
+	std::vector<image> mImages;
+	std::vector<sampler> mSamplers;
+};
@@ -0,0 +1,67 @@
+#include "scene_cache_benchmark.h"
+
+#include "environment_map.h"
+#include "..\third_party\INIReader.h"
+
+
+namespace {
+	// Warm loads are repeated and the fastest one is reported
+	constexpr int REPETITIONS = 3;
+}
+
+
+int scene_cache_benchmark::run(const render_settings &aSettings)
+{
+	uint32_t threadCount = aSettings.mThreadCount > 0 ? aSettings.mThreadCount : std::max(1u, std::thread::hardware_concurrency());
+	printf("Scene cache benchmark for %s, textures decoded on %u threads in batches of %u MiB:\n", aSettings.mScenePath.c_str(), threadCount, aSettings.mTextureBudgetMiB);
+
+	double coldTotal = 0.0;
+	double warmTotal = 0.0;
+
+	INIReader reader(aSettings.mScenePath);
+	std::set<std::string> sections = reader.Sections();
+	for (std::set<std::string>::iterator it = sections.begin(); it != sections.end(); ++it)
+	{
+		if (*it == environment_map::INI_SECTION) {
+			continue;
+		}
+		std::string modelGLBPath = reader.Get(*it, "path", "");
+
+		auto start = std::chrono::steady_clock::now();
+		scene_cache cold = scene_cache::open(modelGLBPath, aSettings, true);
+		cold.touch_all_pages();
+		double coldSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		const scene_cache::load_statistics coldStatistics = cold.statistics();
+
+		double warmSeconds = std::numeric_limits<double>::max();
+		scene_cache::load_statistics warmStatistics;
+		for (int repetition = 0; repetition < REPETITIONS; repetition++) {
+			start = std::chrono::steady_clock::now();
+			scene_cache warm = scene_cache::open(modelGLBPath, aSettings);
+			warm.touch_all_pages();
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			if (!warm.statistics().mHit) {
+				printf("  %s: the cache file written by the cold load was not used\n", modelGLBPath.c_str());
+				return EXIT_FAILURE;
+			}
+			if (seconds < warmSeconds) {
+				warmSeconds = seconds;
+				warmStatistics = warm.statistics();
+			}
+		}
+
+		printf("  %s (%.1f MiB cache file)\n", modelGLBPath.c_str(), coldStatistics.mFileSize / (1024.0 * 1024.0));
+		printf("    cold: %9.2f ms (content hash %.2f ms, Assimp %.2f ms, texture decode %.2f ms, writing the cache %.2f ms)\n",
+			coldSeconds * 1000.0, coldStatistics.mHashSeconds * 1000.0, coldStatistics.mImportSeconds * 1000.0, coldStatistics.mDecodeSeconds * 1000.0,
+			coldStatistics.mWriteSeconds * 1000.0);
+		printf("    warm: %9.2f ms (content hash %.2f ms, mapping and reading %.2f ms)\n",
+			warmSeconds * 1000.0, warmStatistics.mHashSeconds * 1000.0, warmSeconds * 1000.0 - warmStatistics.mHashSeconds * 1000.0);
+
+		coldTotal += coldSeconds;
+		warmTotal += warmSeconds;
+	}
+
+	printf("  total: cold %.2f ms, warm %.2f ms, %.1fx faster\n", coldTotal * 1000.0, warmTotal * 1000.0, warmTotal > 0.0 ? coldTotal / warmTotal : 0.0);
+	printf("  (warm loads read the cache file from the OS file cache, the first load after a reboot additionally pays for the disk reads)\n");
+	return EXIT_SUCCESS;
+}
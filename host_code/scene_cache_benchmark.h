@@ -0,0 +1,16 @@
+#pragma once
+
+#include "render_settings.h"
+#include "scene_cache.h"
+
+
+/// <summary>
+/// Measures the startup cost of every model of the scene with and without the `scene_cache`: cold loads go through Assimp and
+/// stb_image and write the cache file, warm loads only map the cache file and touch all of its pages once.
+/// </summary>
+class scene_cache_benchmark
+{
+public:
+	// Loads every model of the scene from the settings cold and warm, prints the timings, returns the process exit code.
+	static int run(const render_settings &aSettings);
+};
@@ -0,0 +1,192 @@
+#include "screenshot_writer.h"
+
+#include "exr_image.hpp"
+#include "pfm_image.hpp"
+
+#include <stb_image_write.h>
+
+
+namespace {
+	bool signalled(const avk::fence &fence)
+	{
+		return avk::context().device().getFenceStatus(fence->handle(), avk::context().dynamic_dispatch()) == vk::Result::eSuccess;
+	}
+
+	bool ends_with(const std::string &value, const std::string &suffix)
+	{
+		return value.size() >= suffix.size() && value.compare(value.size() - suffix.size(), suffix.size(), suffix) == 0;
+	}
+}
+
+
+screenshot_writer::screenshot_writer(avk::queue &aQueue, const std::string &aLinearFormat)
+	: mQueue{&aQueue}
+	, mLinearFormat{aLinearFormat}
+	, mEncoders(ENCODER_THREADS + 1) // the thread calling flush() counts as one
+{
+}
+
+screenshot_writer::~screenshot_writer()
+{
+	flush();
+}
+
+
+void screenshot_writer::create_resources(glm::uvec2 aResolution)
+{
+	mResolution = aResolution;
+	for (readback_slot &slot : mSlots) {
+		slot.mImage = avk::context().create_image(aResolution.x, aResolution.y, vk::Format::eR8G8B8A8Unorm);
+		slot.mBuffer = avk::context().create_buffer(
+			avk::memory_usage::host_visible,
+			vk::BufferUsageFlagBits::eTransferDst,
+			avk::generic_buffer_meta::create_from_size(aResolution.x * aResolution.y * 4)
+		);
+		if (linear()) {
+			slot.mLinearBuffer = avk::context().create_buffer(
+				avk::memory_usage::host_visible,
+				vk::BufferUsageFlagBits::eTransferDst,
+				avk::generic_buffer_meta::create_from_size(sizeof(glm::vec4) * aResolution.x * aResolution.y)
+			);
+		}
+	}
+}
+
+
+bool screenshot_writer::capture(const avk::image_view &aResultImageView, const avk::image_view &aCameraImageView, const std::string &aPngPath, const std::string &aLinearPath)
+{
+	poll();
+
+	// Round robin, s.t. the oldest capture has had the most time to finish
+	readback_slot *free = nullptr;
+	for (uint32_t i = 0; i < RING_SIZE && !free; i++) {
+		readback_slot &slot = mSlots[(mNextSlot + i) % RING_SIZE];
+		if (slot.mState == slot_state::free) {
+			free = &slot;
+			mNextSlot = (mNextSlot + i + 1) % RING_SIZE;
+		}
+	}
+	if (!free) {
+		printf("Screenshot dropped, the last %u are still being written\n", RING_SIZE);
+		return false;
+	}
+	readback_slot &slot = *free;
+	slot.mPngPath = aPngPath;
+	slot.mLinearPath = aLinearPath;
+	if (!aLinearPath.empty() && !slot.mLinearBuffer.has_value()) {
+		// Linear outputs without --linear-screenshots (headless .pfm/.exr outputs) are rare, the buffer is created on demand
+		slot.mLinearBuffer = avk::context().create_buffer(
+			avk::memory_usage::host_visible,
+			vk::BufferUsageFlagBits::eTransferDst,
+			avk::generic_buffer_meta::create_from_size(sizeof(glm::vec4) * mResolution.x * mResolution.y)
+		);
+	}
+
+	std::vector<avk::recorded_commands_t> commands;
+	if (!aPngPath.empty()) {
+		commands.insert(commands.end(), {
+			avk::sync::image_memory_barrier(aResultImageView->get_image(),
+				avk::stage::ray_tracing_shader >> avk::stage::blit,
+				avk::access::shader_write >> avk::access::transfer_read
+			).with_layout_transition(avk::layout::general >> avk::layout::transfer_src),
+
+			avk::sync::image_memory_barrier(slot.mImage.get(),
+				avk::stage::none >> avk::stage::blit,
+				avk::access::none >> avk::access::transfer_write
+			).with_layout_transition(avk::layout::undefined >> avk::layout::transfer_dst),
+
+			avk::blit_image(aResultImageView->get_image(), avk::layout::transfer_src, slot.mImage, avk::layout::transfer_dst),
+
+			avk::sync::image_memory_barrier(aResultImageView->get_image(),
+				avk::stage::blit >> avk::stage::ray_tracing_shader,
+				avk::access::transfer_read >> avk::access::shader_write
+			).with_layout_transition(avk::layout::transfer_src >> avk::layout::general),
+
+			avk::sync::image_memory_barrier(slot.mImage.get(),
+				avk::stage::blit >> avk::stage::copy,
+				avk::access::transfer_write >> avk::access::transfer_read
+			).with_layout_transition(avk::layout::transfer_dst >> avk::layout::transfer_src),
+
+			avk::copy_image_to_buffer(slot.mImage, avk::layout::transfer_src, vk::ImageAspectFlagBits::eColor, slot.mBuffer)
+		});
+	}
+	if (!slot.mLinearPath.empty()) {
+		commands.insert(commands.end(), {
+			avk::sync::image_memory_barrier(aCameraImageView->get_image(),
+				avk::stage::ray_tracing_shader >> avk::stage::copy,
+				avk::access::shader_write >> avk::access::transfer_read
+			),
+			avk::copy_image_to_buffer(aCameraImageView->get_image(), avk::layout::general, vk::ImageAspectFlagBits::eColor, *slot.mLinearBuffer),
+			avk::sync::image_memory_barrier(aCameraImageView->get_image(),
+				avk::stage::copy >> avk::stage::ray_tracing_shader,
+				avk::access::transfer_read >> avk::access::shader_write
+			)
+		});
+	}
+	if (commands.empty()) {
+		return true;
+	}
+
+	// No waiting, poll() notices when the GPU is done
+	slot.mFence = avk::context().record_and_submit_with_fence(std::move(commands), *mQueue);
+	slot.mState = slot_state::reading_back;
+	return true;
+}
+
+
+void screenshot_writer::poll()
+{
+	for (readback_slot &slot : mSlots) {
+		if (slot.mState == slot_state::reading_back && signalled(*slot.mFence)) {
+			slot.mFence.reset();
+			slot.mState = slot_state::encoding;
+			mEncoders.run(slot.mEncoding, [&slot, resolution = mResolution]() { encode(slot, resolution); });
+		}
+		if (slot.mState == slot_state::encoding && slot.mEncoding.mPending == 0) {
+			slot.mState = slot_state::free;
+		}
+	}
+}
+
+void screenshot_writer::flush()
+{
+	for (readback_slot &slot : mSlots) {
+		if (slot.mState == slot_state::reading_back) {
+			(*slot.mFence)->wait_until_signalled();
+		}
+	}
+	poll();
+	for (readback_slot &slot : mSlots) {
+		mEncoders.wait(slot.mEncoding);
+	}
+	poll();
+}
+
+
+void screenshot_writer::encode(readback_slot &slot, glm::uvec2 resolution)
+{
+	// The slot stays busy until this returns, nobody else touches its buffers in the meantime
+	if (!slot.mPngPath.empty()) {
+		auto mapping = slot.mBuffer->map_memory(avk::mapping_access::read);
+		int channels = 4;
+		int result = stbi_write_png(slot.mPngPath.c_str(), resolution.x, resolution.y, channels, mapping.get(), resolution.x * channels);
+		if (result == 0) {
+			std::cerr << "could not write " << slot.mPngPath << std::endl;
+		} else {
+			std::cout << "wrote " << slot.mPngPath << std::endl;
+		}
+	}
+
+	if (!slot.mLinearPath.empty()) {
+		auto mapping = (*slot.mLinearBuffer)->map_memory(avk::mapping_access::read);
+		const glm::vec4 *texels = static_cast<const glm::vec4 *>(mapping.get());
+		bool written = ends_with(slot.mLinearPath, ".exr")
+			? exr_image::write(slot.mLinearPath, resolution.x, resolution.y, texels)
+			: pfm_image::write(slot.mLinearPath, resolution.x, resolution.y, texels);
+		if (!written) {
+			std::cerr << "could not write " << slot.mLinearPath << std::endl;
+		} else {
+			std::cout << "wrote " << slot.mLinearPath << std::endl;
+		}
+	}
+}
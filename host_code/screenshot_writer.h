@@ -0,0 +1,72 @@
+#pragma once
+
+#include "task_system.h"
+
+#include <auto_vk_toolkit.hpp>
+
+
+/// <summary>
+/// Screenshots which never stall the frame loop. A capture records the blit of the result image into its own slot out of a ring
+/// of RING_SIZE readback buffers (with `--linear-screenshots exr|pfm` also the copy of the rgba32f camera accumulation) and only
+/// submits it together with a fence. `poll()` checks the fences once per frame, hands finished readbacks to a pool of
+/// ENCODER_THREADS threads which write the PNG (and the linear image) straight from the mapped buffers, and frees slots whose
+/// files have been written. A slot is in use from its capture until its files are written, so when the encoders fall behind
+/// the ring fills up and further captures are dropped with a message instead of piling up work or overwriting buffers.
+/// `flush()` blocks until everything captured so far has been written, for the headless output and on exit.
+/// </summary>
+class screenshot_writer
+{
+public:
+	static constexpr uint32_t RING_SIZE = 3;
+	static constexpr uint32_t ENCODER_THREADS = 2;
+
+	// Empty, "exr" or "pfm"
+	screenshot_writer(avk::queue &aQueue, const std::string &aLinearFormat);
+	~screenshot_writer();
+
+	screenshot_writer(const screenshot_writer &) = delete;
+	screenshot_writer &operator=(const screenshot_writer &) = delete;
+
+	void create_resources(glm::uvec2 aResolution);
+
+	// Whether captures also write the linear accumulation next to the PNG
+	inline bool linear() const { return !mLinearFormat.empty(); }
+	inline const std::string &linear_format() const { return mLinearFormat; }
+
+	// Reads back the tonemapped result into `aPngPath` and the untonemapped camera accumulation into `aLinearPath` (.exr or
+	// .pfm), either may be empty. Returns immediately, false if every slot is still busy and the capture was dropped.
+	bool capture(const avk::image_view &aResultImageView, const avk::image_view &aCameraImageView, const std::string &aPngPath, const std::string &aLinearPath);
+
+	// Starts encoding finished readbacks and frees the slots of written files, to be called once per frame
+	void poll();
+
+	// Blocks until every capture so far has been written
+	void flush();
+
+private:
+	enum struct slot_state {
+		free,
+		reading_back, // submitted, mFence not yet signalled
+		encoding      // mEncoding is running on the encoder threads
+	};
+
+	struct readback_slot {
+		slot_state mState = slot_state::free;
+		avk::image mImage;        // rgba8, the blit converts the bgra8 result image
+		avk::buffer mBuffer;
+		std::optional<avk::buffer> mLinearBuffer; // rgba32f, only if linear()
+		std::optional<avk::fence> mFence;
+		std::string mPngPath;
+		std::string mLinearPath;
+		task_group mEncoding;
+	};
+
+	static void encode(readback_slot &slot, glm::uvec2 resolution);
+
+	avk::queue *mQueue;
+	std::string mLinearFormat;
+	glm::uvec2 mResolution = {};
+	std::array<readback_slot, RING_SIZE> mSlots;
+	uint32_t mNextSlot = 0;
+	task_system mEncoders;
+};
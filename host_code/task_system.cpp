@@ -0,0 +1,101 @@
+#include "task_system.h"
+
+
+task_system::task_system(uint32_t threadCount)
+{
+	if (threadCount == 0) {
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+	for (uint32_t i = 1; i < threadCount; i++) {
+		mWorkers.emplace_back([this]() { worker_loop(); });
+	}
+}
+
+
+task_system::~task_system()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStop = true;
+	}
+	mCondition.notify_all();
+	for (auto &worker : mWorkers) {
+		worker.join();
+	}
+}
+
+
+void task_system::run(task_group &group, std::function<void()> task)
+{
+	group.mPending++;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mQueue.push_back(queued_task{ &group, std::move(task) });
+	}
+	mCondition.notify_one();
+}
+
+
+void task_system::wait(task_group &group)
+{
+	while (group.mPending > 0) {
+		if (!try_run_one()) {
+			// Everything left is already running on other threads
+			std::this_thread::yield();
+		}
+	}
+}
+
+
+void task_system::parallel_for(uint32_t begin, uint32_t end, uint32_t grainSize, const std::function<void(uint32_t)> &body)
+{
+	task_group group;
+	grainSize = std::max(1u, grainSize);
+	for (uint32_t chunk = begin; chunk < end; chunk += grainSize) {
+		uint32_t chunkEnd = std::min(end, chunk + grainSize);
+		run(group, [&body, chunk, chunkEnd]() {
+			for (uint32_t i = chunk; i < chunkEnd; i++) {
+				body(i);
+			}
+		});
+	}
+	wait(group);
+}
+
+
+bool task_system::try_run_one()
+{
+	queued_task next;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		if (mQueue.empty()) {
+			return false;
+		}
+		// LIFO: the most recently spawned (= smallest, most cache friendly) task first
+		next = std::move(mQueue.back());
+		mQueue.pop_back();
+	}
+	next.mTask();
+	next.mGroup->mPending--;
+	return true;
+}
+
+
+void task_system::worker_loop()
+{
+	while (true) {
+		queued_task next;
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mCondition.wait(lock, [this]() { return mStop || !mQueue.empty(); });
+			if (mStop && mQueue.empty()) {
+				return;
+			}
+			// FIFO: idle workers pick up the oldest (= largest) tasks
+			next = std::move(mQueue.front());
+			mQueue.pop_front();
+		}
+		next.mTask();
+		next.mGroup->mPending--;
+	}
+}
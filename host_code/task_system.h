@@ -0,0 +1,54 @@
+#pragma once
+
+#include <auto_vk_toolkit.hpp>
+
+#include <condition_variable>
+#include <deque>
+#include <thread>
+
+
+/// <summary>
+/// Tasks which have been spawned together and are waited for together.
+/// </summary>
+struct task_group {
+	std::atomic<uint32_t> mPending = 0;
+};
+
+
+/// <summary>
+/// Minimal fork/join task system: a fixed set of worker threads pulling tasks from a shared queue.
+/// Threads waiting for a group keep executing queued tasks, so tasks may spawn and wait for nested tasks (recursive builds).
+/// </summary>
+class task_system
+{
+public:
+	// 0 => one worker per hardware thread (the thread calling wait() counts as one of them)
+	explicit task_system(uint32_t threadCount = 0);
+	~task_system();
+
+	task_system(const task_system &) = delete;
+	task_system &operator=(const task_system &) = delete;
+
+	void run(task_group &group, std::function<void()> task);
+	void wait(task_group &group);
+
+	// Runs `body(i)` for all i in [begin, end), in chunks of `grainSize`
+	void parallel_for(uint32_t begin, uint32_t end, uint32_t grainSize, const std::function<void(uint32_t)> &body);
+
+	inline uint32_t thread_count() const { return static_cast<uint32_t>(mWorkers.size()) + 1; }
+
+private:
+	struct queued_task {
+		task_group *mGroup;
+		std::function<void()> mTask;
+	};
+
+	bool try_run_one();
+	void worker_loop();
+
+	std::vector<std::thread> mWorkers;
+	std::mutex mMutex;
+	std::condition_variable mCondition;
+	std::deque<queued_task> mQueue;
+	bool mStop = false;
+};
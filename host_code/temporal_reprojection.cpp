@@ -0,0 +1,162 @@
+#include "temporal_reprojection.h"
+
+
+namespace {
+	avk::image create_history_image(glm::uvec2 size, vk::Format format)
+	{
+		return avk::context().create_image(size.x, size.y, format, 1, avk::memory_usage::device, avk::image_usage::general_storage_image);
+	}
+
+	// Copies a whole image which is (and stays) in the general layout
+	void copy_image(avk::command_buffer_t &cb, const avk::image_t &source, const avk::image_t &destination)
+	{
+		vk::ImageCopy region{
+			vk::ImageSubresourceLayers{ vk::ImageAspectFlagBits::eColor, 0, 0, 1 }, vk::Offset3D{},
+			vk::ImageSubresourceLayers{ vk::ImageAspectFlagBits::eColor, 0, 0, 1 }, vk::Offset3D{},
+			vk::Extent3D{ source.width(), source.height(), 1 }
+		};
+		cb.handle().copyImage(source.handle(), vk::ImageLayout::eGeneral, destination.handle(), vk::ImageLayout::eGeneral, region, cb.root_ptr()->dispatch_loader_core());
+	}
+}
+
+
+temporal_reprojection::temporal_reprojection(bool aEnabled)
+	: mEnabled{aEnabled}
+{
+}
+
+
+void temporal_reprojection::create_resources(avk::queue &aQueue, glm::uvec2 aResolution, const avk::image_view &aCameraImageView, const avk::image_view &aMomentImageView,
+	const avk::image_view &aNormalDepthImageView, const avk::image_view &aResultImageView)
+{
+	if (!mEnabled) {
+		return;
+	}
+	mGroupCount = (aResolution + GROUP_SIZE - 1u) / GROUP_SIZE;
+
+	const avk::image_t &moments = aMomentImageView->get_image();
+	avk::image historyCameraImage = create_history_image(aResolution, vk::Format::eR32G32B32A32Sfloat);
+	avk::image historyMomentImage = create_history_image(glm::uvec2(moments.width(), moments.height()), vk::Format::eR32Sfloat);
+	avk::image historyNormalDepthImage = create_history_image(aResolution, vk::Format::eR16G16B16A16Sfloat);
+
+	avk::context().record_and_submit_with_fence({
+		avk::sync::image_memory_barrier(historyCameraImage.as_reference(),
+										avk::stage::none >> avk::stage::none,
+										avk::access::none >> avk::access::none).with_layout_transition(avk::layout::undefined >> avk::layout::general),
+		avk::sync::image_memory_barrier(historyMomentImage.as_reference(),
+										avk::stage::none >> avk::stage::none,
+										avk::access::none >> avk::access::none).with_layout_transition(avk::layout::undefined >> avk::layout::general),
+		avk::sync::image_memory_barrier(historyNormalDepthImage.as_reference(),
+										avk::stage::none >> avk::stage::none,
+										avk::access::none >> avk::access::none).with_layout_transition(avk::layout::undefined >> avk::layout::general)
+	}, aQueue)->wait_until_signalled();
+
+	mHistoryCameraImageView = avk::context().create_image_view(historyCameraImage);
+	mHistoryMomentImageView = avk::context().create_image_view(historyMomentImage);
+	mHistoryNormalDepthImageView = avk::context().create_image_view(historyNormalDepthImage);
+
+	mPipeline = avk::context().create_compute_pipeline_for(
+		avk::compute_shader("shaders/reproject.comp"),
+		avk::push_constant_binding_data{avk::shader_type::compute, 0, sizeof(push_constant_data)},
+		avk::descriptor_binding(0, 0, aCameraImageView->as_storage_image(avk::layout::general)),
+		avk::descriptor_binding(0, 1, aMomentImageView->as_storage_image(avk::layout::general)),
+		avk::descriptor_binding(0, 2, aNormalDepthImageView->as_storage_image(avk::layout::general)),
+		avk::descriptor_binding(0, 3, mHistoryCameraImageView->as_storage_image(avk::layout::general)),
+		avk::descriptor_binding(0, 4, mHistoryMomentImageView->as_storage_image(avk::layout::general)),
+		avk::descriptor_binding(0, 5, mHistoryNormalDepthImageView->as_storage_image(avk::layout::general)),
+		avk::descriptor_binding(0, 6, aResultImageView->as_storage_image(avk::layout::general))
+	);
+}
+
+
+bool temporal_reprojection::restart(bool canReuse, const glm::mat4 &aPreviousCameraTransform, const glm::mat4 &aCameraTransform)
+{
+	mPending = false;
+	if (!mEnabled || !canReuse) {
+		return false;
+	}
+
+	// Angle between the two orientations, from the trace of the relative rotation
+	glm::mat3 relative = glm::transpose(glm::mat3(aPreviousCameraTransform)) * glm::mat3(aCameraTransform);
+	float cosAngle = glm::clamp((relative[0][0] + relative[1][1] + relative[2][2] - 1.0f) * 0.5f, -1.0f, 1.0f);
+	float translation = glm::distance(glm::vec3(aPreviousCameraTransform[3]), glm::vec3(aCameraTransform[3]));
+	if (glm::degrees(std::acos(cosAngle)) > MAX_ROTATION_DEGREES || translation > MAX_TRANSLATION) {
+		return false;
+	}
+
+	mPending = true;
+	mPreviousCameraTransform = aPreviousCameraTransform;
+	mCameraTransform = aCameraTransform;
+	return true;
+}
+
+
+std::vector<avk::recorded_commands_t> temporal_reprojection::history_commands(const avk::image_view &aCameraImageView, const avk::image_view &aMomentImageView, const avk::image_view &aNormalDepthImageView)
+{
+	if (!mPending) {
+		return {};
+	}
+
+	const avk::image_t &camera = aCameraImageView->get_image();
+	const avk::image_t &moments = aMomentImageView->get_image();
+	const avk::image_t &normalDepth = aNormalDepthImageView->get_image();
+	const avk::image_t &historyCamera = mHistoryCameraImageView->get_image();
+	const avk::image_t &historyMoments = mHistoryMomentImageView->get_image();
+	const avk::image_t &historyNormalDepth = mHistoryNormalDepthImageView->get_image();
+
+	return {
+		avk::command::custom_commands([&camera, &moments, &normalDepth, &historyCamera, &historyMoments, &historyNormalDepth](avk::command_buffer_t &cb) {
+			// The previous frame's launches and merge wrote the sources, the previous merge read the history
+			cb.handle().pipelineBarrier(
+				vk::PipelineStageFlagBits::eRayTracingShaderKHR | vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eTransfer, {},
+				vk::MemoryBarrier{ vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eShaderRead, vk::AccessFlagBits::eTransferRead | vk::AccessFlagBits::eTransferWrite },
+				nullptr, nullptr, cb.root_ptr()->dispatch_loader_core());
+			copy_image(cb, camera, historyCamera);
+			copy_image(cb, moments, historyMoments);
+			copy_image(cb, normalDepth, historyNormalDepth);
+			// The clears of the accumulation follow, the merge reads the history
+			cb.handle().pipelineBarrier(
+				vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer | vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eRayTracingShaderKHR, {},
+				vk::MemoryBarrier{ vk::AccessFlagBits::eTransferRead | vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eTransferWrite | vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite },
+				nullptr, nullptr, cb.root_ptr()->dispatch_loader_core());
+		})
+	};
+}
+
+
+std::vector<avk::recorded_commands_t> temporal_reprojection::merge_commands(avk::descriptor_cache &aDescriptorCache, const avk::image_view &aCameraImageView, const avk::image_view &aMomentImageView,
+	const avk::image_view &aNormalDepthImageView, const avk::image_view &aResultImageView, float aCameraHalfFovAngle)
+{
+	if (!mPending) {
+		return {};
+	}
+	mPending = false;
+
+	push_constant_data pushConstants{ mCameraTransform, mPreviousCameraTransform, glm::inverse(mPreviousCameraTransform), aCameraHalfFovAngle };
+
+	return {
+		// The new sample and its guides
+		avk::sync::global_memory_barrier(
+			avk::stage::ray_tracing_shader >> avk::stage::compute_shader,
+			avk::access::shader_write >> (avk::access::shader_read | avk::access::shader_write)
+		),
+		avk::command::bind_pipeline(mPipeline.as_reference()),
+		avk::command::bind_descriptors(mPipeline->layout(), aDescriptorCache->get_or_create_descriptor_sets({
+			avk::descriptor_binding(0, 0, aCameraImageView->as_storage_image(avk::layout::general)),
+			avk::descriptor_binding(0, 1, aMomentImageView->as_storage_image(avk::layout::general)),
+			avk::descriptor_binding(0, 2, aNormalDepthImageView->as_storage_image(avk::layout::general)),
+			avk::descriptor_binding(0, 3, mHistoryCameraImageView->as_storage_image(avk::layout::general)),
+			avk::descriptor_binding(0, 4, mHistoryMomentImageView->as_storage_image(avk::layout::general)),
+			avk::descriptor_binding(0, 5, mHistoryNormalDepthImageView->as_storage_image(avk::layout::general)),
+			avk::descriptor_binding(0, 6, aResultImageView->as_storage_image(avk::layout::general))
+		})),
+		avk::command::push_constants(mPipeline->layout(), pushConstants, avk::shader_type::compute),
+		avk::command::dispatch(mGroupCount.x, mGroupCount.y, 1),
+
+		// The denoiser and the blit read the merged result, the next launches accumulate on top of it
+		avk::sync::global_memory_barrier(
+			avk::stage::compute_shader >> (avk::stage::compute_shader | avk::stage::ray_tracing_shader | avk::stage::blit),
+			avk::access::shader_write >> (avk::access::shader_read | avk::access::shader_write | avk::access::transfer_read)
+		)
+	};
+}
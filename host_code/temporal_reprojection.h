@@ -0,0 +1,65 @@
+#pragma once
+
+#include <auto_vk_toolkit.hpp>
+
+
+/// <summary>
+/// Keeps the accumulation across camera moves instead of throwing every sample away. When the camera moved by at most
+/// MAX_ROTATION_DEGREES and MAX_TRANSLATION, the frame copies the camera and moment images and the normal/distance guide of the
+/// denoiser into history images before they are cleared, traces its one sample as usual, and then merges the history with
+/// it (shaders/reproject.comp): every pixel is projected into the previous view with the distance of its new first hit, taps
+/// whose distance or normal do not match are rejected (disocclusions), the others are fetched bilinearly. Reused history counts
+/// as fewer samples than it had, s.t. errors of the reprojection fade out quickly while moving.
+/// Larger moves, explicit restarts (benchmark views) and TLAS rebuilds still reset the accumulation. The light image of BDPT is
+/// always reset. Reprojection needs the guides, i.e. a window or `--denoise`, and is turned off with `--no-reprojection`.
+/// Reprojected pixels are biased until their history has faded, final frames should be rendered without moving the camera.
+/// </summary>
+class temporal_reprojection
+{
+public:
+	// Same as GROUP_SIZE in reproject.comp
+	static constexpr uint32_t GROUP_SIZE = 8;
+	static constexpr float MAX_ROTATION_DEGREES = 30.0f;
+	static constexpr float MAX_TRANSLATION = 2.0f; // scene units, the flooded sponza is about 30 across
+
+	// Push constants of reproject.comp
+	struct push_constant_data {
+		glm::mat4 mCameraTransform;
+		glm::mat4 mPreviousCameraTransform;
+		glm::mat4 mInvPreviousCameraTransform;
+		float mCameraHalfFovAngle;
+	};
+
+	explicit temporal_reprojection(bool aEnabled);
+
+	inline bool enabled() const { return mEnabled; }
+
+	// Creates the history images (1x1 if disabled) and the merge pipeline. The moment image may be 1x1 (no adaptive sampling).
+	void create_resources(avk::queue &aQueue, glm::uvec2 aResolution, const avk::image_view &aCameraImageView, const avk::image_view &aMomentImageView,
+		const avk::image_view &aNormalDepthImageView, const avk::image_view &aResultImageView);
+
+	// The accumulation restarts. Returns whether the next frame reuses the previous one, which requires `canReuse` and a small
+	// enough camera motion since the last frame.
+	bool restart(bool canReuse, const glm::mat4 &aPreviousCameraTransform, const glm::mat4 &aCameraTransform);
+
+	inline bool pending() const { return mPending; }
+
+	// Copies the accumulation into the history, to be recorded before the accumulation is cleared (nothing if not pending)
+	std::vector<avk::recorded_commands_t> history_commands(const avk::image_view &aCameraImageView, const avk::image_view &aMomentImageView, const avk::image_view &aNormalDepthImageView);
+
+	// Merges the history into the new sample, to be recorded after trace_rays. Clears `pending()`.
+	std::vector<avk::recorded_commands_t> merge_commands(avk::descriptor_cache &aDescriptorCache, const avk::image_view &aCameraImageView, const avk::image_view &aMomentImageView,
+		const avk::image_view &aNormalDepthImageView, const avk::image_view &aResultImageView, float aCameraHalfFovAngle);
+
+private:
+	bool mEnabled;
+	bool mPending = false;
+	glm::mat4 mCameraTransform = glm::mat4(1.0f);
+	glm::mat4 mPreviousCameraTransform = glm::mat4(1.0f);
+
+	glm::uvec2 mGroupCount = {};
+	avk::image_view mHistoryCameraImageView;
+	avk::image_view mHistoryMomentImageView;
+	avk::image_view mHistoryNormalDepthImageView;
+	avk::compute_pipeline mPipeline;
+};
@@ -0,0 +1,510 @@
+#include "texture_compression.h"
+#include "mip_chain.hpp"
+
+
+namespace {
+
+	// Weights of the 4 bit indices of BC7, in 64ths
+	constexpr int BC7_WEIGHTS[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+	// Texels of one 4x4 block, borders are clamped
+	void load_block(const glm::u8vec4 *texels, uint32_t width, uint32_t height, uint32_t bx, uint32_t by, glm::u8vec4 block[16])
+	{
+		for (uint32_t y = 0; y < 4; y++) {
+			for (uint32_t x = 0; x < 4; x++) {
+				uint32_t sx = std::min(bx * 4 + x, width - 1);
+				uint32_t sy = std::min(by * 4 + y, height - 1);
+				block[y * 4 + x] = texels[static_cast<size_t>(sy) * width + sx];
+			}
+		}
+	}
+
+	void store_block(const glm::u8vec4 block[16], uint32_t width, uint32_t height, uint32_t bx, uint32_t by, glm::u8vec4 *texels)
+	{
+		for (uint32_t y = 0; y < 4 && by * 4 + y < height; y++) {
+			for (uint32_t x = 0; x < 4 && bx * 4 + x < width; x++) {
+				texels[static_cast<size_t>(by * 4 + y) * width + bx * 4 + x] = block[y * 4 + x];
+			}
+		}
+	}
+
+	// Direction of the largest variance of the block (power iteration on the covariance), zero for uniform blocks
+	glm::vec4 principal_axis(const glm::vec4 values[16], const glm::vec4 &mean)
+	{
+		glm::mat4 covariance(0.0f);
+		glm::vec4 minimum = values[0];
+		glm::vec4 maximum = values[0];
+		for (int i = 0; i < 16; i++) {
+			glm::vec4 d = values[i] - mean;
+			covariance += glm::outerProduct(d, d);
+			minimum = glm::min(minimum, values[i]);
+			maximum = glm::max(maximum, values[i]);
+		}
+		glm::vec4 diagonal = maximum - minimum;
+		if (glm::length(diagonal) < 1e-6f) {
+			return glm::vec4(0.0f);
+		}
+
+		// Seeded with the channel of the largest variance: a fixed seed like (1,1,1,1) can be orthogonal to the variance of the
+		// block (anti-correlated channels), the iteration would collapse to zero. covariance * seed is never zero then.
+		int channel = 0;
+		for (int c = 1; c < 4; c++) {
+			if (covariance[c][c] > covariance[channel][channel]) {
+				channel = c;
+			}
+		}
+		glm::vec4 axis(0.0f);
+		axis[channel] = 1.0f;
+		for (int iteration = 0; iteration < 8; iteration++) {
+			axis = covariance * axis;
+			float length = glm::length(axis);
+			if (!(length >= 1e-6f)) {
+				// Degenerate after all (rounding), the bounding box diagonal still spans the block
+				return glm::normalize(diagonal);
+			}
+			axis /= length;
+		}
+		return axis;
+	}
+
+	// Endpoints of the block along its principal axis, restricted to the channels in `mask`
+	void fit_endpoints(const glm::u8vec4 block[16], const glm::vec4 &mask, glm::vec4 &low, glm::vec4 &high)
+	{
+		glm::vec4 values[16];
+		glm::vec4 mean(0.0f);
+		for (int i = 0; i < 16; i++) {
+			values[i] = glm::vec4(block[i]) * mask;
+			mean += values[i] / 16.0f;
+		}
+
+		glm::vec4 axis = principal_axis(values, mean);
+		float tMin = 0.0f;
+		float tMax = 0.0f;
+		for (int i = 0; i < 16; i++) {
+			float t = glm::dot(values[i] - mean, axis);
+			tMin = std::min(tMin, t);
+			tMax = std::max(tMax, t);
+		}
+		low = glm::clamp(mean + axis * tMin, 0.0f, 255.0f);
+		high = glm::clamp(mean + axis * tMax, 0.0f, 255.0f);
+	}
+
+	int squared_distance(const glm::ivec4 &a, const glm::ivec4 &b)
+	{
+		glm::ivec4 d = a - b;
+		return d.x * d.x + d.y * d.y + d.z * d.z + d.w * d.w;
+	}
+
+	//////////////////// BC1 ////////////////////
+
+	uint16_t to_565(const glm::vec4 &color)
+	{
+		uint32_t r = static_cast<uint32_t>(std::round(color.x * 31.0f / 255.0f));
+		uint32_t g = static_cast<uint32_t>(std::round(color.y * 63.0f / 255.0f));
+		uint32_t b = static_cast<uint32_t>(std::round(color.z * 31.0f / 255.0f));
+		return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+	}
+
+	glm::ivec4 from_565(uint16_t color)
+	{
+		int r = (color >> 11) & 31;
+		int g = (color >> 5) & 63;
+		int b = color & 31;
+		return glm::ivec4((r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2), 255);
+	}
+
+	void bc1_palette(uint16_t c0, uint16_t c1, glm::ivec4 palette[4])
+	{
+		palette[0] = from_565(c0);
+		palette[1] = from_565(c1);
+		if (c0 > c1) {
+			palette[2] = (2 * palette[0] + palette[1] + 1) / 3;
+			palette[3] = (palette[0] + 2 * palette[1] + 1) / 3;
+		}
+		else {
+			palette[2] = (palette[0] + palette[1]) / 2;
+			palette[3] = glm::ivec4(0, 0, 0, 255);
+		}
+		palette[2].w = 255;
+		palette[3].w = 255;
+	}
+
+	void encode_bc1(const glm::u8vec4 block[16], uint8_t *out)
+	{
+		glm::vec4 low, high;
+		fit_endpoints(block, glm::vec4(1.0f, 1.0f, 1.0f, 0.0f), low, high);
+		uint16_t c0 = to_565(high);
+		uint16_t c1 = to_565(low);
+		if (c0 < c1) {
+			std::swap(c0, c1);
+		}
+
+		// c0 == c1 selects the three color mode, where index 0 is just as exact
+		uint32_t indices = 0;
+		if (c0 != c1) {
+			glm::ivec4 palette[4];
+			bc1_palette(c0, c1, palette);
+			for (int i = 0; i < 16; i++) {
+				glm::ivec4 texel = glm::ivec4(block[i].x, block[i].y, block[i].z, 255);
+				uint32_t best = 0;
+				for (uint32_t p = 1; p < 4; p++) {
+					if (squared_distance(texel, palette[p]) < squared_distance(texel, palette[best])) {
+						best = p;
+					}
+				}
+				indices |= best << (2 * i);
+			}
+		}
+
+		out[0] = static_cast<uint8_t>(c0 & 0xFF);
+		out[1] = static_cast<uint8_t>(c0 >> 8);
+		out[2] = static_cast<uint8_t>(c1 & 0xFF);
+		out[3] = static_cast<uint8_t>(c1 >> 8);
+		std::memcpy(out + 4, &indices, sizeof(indices));
+	}
+
+	void decode_bc1(const uint8_t *in, glm::u8vec4 block[16])
+	{
+		uint16_t c0 = static_cast<uint16_t>(in[0] | (in[1] << 8));
+		uint16_t c1 = static_cast<uint16_t>(in[2] | (in[3] << 8));
+		uint32_t indices;
+		std::memcpy(&indices, in + 4, sizeof(indices));
+
+		glm::ivec4 palette[4];
+		bc1_palette(c0, c1, palette);
+		for (int i = 0; i < 16; i++) {
+			block[i] = glm::u8vec4(palette[(indices >> (2 * i)) & 3]);
+		}
+	}
+
+	//////////////////// BC4 (the two halves of BC5) ////////////////////
+
+	void bc4_palette(int r0, int r1, int palette[8])
+	{
+		palette[0] = r0;
+		palette[1] = r1;
+		if (r0 > r1) {
+			for (int i = 2; i < 8; i++) {
+				palette[i] = ((8 - i) * r0 + (i - 1) * r1 + 3) / 7;
+			}
+		}
+		else {
+			for (int i = 2; i < 6; i++) {
+				palette[i] = ((6 - i) * r0 + (i - 1) * r1 + 2) / 5;
+			}
+			palette[6] = 0;
+			palette[7] = 255;
+		}
+	}
+
+	void encode_bc4(const glm::u8vec4 block[16], int channel, uint8_t *out)
+	{
+		int r0 = 0;
+		int r1 = 255;
+		for (int i = 0; i < 16; i++) {
+			r0 = std::max(r0, static_cast<int>(block[i][channel]));
+			r1 = std::min(r1, static_cast<int>(block[i][channel]));
+		}
+
+		int palette[8];
+		bc4_palette(r0, r1, palette);
+
+		uint64_t indices = 0;
+		for (int i = 0; i < 16; i++) {
+			int value = block[i][channel];
+			uint64_t best = 0;
+			for (int p = 1; p < 8; p++) {
+				if (std::abs(value - palette[p]) < std::abs(value - palette[best])) {
+					best = static_cast<uint64_t>(p);
+				}
+			}
+			indices |= best << (3 * i);
+		}
+
+		out[0] = static_cast<uint8_t>(r0);
+		out[1] = static_cast<uint8_t>(r1);
+		for (int i = 0; i < 6; i++) {
+			out[2 + i] = static_cast<uint8_t>((indices >> (8 * i)) & 0xFF);
+		}
+	}
+
+	void decode_bc4(const uint8_t *in, int channel, glm::u8vec4 block[16])
+	{
+		int palette[8];
+		bc4_palette(in[0], in[1], palette);
+
+		uint64_t indices = 0;
+		for (int i = 0; i < 6; i++) {
+			indices |= static_cast<uint64_t>(in[2 + i]) << (8 * i);
+		}
+		for (int i = 0; i < 16; i++) {
+			block[i][channel] = static_cast<uint8_t>(palette[(indices >> (3 * i)) & 7]);
+		}
+	}
+
+	//////////////////// BC7 (mode 6 only) ////////////////////
+
+	struct bit_writer {
+		uint8_t *mData;
+		uint32_t mPosition = 0;
+
+		void write(uint32_t value, uint32_t count) {
+			for (uint32_t i = 0; i < count; i++, mPosition++) {
+				if ((value >> i) & 1) {
+					mData[mPosition / 8] |= static_cast<uint8_t>(1 << (mPosition % 8));
+				}
+			}
+		}
+	};
+
+	struct bit_reader {
+		const uint8_t *mData;
+		uint32_t mPosition = 0;
+
+		uint32_t read(uint32_t count) {
+			uint32_t value = 0;
+			for (uint32_t i = 0; i < count; i++, mPosition++) {
+				value |= ((mData[mPosition / 8] >> (mPosition % 8)) & 1u) << i;
+			}
+			return value;
+		}
+	};
+
+	// 7 bit endpoint plus p-bit, the p-bit is shared by all channels of an endpoint
+	void quantize_bc7_endpoint(const glm::vec4 &endpoint, glm::ivec4 &quantized, int &pBit)
+	{
+		float bestError = std::numeric_limits<float>::max();
+		for (int p = 0; p < 2; p++) {
+			glm::ivec4 q = glm::clamp(glm::ivec4(glm::round((endpoint - float(p)) * 0.5f)), 0, 127);
+			glm::vec4 d = glm::vec4(q * 2 + p) - endpoint;
+			float error = glm::dot(d, d);
+			if (error < bestError) {
+				bestError = error;
+				quantized = q;
+				pBit = p;
+			}
+		}
+	}
+
+	void bc7_palette(const glm::ivec4 &e0, const glm::ivec4 &e1, glm::ivec4 palette[16])
+	{
+		for (int i = 0; i < 16; i++) {
+			palette[i] = ((64 - BC7_WEIGHTS[i]) * e0 + BC7_WEIGHTS[i] * e1 + 32) >> 6;
+		}
+	}
+
+	void encode_bc7(const glm::u8vec4 block[16], uint8_t *out)
+	{
+		glm::vec4 low, high;
+		fit_endpoints(block, glm::vec4(1.0f), low, high);
+
+		glm::ivec4 q0, q1;
+		int p0, p1;
+		quantize_bc7_endpoint(low, q0, p0);
+		quantize_bc7_endpoint(high, q1, p1);
+
+		glm::ivec4 palette[16];
+		bc7_palette(q0 * 2 + p0, q1 * 2 + p1, palette);
+
+		uint32_t indices[16];
+		for (int i = 0; i < 16; i++) {
+			glm::ivec4 texel = glm::ivec4(block[i]);
+			uint32_t best = 0;
+			for (uint32_t p = 1; p < 16; p++) {
+				if (squared_distance(texel, palette[p]) < squared_distance(texel, palette[best])) {
+					best = p;
+				}
+			}
+			indices[i] = best;
+		}
+
+		// The most significant bit of the first index is implicitly 0, swap the endpoints if it is not
+		if (indices[0] >= 8) {
+			std::swap(q0, q1);
+			std::swap(p0, p1);
+			for (auto &index : indices) {
+				index = 15 - index;
+			}
+		}
+
+		std::memset(out, 0, 16);
+		bit_writer writer{ out };
+		writer.write(1 << 6, 7); // mode 6
+		for (int channel = 0; channel < 4; channel++) {
+			writer.write(static_cast<uint32_t>(q0[channel]), 7);
+			writer.write(static_cast<uint32_t>(q1[channel]), 7);
+		}
+		writer.write(static_cast<uint32_t>(p0), 1);
+		writer.write(static_cast<uint32_t>(p1), 1);
+		writer.write(indices[0], 3);
+		for (int i = 1; i < 16; i++) {
+			writer.write(indices[i], 4);
+		}
+	}
+
+	void decode_bc7(const uint8_t *in, glm::u8vec4 block[16])
+	{
+		bit_reader reader{ in };
+		if (reader.read(7) != (1 << 6)) {
+			// Never written by encode_bc7
+			std::fill(block, block + 16, glm::u8vec4(0));
+			return;
+		}
+
+		glm::ivec4 e0, e1;
+		for (int channel = 0; channel < 4; channel++) {
+			e0[channel] = static_cast<int>(reader.read(7));
+			e1[channel] = static_cast<int>(reader.read(7));
+		}
+		int p0 = static_cast<int>(reader.read(1));
+		int p1 = static_cast<int>(reader.read(1));
+
+		glm::ivec4 palette[16];
+		bc7_palette(e0 * 2 + p0, e1 * 2 + p1, palette);
+		for (int i = 0; i < 16; i++) {
+			block[i] = glm::u8vec4(palette[reader.read(i == 0 ? 3 : 4)]);
+		}
+	}
+
+	size_t block_size(texture_format format)
+	{
+		return format == texture_format::bc1 ? 8 : 16;
+	}
+}
+
+
+vk::Format texture_compression::vk_format(texture_format format)
+{
+	switch (format) {
+	case texture_format::bc1:
+		return vk::Format::eBc1RgbUnormBlock;
+	case texture_format::bc5:
+		return vk::Format::eBc5UnormBlock;
+	case texture_format::bc7:
+		return vk::Format::eBc7UnormBlock;
+	default:
+		return avk::default_rgb8_4comp_format();
+	}
+}
+
+
+bool texture_compression::supported(texture_format format)
+{
+	if (format == texture_format::rgba8) {
+		return true;
+	}
+	vk::PhysicalDevice physicalDevice = avk::context().physical_device();
+	if (!physicalDevice.getFeatures(avk::context().dispatch_loader_core()).textureCompressionBC) {
+		return false;
+	}
+	const vk::FormatFeatureFlags required = vk::FormatFeatureFlagBits::eSampledImage | vk::FormatFeatureFlagBits::eSampledImageFilterLinear | vk::FormatFeatureFlagBits::eTransferDst;
+	vk::FormatProperties properties = physicalDevice.getFormatProperties(vk_format(format), avk::context().dispatch_loader_core());
+	return (properties.optimalTilingFeatures & required) == required;
+}
+
+
+const char *texture_compression::name(texture_format format)
+{
+	switch (format) {
+	case texture_format::bc1:
+		return "bc1";
+	case texture_format::bc5:
+		return "bc5";
+	case texture_format::bc7:
+		return "bc7";
+	default:
+		return "rgba8";
+	}
+}
+
+
+size_t texture_compression::level_size(texture_format format, uint32_t width, uint32_t height)
+{
+	if (format == texture_format::rgba8) {
+		return static_cast<size_t>(width) * height * sizeof(glm::u8vec4);
+	}
+	return static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * block_size(format);
+}
+
+
+size_t texture_compression::level_offset(texture_format format, uint32_t width, uint32_t height, uint32_t level)
+{
+	size_t offset = 0;
+	for (uint32_t l = 0; l < level; l++) {
+		glm::uvec2 extent = mip_chain::level_extent(width, height, l);
+		offset += level_size(format, extent.x, extent.y);
+	}
+	return offset;
+}
+
+
+size_t texture_compression::chain_size(texture_format format, uint32_t width, uint32_t height)
+{
+	return level_offset(format, width, height, mip_chain::level_count(width, height));
+}
+
+
+void texture_compression::encode(texture_format format, uint32_t width, uint32_t height, const glm::u8vec4 *texels, uint8_t *blocks)
+{
+	if (format == texture_format::rgba8) {
+		std::memcpy(blocks, texels, level_size(format, width, height));
+		return;
+	}
+
+	const size_t blockSize = block_size(format);
+	const uint32_t blocksX = (width + 3) / 4;
+	const uint32_t blocksY = (height + 3) / 4;
+	glm::u8vec4 block[16];
+	for (uint32_t by = 0; by < blocksY; by++) {
+		for (uint32_t bx = 0; bx < blocksX; bx++) {
+			uint8_t *out = blocks + (static_cast<size_t>(by) * blocksX + bx) * blockSize;
+			load_block(texels, width, height, bx, by, block);
+			switch (format) {
+			case texture_format::bc1:
+				encode_bc1(block, out);
+				break;
+			case texture_format::bc5:
+				encode_bc4(block, 0, out);
+				encode_bc4(block, 1, out + 8);
+				break;
+			default:
+				encode_bc7(block, out);
+				break;
+			}
+		}
+	}
+}
+
+
+void texture_compression::decode(texture_format format, uint32_t width, uint32_t height, const uint8_t *blocks, glm::u8vec4 *texels)
+{
+	if (format == texture_format::rgba8) {
+		std::memcpy(texels, blocks, level_size(format, width, height));
+		return;
+	}
+
+	const size_t blockSize = block_size(format);
+	const uint32_t blocksX = (width + 3) / 4;
+	const uint32_t blocksY = (height + 3) / 4;
+	glm::u8vec4 block[16];
+	for (uint32_t by = 0; by < blocksY; by++) {
+		for (uint32_t bx = 0; bx < blocksX; bx++) {
+			const uint8_t *in = blocks + (static_cast<size_t>(by) * blocksX + bx) * blockSize;
+			switch (format) {
+			case texture_format::bc1:
+				decode_bc1(in, block);
+				break;
+			case texture_format::bc5:
+				// Like the GPU: 0 for b and 1 for a
+				std::fill(block, block + 16, glm::u8vec4(0, 0, 0, 255));
+				decode_bc4(in, 0, block);
+				decode_bc4(in + 8, 1, block);
+				break;
+			default:
+				decode_bc7(in, block);
+				break;
+			}
+			store_block(block, width, height, bx, by, texels);
+		}
+	}
+}
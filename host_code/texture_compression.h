@@ -0,0 +1,40 @@
+#pragma once
+
+#include <auto_vk_toolkit.hpp>
+
+
+/// <summary>
+/// Storage format of an image in the scene cache. Block compressed formats store every mip level as 4x4 blocks,
+/// levels smaller than a block are padded to one.
+/// </summary>
+enum struct texture_format : uint32_t {
+	rgba8 = 0,
+	bc1 = 1, // rgb, 8 bytes per block: the packed ambient occlusion/roughness/metalness maps
+	bc5 = 2, // rg, 16 bytes per block: normal maps, z is reconstructed in the shader
+	bc7 = 3  // rgba, 16 bytes per block: everything else (albedo, emission, ...)
+};
+
+
+/// <summary>
+/// Block compression encoders used when a scene cache file is built, and the matching decoders for the CPU path tracer,
+/// s.t. it samples the same texels as the GPU. The encoders favour speed over quality: endpoints are taken from the extent of
+/// the texels along their principal axis, BC7 only uses mode 6 (one subset, rgba endpoints, 16 weights).
+/// </summary>
+namespace texture_compression {
+
+	vk::Format vk_format(texture_format format);
+	// Whether the device samples the format, i.e. textureCompressionBC is enabled and the format supports sampling with
+	// linear filtering and transfers. Unsupported formats are decoded and uploaded as RGBA8 by the texture_uploader.
+	bool supported(texture_format format);
+	const char *name(texture_format format);
+
+	// Bytes of one mip level of the given extent
+	size_t level_size(texture_format format, uint32_t width, uint32_t height);
+	// Byte offset of `level` within a full mip chain (see mip_chain.hpp) and the size of the whole chain
+	size_t level_offset(texture_format format, uint32_t width, uint32_t height, uint32_t level);
+	size_t chain_size(texture_format format, uint32_t width, uint32_t height);
+
+	// Both operate on one level, `blocks` holds level_size() bytes
+	void encode(texture_format format, uint32_t width, uint32_t height, const glm::u8vec4 *texels, uint8_t *blocks);
+	void decode(texture_format format, uint32_t width, uint32_t height, const uint8_t *blocks, glm::u8vec4 *texels);
+}
@@ -0,0 +1,155 @@
+#include "texture_uploader.h"
+
+
+namespace {
+	// vkCmdCopyBufferToImage wants offsets that are a multiple of the texel or block size, cache lines are a safe choice
+	constexpr uint64_t STAGING_ALIGNMENT = 64;
+}
+
+
+texture_uploader::texture_uploader(avk::queue &aQueue, const render_settings &aSettings)
+	: mQueue{&aQueue}
+	, mTasks(aSettings.mThreadCount)
+	, mBudget(std::max<uint64_t>(1, aSettings.mTextureBudgetMiB) * 1024 * 1024)
+{
+	for (texture_format format : { texture_format::rgba8, texture_format::bc1, texture_format::bc5, texture_format::bc7 }) {
+		mSupported[static_cast<size_t>(format)] = texture_compression::supported(format);
+		if (!mSupported[static_cast<size_t>(format)]) {
+			printf("The device does not support %s textures, they are uploaded as rgba8\n", texture_compression::name(format));
+		}
+	}
+}
+
+
+void texture_uploader::add(const scene_cache::image &image, const std::string &model, uint32_t imageIndex)
+{
+	texture_format uploadFormat = mSupported[static_cast<size_t>(image.mFormat)] ? image.mFormat : texture_format::rgba8;
+	mPending.push_back(pending_image{ image, model, imageIndex, uploadFormat });
+}
+
+
+std::vector<avk::image_view> texture_uploader::upload()
+{
+	auto start = std::chrono::steady_clock::now();
+
+	auto uploadSize = [](const pending_image &p) {
+		return static_cast<uint64_t>(texture_compression::chain_size(p.mUploadFormat, p.mImage.mWidth, p.mImage.mHeight));
+	};
+	auto alignedSize = [&](const pending_image &p) {
+		return (uploadSize(p) + STAGING_ALIGNMENT - 1) / STAGING_ALIGNMENT * STAGING_ALIGNMENT;
+	};
+
+	// Two slots of half the budget each, unless a single image is larger than that
+	uint64_t slotSize = mBudget / 2;
+	uint64_t totalBytes = 0;
+	uint64_t uncompressedBytes = 0; // what the same images would occupy as RGBA8
+	for (const pending_image &p : mPending) {
+		slotSize = std::max(slotSize, alignedSize(p));
+		totalBytes += uploadSize(p);
+		uncompressedBytes += texture_compression::chain_size(texture_format::rgba8, p.mImage.mWidth, p.mImage.mHeight);
+	}
+
+	std::vector<avk::image_view> imageViews;
+	imageViews.reserve(mPending.size());
+
+	std::array<staging_slot, 2> slots;
+	uint32_t batch = 0;
+	for (size_t first = 0; first < mPending.size(); batch++) {
+		std::vector<uint64_t> offsets;
+		uint64_t batchBytes = 0;
+		size_t end = first;
+		while (end < mPending.size() && batchBytes + alignedSize(mPending[end]) <= slotSize) {
+			offsets.push_back(batchBytes);
+			batchBytes += alignedSize(mPending[end]);
+			end++;
+		}
+
+		// Wait until the GPU is done with the batch before the previous one, which used the same slot
+		staging_slot &slot = slots[batch % slots.size()];
+		if (slot.mFence.has_value()) {
+			(*slot.mFence)->wait_until_signalled();
+			slot.mFence.reset();
+		}
+		if (!slot.mBuffer.has_value()) {
+			slot.mBuffer = avk::context().create_buffer(
+				avk::memory_usage::host_visible,
+				vk::BufferUsageFlagBits::eTransferSrc,
+				avk::generic_buffer_meta::create_from_size(slotSize)
+			);
+		}
+
+		// The worker threads copy the texels into the staging buffer, for scene caches this is the first read of the mapping
+		{
+			auto mapping = (*slot.mBuffer)->map_memory(avk::mapping_access::write);
+			uint8_t *staging = static_cast<uint8_t *>(mapping.get());
+			std::vector<texture_timing> batchTimings(end - first);
+			mTasks.parallel_for(static_cast<uint32_t>(first), static_cast<uint32_t>(end), 1, [&](uint32_t i) {
+				auto copyStart = std::chrono::steady_clock::now();
+				const pending_image &p = mPending[i];
+				if (p.mUploadFormat == p.mImage.mFormat) {
+					std::memcpy(staging + offsets[i - first], p.mImage.mData.data(), p.mImage.mData.size_bytes());
+				}
+				else {
+					for (uint32_t level = 0; level < p.mImage.mLevelCount; level++) {
+						glm::uvec2 extent = mip_chain::level_extent(p.mImage.mWidth, p.mImage.mHeight, level);
+						texture_compression::decode(p.mImage.mFormat, extent.x, extent.y, p.mImage.level(level).data(),
+							reinterpret_cast<glm::u8vec4 *>(staging + offsets[i - first] + texture_compression::level_offset(texture_format::rgba8, p.mImage.mWidth, p.mImage.mHeight, level)));
+					}
+				}
+				double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - copyStart).count();
+				batchTimings[i - first] = texture_timing{ "upload", p.mModel, p.mImageIndex, p.mImage.mWidth, p.mImage.mHeight, batch, milliseconds };
+			});
+			mTimings.insert(mTimings.end(), batchTimings.begin(), batchTimings.end());
+		}
+
+		// One submission for the whole batch
+		std::vector<avk::recorded_commands_t> commands;
+		vk::Buffer stagingHandle = (*slot.mBuffer)->handle();
+		for (size_t i = first; i < end; i++) {
+			const scene_cache::image &image = mPending[i].mImage;
+			texture_format format = mPending[i].mUploadFormat;
+			// The mip chain comes from the scene cache, s.t. the GPU samples exactly the same levels as host_texture
+			avk::image img = avk::context().create_image(image.mWidth, image.mHeight, texture_compression::vk_format(format), 1, avk::memory_usage::device, avk::image_usage::general_texture,
+				[levels = image.mLevelCount](avk::image_t &bImage) { bImage.create_info().mipLevels = levels; });
+
+			commands.push_back(avk::sync::image_memory_barrier(img.as_reference(),
+				avk::stage::none >> avk::stage::copy,
+				avk::access::none >> avk::access::transfer_write).with_layout_transition(avk::layout::undefined >> avk::layout::transfer_dst));
+
+			std::vector<vk::BufferImageCopy> regions;
+			for (uint32_t level = 0; level < image.mLevelCount; level++) {
+				glm::uvec2 extent = mip_chain::level_extent(image.mWidth, image.mHeight, level);
+				regions.push_back(vk::BufferImageCopy{ offsets[i - first] + texture_compression::level_offset(format, image.mWidth, image.mHeight, level), 0, 0,
+					vk::ImageSubresourceLayers{ vk::ImageAspectFlagBits::eColor, level, 0, 1 },
+					vk::Offset3D{ 0, 0, 0 }, vk::Extent3D{ extent.x, extent.y, 1 } });
+			}
+			commands.push_back(avk::command::custom_commands([stagingHandle, imageHandle = img->handle(), regions](avk::command_buffer_t &cb) {
+				cb.handle().copyBufferToImage(stagingHandle, imageHandle, vk::ImageLayout::eTransferDstOptimal, static_cast<uint32_t>(regions.size()), regions.data());
+			}));
+
+			commands.push_back(avk::sync::image_memory_barrier(img.as_reference(),
+				avk::stage::copy >> avk::stage::ray_tracing_shader,
+				avk::access::transfer_write >> avk::access::shader_sampled_read).with_layout_transition(avk::layout::transfer_dst >> avk::layout::shader_read_only_optimal));
+
+			imageViews.push_back(avk::context().create_image_view(std::move(img)));
+		}
+		slot.mFence = avk::context().record_and_submit_with_fence(std::move(commands), *mQueue);
+
+		first = end;
+	}
+
+	for (staging_slot &slot : slots) {
+		if (slot.mFence.has_value()) {
+			(*slot.mFence)->wait_until_signalled();
+		}
+	}
+
+	printf("Uploaded %zu textures (%.1f MiB) in %u batches of at most %.1f MiB on %u threads in %.2lf ms\n",
+		mPending.size(), totalBytes / (1024.0 * 1024.0), batch, slotSize / (1024.0 * 1024.0), mTasks.thread_count(),
+		std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+	printf("Texture memory: %.1f MiB instead of %.1f MiB as RGBA8, %.1f MiB of VRAM saved\n",
+		totalBytes / (1024.0 * 1024.0), uncompressedBytes / (1024.0 * 1024.0), (uncompressedBytes - totalBytes) / (1024.0 * 1024.0));
+
+	mPending.clear();
+	return imageViews;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "render_settings.h"
+#include "scene_cache.h"
+#include "task_system.h"
+
+#include <auto_vk_toolkit.hpp>
+
+
+/// <summary>
+/// Uploads the (block compressed) images of scene caches to device local images through a ring of two host visible staging buffers.
+/// Images are grouped into batches of at most half the texture budget. While the GPU copies one batch out of one staging
+/// buffer, the worker threads copy the texels of the next batch into the other one. Hence, the staging memory is bounded
+/// by the texture budget and there is only one submission per batch instead of one per image. Block compressed images in a
+/// format the device cannot sample (see texture_compression::supported) are decoded into the staging buffer as RGBA8.
+/// </summary>
+class texture_uploader
+{
+public:
+	texture_uploader(avk::queue &aQueue, const render_settings &aSettings);
+
+	// Queues an image for the next upload(), the image views returned by upload() are in the same order
+	void add(const scene_cache::image &image, const std::string &model, uint32_t imageIndex);
+	inline size_t size() const { return mPending.size(); }
+
+	// Uploads all queued images and waits until the GPU is done with them. The texels must stay valid until then.
+	std::vector<avk::image_view> upload();
+
+	inline const std::vector<texture_timing> &timings() const { return mTimings; }
+
+private:
+	struct staging_slot {
+		std::optional<avk::buffer> mBuffer;
+		std::optional<avk::fence> mFence; // signalled once the GPU is done copying out of mBuffer
+	};
+
+	struct pending_image {
+		scene_cache::image mImage;
+		std::string mModel;
+		uint32_t mImageIndex;
+		texture_format mUploadFormat; // mImage.mFormat, or rgba8 if the device does not support it
+	};
+
+	avk::queue *mQueue;
+	task_system mTasks;
+	uint64_t mBudget;
+	std::array<bool, 4> mSupported; // per texture_format
+
+	std::vector<pending_image> mPending;
+	std::vector<texture_timing> mTimings;
+};
@@ -0,0 +1,83 @@
+#include "time_slicer.h"
+
+
+time_slicer::time_slicer(double aBudgetMilliseconds)
+	: mBudgetMilliseconds{aBudgetMilliseconds}
+{
+}
+
+
+void time_slicer::create(glm::uvec2 aResolution)
+{
+	glm::uvec2 tileCount = (aResolution + TILE_SIZE - 1u) / TILE_SIZE;
+	mTileSamples.assign(enabled() ? tileCount.x * tileCount.y : 0, 0);
+	mTilesPerFrame = std::min<double>(INITIAL_TILES_PER_FRAME, static_cast<double>(std::max<size_t>(mTileSamples.size(), 1)));
+}
+
+void time_slicer::restart()
+{
+	std::fill(mTileSamples.begin(), mTileSamples.end(), 0);
+	mSweeps = 0;
+	mNextTile = 0;
+}
+
+
+void time_slicer::add_measurement(const gpu_profiler::measurement &aMeasurement)
+{
+	if (aMeasurement.mFrame <= mLastMeasuredFrame) {
+		return;
+	}
+	const issued_slice &issued = mIssued[aMeasurement.mFrame % mIssued.size()];
+	if (issued.mFrame != aMeasurement.mFrame || issued.mTileCount == 0) {
+		return;
+	}
+	mLastMeasuredFrame = aMeasurement.mFrame;
+
+	double millisecondsPerTile = aMeasurement.mMilliseconds / issued.mTileCount;
+	mMillisecondsPerTile = mMillisecondsPerTile > 0.0 ? glm::mix(mMillisecondsPerTile, millisecondsPerTile, SMOOTHING) : millisecondsPerTile;
+	if (mMillisecondsPerTile <= 0.0) {
+		return;
+	}
+
+	// Towards the budget, but not faster than MAX_GROWTH, s.t. a single outlier cannot blow up the next frames
+	double tilesPerFrame = glm::clamp(mBudgetMilliseconds / mMillisecondsPerTile, mTilesPerFrame / MAX_GROWTH, mTilesPerFrame * MAX_GROWTH);
+	mTilesPerFrame = glm::clamp(tilesPerFrame, 1.0, static_cast<double>(std::max<size_t>(mTileSamples.size(), 1)));
+}
+
+bool time_slicer::next_slice(uint32_t aTileCount, bool aAllTiles, uint64_t aFrame)
+{
+	if (mNextTile >= aTileCount) {
+		// The tile list shrank, only possible after an evaluation of adaptive sampling which happens between sweeps
+		mNextTile = 0;
+	}
+
+	uint32_t tileCount = std::min(std::max(static_cast<uint32_t>(mTilesPerFrame), 1u), aTileCount - mNextTile);
+	mSlice = { mNextTile, tileCount };
+	mIssued[aFrame % mIssued.size()] = { aFrame, tileCount };
+
+	if (aAllTiles) {
+		for (uint32_t tile = mSlice.mFirstTile; tile < mSlice.mFirstTile + mSlice.mTileCount; tile++) {
+			mTileSamples[tile]++;
+		}
+	}
+
+	mNextTile += tileCount;
+	if (mNextTile < aTileCount) {
+		return false;
+	}
+	mNextTile = 0;
+	mSweeps++;
+	return true;
+}
+
+
+void time_slicer::print_statistics() const
+{
+	if (!enabled()) {
+		return;
+	}
+	auto [minSamples, maxSamples] = std::minmax_element(mTileSamples.begin(), mTileSamples.end());
+	printf("Time slicing: %.0lf of %zu tiles per frame (%.4lf ms per tile, budget %.2lf ms), %u sweeps, %u..%u samples per tile\n",
+		mTilesPerFrame, mTileSamples.size(), mMillisecondsPerTile, mBudgetMilliseconds, mSweeps,
+		minSamples != mTileSamples.end() ? *minSamples : 0, maxSamples != mTileSamples.end() ? *maxSamples : 0);
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "adaptive_sampler.h"
+#include "gpu_profiler.h"
+
+#include <auto_vk_toolkit.hpp>
+
+
+/// <summary>
+/// Time-sliced dispatch (`--frame-budget <ms>`): instead of tracing the whole image in one trace_rays launch, which can take long
+/// enough at 4K with SMS and BDPT to stall presentation or run into driver timeouts, every frame traces a contiguous run of the
+/// 16x16 tiles of adaptive sampling and the next frame continues after it. A sweep over all tiles (or all active tiles of
+/// adaptive sampling) adds one sample per pixel, every tile is traced exactly once per sweep.
+/// The tiles per frame follow the GPU time of trace_rays: every timestamp measurement of a frame (RING_SIZE frames late, see
+/// gpu_profiler) gives the cost per tile of the slice traced in it, the smoothed cost decides how many tiles fit into the budget.
+/// Without timestamp support the slices keep INITIAL_TILES_PER_FRAME tiles.
+/// The samples per tile are counted on the host while all tiles are launched, the tile list of adaptive sampling only exists on
+/// the GPU (the alpha of the accumulation counts the samples of every pixel in any case).
+/// </summary>
+class time_slicer
+{
+public:
+	// The tiles of pixelOfLaunch in ray_gen_shader.rgen
+	static constexpr uint32_t TILE_SIZE = adaptive_sampler::TILE_SIZE;
+	static constexpr uint32_t INITIAL_TILES_PER_FRAME = 256; // about 1/128 of a 4K image
+	static constexpr double SMOOTHING = 0.25;                // weight of a new measurement in the cost per tile
+	static constexpr double MAX_GROWTH = 2.0;                // the tiles per frame change by at most this factor per measurement
+
+	struct slice {
+		uint32_t mFirstTile;
+		uint32_t mTileCount;
+	};
+
+	// A budget of 0 disables time slicing
+	explicit time_slicer(double aBudgetMilliseconds);
+
+	inline bool enabled() const { return mBudgetMilliseconds > 0.0; }
+
+	void create(glm::uvec2 aResolution);
+
+	inline uint32_t tile_count() const { return static_cast<uint32_t>(mTileSamples.size()); }
+
+	// The accumulation restarted, the next slice starts a new sweep
+	void restart();
+
+	// Whether the accumulation is in the middle of a sweep, i.e. only some tiles have their next sample
+	inline bool sweep_in_progress() const { return mNextTile > 0; }
+
+	// Updates the cost per tile with the time of trace_rays in an earlier frame, measurements of unknown frames are ignored
+	void add_measurement(const gpu_profiler::measurement &aMeasurement);
+
+	// Picks the tiles which frame `aFrame` traces out of `aTileCount` (all tiles if `aAllTiles`, else the active tiles of
+	// adaptive sampling), continuing where the previous slice stopped. Returns whether the slice completes a sweep.
+	bool next_slice(uint32_t aTileCount, bool aAllTiles, uint64_t aFrame);
+
+	inline const slice &current_slice() const { return mSlice; }
+
+	// trace_rays launch size of the current slice, one invocation per pixel of every tile
+	inline vk::Extent3D launch_size() const { return { TILE_SIZE * TILE_SIZE, mSlice.mTileCount, 1 }; }
+
+	void print_statistics() const;
+
+private:
+	// The tiles traced in a frame, kept until its measurement arrives
+	struct issued_slice {
+		uint64_t mFrame = 0;
+		uint32_t mTileCount = 0;
+	};
+
+	double mBudgetMilliseconds;
+
+	std::vector<uint32_t> mTileSamples; // per tile, row-major
+	uint32_t mSweeps = 0;
+	uint32_t mNextTile = 0;
+	slice mSlice = {};
+
+	double mTilesPerFrame = INITIAL_TILES_PER_FRAME;
+	double mMillisecondsPerTile = 0.0; // 0 before the first measurement
+	uint64_t mLastMeasuredFrame = 0;
+	std::array<issued_slice, 2 * gpu_profiler::RING_SIZE> mIssued = {};
+};
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <auto_vk_toolkit.hpp>
+
+/// <summary>
+/// Interleaved, quantized shading attributes of one vertex, 16 bytes instead of the 44 bytes of separate float uvs, normals,
+/// tangents and bitangents. The closest hit shader fetches one vertex as a single uvec4 (see `decode_vertex` in
+/// closest_hit_shader.rchit), positions stay separate float3 since the BLAS builds and the ray cones need them at full precision.
+///  - normal and tangent: octahedral encoding (Cigolle et al. 2014, "A Survey of Efficient Representations for Independent Unit
+///    Vectors"), two snorm16 each
+///  - bitangent: only its sign relative to cross(normal, tangent)
+///  - uv: two half floats
+/// </summary>
+namespace vertex_layout {
+
+	struct packed_vertex {
+		uint32_t mNormal;        // packSnorm2x16(octahedral)
+		uint32_t mTangent;       // packSnorm2x16(octahedral)
+		uint32_t mTexCoords;     // packHalf2x16
+		float mBitangentSign;    // +1 or -1
+	};
+	static_assert(sizeof(packed_vertex) == 16, "packed_vertex must match one uvec4 texel");
+
+	inline glm::vec2 octahedral_encode(glm::vec3 v)
+	{
+		float l1 = std::abs(v.x) + std::abs(v.y) + std::abs(v.z);
+		if (!(l1 > 0.0f)) {
+			return glm::vec2(0.0f); // degenerate vectors (e.g. tangents of geometry without uvs) decode to +z
+		}
+		v /= l1;
+		glm::vec2 p(v.x, v.y);
+		if (v.z < 0.0f) {
+			p = glm::vec2((1.0f - std::abs(v.y)) * (v.x >= 0.0f ? 1.0f : -1.0f), (1.0f - std::abs(v.x)) * (v.y >= 0.0f ? 1.0f : -1.0f));
+		}
+		return p;
+	}
+
+	inline glm::vec3 octahedral_decode(glm::vec2 p)
+	{
+		glm::vec3 v(p.x, p.y, 1.0f - std::abs(p.x) - std::abs(p.y));
+		float t = std::max(-v.z, 0.0f);
+		v.x += v.x >= 0.0f ? -t : t;
+		v.y += v.y >= 0.0f ? -t : t;
+		return glm::normalize(v);
+	}
+
+	inline packed_vertex pack(const glm::vec3 &normal, const glm::vec3 &tangent, const glm::vec3 &bitangent, const glm::vec2 &texCoords)
+	{
+		packed_vertex result;
+		result.mNormal = glm::packSnorm2x16(octahedral_encode(normal));
+		result.mTangent = glm::packSnorm2x16(octahedral_encode(tangent));
+		result.mTexCoords = glm::packHalf2x16(texCoords);
+		result.mBitangentSign = glm::dot(glm::cross(normal, tangent), bitangent) < 0.0f ? -1.0f : 1.0f;
+		return result;
+	}
+
+	// Same as decode_vertex in the closest hit shader
+	inline void unpack(const packed_vertex &vertex, glm::vec3 &normal, glm::vec3 &tangent, glm::vec3 &bitangent, glm::vec2 &texCoords)
+	{
+		normal = octahedral_decode(glm::unpackSnorm2x16(vertex.mNormal));
+		tangent = octahedral_decode(glm::unpackSnorm2x16(vertex.mTangent));
+		bitangent = vertex.mBitangentSign * glm::cross(normal, tangent);
+		texCoords = glm::unpackHalf2x16(vertex.mTexCoords);
+	}
+}
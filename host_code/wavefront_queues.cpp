@@ -0,0 +1,91 @@
+#include "wavefront_queues.h"
+
+
+namespace {
+	// Makes the queues and paths written by one stage visible to the next one
+	avk::recorded_commands_t stage_barrier()
+	{
+		return avk::command::custom_commands([](avk::command_buffer_t &cb) {
+			cb.handle().pipelineBarrier(
+				vk::PipelineStageFlagBits::eRayTracingShaderKHR, vk::PipelineStageFlagBits::eRayTracingShaderKHR, {},
+				vk::MemoryBarrier{ vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite },
+				nullptr, nullptr, cb.root_ptr()->dispatch_loader_core());
+		});
+	}
+
+	// Zeroes the given ranges of counters before the next stage appends to their queues
+	avk::recorded_commands_t clear_counters(vk::Buffer counters, std::vector<std::pair<uint32_t, uint32_t>> ranges)
+	{
+		return avk::command::custom_commands([counters, ranges](avk::command_buffer_t &cb) {
+			cb.handle().pipelineBarrier(
+				vk::PipelineStageFlagBits::eRayTracingShaderKHR, vk::PipelineStageFlagBits::eTransfer, {},
+				vk::MemoryBarrier{ vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eTransferWrite },
+				nullptr, nullptr, cb.root_ptr()->dispatch_loader_core());
+			for (auto [first, count] : ranges) {
+				cb.handle().fillBuffer(counters, sizeof(uint32_t) * first, sizeof(uint32_t) * count, 0, cb.root_ptr()->dispatch_loader_core());
+			}
+			cb.handle().pipelineBarrier(
+				vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eRayTracingShaderKHR, {},
+				vk::MemoryBarrier{ vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite },
+				nullptr, nullptr, cb.root_ptr()->dispatch_loader_core());
+		});
+	}
+}
+
+
+wavefront_queues::wavefront_queues(bool aEnabled)
+	: mEnabled{aEnabled}
+{
+	// A single element each if disabled
+	const size_t paths = mEnabled ? WAVEFRONT_SIZE : 1;
+
+	mCounters = avk::context().create_buffer(
+		avk::memory_usage::device,
+		vk::BufferUsageFlagBits::eTransferDst,
+		avk::storage_buffer_meta::create_from_size(sizeof(uint32_t) * counter_count)
+	);
+	mQueues = avk::context().create_buffer(
+		avk::memory_usage::device, {},
+		avk::storage_buffer_meta::create_from_size(sizeof(uint32_t) * counter_count * paths)
+	);
+	mPaths = avk::context().create_buffer(
+		avk::memory_usage::device, {},
+		avk::storage_buffer_meta::create_from_size(sizeof(glm::vec4) * PATH_ATTRIBUTE_COUNT * paths)
+	);
+}
+
+
+std::vector<avk::recorded_commands_t> wavefront_queues::sample_commands(uint32_t pathCount, const launch_function &aLaunch) const
+{
+	vk::Buffer counters = mCounters->handle();
+	std::vector<avk::recorded_commands_t> commands;
+	auto append = [&commands](std::vector<avk::recorded_commands_t> more) {
+		commands.insert(commands.end(), std::make_move_iterator(more.begin()), std::make_move_iterator(more.end()));
+	};
+
+	for (uint32_t firstPath = 0; firstPath < pathCount; firstPath += WAVEFRONT_SIZE) {
+		const uint32_t batchSize = std::min(WAVEFRONT_SIZE, pathCount - firstPath);
+
+		commands.push_back(clear_counters(counters, { { rays_even, 1 } }));
+		append(aLaunch(wavefront_stage::generate, firstPath, 0, batchSize));
+		commands.push_back(stage_barrier());
+
+		for (uint32_t bounce = 0; bounce < MAX_BOUNCES; bounce++) {
+			// The rays of this bounce stay, the next bounce, the bins and the shadow rays start empty
+			uint32_t nextRays = bounce % 2 == 0 ? rays_odd : rays_even;
+			commands.push_back(clear_counters(counters, { { nextRays, 1 }, { bin_miss, counter_count - bin_miss } }));
+
+			append(aLaunch(wavefront_stage::extend, firstPath, bounce, batchSize));
+			commands.push_back(stage_barrier());
+			append(aLaunch(wavefront_stage::shade, firstPath, bounce, batchSize));
+			commands.push_back(stage_barrier());
+			append(aLaunch(wavefront_stage::shadow_connect, firstPath, bounce, batchSize));
+			commands.push_back(stage_barrier());
+		}
+
+		append(aLaunch(wavefront_stage::accumulate, firstPath, MAX_BOUNCES, batchSize));
+		commands.push_back(stage_barrier());
+	}
+
+	return commands;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <auto_vk_toolkit.hpp>
+
+
+// Ray generation shader groups of the ray tracing pipeline, the same as the STAGE_* defines in ray_gen_shader.rgen
+enum struct wavefront_stage : uint32_t {
+	megakernel = 0,     // traces whole paths, the default
+	generate = 1,       // one camera ray per path
+	extend = 2,         // traces the queued rays, bins the hits by material
+	shade = 3,          // one bounce per hit, queues NEE shadow rays and continuing paths
+	shadow_connect = 4, // traces the shadow rays, adds the light of unoccluded ones
+	accumulate = 5,     // adds the radiance of every path to the accumulation
+	count = 6
+};
+
+
+/// <summary>
+/// Storage of the wavefront path tracer (`--wavefront`). It splits the megakernel of ray_gen_shader.rgen into separate
+/// launches of the same ray tracing pipeline, one per `wavefront_stage`, which communicate through queues of path indices
+/// and a structure of arrays with the state of every path. The extend stage bins the hits by material (miss, diffuse,
+/// metal, dielectric), the shade stage is launched over all bins one after another, s.t. a warp mostly shades one kind of
+/// material. Paths are processed in batches of WAVEFRONT_SIZE, every batch runs MAX_BOUNCES times extend, shade and
+/// shadow_connect. The queue lengths stay on the GPU, the launches are sized for full queues and idle invocations return.
+/// </summary>
+class wavefront_queues
+{
+public:
+	// Same as WAVEFRONT_SIZE and PATH_ATTRIBUTE_COUNT in ray_gen_shader.rgen
+	static constexpr uint32_t WAVEFRONT_SIZE = 1 << 19;
+	static constexpr uint32_t PATH_ATTRIBUTE_COUNT = 17;
+	// MAX_DEPTH + 1 in ray_gen_shader.rgen, the last bounce only adds the sky of escaped paths, the shade stage ends paths
+	// that hit anything at MAX_DEPTH before adding emission, like the megakernel
+	static constexpr uint32_t MAX_BOUNCES = 11;
+
+	// Indices into the counter buffer, the same as the COUNTER_* defines in ray_gen_shader.rgen. Each counter has a queue of
+	// WAVEFRONT_SIZE path indices at the same index of the queue buffer.
+	enum counter : uint32_t {
+		rays_even = 0,
+		rays_odd = 1,
+		bin_miss = 2,
+		bin_diffuse = 3,
+		bin_metal = 4,
+		bin_dielectric = 5,
+		shadow = 6,
+		counter_count = 7
+	};
+
+	explicit wavefront_queues(bool aEnabled);
+
+	inline bool enabled() const { return mEnabled; }
+
+	// Bound as storage buffers, also if the wavefront path tracer is disabled (the shader declares them anyway)
+	inline const avk::buffer &counter_buffer() const { return mCounters; }
+	inline const avk::buffer &queue_buffer() const { return mQueues; }
+	inline const avk::buffer &path_buffer() const { return mPaths; }
+
+	// Records one trace_rays of the given stage over `pathCount` paths, with the push constants of the batch starting at `firstPath`
+	using launch_function = std::function<std::vector<avk::recorded_commands_t>(wavefront_stage stage, uint32_t firstPath, uint32_t bounce, uint32_t pathCount)>;
+
+	// All launches and barriers of one sample for `pathCount` paths (the size of the megakernel launch)
+	std::vector<avk::recorded_commands_t> sample_commands(uint32_t pathCount, const launch_function &aLaunch) const;
+
+private:
+	bool mEnabled;
+	avk::buffer mCounters;
+	avk::buffer mQueues;
+	avk::buffer mPaths;
+};